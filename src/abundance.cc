@@ -60,173 +60,200 @@
 
 #include "vsearch.h"
 
-#if REGEX
+/*
+  Abundance annotations have the form "size=123" and must be found at
+  the start of the header or right after a semicolon, and be followed
+  by a semicolon or the end of the header. This corresponds to the
+  regular expression "(^|;)size=([0-9]+)(;|$)", but is found with a
+  single scan of the header. Candidate positions are located 16 at a
+  time by comparing the 's' and '=' of "size=" in parallel.
+
+  The span of an annotation is given as start and end positions, in
+  the same way as the whole match of the regular expression: it
+  includes the preceding and following semicolons, if any. When there
+  is no annotation, start and end are both zero.
+*/
 
 abundance_t * abundance_init(void)
 {
- abundance_t * a = (abundance_t *) xmalloc(sizeof(abundance_t));
- if (regcomp(&a->regex, "(^|;)size=([0-9]+)(;|$)",REG_EXTENDED))
-   fatal("Compilation of regular expression for abundance annotation failed");
- return a;
+  abundance_t * a = (abundance_t *) xmalloc(sizeof(abundance_t));
+  a->abundance = 1;
+  a->start = 0;
+  a->end = 0;
+  return a;
 }
 
 void abundance_exit(abundance_t * a)
 {
-  regfree(&a->regex);
   free(a);
 }
 
+static bool abundance_match(const char * header,
+                            int header_length,
+                            int pos,
+                            int * start,
+                            int * end,
+                            long * number)
+{
+  /* check for a valid annotation with "size=" at pos */
+
+  if ((pos > 0) && (header[pos - 1] != ';'))
+    return false;
+
+  if (memcmp(header + pos, "size=", 5))
+    return false;
+
+  int i = pos + 5;
+  long n = 0;
+  while ((i < header_length) && (header[i] >= '0') && (header[i] <= '9'))
+    n = 10 * n + (header[i++] - '0');
+
+  if (i == pos + 5)
+    return false;
+
+  if (i < header_length)
+    {
+      if (header[i] != ';')
+        return false;
+      i++;
+    }
+
+  *start = pos > 0 ? pos - 1 : 0;
+  *end = i;
+  *number = n;
+  return true;
+}
+
+long abundance_scan(const char * header,
+                    int header_length,
+                    int * start,
+                    int * end)
+{
+  /*
+    Find the first abundance annotation in the header.
+    Return the number, or zero if there is no annotation.
+  */
+
+  long number = 0;
+  int pos = 0;
+  int last = header_length - 5;
+
+  *start = 0;
+  *end = 0;
+
+#ifdef __SSE2__
+  __m128i xs = _mm_set1_epi8('s');
+  __m128i xeq = _mm_set1_epi8('=');
+
+  while (pos + 4 + 16 <= header_length)
+    {
+      __m128i a = _mm_loadu_si128((__m128i *) (header + pos));
+      __m128i b = _mm_loadu_si128((__m128i *) (header + pos + 4));
+      unsigned int m = _mm_movemask_epi8
+        (_mm_and_si128(_mm_cmpeq_epi8(a, xs), _mm_cmpeq_epi8(b, xeq)));
+
+      while (m)
+        {
+          int i = pos + __builtin_ctz(m);
+          if (abundance_match(header, header_length, i, start, end, & number))
+            return number;
+          m &= m - 1;
+        }
+
+      pos += 16;
+    }
+#endif
+
+  for( ; pos <= last; pos++)
+    if ((header[pos] == 's') &&
+        abundance_match(header, header_length, pos, start, end, & number))
+      return number;
+
+  return 0;
+}
+
+long abundance_get_span(char * header,
+                        int header_length,
+                        int * start,
+                        int * end)
+{
+  /* read size/abundance annotation, default 1 */
+
+  long number = abundance_scan(header, header_length, start, end);
+
+  if (*end == 0)
+    return 1;
+
+  if (number <= 0)
+    fatal("Invalid (zero) abundance annotation in fasta header");
+
+  return number;
+}
+
 long abundance_get(abundance_t * a, char * header)
 {
-  /* read size/abundance annotation */
-  
-  long abundance = 1;
-  regmatch_t pmatch[4];
-  
-  if (!regexec(&a->regex, header, 4, pmatch, 0))
+  if (! header)
     {
-      long number = atol(header + pmatch[2].rm_so);
-      if (number > 0)
-        abundance = number;
-      else
-        fatal("Invalid (zero) abundance annotation in fasta header");
+      a->abundance = 1;
+      a->start = 0;
+      a->end = 0;
     }
-  return abundance;
+  else
+    a->abundance = abundance_get_span(header,
+                                      strlen(header),
+                                      & a->start,
+                                      & a->end);
+  return a->abundance;
 }
 
-void abundance_fprint_header_with_size(abundance_t * a,
-                                       FILE * fp,
-                                       char * header,
-                                       int header_length,
-                                       unsigned long size)
+void abundance_fprint_span_with_size(FILE * fp,
+                                     char * header,
+                                     int header_length,
+                                     int start,
+                                     int end,
+                                     unsigned long size)
 {
   /* remove any previous size annotation */
-  /* regexp search for "(^|;)(\d+)(;|$)" */
   /* replace by ';' if not at either end */
 
-  regmatch_t pmatch[1];
-
-  if (!regexec(&a->regex, header, 1, pmatch, 0))
+  if (end > 0)
     {
-      int pat_start = pmatch[0].rm_so;
-      int pat_end = pmatch[0].rm_eo;
-
       fprintf(fp,
               "%.*s%s%.*s%ssize=%lu;",
-              pat_start, header,
-              (pat_start > 0 ? ";" : ""),
-              header_length - pat_end, header + pat_end,
-              (((pat_end < header_length) &&
+              start, header,
+              (start > 0 ? ";" : ""),
+              header_length - end, header + end,
+              (((end < header_length) &&
                 (header[header_length - 1] != ';')) ? ";" : ""),
               size);
     }
   else
     {
       fprintf(fp,
-              "%s%ssize=%lu;",
-              header,
-              (((header_length == 0) || 
+              "%.*s%ssize=%lu;",
+              header_length, header,
+              (((header_length == 0) ||
                 (header[header_length - 1] != ';')) ? ";" : ""),
               size);
     }
 }
 
-void abundance_fprint_header_strip_size(abundance_t * a,
-                                        FILE * fp,
-                                        char * header,
-                                        int header_length)
+void abundance_fprint_span_strip_size(FILE * fp,
+                                      char * header,
+                                      int header_length,
+                                      int start,
+                                      int end)
 {
-  regmatch_t pmatch[1];
-
-  if (!regexec(&a->regex, header, 1, pmatch, 0))
+  if (end > 0)
     {
-      int pat_start = pmatch[0].rm_so;
-      int pat_end = pmatch[0].rm_eo;
-
       fprintf(fp,
               "%.*s%s%.*s",
-              pat_start, header,
-              ((pat_start > 0) && (pat_end < header_length)) ? ";" : "",
-              header_length - pat_end, header + pat_end);
+              start, header,
+              ((start > 0) && (end < header_length)) ? ";" : "",
+              header_length - end, header + end);
     }
   else
-    fprintf(fp, "%s", header);
-}
-
-char * abundance_strip_size(abundance_t * a,
-                            char * header,
-                            int header_length)
-{
-  int ret;
-  char * temp = 0;
-  regmatch_t pmatch[1];
-  
-
-  if (!regexec(&a->regex, header, 1, pmatch, 0))
-    {
-      int pat_start = pmatch[0].rm_so;
-      int pat_end = pmatch[0].rm_eo;
-
-int promptLength = ((header_length - a->end) - (header_length - a->start)) + 1;  
-
-    	temp = new char(promptLength); 
-      ret = sprintf(temp,
-                     "%.*s%s%.*s",
-                     pat_start, header,
-                     ((pat_start > 0) && (pat_end < header_length)) ? ";" : "",
-                     header_length - pat_end, header + pat_end);
-    }
-  else {
-int promptLength = strlen(header) + 1;
-	temp = new char(promptLength);
-
-    ret = sprintf(temp, "%s", header);
-  }
-  if (ret == -1)
-    fatal("Out of memory");
-  
-  return temp;
-}
-#else
-
-#include <string>
-
-abundance_t * abundance_init(void)
-{
-    //Beginning of line, any chars, ';size=', abundanceWeWant, ';', any chars, end of line.
-
-    abundance_t * a = (abundance_t *) xmalloc(sizeof(abundance_t));
-
-    a->abundance = 1;
-
-	return a;
-}
-
-void abundance_exit(abundance_t * a) { free(a); }
-
-long abundance_get(abundance_t * a, char * header)
-{
-    a->abundance = 1;
-if ((header == NULL)) {     return a->abundance;
- }
-    std::string search(header);
-   
-    int pos = search.find_first_of("size=");
-    if (pos == search.npos) {
-//abundance = 1;
-    }else {
-
-        std::string snum = "";
-        //read abundance
-        for (int i = pos+5; i < search.size(); i++) { 
- if (isdigit(search[i])){ snum += search[i]; }
-else{ a->end = i; break; }  }
-        a->abundance = atol(&snum[0]);
-
-        if (a->abundance <= 0) { fatal("Invalid (zero) abundance annotation in fasta header"); }
-        a->start = pos;
-    }
-    return a->abundance;
+    fprintf(fp, "%.*s", header_length, header);
 }
 
 void abundance_fprint_header_with_size(abundance_t * a,
@@ -235,32 +262,10 @@ void abundance_fprint_header_with_size(abundance_t * a,
                                        int header_length,
                                        unsigned long size)
 {
-    /* remove any previous size annotation */
-    /* regexp search for "(^|;)(\d+)(;|$)" */
-    /* replace by ';' if not at either end */
-    
-    abundance_get(a, header);
-
-    if ((a->start!=0) && (a->end != 0))
-    {
-        fprintf(fp,
-                "%.*s%s%.*s%ssize=%lu;",
-                a->start, header,
-                (a->start > 0 ? ";" : ""),
-                header_length - a->end, header + a->end,
-                (((a->end < header_length) &&
-                  (header[header_length - 1] != ';')) ? ";" : ""),
-                size);
-    }
-    else
-    {
-        fprintf(fp,
-                "%s%ssize=%lu;",
-                header,
-                (((header_length == 0) ||
-                  (header[header_length - 1] != ';')) ? ";" : ""),
-                size);
-    }
+  int start, end;
+  abundance_scan(header, header_length, & start, & end);
+  abundance_fprint_span_with_size(fp, header, header_length,
+                                  start, end, size);
 }
 
 void abundance_fprint_header_strip_size(abundance_t * a,
@@ -268,52 +273,37 @@ void abundance_fprint_header_strip_size(abundance_t * a,
                                         char * header,
                                         int header_length)
 {
-    abundance_get(a, header);
-
-    if ((a->start!=0) && (a->end != 0))
-    {
-        fprintf(fp,
-                "%.*s%s%.*s",
-                a->start, header,
-                ((a->start > 0) && (a->end < header_length)) ? ";" : "",
-                header_length - a->end, header + a->end);
-    }
-    else
-        fprintf(fp, "%s", header);
+  int start, end;
+  abundance_scan(header, header_length, & start, & end);
+  abundance_fprint_span_strip_size(fp, header, header_length, start, end);
 }
 
 char * abundance_strip_size(abundance_t * a,
                             char * header,
                             int header_length)
 {
-    int ret;
-    char * temp = 0;
+  /* return a new string with the header without size annotation */
 
+  int start, end;
+  abundance_scan(header, header_length, & start, & end);
 
-    abundance_get(a, header);
+  char * temp = (char *) xmalloc(header_length + 2);
 
-    if ((a->start!=0) && (a->end != 0))
+  if (end > 0)
     {
-
-int promptLength = ((header_length - a->end) - (header_length - a->start)) + 1;  
-    	temp = new char(promptLength); 
-        ret = sprintf(temp,
-                      "%.*s%s%.*s",
-                      a->start, header,
-                      ((a->start > 0) && (a->end < header_length)) ? ";" : "",
-                      header_length - a->end, header + a->end);
+      int len = start;
+      memcpy(temp, header, start);
+      if ((start > 0) && (end < header_length))
+        temp[len++] = ';';
+      memcpy(temp + len, header + end, header_length - end);
+      len += header_length - end;
+      temp[len] = 0;
     }
-    else {
-    	int promptLength = strlen(header) + 1;
-	temp = new char(promptLength);
-        ret = sprintf(temp, "%s", header);
+  else
+    {
+      memcpy(temp, header, header_length);
+      temp[header_length] = 0;
     }
-    if (ret == -1)
-        fatal("Out of memory");
-    
-    return temp;
-}
-
-
-#endif
 
+  return temp;
+}
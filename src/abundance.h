@@ -61,43 +61,6 @@
 #ifndef ABUNDANCE_H
 #define ABUNDANCE_H
 
-
-#define REGEX 0
-
-#if REGEX
-//#ifdef _MSC_VER
-//to do use System regex object
-//#else
-#include <regex.h>
-
-typedef struct abundance_s
-{
-    regex_t regex;
-} abundance_t;
-
-abundance_t * abundance_init(void);
-
-void abundance_exit(abundance_t * a);
-
-long abundance_get(abundance_t * a, char * header);
-
-void abundance_fprint_header_with_size(abundance_t * a,
-                                       FILE * fp,
-                                       char * header,
-                                       int header_length,
-                                       unsigned long size);
-
-void abundance_fprint_header_strip_size(abundance_t * a,
-                                        FILE * fp,
-                                        char * header,
-                                        int header_length);
-
-char * abundance_strip_size(abundance_t * a,
-                            char * header,
-                            int header_length);
-//#endif
-#else
-
 typedef struct abundance_s
 {
     long abundance;
@@ -108,8 +71,17 @@ abundance_t * abundance_init();
 
 void abundance_exit(abundance_t * a);
 
+long abundance_scan(const char * header,
+                    int header_length,
+                    int * start,
+                    int * end);
+
 long abundance_get(abundance_t * a, char * header);
 
+long abundance_get_span(char * header,
+                        int header_length,
+                        int * start,
+                        int * end);
 
 void abundance_fprint_header_with_size(abundance_t * a,
                                        FILE * fp,
@@ -117,16 +89,26 @@ void abundance_fprint_header_with_size(abundance_t * a,
                                        int header_length,
                                        unsigned long size);
 
-
 void abundance_fprint_header_strip_size(abundance_t * a,
                                         FILE * fp,
                                         char * header,
                                         int header_length);
 
+void abundance_fprint_span_with_size(FILE * fp,
+                                     char * header,
+                                     int header_length,
+                                     int start,
+                                     int end,
+                                     unsigned long size);
+
+void abundance_fprint_span_strip_size(FILE * fp,
+                                      char * header,
+                                      int header_length,
+                                      int start,
+                                      int end);
+
 char * abundance_strip_size(abundance_t * a,
                             char * header,
                             int header_length);
 
 #endif
-#endif
-
@@ -86,9 +86,23 @@ static pthread_t * pthread;
 static pthread_mutex_t mutex_input;
 static pthread_mutex_t mutex_output;
 
+/*
+  uchime_denovo: the queries are searched in parallel against the
+  index of the non-chimeras found so far, but judged one at a time in
+  input order. The index is read-locked while searching and
+  write-locked while a non-chimera is added. When a query gets its
+  turn, the non-chimeras added since it was searched are checked; the
+  searches are repeated only if one of them could have been found, so
+  the results are the same as with one thread.
+*/
+
+static pthread_rwlock_t rwlock_index;
+static pthread_cond_t cond_turn;
+
 #endif
 
 static unsigned int seqno = 0;
+static unsigned int input_seqno = 0;
 static unsigned long progress = 0;
 static int chimera_count = 0;
 static int nonchimera_count = 0;
@@ -111,6 +125,8 @@ struct chimera_info_s
   char * query_seq;
   int query_len;
 
+  unsigned int index_count; /* sequences indexed when query was searched */
+
   struct searchinfo_s si[parts];
 
   unsigned int cand_list[maxcandidates];
@@ -1084,6 +1100,156 @@ void chimera_thread_exit(struct chimera_info_s * ci)
     free(ci->query_head);
 }
 
+void chimera_search(struct chimera_info_s * ci,
+                    struct hit * allhits_list,
+                    LinearMemoryAligner * lma)
+{
+#if PTHREAD
+  if (opt_uchime_denovo)
+    pthread_rwlock_rdlock(&rwlock_index);
+#endif
+
+  ci->index_count = dbindex_getcount();
+
+  /* partition query */
+  partition_query(ci);
+
+  /* perform searches and collect candidate parents */
+  ci->cand_count = 0;
+  int allhits_count = 0;
+
+  if (ci->query_len >= parts)
+    {
+      search_segments(ci->si, parts, ci->query_seq, ci->query_len, opt_qmask);
+
+      for (int i=0; i<parts; i++)
+        {
+          struct hit * hits;
+          int hit_count;
+          search_joinhits(ci->si+i, 0, & hits, & hit_count);
+          for(int j=0; j<hit_count; j++)
+            if (hits[j].accepted)
+              allhits_list[allhits_count++] = hits[j];
+          free(hits);
+        }
+    }
+
+  for(int i=0; i < allhits_count; i++)
+    {
+      unsigned int target = allhits_list[i].target;
+
+      /* skip duplicates */
+      int k;
+      for(k = 0; k < ci->cand_count; k++)
+        if (ci->cand_list[k] == target)
+          break;
+
+      if (k == ci->cand_count)
+        ci->cand_list[ci->cand_count++] = target;
+
+      /* deallocate cigar */
+      if (allhits_list[i].nwalignment)
+        free(allhits_list[i].nwalignment);
+    }
+
+
+  /* align full query to each candidate */
+
+  search16_qprep(ci->s, ci->query_seq, ci->query_len);
+
+  search16(ci->s,
+           ci->cand_count,
+           ci->cand_list,
+           ci->snwscore,
+           ci->snwalignmentlength,
+           ci->snwmatches,
+           ci->snwmismatches,
+           ci->snwgaps,
+           ci->nwcigar);
+
+  for(int i=0; i < ci->cand_count; i++)
+    {
+      long target = ci->cand_list[i];
+      long nwscore = ci->snwscore[i];
+      char * nwcigar;
+      long nwalignmentlength;
+      long nwmatches;
+      long nwmismatches;
+      long nwgaps;
+
+      if (nwscore == SHRT_MAX)
+        {
+          /* In case the SIMD aligner cannot align,
+                     perform a new alignment with the
+                     linear memory aligner */
+                  
+          char * tseq = db_getsequence(target);
+          long tseqlen = db_getsequencelen(target);
+                  
+          if (ci->nwcigar[i])
+            free(ci->nwcigar[i]);
+                  
+          nwcigar = xstrdup(lma->align(ci->query_seq,
+                                     tseq,
+                                     ci->query_len,
+                                     tseqlen));
+          lma->alignstats(nwcigar,
+                         ci->query_seq,
+                         tseq,
+                         & nwscore,
+                         & nwalignmentlength,
+                         & nwmatches,
+                         & nwmismatches,
+                         & nwgaps);
+
+          ci->nwcigar[i] = nwcigar;
+          ci->nwscore[i] = nwscore;
+          ci->nwalignmentlength[i] = nwalignmentlength;
+          ci->nwmatches[i] = nwmatches;
+          ci->nwmismatches[i] = nwmismatches;
+          ci->nwgaps[i] = nwgaps;
+        }
+      else
+        {
+          ci->nwscore[i] = ci->snwscore[i];
+          ci->nwalignmentlength[i] = ci->snwalignmentlength[i];
+          ci->nwmatches[i] = ci->snwmatches[i];
+          ci->nwmismatches[i] = ci->snwmismatches[i];
+          ci->nwgaps[i] = ci->snwgaps[i];
+        }
+    }
+
+#if PTHREAD
+  if (opt_uchime_denovo)
+    pthread_rwlock_unlock(&rwlock_index);
+#endif
+}
+
+int chimera_parents_added(struct chimera_info_s * ci)
+{
+  /* uchime_denovo: could any of the non-chimeras added to the index
+     since the query was searched have been found by its searches? */
+
+  if (ci->query_len < parts)
+    return 0;
+
+  for(unsigned int index = ci->index_count;
+      index < dbindex_getcount();
+      index++)
+    for(int i=0; i < parts; i++)
+      if (search_hits_could_change(ci->si + i, index))
+        return 1;
+
+  return 0;
+}
+
+void chimera_free_cigars(struct chimera_info_s * ci)
+{
+  for (int i=0; i < ci->cand_count; i++)
+    if (ci->nwcigar[i])
+      free(ci->nwcigar[i]);
+}
+
 unsigned long chimera_thread_core(struct chimera_info_s * ci)
 {
   chimera_thread_init(ci);
@@ -1144,18 +1310,19 @@ unsigned long chimera_thread_core(struct chimera_info_s * ci)
         }
       else
         {
-          if (seqno < db_getsequencecount())
+          if (input_seqno < db_getsequencecount())
             {
-              ci->query_no = seqno;
-              ci->query_head_len = db_getheaderlen(seqno);
-              ci->query_len = db_getsequencelen(seqno);
-              ci->query_size = db_getabundance(seqno);
+              ci->query_no = input_seqno;
+              ci->query_head_len = db_getheaderlen(input_seqno);
+              ci->query_len = db_getsequencelen(input_seqno);
+              ci->query_size = db_getabundance(input_seqno);
               
               /* if necessary expand memory for arrays based on query length */
               realloc_arrays(ci);
 
-              strcpy(ci->query_head, db_getheader(seqno));
-              strcpy(ci->query_seq, db_getsequence(seqno));
+              strcpy(ci->query_head, db_getheader(input_seqno));
+              strcpy(ci->query_seq, db_getsequence(input_seqno));
+              input_seqno++;
             }
           else
             {
@@ -1174,111 +1341,24 @@ unsigned long chimera_thread_core(struct chimera_info_s * ci)
       
       int status = 0;
 
-      /* partition query */
-      partition_query(ci);
+      chimera_search(ci, allhits_list, & lma);
 
-      /* perform searches and collect candidate parents */
-      ci->cand_count = 0;
-      int allhits_count = 0;
-
-      if (ci->query_len >= parts)
-        for (int i=0; i<parts; i++)
-          {
-            struct hit * hits;
-            int hit_count;
-            search_onequery(ci->si+i, opt_qmask);
-            search_joinhits(ci->si+i, 0, & hits, & hit_count);
-            for(int j=0; j<hit_count; j++)
-              if (hits[j].accepted)
-                allhits_list[allhits_count++] = hits[j];
-            free(hits);
-          }
-
-      for(int i=0; i < allhits_count; i++)
+      if (opt_uchime_denovo)
         {
-          unsigned int target = allhits_list[i].target;
-
-          /* skip duplicates */
-          int k;
-          for(k = 0; k < ci->cand_count; k++)
-            if (ci->cand_list[k] == target)
-              break;
-
-          if (k == ci->cand_count)
-            ci->cand_list[ci->cand_count++] = target;
-
-          /* deallocate cigar */
-          if (allhits_list[i].nwalignment)
-            free(allhits_list[i].nwalignment);
-        }
-
-
-      /* align full query to each candidate */
-
-      search16_qprep(ci->s, ci->query_seq, ci->query_len);
-
-      search16(ci->s,
-               ci->cand_count,
-               ci->cand_list,
-               ci->snwscore,
-               ci->snwalignmentlength,
-               ci->snwmatches,
-               ci->snwmismatches,
-               ci->snwgaps,
-               ci->nwcigar);
+          /* wait for the turn of this query */
+#if PTHREAD
+          pthread_mutex_lock(&mutex_output);
+          while (seqno != (unsigned int) ci->query_no)
+            pthread_cond_wait(&cond_turn, &mutex_output);
+          pthread_mutex_unlock(&mutex_output);
+#endif
 
-      for(int i=0; i < ci->cand_count; i++)
-        {
-          long target = ci->cand_list[i];
-          long nwscore = ci->snwscore[i];
-          char * nwcigar;
-          long nwalignmentlength;
-          long nwmatches;
-          long nwmismatches;
-          long nwgaps;
-
-          if (nwscore == SHRT_MAX)
+          if (chimera_parents_added(ci))
             {
-              /* In case the SIMD aligner cannot align,
-                         perform a new alignment with the
-                         linear memory aligner */
-                      
-              char * tseq = db_getsequence(target);
-              long tseqlen = db_getsequencelen(target);
-                      
-              if (ci->nwcigar[i])
-                free(ci->nwcigar[i]);
-                      
-              nwcigar = xstrdup(lma.align(ci->query_seq,
-                                         tseq,
-                                         ci->query_len,
-                                         tseqlen));
-              lma.alignstats(nwcigar,
-                             ci->query_seq,
-                             tseq,
-                             & nwscore,
-                             & nwalignmentlength,
-                             & nwmatches,
-                             & nwmismatches,
-                             & nwgaps);
-
-              ci->nwcigar[i] = nwcigar;
-              ci->nwscore[i] = nwscore;
-              ci->nwalignmentlength[i] = nwalignmentlength;
-              ci->nwmatches[i] = nwmatches;
-              ci->nwmismatches[i] = nwmismatches;
-              ci->nwgaps[i] = nwgaps;
-            }
-          else
-            {
-              ci->nwscore[i] = ci->snwscore[i];
-              ci->nwalignmentlength[i] = ci->snwalignmentlength[i];
-              ci->nwmatches[i] = ci->snwmatches[i];
-              ci->nwmismatches[i] = ci->snwmismatches[i];
-              ci->nwgaps[i] = ci->snwgaps[i];
+              chimera_free_cigars(ci);
+              chimera_search(ci, allhits_list, & lma);
             }
         }
-      
 
       /* find the best pair of parents, then compute score for them */
 
@@ -1337,7 +1417,15 @@ unsigned long chimera_thread_core(struct chimera_info_s * ci)
           
           /* uchime_denovo: add non-chimeras to db */
           if (opt_uchime_denovo)
-            dbindex_addsequence(seqno, opt_qmask);
+            {
+#if PTHREAD
+              pthread_rwlock_wrlock(&rwlock_index);
+#endif
+              dbindex_addsequence(seqno, opt_qmask);
+#if PTHREAD
+              pthread_rwlock_unlock(&rwlock_index);
+#endif
+            }
 
           if (opt_nonchimeras)
             {
@@ -1351,9 +1439,7 @@ unsigned long chimera_thread_core(struct chimera_info_s * ci)
             }
         }
       
-      for (int i=0; i < ci->cand_count; i++)
-        if (ci->nwcigar[i])
-          free(ci->nwcigar[i]);
+      chimera_free_cigars(ci);
 
       if (opt_uchime_ref)
         progress = fasta_get_position(query_fasta_h);
@@ -1365,6 +1451,7 @@ unsigned long chimera_thread_core(struct chimera_info_s * ci)
       seqno++;
 
 #if PTHREAD
+        pthread_cond_broadcast(&cond_turn);
         pthread_mutex_unlock(&mutex_output);
 #endif
     }
@@ -1419,7 +1506,7 @@ void open_chimera_file(FILE * * f, char * name)
 {
   if (name)
     {
-      *f = fopen(name, "w");
+      *f = fopen_output(name);
       if (!*f)
         fatal("Unable to open file %s for writing", name);
     }
@@ -1449,9 +1536,6 @@ void chimera()
   opt_self = 1;
   opt_selfid = 1;
 
-  if (opt_uchime_denovo)
-    opt_threads = 1;
-
   if (opt_uchime_denovo)
     opt_maxsizeratio = 1.0 / opt_abskew;
 
@@ -1462,6 +1546,7 @@ void chimera()
   nonchimera_count = 0;
   progress = 0;
   seqno = 0;
+  input_seqno = 0;
   cia = (struct chimera_info_s *) xmalloc(opt_threads *
                                             sizeof(struct chimera_info_s));
  
@@ -1472,6 +1557,8 @@ void chimera()
     /* init mutexes for input and output */
     pthread_mutex_init(&mutex_input, NULL);
     pthread_mutex_init(&mutex_output, NULL);
+    pthread_rwlock_init(&rwlock_index, NULL);
+    pthread_cond_init(&cond_turn, NULL);
 #endif
   /* prepare queries / database */
   if (opt_uchime_ref)
@@ -1555,6 +1642,8 @@ void chimera()
   free(cia);
     
 #if PTHREAD
+    pthread_cond_destroy(&cond_turn);
+    pthread_rwlock_destroy(&rwlock_index);
     pthread_mutex_destroy(&mutex_output);
     pthread_mutex_destroy(&mutex_input);
     free(pthread);
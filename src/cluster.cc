@@ -73,6 +73,51 @@ typedef struct clusterinfo_s
 
 static clusterinfo_t * clusterinfo = 0;
 static int clusters = 0;
+static int cluster_base = 0; /* added to the cluster numbers in uc output */
+
+/*
+  Only the centroids are added to the index, which starts empty and
+  grows with them. The search info has room for cluster_capacity
+  indexed sequences, doubled as needed before each round of queries.
+*/
+
+#define CLUSTER_CAPACITY_MIN 1024
+
+static int cluster_capacity;    /* database sequences the searches allow */
+static long cluster_maxaccepts; /* limits as specified */
+static long cluster_maxrejects;
+
+/*
+  Without --msaout, --consout, --profile or --samheader, which need
+  every sequence, cluster_smallmem reads the queries one at a time.
+  Only the centroids are added to the database and its index, so
+  that clusterinfo is not needed: the centroid of cluster number c is
+  database sequence c. Members are written to the --clusters files
+  as they are found.
+*/
+
+static bool cluster_streaming = false;
+static fastx_handle cluster_stream_h = 0;
+static std::vector<long> cluster_stream_abundance;
+static char * cluster_stream_fn = 0;
+static unsigned long cluster_stream_sequences;
+static unsigned long cluster_stream_nucleotides;
+static unsigned long cluster_stream_shortest;
+static unsigned long cluster_stream_longest;
+static long cluster_stream_discarded_short;
+static long cluster_stream_discarded_long;
+
+/*
+  With several --id thresholds, the centroids of each level are
+  clustered again at the next one. Only the given queries, in order,
+  are then clustered, and the alignments of the queries that become
+  centroids are kept in the search cache for the next level.
+*/
+
+static int * cluster_queries = 0;
+static int cluster_querycount;
+static unsigned long cluster_querynucleotides;
+static bool cluster_caching = false;
 
 static long * cluster_abundance;
 
@@ -148,16 +193,19 @@ inline void cluster_query_core(struct searchinfo_s * si)
 {
   /* the main core function for clustering */
   
-  /* get sequence etc */
-  int seqno = si->query_no;
-  si->query_head_len = db_getheaderlen(seqno);
-  si->query_head = db_getheader(seqno);
-  si->qsize = db_getabundance(seqno);
-  si->qseqlen = db_getsequencelen(seqno);
-  if (si->strand)
-    reverse_complement(si->qsequence, db_getsequence(seqno), si->qseqlen);
-  else
-    strcpy(si->qsequence, db_getsequence(seqno));
+  /* get sequence etc, unless already read by cluster_stream_next */
+  if (! cluster_streaming)
+    {
+      int seqno = si->query_no;
+      si->query_head_len = db_getheaderlen(seqno);
+      si->query_head = db_getheader(seqno);
+      si->qsize = db_getabundance(seqno);
+      si->qseqlen = db_getsequencelen(seqno);
+      if (si->strand)
+        reverse_complement(si->qsequence, db_getsequence(seqno), si->qseqlen);
+      else
+        strcpy(si->qsequence, db_getsequence(seqno));
+    }
   /* perform search */
   search_onequery(si, opt_qmask);
 }
@@ -304,13 +352,23 @@ void cluster_query_init(struct searchinfo_s * si)
   si->qsize = 1;
   si->nw = 0;
   si->hit_count = 0;
+  si->query_head_alloc = 0;
+  si->query_head = 0;
 
-  /* allocate memory for sequence */
+  /* allocate memory for sequence, or when streaming as they are read */
 
-  si->seq_alloc = db_getlongestsequence() + 1;
-  si->qsequence = (char *) xmalloc(si->seq_alloc);
+  if (cluster_streaming)
+    {
+      si->seq_alloc = 0;
+      si->qsequence = 0;
+    }
+  else
+    {
+      si->seq_alloc = db_getlongestsequence() + 1;
+      si->qsequence = (char *) xmalloc(si->seq_alloc);
+    }
 
-  si->kmers = (count_t *) xmalloc(seqcount * sizeof(count_t) + 32);
+  si->kmers = (count_t *) xmalloc(cluster_capacity * sizeof(count_t) + 32);
   si->hits = (struct hit *) xmalloc(sizeof(struct hit) * tophits);
 
   si->uh = unique_init();
@@ -343,12 +401,585 @@ void cluster_query_exit(struct searchinfo_s * si)
   
   if (si->qsequence)
     free(si->qsequence);
+  if (si->query_head_alloc)
+    free(si->query_head);
   if (si->hits)
     free(si->hits);
   if (si->kmers)
     free(si->kmers);
 }
 
+static void cluster_limits()
+{
+  /* tophits = the maximum number of hits we need to store */
+
+  opt_maxrejects = cluster_maxrejects;
+  opt_maxaccepts = cluster_maxaccepts;
+
+  if ((opt_maxrejects == 0) || (opt_maxrejects > cluster_capacity))
+    opt_maxrejects = cluster_capacity;
+
+  if ((opt_maxaccepts == 0) || (opt_maxaccepts > cluster_capacity))
+    opt_maxaccepts = cluster_capacity;
+
+  tophits = opt_maxrejects + opt_maxaccepts + MAXDELAYED;
+
+  if (tophits > cluster_capacity)
+    tophits = cluster_capacity;
+}
+
+static void cluster_reserve(struct searchinfo_s * si_p,
+                            struct searchinfo_s * si_m,
+                            int count,
+                            int queries)
+{
+  /* make room for the centroids there may be after the given number
+     of queries, in the search info of count queries */
+
+  int needed = dbindex_getcount() + queries;
+
+  if (needed <= cluster_capacity)
+    return;
+
+  while (cluster_capacity < needed)
+    cluster_capacity *= 2;
+
+  cluster_limits();
+
+  for(int i = 0; i < count; i++)
+    for(int s = 0; s < opt_strand; s++)
+      {
+        struct searchinfo_s * si = s ? si_m + i : si_p + i;
+        si->kmers = (count_t *)
+          xrealloc(si->kmers, cluster_capacity * sizeof(count_t) + 32);
+        si->hits = (struct hit *)
+          xrealloc(si->hits, sizeof(struct hit) * tophits);
+        minheap_exit(si->m);
+        si->m = minheap_init(tophits);
+      }
+}
+
+static void cluster_stream_open(char * filename)
+{
+  cluster_stream_h = fastx_open(filename);
+
+  if (!cluster_stream_h)
+    fatal("Unrecognized file type (not proper FASTA or FASTQ format)");
+
+  db_init();
+
+  cluster_stream_abundance.clear();
+  cluster_stream_sequences = 0;
+  cluster_stream_nucleotides = 0;
+  cluster_stream_shortest = LONG_MAX;
+  cluster_stream_longest = 0;
+  cluster_stream_discarded_short = 0;
+  cluster_stream_discarded_long = 0;
+
+  if (opt_clusters)
+    cluster_stream_fn = (char *) xmalloc(strlen(opt_clusters) + 25);
+}
+
+static void cluster_stream_close()
+{
+  fastx_close(cluster_stream_h);
+  cluster_stream_h = 0;
+
+  if (cluster_stream_fn)
+    {
+      free(cluster_stream_fn);
+      cluster_stream_fn = 0;
+    }
+
+  db_report(cluster_stream_nucleotides,
+            cluster_stream_sequences,
+            cluster_stream_shortest,
+            cluster_stream_longest,
+            cluster_stream_discarded_short,
+            cluster_stream_discarded_long);
+}
+
+static bool cluster_stream_next(struct searchinfo_s * si_p,
+                                struct searchinfo_s * si_m)
+{
+  /* read the next query within the length limits, masked as the
+     database would be, into the search info of both strands */
+
+  while (fastx_next(cluster_stream_h,
+                    ! opt_notrunclabels,
+                    chrmap_no_change))
+    {
+      unsigned long length = fastx_get_sequence_length(cluster_stream_h);
+
+      if (length < (unsigned long) opt_minseqlength)
+        {
+          cluster_stream_discarded_short++;
+          continue;
+        }
+
+      if (length > (unsigned long) opt_maxseqlength)
+        {
+          cluster_stream_discarded_long++;
+          continue;
+        }
+
+      char * header = fastx_get_header(cluster_stream_h);
+      int header_len = fastx_get_header_length(cluster_stream_h);
+      int size_start, size_end;
+      int abundance = abundance_get_span(header, header_len,
+                                         & size_start, & size_end);
+
+      for (int s = 0; s < opt_strand; s++)
+        {
+          struct searchinfo_s * si = s ? si_m : si_p;
+
+          si->query_head_len = header_len;
+          si->qseqlen = length;
+          si->qsize = abundance;
+
+          if (si->query_head_len + 1 > si->query_head_alloc)
+            {
+              si->query_head_alloc = si->query_head_len + 2001;
+              si->query_head = (char *)
+                xrealloc(si->query_head, (size_t) si->query_head_alloc);
+            }
+
+          if (si->qseqlen + 1 > si->seq_alloc)
+            {
+              si->seq_alloc = si->qseqlen + 2001;
+              si->qsequence = (char *)
+                xrealloc(si->qsequence, (size_t) si->seq_alloc);
+            }
+
+          strcpy(si->query_head, header);
+        }
+
+      strcpy(si_p->qsequence, fastx_get_sequence(cluster_stream_h));
+
+      if (opt_qmask == MASK_DUST)
+        dust(si_p->qsequence, length);
+      else if ((opt_qmask == MASK_SOFT) && (opt_hardmask))
+        hardmask(si_p->qsequence, length);
+
+      if (opt_strand > 1)
+        reverse_complement(si_m->qsequence, si_p->qsequence, length);
+
+      cluster_stream_sequences++;
+      cluster_stream_nucleotides += length;
+      if (length < cluster_stream_shortest)
+        cluster_stream_shortest = length;
+      if (length > cluster_stream_longest)
+        cluster_stream_longest = length;
+
+      return true;
+    }
+
+  return false;
+}
+
+static void cluster_stream_print(int clusterno,
+                                 struct searchinfo_s * si,
+                                 bool first)
+{
+  /* add a sequence to the --clusters file of its cluster */
+
+  sprintf(cluster_stream_fn, "%s%d", opt_clusters, clusterno);
+  FILE * fp = first ? fopen_output(cluster_stream_fn) :
+    fopen(cluster_stream_fn, "a");
+  if (!fp)
+    fatal("Unable to open clusters file for writing");
+  fasta_print(fp, si->query_head, si->qsequence, si->qseqlen);
+  fclose(fp);
+}
+
+static bool cluster_next_query(struct searchinfo_s * si_p,
+                               struct searchinfo_s * si_m,
+                               int seqno)
+{
+  /* set up the search info for query seqno, if there is one */
+
+  if (cluster_streaming)
+    {
+      if (! cluster_stream_next(si_p, si_m))
+        return false;
+    }
+  else if (cluster_queries)
+    {
+      if (seqno >= cluster_querycount)
+        return false;
+      seqno = cluster_queries[seqno];
+      si_p->qseqlen = db_getsequencelen(seqno);
+    }
+  else
+    {
+      if (seqno >= seqcount)
+        return false;
+      si_p->qseqlen = db_getsequencelen(seqno);
+    }
+
+  si_p->query_no = seqno;
+  si_p->strand = 0;
+
+  if (opt_strand > 1)
+    {
+      si_m->query_no = seqno;
+      si_m->strand = 1;
+    }
+
+  return true;
+}
+
+static unsigned long cluster_progress_size()
+{
+  if (cluster_streaming)
+    return fastx_get_size(cluster_stream_h);
+  else if (cluster_queries)
+    return cluster_querynucleotides;
+  else
+    return db_getnucleotidecount();
+}
+
+static unsigned long cluster_progress(unsigned long nucleotides)
+{
+  if (cluster_streaming)
+    return fastx_get_position(cluster_stream_h);
+  else
+    return nucleotides;
+}
+
+inline int cluster_of(int target)
+{
+  /* the cluster of a centroid */
+
+  if (cluster_streaming)
+    return target;
+  else
+    return clusterinfo[target].clusterno;
+}
+
+static void cluster_member(struct searchinfo_s * si_p,
+                           int clusterno,
+                           struct hit * best)
+{
+  /* the query joins the cluster */
+
+  if (cluster_streaming)
+    {
+      cluster_stream_abundance[clusterno] += opt_sizein ? si_p->qsize : 1;
+      if (opt_clusters)
+        cluster_stream_print(clusterno, si_p, false);
+    }
+  else
+    {
+      int seqno = si_p->query_no;
+      clusterinfo[seqno].seqno = seqno;
+      clusterinfo[seqno].clusterno = clusterno;
+      clusterinfo[seqno].cigar = best->nwalignment;
+      clusterinfo[seqno].strand = best->strand;
+      best->nwalignment = 0;
+    }
+}
+
+static void cluster_centroid(struct searchinfo_s * si_p)
+{
+  /* the query is the centroid of a new cluster, index it */
+
+  if (cluster_streaming)
+    {
+      si_p->query_no = db_add(si_p->query_head,
+                              si_p->query_head_len,
+                              si_p->qsequence,
+                              si_p->qseqlen,
+                              0);
+      cluster_stream_abundance.push_back(opt_sizein ? si_p->qsize : 1);
+      if (opt_clusters)
+        cluster_stream_print(clusters, si_p, true);
+    }
+  else
+    {
+      int seqno = si_p->query_no;
+      clusterinfo[seqno].seqno = seqno;
+      clusterinfo[seqno].clusterno = clusters;
+      clusterinfo[seqno].cigar = 0;
+      clusterinfo[seqno].strand = 0;
+    }
+
+  dbindex_addsequence(si_p->query_no, opt_qmask);
+}
+
+static void cluster_cache(struct searchinfo_s * si_p,
+                          struct searchinfo_s * si_m)
+{
+  /* keep the alignments of a new centroid for the next level */
+
+  if (cluster_caching)
+    {
+      search_cache_add(si_p);
+      if (opt_strand > 1)
+        search_cache_add(si_m);
+    }
+}
+
+static char * cluster_getline(FILE * fp, char ** line, size_t * alloc)
+{
+  /* read a whole line of any length from a file */
+
+  size_t len = 0;
+
+  while (1)
+    {
+      if (len + 2 > * alloc)
+        {
+          * alloc = MAX(2 * (* alloc), 1024);
+          * line = (char *) xrealloc(* line, * alloc);
+        }
+
+      if (! fgets(* line + len, * alloc - len, fp))
+        return len ? * line : 0;
+
+      len += strlen(* line + len);
+
+      if ((len > 0) && ((* line)[len - 1] == '\n'))
+        return * line;
+    }
+}
+
+/*
+  With --checkpoint, the state of the clustering is saved at most every
+  CHECKPOINT_INTERVAL seconds, between two rounds of queries: the
+  number of queries done, the cluster, strand and alignment of each of
+  them, and the length of the output files written during clustering.
+  It is written to a temporary file that then replaces the checkpoint,
+  so that a complete checkpoint is left at any time.
+
+  With --resume, the input is read and sorted as before and must match
+  the checkpoint. The output files are cut back to the saved lengths,
+  the index is rebuilt from the centroids, which are the first
+  sequences of their clusters, and clustering continues with the next
+  query.
+*/
+
+#define CHECKPOINT_INTERVAL 600
+#define CHECKPOINT_OUTPUTS 8
+
+static const char checkpoint_magic[] = "vsearch checkpoint 1";
+
+static time_t checkpoint_time;
+static int checkpoint_position;  /* the first query to cluster */
+static int checkpoint_clusters;
+static FILE * fp_checkpoint = 0; /* when resuming */
+static long checkpoint_length[CHECKPOINT_OUTPUTS];
+
+static FILE * * checkpoint_output(int i)
+{
+  /* the output files written during clustering */
+
+  static FILE * * outputs[CHECKPOINT_OUTPUTS] =
+    {
+      & fp_uc, & fp_alnout, & fp_samout, & fp_userout,
+      & fp_blast6out, & fp_fastapairs, & fp_matched, & fp_notmatched
+    };
+
+  return outputs[i];
+}
+
+static void checkpoint_write(int position)
+{
+  char * tmpname = (char *) xmalloc(strlen(opt_checkpoint) + 5);
+  sprintf(tmpname, "%s.tmp", opt_checkpoint);
+
+  FILE * fp = fopen(tmpname, "w");
+  if (! fp)
+    fatal("Unable to open checkpoint file for writing");
+
+  fprintf(fp, "%s\n", checkpoint_magic);
+  fprintf(fp, "%d %lu %ld %d %d\n",
+          seqcount, db_getnucleotidecount(), opt_strand, position, clusters);
+
+  for(int i = 0; i < CHECKPOINT_OUTPUTS; i++)
+    {
+      FILE * output = * checkpoint_output(i);
+      long length = -1;
+      if (output)
+        {
+          fflush(output);
+          length = ftell(output);
+        }
+      fprintf(fp, "%s%ld", i ? " " : "", length);
+    }
+  fprintf(fp, "\n");
+
+  for(int i = 0; i < position; i++)
+    {
+      char * cigar = clusterinfo[i].cigar;
+      fprintf(fp, "%d %d %s\n",
+              clusterinfo[i].clusterno,
+              clusterinfo[i].strand,
+              (cigar && *cigar) ? cigar : "*");
+    }
+
+  if (fclose(fp))
+    fatal("Unable to write checkpoint file");
+
+#ifdef _WIN32
+  remove(opt_checkpoint);
+#endif
+
+  if (rename(tmpname, opt_checkpoint))
+    fatal("Unable to replace checkpoint file");
+
+  free(tmpname);
+}
+
+static void checkpoint_update(int position)
+{
+  /* save the state after the given number of queries, if it is time */
+
+  if (! opt_checkpoint)
+    return;
+
+  time_t now = time(0);
+
+  if (now - checkpoint_time >= CHECKPOINT_INTERVAL)
+    {
+      checkpoint_write(position);
+      checkpoint_time = now;
+    }
+}
+
+static void checkpoint_open()
+{
+  /* read the output file lengths from the checkpoint */
+
+  checkpoint_time = time(0);
+  checkpoint_position = 0;
+
+  if (! opt_resume)
+    return;
+
+  fp_checkpoint = fopen(opt_checkpoint, "r");
+  if (! fp_checkpoint)
+    fatal("Unable to open checkpoint file for reading");
+
+  char magic[sizeof(checkpoint_magic) + 1];
+  if ((! fgets(magic, sizeof(magic), fp_checkpoint)) ||
+      strncmp(magic, checkpoint_magic, strlen(checkpoint_magic)))
+    fatal("Invalid checkpoint file");
+
+  int count;
+  unsigned long nucleotides;
+  long strand;
+  if (fscanf(fp_checkpoint, "%d %lu %ld %d %d",
+             & count, & nucleotides, & strand,
+             & checkpoint_position, & checkpoint_clusters) != 5)
+    fatal("Invalid checkpoint file");
+
+  for(int i = 0; i < CHECKPOINT_OUTPUTS; i++)
+    if (fscanf(fp_checkpoint, "%ld", checkpoint_length + i) != 1)
+      fatal("Invalid checkpoint file");
+}
+
+static void checkpoint_open_output(FILE * * fpp, const char * filename)
+{
+  /* open an output file written during clustering, when resuming
+     after the length it had at the checkpoint */
+
+  if (! opt_resume)
+    {
+      * fpp = fopen_output(filename);
+      return;
+    }
+
+  for(int i = 0; i < CHECKPOINT_OUTPUTS; i++)
+    if (checkpoint_output(i) == fpp)
+      {
+        if (checkpoint_length[i] < 0)
+          fatal("Output options do not match those of the checkpoint");
+        * fpp = fopen_output_at(filename, checkpoint_length[i]);
+      }
+}
+
+static void checkpoint_resume()
+{
+  /* restore the state of the queries done and index their centroids */
+
+  if (! fp_checkpoint)
+    return;
+
+  for(int i = 0; i < CHECKPOINT_OUTPUTS; i++)
+    if ((checkpoint_length[i] >= 0) && ! * checkpoint_output(i))
+      fatal("Output options do not match those of the checkpoint");
+
+  rewind(fp_checkpoint);
+
+  char * line = 0;
+  size_t alloc = 0;
+
+  cluster_getline(fp_checkpoint, & line, & alloc);
+  cluster_getline(fp_checkpoint, & line, & alloc);
+
+  int count;
+  unsigned long nucleotides;
+  long strand;
+  if (sscanf(line, "%d %lu %ld", & count, & nucleotides, & strand) != 3)
+    fatal("Invalid checkpoint file");
+
+  if ((count != seqcount) || (nucleotides != db_getnucleotidecount()))
+    fatal("The input does not match the checkpoint");
+
+  if (strand != opt_strand)
+    fatal("Option --strand does not match that of the checkpoint");
+
+  cluster_getline(fp_checkpoint, & line, & alloc);
+
+  progress_init("Resuming from checkpoint", checkpoint_position);
+
+  int centroids = 0;
+
+  for(int i = 0; i < checkpoint_position; i++)
+    {
+      int clusterno;
+      int strand;
+      int n = 0;
+
+      if ((! cluster_getline(fp_checkpoint, & line, & alloc)) ||
+          (sscanf(line, "%d %d %n", & clusterno, & strand, & n) != 2) ||
+          (clusterno < 0) || (clusterno > centroids) ||
+          (clusterno >= checkpoint_clusters))
+        fatal("Invalid checkpoint file");
+
+      char * cigar = line + n;
+      cigar[strcspn(cigar, "\r\n")] = 0;
+
+      clusterinfo[i].seqno = i;
+      clusterinfo[i].clusterno = clusterno;
+      clusterinfo[i].strand = strand;
+      clusterinfo[i].cigar = strcmp(cigar, "*") ? xstrdup(cigar) : 0;
+
+      if (clusterno == centroids)
+        {
+          /* the first sequence of a cluster is its centroid */
+          dbindex_addsequence(i, opt_qmask);
+          centroids++;
+        }
+
+      progress_update(i);
+    }
+
+  progress_done();
+
+  if (centroids != checkpoint_clusters)
+    fatal("Invalid checkpoint file");
+
+  clusters = checkpoint_clusters;
+
+  if (line)
+    free(line);
+
+  fclose(fp_checkpoint);
+  fp_checkpoint = 0;
+}
+
 void cluster_core_results_hit(struct hit * best,
                               int clusterno,
                               char * query_head,
@@ -359,7 +990,7 @@ void cluster_core_results_hit(struct hit * best,
   if (opt_uc)
     {
       fprintf(fp_uc, "H\t%d\t%d\t%.1f\t%c\t0\t0\t%s\t%s\t%s\n",
-              clusterno,
+              cluster_base + clusterno,
               qseqlen,
               best->id,
               best->strand ? '-' : '+',
@@ -407,7 +1038,7 @@ void cluster_core_results_nohit(int clusterno,
   if (opt_uc)
     {
       fprintf(fp_uc, "S\t%d\t%d\t*\t*\t*\t*\t*\t%s\t*\n",
-              clusters, qseqlen, query_head);
+              cluster_base + clusterno, qseqlen, query_head);
     }
   
   if (opt_output_no_hits)
@@ -486,13 +1117,13 @@ void cluster_core_parallel()
 
   int lastlength = INT_MAX;
 
-  int seqno = 0;
+  int seqno = checkpoint_position;
 
   long sum_nucleotides = 0;
 
-  progress_init("Clustering", db_getnucleotidecount());
+  progress_init("Clustering", cluster_progress_size());
 
-  while(seqno < seqcount)
+  while(1)
     {
       /* prepare work for the threads in sia[i] */
       /* read query sequences into the search info (si) for each thread */
@@ -501,9 +1132,9 @@ void cluster_core_parallel()
       
       for(int i = 0; i < max_queries; i++)
         {
-          if (seqno < seqcount)
+          if (cluster_next_query(si_plus + i, si_minus + i, seqno))
             {
-              int length = db_getsequencelen(seqno);
+              int length = si_plus[i].qseqlen;
 
 #if 1
               if (opt_cluster_smallmem && (!opt_usersort) && (length > lastlength))
@@ -512,20 +1143,18 @@ void cluster_core_parallel()
 
               lastlength = length;
 
-              si_plus[i].query_no = seqno;
-              si_plus[i].strand = 0;
-
-              if (opt_strand > 1)
-                {
-                  si_minus[i].query_no = seqno;
-                  si_minus[i].strand = 1;
-                }
-
               queries++;
               seqno++;
             }
+          else
+            break;
         }
 
+      if (queries == 0)
+        break;
+
+      cluster_reserve(si_plus, si_minus, max_queries, queries);
+
       /* perform work in threads */
       threads_wakeup(queries);
       
@@ -639,7 +1268,17 @@ void cluster_core_parallel()
                         {
                           /* Test accept/reject criteria before alignment */
                           unsigned int target = hit->target;
-                          if (search_acceptable_unaligned(si, target))
+                          if (! search_acceptable_unaligned(si, target))
+                            {
+                              /* rejection without alignment */
+                              hit->rejected = 1;
+                              si->rejects++;
+                            }
+                          else if (search_cache_get(si, hit))
+                            {
+                              /* aligned at an earlier level */
+                            }
+                          else
                             {
                               aligncount++;
                               
@@ -733,12 +1372,6 @@ void cluster_core_parallel()
                                  excluding terminal gaps */
                               align_trim(hit);
                             }
-                          else
-                            {
-                              /* rejection without alignment */
-                              hit->rejected = 1;
-                              si->rejects++;
-                            }
                         }
                           
                       if (! hit->rejected)
@@ -775,27 +1408,21 @@ void cluster_core_parallel()
           else
             best = search_findbest2_byid(si_p, si_m);
             
-          int myseqno = si_p->query_no;
-          
           if (best)
             {
               /* a hit was found, cluster current sequence with hit */
-              int target = best->target;
+              int clusterno = cluster_of(best->target);
               
               /* output intermediate results to uc etc */
               cluster_core_results_hit(best,
-                                       clusterinfo[target].clusterno,
+                                       clusterno,
                                        si_p->query_head,
                                        si_p->qseqlen,
                                        si_p->qsequence,
                                        best->strand ? si_m->qsequence : 0);
 
               /* update cluster info about this sequence */
-              clusterinfo[myseqno].seqno = myseqno;
-              clusterinfo[myseqno].clusterno = clusterinfo[target].clusterno;
-              clusterinfo[myseqno].cigar = best->nwalignment;
-              clusterinfo[myseqno].strand = best->strand;
-              best->nwalignment = 0;
+              cluster_member(si_p, clusterno, best);
             }
           else
             {
@@ -804,14 +1431,9 @@ void cluster_core_parallel()
                  round */
               extra_list[extra_count++] = i;
               
-              /* update cluster info about this sequence */
-              clusterinfo[myseqno].seqno = myseqno;
-              clusterinfo[myseqno].clusterno = clusters;
-              clusterinfo[myseqno].cigar = 0;
-              clusterinfo[myseqno].strand = 0;
-              
-              /* add current sequence to database */
-              dbindex_addsequence(myseqno, opt_qmask);
+              /* update cluster info and add it to the database */
+              cluster_centroid(si_p);
+              cluster_cache(si_p, si_m);
               
               /* output intermediate results to uc etc */
               cluster_core_results_nohit(clusters,
@@ -835,7 +1457,9 @@ void cluster_core_parallel()
           sum_nucleotides += si_p->qseqlen;
         }
       
-      progress_update(sum_nucleotides);
+      progress_update(cluster_progress(sum_nucleotides));
+
+      checkpoint_update(seqno);
     }
   progress_done();
 
@@ -875,10 +1499,14 @@ void cluster_core_serial()
 
   int lastlength = INT_MAX;
 
-  progress_init("Clustering", seqcount);
-  for (int seqno=0; seqno<seqcount; seqno++)
+  progress_init("Clustering",
+                cluster_streaming ? cluster_progress_size() :
+                cluster_queries ? cluster_querycount : seqcount);
+  for (int seqno = checkpoint_position;
+       cluster_next_query(si_p, si_m, seqno);
+       seqno++)
     {
-      int length = db_getsequencelen(seqno);
+      int length = si_p->qseqlen;
 
 #if 1
       if (opt_cluster_smallmem && (!opt_usersort) && (length > lastlength))
@@ -887,16 +1515,12 @@ void cluster_core_serial()
 
       lastlength = length;
 
-      si_p->query_no = seqno;
-      si_p->strand = 0;
+      cluster_reserve(si_p, si_m, 1, 1);
+
       cluster_query_core(si_p);
 
       if (opt_strand > 1)
-        {
-          si_m->query_no = seqno;
-          si_m->strand = 1;
-          cluster_query_core(si_m);
-        }
+        cluster_query_core(si_m);
 
       struct hit * best = 0;
       if (opt_sizeorder)
@@ -906,26 +1530,19 @@ void cluster_core_serial()
       
       if (best)
         {
-          int target = best->target;
+          int clusterno = cluster_of(best->target);
           cluster_core_results_hit(best,
-                                   clusterinfo[target].clusterno,
+                                   clusterno,
                                    si_p->query_head,
                                    si_p->qseqlen,
                                    si_p->qsequence,
                                    best->strand ? si_m->qsequence : 0);
-          clusterinfo[seqno].seqno = seqno;
-          clusterinfo[seqno].clusterno = clusterinfo[target].clusterno;
-          clusterinfo[seqno].cigar = best->nwalignment;
-          clusterinfo[seqno].strand = best->strand;
-          best->nwalignment = 0;
+          cluster_member(si_p, clusterno, best);
         }
       else
         {
-          clusterinfo[seqno].seqno = seqno;
-          clusterinfo[seqno].clusterno = clusters;
-          clusterinfo[seqno].cigar = 0;
-          clusterinfo[seqno].strand = 0;
-          dbindex_addsequence(seqno, opt_qmask);
+          cluster_centroid(si_p);
+          cluster_cache(si_p, si_m);
           cluster_core_results_nohit(clusters,
                                      si_p->query_head,
                                      si_p->qseqlen,
@@ -944,7 +1561,9 @@ void cluster_core_serial()
                 free(si->hits[i].nwalignment);
         }
 
-      progress_update(seqno);
+      progress_update(cluster_streaming ? cluster_progress(0) : seqno);
+
+      checkpoint_update(seqno + 1);
     }
   progress_done();
 
@@ -954,132 +1573,392 @@ void cluster_core_serial()
 }
 
 
-void cluster(char * dbname, 
-             char * cmdline,
-             char * progheader)
+static void cluster_log_index()
 {
-  if (opt_centroids)
+  if (opt_log)
     {
-      fp_centroids = fopen(opt_centroids, "w");
-      if (!fp_centroids)
-        fatal("Unable to open centroids file for writing");
-    }
+      unsigned long slots = 1UL << (opt_wordlength << 1UL);
+      fprintf(fp_log, "\n");
+      fprintf(fp_log, "      Alphabet  nt\n");
+      fprintf(fp_log, "    Word width  %ld\n", opt_wordlength);
+      fprintf(fp_log, "     Word ones  %ld\n", opt_wordlength);
+      fprintf(fp_log, "        Spaced  No\n");
+      fprintf(fp_log, "        Hashed  No\n");
+      fprintf(fp_log, "         Coded  No\n");
+      fprintf(fp_log, "       Stepped  No\n");
+      fprintf(fp_log, "         Slots  %lu (%.1fk)\n", slots, slots/1000.0);
+      fprintf(fp_log, "       DBAccel  100%%\n");
+      fprintf(fp_log, "\n");
+    }      
+}
 
-  if (opt_uc)
+static void cluster_run()
+{
+  /* cluster the sequences in the database in their current order,
+     or those read from the input when streaming */
+
+  cluster_maxaccepts = opt_maxaccepts;
+  cluster_maxrejects = opt_maxrejects;
+
+  if (cluster_streaming)
+    seqcount = 0;
+  else
     {
-      fp_uc = fopen(opt_uc, "w");
-      if (!fp_uc)
-        fatal("Unable to open uc file for writing");
+      seqcount = db_getsequencecount();
+      clusterinfo = (clusterinfo_t *)
+        xmalloc(seqcount * sizeof(clusterinfo_t));
     }
 
-  if (opt_alnout)
-    {
-      fp_alnout = fopen(opt_alnout, "w");
-      if (! fp_alnout)
-        fatal("Unable to open alignment output file for writing");
+  cluster_capacity = CLUSTER_CAPACITY_MIN;
+  dbindex_prepare_empty(1);
 
-      fprintf(fp_alnout, "%s\n", cmdline);
-      fprintf(fp_alnout, "%s\n", progheader);
-    }
+  clusters = 0;
 
-  if (opt_samout)
-    {
-      fp_samout = fopen(opt_samout, "w");
-      if (! fp_samout)
-        fatal("Unable to open SAM output file for writing");
-    }
+  checkpoint_resume();
 
-  if (opt_userout)
+  cluster_limits();
+
+  if (opt_threads == 1)
+    cluster_core_serial();
+  else
+    cluster_core_parallel();
+}
+
+/*
+  Single-linkage clustering by differences, with --cluster_linkage.
+  The sequences are sorted by abundance, and each one not yet in a
+  cluster becomes the centroid of a new cluster, which is expanded
+  breadth-first along the links found by linkage.cc. In the uc file
+  and the other per-query output, each member is reported as a hit to
+  the sequence it was reached from, which is not always the centroid.
+*/
+
+static void cluster_linkage_run()
+{
+  seqcount = db_getsequencecount();
+  clusterinfo = (clusterinfo_t *) xmalloc(seqcount * sizeof(clusterinfo_t));
+  for(int i=0; i<seqcount; i++)
+    clusterinfo[i].clusterno = -1;
+
+  linkage_build(opt_differences);
+
+  int * queue = (int *) xmalloc(seqcount * sizeof(int));
+  int clustered = 0;
+
+  clusters = 0;
+
+  progress_init("Clustering", seqcount);
+
+  for(int seed = 0; seed < seqcount; seed++)
     {
-      fp_userout = fopen(opt_userout, "w");
-      if (! fp_userout)
-        fatal("Unable to open user-defined output file for writing");
+      if (clusterinfo[seed].clusterno >= 0)
+        continue;
+
+      clusterinfo[seed].seqno = seed;
+      clusterinfo[seed].clusterno = clusters;
+      clusterinfo[seed].cigar = 0;
+      clusterinfo[seed].strand = 0;
+
+      cluster_core_results_nohit(clusters,
+                                 db_getheader(seed),
+                                 db_getsequencelen(seed),
+                                 db_getsequence(seed),
+                                 0);
+
+      int head = 0;
+      int tail = 0;
+      queue[tail++] = seed;
+
+      while (head < tail)
+        {
+          int source = queue[head++];
+          struct linkage_edge_s * edges = linkage_getedges(source);
+          unsigned long count = linkage_getedgecount(source);
+
+          for(unsigned long j = 0; j < count; j++)
+            {
+              int seqno = edges[j].target;
+              if (clusterinfo[seqno].clusterno >= 0)
+                continue;
+
+              clusterinfo[seqno].seqno = seqno;
+              clusterinfo[seqno].clusterno = clusters;
+              clusterinfo[seqno].cigar = 0;
+              clusterinfo[seqno].strand = 0;
+
+              struct hit hit;
+              linkage_hit(source, edges + j, & hit);
+              cluster_core_results_hit(& hit,
+                                       clusters,
+                                       db_getheader(seqno),
+                                       db_getsequencelen(seqno),
+                                       db_getsequence(seqno),
+                                       0);
+              free(hit.nwalignment);
+
+              queue[tail++] = seqno;
+            }
+        }
+
+      clustered += tail;
+      clusters++;
+      progress_update(clustered);
     }
 
-  if (opt_blast6out)
+  progress_done();
+
+  free(queue);
+}
+
+static void cluster_run_exit()
+{
+  /* free cigar strings for all aligned sequences */
+
+  for(int i=0; i<seqcount; i++)
+    if (clusterinfo[i].cigar)
+      free(clusterinfo[i].cigar);
+
+  free(clusterinfo);
+  clusterinfo = 0;
+
+  if (opt_cluster_linkage)
+    linkage_free();
+  else
+    dbindex_free();
+  db_free();
+}
+
+static void cluster_summary(long sequences)
+{
+  /* show the number and abundance of the clusters */
+
+  long abundance_min = LONG_MAX;
+  long abundance_max = 0;
+  int singletons = 0;
+
+  for(int z=0; z<clusters; z++)
     {
-      fp_blast6out = fopen(opt_blast6out, "w");
-      if (! fp_blast6out)
-        fatal("Unable to open blast6-like output file for writing");
+      long abundance = cluster_abundance[z];
+      if (abundance < abundance_min)
+        abundance_min = abundance;
+      if (abundance > abundance_max)
+        abundance_max = abundance;
+
+      if (abundance == 1)
+        singletons++;
     }
 
-  if (opt_fastapairs)
+  if (!opt_quiet)
     {
-      fp_fastapairs = fopen(opt_fastapairs, "w");
-      if (! fp_fastapairs)
-        fatal("Unable to open fastapairs output file for writing");
+      fprintf(stderr,
+              "Clusters: %d Size min %ld, max %ld, avg %.1f\n",
+              clusters,
+              abundance_min,
+              abundance_max,
+              1.0 * sequences / clusters);
+      fprintf(stderr,
+              "Singletons: %d, %.1f%% of seqs, %.1f%% of clusters\n",
+              singletons,
+              100.0 * singletons / sequences, 
+              100.0 * singletons / clusters);
     }
 
-  if (opt_matched)
+  if (opt_log)
     {
-      fp_matched = fopen(opt_matched, "w");
-      if (! fp_matched)
-        fatal("Unable to open matched output file for writing");
+      fprintf(fp_log,
+              "Clusters: %d Size min %ld, max %ld, avg %.1f\n",
+              clusters,
+              abundance_min,
+              abundance_max,
+              1.0 * sequences / clusters);
+      fprintf(fp_log,
+              "Singletons: %d, %.1f%% of seqs, %.1f%% of clusters\n",
+              singletons,
+              100.0 * singletons / sequences, 
+              100.0 * singletons / clusters);
+      fprintf(fp_log, "\n");
     }
+}
 
-  if (opt_notmatched)
+/*
+  The multiple alignments, consensus sequences and profiles of the
+  clusters are computed by several threads. Each thread takes the next
+  cluster in turn and formats its output in its own buffers, which the
+  ordered writers put out in cluster order.
+*/
+
+static int msa_clusters;
+static int * msa_start;  /* first clusterinfo entry of each cluster */
+static int msa_next;     /* next cluster to compute */
+static int msa_size_max; /* size of the largest cluster */
+static writer_t * w_msaout = 0;
+static writer_t * w_consout = 0;
+static writer_t * w_profile = 0;
+
+#if PTHREAD
+static pthread_mutex_t msa_mutex;
+#endif
+
+static void cluster_msa_range(long t)
+{
+  msa_t * m = msa_init();
+  struct msa_target_s * target_list = (struct msa_target_s *)
+    xmalloc(sizeof(struct msa_target_s) * msa_size_max);
+
+  while (1)
     {
-      fp_notmatched = fopen(opt_notmatched, "w");
-      if (! fp_notmatched)
-        fatal("Unable to open notmatched output file for writing");
+#if PTHREAD
+      pthread_mutex_lock(&msa_mutex);
+#endif
+      int c = msa_next;
+      if (c < msa_clusters)
+        {
+          msa_next++;
+          progress_update(msa_start[c]);
+        }
+#if PTHREAD
+      pthread_mutex_unlock(&msa_mutex);
+#endif
+
+      if (c >= msa_clusters)
+        break;
+
+      int first = msa_start[c];
+      int target_count = msa_start[c + 1] - first;
+
+      for(int i = 0; i < target_count; i++)
+        {
+          target_list[i].seqno = clusterinfo[first + i].seqno;
+          target_list[i].cigar = clusterinfo[first + i].cigar;
+          target_list[i].strand = clusterinfo[first + i].strand;
+        }
+
+      int clusterno = clusterinfo[first].clusterno;
+
+      msa_format(m,
+                 w_msaout ? writer_buffer(w_msaout, t) : 0,
+                 w_consout ? writer_buffer(w_consout, t) : 0,
+                 w_profile ? writer_buffer(w_profile, t) : 0,
+                 clusterno,
+                 target_count, target_list,
+                 cluster_abundance[clusterno]);
+
+      if (w_msaout)
+        writer_commit(w_msaout, t, c);
+      if (w_consout)
+        writer_commit(w_consout, t, c);
+      if (w_profile)
+        writer_commit(w_profile, t, c);
     }
 
-  db_read(dbname, 0);
+  free(target_list);
+  msa_exit(m);
+}
 
-  results_show_samheader(fp_samout, cmdline, dbname);
+#if PTHREAD
+static void * cluster_msa_worker(void * vp)
+{
+  cluster_msa_range((long) vp);
+  return 0;
+}
+#endif
 
-  if (opt_qmask == MASK_DUST)
-    dust_all();
-  else if ((opt_qmask == MASK_SOFT) && (opt_hardmask))
-    hardmask_all();
-  
-  show_rusage();
-  
-  seqcount = db_getsequencecount();
+static void cluster_msa(int size_max)
+{
+  FILE * fp_msaout = 0;
+  FILE * fp_consout = 0;
+  FILE * fp_profile = 0;
 
-  if (opt_cluster_fast)
-    db_sortbylength();
-  else if (opt_cluster_size)
-    db_sortbyabundance();
-  
-  dbindex_prepare(1, opt_qmask);
-  
-  /* tophits = the maximum number of hits we need to store */
+  if (opt_msaout)
+    if (!(fp_msaout = fopen_output(opt_msaout)))
+      fatal("Unable to open msaout file");
 
-  if ((opt_maxrejects == 0) || (opt_maxrejects > seqcount))
-    opt_maxrejects = seqcount;
+  if (opt_consout)
+    if (!(fp_consout = fopen_output(opt_consout)))
+      fatal("Unable to open consout file");
 
-  if ((opt_maxaccepts == 0) || (opt_maxaccepts > seqcount))
-    opt_maxaccepts = seqcount;
+  if (opt_profile)
+    if (!(fp_profile = fopen_output(opt_profile)))
+      fatal("Unable to open profile file");
 
-  tophits = opt_maxrejects + opt_maxaccepts + MAXDELAYED;
+  if (fp_msaout)
+    w_msaout = writer_open(fp_msaout, opt_threads);
+  if (fp_consout)
+    w_consout = writer_open(fp_consout, opt_threads);
+  if (fp_profile)
+    w_profile = writer_open(fp_profile, opt_threads);
 
-  if (tophits > seqcount)
-    tophits = seqcount;
+  /* find the first sequence of each cluster, in output order */
 
-  clusterinfo = (clusterinfo_t *) xmalloc(seqcount * sizeof(clusterinfo_t));
+  msa_start = (int *) xmalloc((clusters + 1) * sizeof(int));
+  msa_clusters = 0;
+  for(int i=0; i<seqcount; i++)
+    if ((i == 0) ||
+        (clusterinfo[i].clusterno != clusterinfo[i-1].clusterno))
+      msa_start[msa_clusters++] = i;
+  msa_start[msa_clusters] = seqcount;
 
-  if (opt_log)
+  msa_next = 0;
+  msa_size_max = size_max;
+
+  progress_init("Multiple alignments", seqcount);
+
+#if PTHREAD
+  if (opt_threads > 1)
     {
-      unsigned long slots = 1UL << (opt_wordlength << 1UL);
-      fprintf(fp_log, "\n");
-      fprintf(fp_log, "      Alphabet  nt\n");
-      fprintf(fp_log, "    Word width  %ld\n", opt_wordlength);
-      fprintf(fp_log, "     Word ones  %ld\n", opt_wordlength);
-      fprintf(fp_log, "        Spaced  No\n");
-      fprintf(fp_log, "        Hashed  No\n");
-      fprintf(fp_log, "         Coded  No\n");
-      fprintf(fp_log, "       Stepped  No\n");
-      fprintf(fp_log, "         Slots  %lu (%.1fk)\n", slots, slots/1000.0);
-      fprintf(fp_log, "       DBAccel  100%%\n");
-      fprintf(fp_log, "\n");
-    }      
+      pthread_mutex_init(&msa_mutex, NULL);
 
-  if (opt_threads == 1)
-    cluster_core_serial();
+      pthread_attr_t msa_attr;
+      pthread_attr_init(&msa_attr);
+      pthread_attr_setdetachstate(&msa_attr, PTHREAD_CREATE_JOINABLE);
+
+      pthread_t * pthread
+        = (pthread_t *) xmalloc(opt_threads * sizeof(pthread_t));
+
+      for(long t=0; t<opt_threads; t++)
+        if (pthread_create(pthread+t, &msa_attr, cluster_msa_worker, (void*)t))
+          fatal("Cannot create thread");
+
+      for(long t=0; t<opt_threads; t++)
+        if (pthread_join(pthread[t], NULL))
+          fatal("Cannot join thread");
+
+      free(pthread);
+      pthread_attr_destroy(&msa_attr);
+      pthread_mutex_destroy(&msa_mutex);
+    }
   else
-    cluster_core_parallel();
+    cluster_msa_range(0);
+#else
+  cluster_msa_range(0);
+#endif
+
+  progress_done();
+
+  free(msa_start);
+  msa_start = 0;
+
+  writer_t ** w[] = { & w_msaout, & w_consout, & w_profile };
+  for (unsigned int i = 0; i < sizeof(w) / sizeof(writer_t **); i++)
+    if (* w[i])
+      {
+        writer_close(* w[i]);
+        * w[i] = 0;
+      }
 
+  if (fp_profile)
+    fclose(fp_profile);
+
+  if (fp_msaout)
+    fclose(fp_msaout);
+
+  if (fp_consout)
+    fclose(fp_consout);
+}
+
+static void cluster_output()
+{
+  /* write clusters, msa and consensus from clusterinfo */
 
   /* find size and abundance of each cluster and save stats */
 
@@ -1097,22 +1976,10 @@ void cluster(char * dbname,
       cluster_size[clusterno]++;
     }
       
-  long abundance_min = LONG_MAX;
-  long abundance_max = 0;
   int size_max = 0;
-  int singletons = 0;
 
   for(int z=0; z<clusters; z++)
     {
-      long abundance = cluster_abundance[z];
-      if (abundance < abundance_min)
-        abundance_min = abundance;
-      if (abundance > abundance_max)
-        abundance_max = abundance;
-
-      if (abundance == 1)
-        singletons++;
-
       int size = cluster_size[z];
       if (size > size_max)
         size_max = size;
@@ -1174,7 +2041,7 @@ void cluster(char * dbname,
                 fclose(fp_clusters);
               
               sprintf(fn_clusters, "%s%d", opt_clusters, clusterno);
-              fp_clusters = fopen(fn_clusters, "w");
+              fp_clusters = fopen_output(fn_clusters);
               if (!fp_clusters)
                 fatal("Unable to open clusters file for writing");
             }
@@ -1203,38 +2070,9 @@ void cluster(char * dbname,
 
   progress_done();
 
-  if (!opt_quiet)
-    {
-      fprintf(stderr,
-              "Clusters: %d Size min %ld, max %ld, avg %.1f\n",
-              clusters,
-              abundance_min,
-              abundance_max,
-              1.0 * seqcount / clusters);
-      fprintf(stderr,
-              "Singletons: %d, %.1f%% of seqs, %.1f%% of clusters\n",
-              singletons,
-              100.0 * singletons / seqcount, 
-              100.0 * singletons / clusters);
-    }
+  cluster_summary(seqcount);
 
-  if (opt_log)
-    {
-      fprintf(fp_log,
-              "Clusters: %d Size min %ld, max %ld, avg %.1f\n",
-              clusters,
-              abundance_min,
-              abundance_max,
-              1.0 * seqcount / clusters);
-      fprintf(fp_log,
-              "Singletons: %d, %.1f%% of seqs, %.1f%% of clusters\n",
-              singletons,
-              100.0 * singletons / seqcount, 
-              100.0 * singletons / clusters);
-      fprintf(fp_log, "\n");
-    }
-
-  if (opt_clusterout_sort)
+  if (opt_clusterout_sort)
     {
       /* Optionally sort clusters by abundance */
       progress_init("Sorting clusters by abundance", clusters);
@@ -1244,95 +2082,166 @@ void cluster(char * dbname,
     }
 
   if (opt_msaout || opt_consout || opt_profile)
-    {
-      int msa_target_count = 0;
-      struct msa_target_s * msa_target_list =
-        (struct msa_target_s *) xmalloc(sizeof(struct msa_target_s) * size_max);
-      progress_init("Multiple alignments", seqcount);
+    cluster_msa(size_max);
 
-      FILE * fp_msaout = 0;
-      FILE * fp_consout = 0;
-      FILE * fp_profile = 0;
+  free(cluster_abundance);
+  free(cluster_size);
+}
 
-      if (opt_msaout)
-        if (!(fp_msaout = fopen(opt_msaout, "w")))
-          fatal("Unable to open msaout file");
+void cluster(char * dbname, 
+             char * cmdline,
+             char * progheader)
+{
+  if (opt_centroids)
+    {
+      fp_centroids = fopen_output(opt_centroids);
+      if (!fp_centroids)
+        fatal("Unable to open centroids file for writing");
+    }
 
-      if (opt_consout)
-        if (!(fp_consout = fopen(opt_consout, "w")))
-          fatal("Unable to open consout file");
+  checkpoint_open();
 
-      if (opt_profile)
-        if (!(fp_profile = fopen(opt_profile, "w")))
-          fatal("Unable to open profile file");
+  if (opt_uc)
+    {
+      checkpoint_open_output(& fp_uc, opt_uc);
+      if (!fp_uc)
+        fatal("Unable to open uc file for writing");
+    }
 
-      lastcluster = -1;
+  if (opt_alnout)
+    {
+      checkpoint_open_output(& fp_alnout, opt_alnout);
+      if (! fp_alnout)
+        fatal("Unable to open alignment output file for writing");
 
-      for(int i=0; i<seqcount; i++)
+      if (! opt_resume)
         {
-          int clusterno = clusterinfo[i].clusterno;
-          int seqno = clusterinfo[i].seqno;
-          char * cigar = clusterinfo[i].cigar;
-          int strand = clusterinfo[i].strand;
+          fprintf(fp_alnout, "%s\n", cmdline);
+          fprintf(fp_alnout, "%s\n", progheader);
+        }
+    }
 
-          if (clusterno != lastcluster)
-            {
-              if (lastcluster != -1)
-                {
-                  /* compute msa & consensus */
-                  msa(fp_msaout, fp_consout, fp_profile,
-                      lastcluster,
-                      msa_target_count, msa_target_list,
-                      cluster_abundance[lastcluster]);
-                }
+  if (opt_samout)
+    {
+      checkpoint_open_output(& fp_samout, opt_samout);
+      if (! fp_samout)
+        fatal("Unable to open SAM output file for writing");
+    }
 
-              /* start new cluster */
-              msa_target_count = 0;
-              lastcluster = clusterno;
-            }
+  if (opt_userout)
+    {
+      checkpoint_open_output(& fp_userout, opt_userout);
+      if (! fp_userout)
+        fatal("Unable to open user-defined output file for writing");
+    }
 
-          /* add current sequence to the cluster */
-          msa_target_list[msa_target_count].seqno = seqno;
-          msa_target_list[msa_target_count].cigar = cigar;
-          msa_target_list[msa_target_count].strand = strand;
-          msa_target_count++;
+  if (opt_blast6out)
+    {
+      checkpoint_open_output(& fp_blast6out, opt_blast6out);
+      if (! fp_blast6out)
+        fatal("Unable to open blast6-like output file for writing");
+    }
 
-          progress_update(i);
-        }
+  if (opt_fastapairs)
+    {
+      checkpoint_open_output(& fp_fastapairs, opt_fastapairs);
+      if (! fp_fastapairs)
+        fatal("Unable to open fastapairs output file for writing");
+    }
 
-      if (lastcluster != -1)
-        {
-          /* compute msa & consensus */
-          msa(fp_msaout, fp_consout, fp_profile,
-              lastcluster,
-              msa_target_count, msa_target_list,
-              cluster_abundance[lastcluster]);
-        }
+  if (opt_matched)
+    {
+      checkpoint_open_output(& fp_matched, opt_matched);
+      if (! fp_matched)
+        fatal("Unable to open matched output file for writing");
+    }
 
-      progress_done();
+  if (opt_notmatched)
+    {
+      checkpoint_open_output(& fp_notmatched, opt_notmatched);
+      if (! fp_notmatched)
+        fatal("Unable to open notmatched output file for writing");
+    }
 
-      if (fp_profile)
-        fclose(fp_profile);
+  cluster_streaming = opt_cluster_smallmem &&
+    !(opt_msaout || opt_consout || opt_profile || (opt_samout && opt_samheader));
 
-      if (fp_msaout)
-        fclose(fp_msaout);
+  if (cluster_streaming)
+    {
+      cluster_stream_open(dbname);
+      results_show_samheader(fp_samout, cmdline, dbname);
+    }
+  else
+    {
+      db_read(dbname, 0);
 
-      if (fp_consout)
-        fclose(fp_consout);
+      if (! opt_resume)
+        results_show_samheader(fp_samout, cmdline, dbname);
 
-      free(msa_target_list);
+      if (opt_qmask == MASK_DUST)
+        dust_all();
+      else if ((opt_qmask == MASK_SOFT) && (opt_hardmask))
+        hardmask_all();
+    }
+  
+  show_rusage();
+  
+  if (opt_cluster_fast)
+    db_sortbylength();
+  else if (opt_cluster_size || opt_cluster_linkage)
+    db_sortbyabundance();
+  
+  if (opt_cluster_linkage)
+    cluster_linkage_run();
+  else
+    {
+      cluster_log_index();
+      cluster_run();
     }
 
-  free(cluster_abundance);
-  free(cluster_size);
+  if (cluster_streaming)
+    {
+      cluster_stream_close();
 
-  /* free cigar strings for all aligned sequences */
+      /* the centroids are the database sequences in cluster order */
 
-  for(int i=0; i<seqcount; i++)
-    if (clusterinfo[i].cigar)
-      free(clusterinfo[i].cigar);
+      cluster_abundance = (long *) xmalloc(clusters * sizeof(long));
 
-  free(clusterinfo);
+      progress_init("Writing clusters", clusters);
+
+      for(int z=0; z<clusters; z++)
+        {
+          cluster_abundance[z] = cluster_stream_abundance[z];
+
+          if (opt_centroids)
+            fasta_print_relabel(fp_centroids,
+                                db_getsequence(z),
+                                db_getsequencelen(z),
+                                db_getheader(z),
+                                db_getheaderlen(z),
+                                cluster_abundance[z],
+                                z+1);
+
+          if (opt_uc)
+            fprintf(fp_uc, "C\t%d\t%ld\t*\t*\t*\t*\t*\t%s\t*\n",
+                    z,
+                    cluster_abundance[z],
+                    db_getheader(z));
+
+          progress_update(z);
+        }
+
+      progress_done();
+
+      cluster_summary(cluster_stream_sequences);
+
+      free(cluster_abundance);
+      cluster_stream_abundance.clear();
+    }
+  else
+    cluster_output();
+
+  cluster_streaming = false;
 
   if (opt_matched)
     fclose(fp_matched);
@@ -1353,14 +2262,491 @@ void cluster(char * dbname,
   if (fp_centroids)
     fclose(fp_centroids);
   
-  dbindex_free();
-  db_free();
+  cluster_run_exit();
+  show_rusage();
+}
+
+/*
+  Clustering in shards, with --shards.
+
+  The input is sorted as for clustering, by length or abundance, with
+  an external sort that stays within --memory_budget if specified.
+  The sorted sequences are cut into the given number of consecutive
+  shards of equal size. Each shard is read into memory and clustered
+  on its own, after which only its centroids and their cluster
+  abundances are kept. The centroids of all shards, still in sorted
+  order, are then clustered again in a final pass. A shard centroid
+  that matches an earlier centroid in this pass is merged into its
+  cluster together with all its members.
+
+  With a single shard the result is identical to that of an ordinary
+  run. With more, a sequence is only compared with the centroids of
+  its own shard, so it may form a centroid of its own instead of
+  joining a cluster from an earlier shard. Every member is still
+  within --id of its shard centroid, and every merged shard centroid
+  within --id of the final centroid, so a member is at least about
+  2 * id - 1 identical to the final centroid. Final centroids do not
+  match each other, as in an ordinary run.
+
+  Only --centroids and --uc output is available. In the uc file the
+  target of a hit is the centroid of the shard of the query, which is
+  itself a hit to the final centroid when it has been merged. The
+  cluster numbers are those of the final clusters.
+
+  The memory needed is that of clustering one shard, or all shard
+  centroids, plus that of the sort.
+*/
+
+static void cluster_shards(char * dbname)
+{
+  if (opt_alnout || opt_samout || opt_userout || opt_blast6out ||
+      opt_fastapairs || opt_matched || opt_notmatched || opt_clusters ||
+      opt_msaout || opt_consout || opt_profile)
+    fatal("Only --centroids and --uc output is supported with --shards");
+
+  if (opt_centroids)
+    {
+      fp_centroids = fopen_output(opt_centroids);
+      if (!fp_centroids)
+        fatal("Unable to open centroids file for writing");
+    }
+
+  FILE * fp_uc_final = 0;
+  if (opt_uc)
+    {
+      fp_uc_final = fopen_output(opt_uc);
+      if (!fp_uc_final)
+        fatal("Unable to open uc file for writing");
+    }
+
+  unsigned long budget = ULONG_MAX;
+  if (opt_memory_budget > 0)
+    budget = opt_memory_budget * 1024UL * 1024UL;
+
+  extsort_open(dbname,
+               budget,
+               0,
+               opt_cluster_fast ?
+               sortbylength_compare_entry : sortbysize_compare_entry);
+
+  long sequences = extsort_count();
+  long shard_size = MAX((sequences + opt_shards - 1) / opt_shards, 1);
+
+  cluster_log_index();
+
+  /* the limits on accepts and rejects are adjusted for each run */
+  long maxaccepts = opt_maxaccepts;
+  long maxrejects = opt_maxrejects;
+
+  /* uc lines of the shards, numbered by shard centroid */
+  if (opt_uc)
+    fp_uc = fopen_temp();
+
+  /* the shard centroids, in sorted order, and their cluster abundance */
+  char * centroids_name;
+  FILE * fp_shard_centroids = fopen_temp_named(& centroids_name);
+  std::vector<long> shard_abundance;
+
+  cluster_base = 0;
+
+  for(long first = 0; first < sequences; first += shard_size)
+    {
+      char * shard_name;
+      FILE * fp_shard = fopen_temp_named(& shard_name);
+      for(long i = first; (i < first + shard_size) && (i < sequences); i++)
+        {
+          struct topn_entry_s * e = extsort_next();
+          fasta_print(fp_shard, e->header, e->sequence, e->seqlen);
+        }
+      fclose(fp_shard);
+
+      db_read(shard_name, 0);
+      remove(shard_name);
+      free(shard_name);
+
+      if (opt_qmask == MASK_DUST)
+        dust_all();
+      else if ((opt_qmask == MASK_SOFT) && (opt_hardmask))
+        hardmask_all();
+
+      if (opt_cluster_fast)
+        db_sortbylength();
+      else
+        db_sortbyabundance();
+
+      opt_maxaccepts = maxaccepts;
+      opt_maxrejects = maxrejects;
+      cluster_run();
+
+      /* a centroid comes before the other members of its cluster */
+      for(int seqno = 0; seqno < seqcount; seqno++)
+        {
+          int clusterno = clusterinfo[seqno].clusterno;
+          long abundance = opt_sizein ? db_getabundance(seqno) : 1;
+          if (cluster_base + clusterno == (int) shard_abundance.size())
+            {
+              fasta_print(fp_shard_centroids,
+                          db_getheader(seqno),
+                          db_getsequence(seqno),
+                          db_getsequencelen(seqno));
+              shard_abundance.push_back(abundance);
+            }
+          else
+            shard_abundance[cluster_base + clusterno] += abundance;
+        }
+
+      cluster_base += clusters;
+      cluster_run_exit();
+      show_rusage();
+    }
+
+  extsort_close();
+  fclose(fp_shard_centroids);
+
+  /* cluster the shard centroids, in order; uc lines by final cluster */
+
+  FILE * fp_uc_shards = fp_uc;
+  if (opt_uc)
+    fp_uc = fopen_temp();
+
+  db_read(centroids_name, 0);
+  remove(centroids_name);
+  free(centroids_name);
+
+  cluster_base = 0;
+  opt_maxaccepts = maxaccepts;
+  opt_maxrejects = maxrejects;
+  cluster_run();
+
+  cluster_abundance = (long *) xmalloc(clusters * sizeof(long));
+  memset(cluster_abundance, 0, clusters * sizeof(long));
+  for(int g = 0; g < seqcount; g++)
+    cluster_abundance[clusterinfo[g].clusterno] += shard_abundance[g];
+
+  progress_init("Writing clusters", seqcount);
+  int written = 0;
+  for(int g = 0; g < seqcount; g++)
+    {
+      int clusterno = clusterinfo[g].clusterno;
+      if (clusterno == written)
+        {
+          if (opt_centroids)
+            fasta_print_relabel(fp_centroids,
+                                db_getsequence(g),
+                                db_getsequencelen(g),
+                                db_getheader(g),
+                                db_getheaderlen(g),
+                                cluster_abundance[clusterno],
+                                clusterno+1);
+          written++;
+        }
+      progress_update(g);
+    }
+  progress_done();
+
+  if (opt_uc)
+    {
+      /* the S line of a shard centroid is replaced by its line from the
+         final pass, the other lines get the final cluster number */
+
+      rewind_temp(fp_uc_shards);
+      rewind_temp(fp_uc);
+
+      char * line = 0;
+      size_t line_alloc = 0;
+      char * final_line = 0;
+      size_t final_line_alloc = 0;
+
+      while (cluster_getline(fp_uc_shards, & line, & line_alloc))
+        {
+          if (line[0] == 'S')
+            {
+              if (! cluster_getline(fp_uc, & final_line, & final_line_alloc))
+                fatal("Unable to read from temporary file");
+              fprintf(fp_uc_final, "%s", final_line);
+            }
+          else
+            {
+              char * rest;
+              long g = strtol(line + 2, & rest, 10);
+              fprintf(fp_uc_final, "H\t%d%s", clusterinfo[g].clusterno, rest);
+            }
+        }
+
+      written = 0;
+      for(int g = 0; g < seqcount; g++)
+        {
+          int clusterno = clusterinfo[g].clusterno;
+          if (clusterno == written)
+            {
+              fprintf(fp_uc_final, "C\t%d\t%ld\t*\t*\t*\t*\t*\t%s\t*\n",
+                      clusterno,
+                      cluster_abundance[clusterno],
+                      db_getheader(g));
+              written++;
+            }
+        }
+
+      free(line);
+      free(final_line);
+      fclose(fp_uc_shards);
+      fclose(fp_uc);
+      fclose(fp_uc_final);
+    }
+
+  cluster_summary(sequences);
+
+  free(cluster_abundance);
+
+  if (fp_centroids)
+    fclose(fp_centroids);
+
+  cluster_run_exit();
   show_rusage();
 }
 
+/*
+  Hierarchical clustering, with several thresholds given to --id.
+
+  The sequences are sorted and clustered at the first threshold as
+  usual. The centroids are then clustered at the next threshold, in
+  the same order, and so on, without reading, sorting or indexing the
+  other sequences again. The abundance of a cluster is that of all the
+  sequences in the clusters it contains. The alignments made for a new
+  centroid are kept in the search cache, and are not made again when
+  the same sequences are compared at the next level.
+
+  A --centroids and a --uc file is written for each level, named by
+  adding the level number, starting at 0, to the filename given. As
+  with --shards, the uc file of a level has a line for every sequence:
+  the centroids of the level before are a hit to their centroid at
+  this level or a centroid themselves, and the other sequences are a
+  hit to their centroid of the level before, with the cluster number
+  of this level.
+*/
+
+static FILE * cluster_level_open(char * filename, int level)
+{
+  char * name = (char *) xmalloc(strlen(filename) + 25);
+  sprintf(name, "%s%d", filename, level);
+  FILE * fp = fopen_output(name);
+  free(name);
+  return fp;
+}
+
+static void cluster_levels(char * dbname)
+{
+  if (opt_alnout || opt_samout || opt_userout || opt_blast6out ||
+      opt_fastapairs || opt_matched || opt_notmatched || opt_clusters ||
+      opt_msaout || opt_consout || opt_profile)
+    fatal("Only --centroids and --uc output is supported with several --id thresholds");
+
+  db_read(dbname, 0);
+
+  if (opt_qmask == MASK_DUST)
+    dust_all();
+  else if ((opt_qmask == MASK_SOFT) && (opt_hardmask))
+    hardmask_all();
+
+  show_rusage();
+
+  if (opt_cluster_fast)
+    db_sortbylength();
+  else
+    db_sortbyabundance();
+
+  cluster_log_index();
+
+  /* the limits on accepts and rejects are adjusted for each run */
+  long maxaccepts = opt_maxaccepts;
+  long maxrejects = opt_maxrejects;
+  double weak_id = opt_weak_id;
+
+  int sequences = db_getsequencecount();
+
+  /* the queries of a level, and the abundance of their clusters */
+  cluster_queries = (int *) xmalloc(sequences * sizeof(int));
+  cluster_querycount = sequences;
+  long * abundance = (long *) xmalloc(sequences * sizeof(long));
+  for(int g = 0; g < sequences; g++)
+    {
+      cluster_queries[g] = g;
+      abundance[g] = opt_sizein ? db_getabundance(g) : 1;
+    }
+
+  search_cache_init(sequences);
+
+  /* the S and H lines of all sequences at the level before */
+  FILE * fp_uc_before = 0;
+
+  for(int level = 0; level < opt_id_levelcount; level++)
+    {
+      opt_id = opt_id_levels[level];
+      opt_weak_id = MIN(weak_id, opt_id);
+      opt_maxaccepts = maxaccepts;
+      opt_maxrejects = maxrejects;
+      cluster_caching = level + 1 < opt_id_levelcount;
+
+      cluster_querynucleotides = 0;
+      for(int g = 0; g < cluster_querycount; g++)
+        cluster_querynucleotides += db_getsequencelen(cluster_queries[g]);
+
+      if (!opt_quiet)
+        fprintf(stderr, "Level %d, identity %.3f, %d sequences\n",
+                level, opt_id, cluster_querycount);
+      if (opt_log)
+        fprintf(fp_log, "Level %d, identity %.3f, %d sequences\n\n",
+                level, opt_id, cluster_querycount);
+
+      if (opt_uc)
+        fp_uc = fopen_temp();
+
+      cluster_run();
+
+      /* the centroids in cluster order, and the abundance of clusters */
+      int * centroids = (int *) xmalloc(clusters * sizeof(int));
+      cluster_abundance = (long *) xmalloc(clusters * sizeof(long));
+      memset(cluster_abundance, 0, clusters * sizeof(long));
+      int written = 0;
+      for(int g = 0; g < cluster_querycount; g++)
+        {
+          int clusterno = clusterinfo[cluster_queries[g]].clusterno;
+          if (clusterno == written)
+            centroids[written++] = cluster_queries[g];
+          cluster_abundance[clusterno] += abundance[g];
+        }
+
+      if (opt_centroids)
+        {
+          FILE * fp = cluster_level_open(opt_centroids, level);
+          if (!fp)
+            fatal("Unable to open centroids file for writing");
+          for(int z = 0; z < clusters; z++)
+            fasta_print_relabel(fp,
+                                db_getsequence(centroids[z]),
+                                db_getsequencelen(centroids[z]),
+                                db_getheader(centroids[z]),
+                                db_getheaderlen(centroids[z]),
+                                cluster_abundance[z],
+                                z+1);
+          fclose(fp);
+        }
+
+      if (opt_uc)
+        {
+          FILE * fp_uc_level = cluster_level_open(opt_uc, level);
+          if (!fp_uc_level)
+            fatal("Unable to open uc file for writing");
+
+          /* the lines without the C lines, for the next level */
+          FILE * fp_uc_next = cluster_caching ? fopen_temp() : 0;
+
+          rewind_temp(fp_uc);
+
+          char * line = 0;
+          size_t line_alloc = 0;
+
+          if (level == 0)
+            {
+              while (cluster_getline(fp_uc, & line, & line_alloc))
+                {
+                  fputs(line, fp_uc_level);
+                  if (fp_uc_next)
+                    fputs(line, fp_uc_next);
+                }
+            }
+          else
+            {
+              /* the S line of a centroid of the level before is
+                 replaced by its line from this level, the other lines
+                 get the cluster number of this level */
+
+              rewind_temp(fp_uc_before);
+
+              char * before = 0;
+              size_t before_alloc = 0;
+
+              while (cluster_getline(fp_uc_before, & before, & before_alloc))
+                {
+                  if (before[0] == 'S')
+                    {
+                      if (! cluster_getline(fp_uc, & line, & line_alloc))
+                        fatal("Unable to read from temporary file");
+                      fputs(line, fp_uc_level);
+                      if (fp_uc_next)
+                        fputs(line, fp_uc_next);
+                    }
+                  else
+                    {
+                      char * rest;
+                      long g = strtol(before + 2, & rest, 10);
+                      int seqno = cluster_queries[g];
+                      int clusterno = clusterinfo[seqno].clusterno;
+                      fprintf(fp_uc_level, "H\t%d%s", clusterno, rest);
+                      if (fp_uc_next)
+                        fprintf(fp_uc_next, "H\t%d%s", clusterno, rest);
+                    }
+                }
+
+              free(before);
+              fclose(fp_uc_before);
+            }
+
+          for(int z = 0; z < clusters; z++)
+            fprintf(fp_uc_level, "C\t%d\t%ld\t*\t*\t*\t*\t*\t%s\t*\n",
+                    z,
+                    cluster_abundance[z],
+                    db_getheader(centroids[z]));
+
+          free(line);
+          fclose(fp_uc);
+          fp_uc = 0;
+          fclose(fp_uc_level);
+          fp_uc_before = fp_uc_next;
+        }
+
+      cluster_summary(sequences);
+
+      /* the centroids are the queries of the next level */
+
+      for(int g = 0; g < cluster_querycount; g++)
+        {
+          int seqno = cluster_queries[g];
+          if (clusterinfo[seqno].cigar)
+            free(clusterinfo[seqno].cigar);
+        }
+      free(clusterinfo);
+      clusterinfo = 0;
+      dbindex_free();
+
+      free(cluster_queries);
+      cluster_queries = centroids;
+      cluster_querycount = clusters;
+      free(abundance);
+      abundance = cluster_abundance;
+      cluster_abundance = 0;
+
+      show_rusage();
+    }
+
+  search_cache_exit();
+  cluster_caching = false;
+
+  free(cluster_queries);
+  cluster_queries = 0;
+  free(abundance);
+
+  db_free();
+}
+
 void cluster_fast(char * cmdline, char * progheader)
 {
-  cluster(opt_cluster_fast, cmdline, progheader);
+  if (opt_shards > 0)
+    cluster_shards(opt_cluster_fast);
+  else if (opt_id_levelcount > 1)
+    cluster_levels(opt_cluster_fast);
+  else
+    cluster(opt_cluster_fast, cmdline, progheader);
 }
 
 void cluster_smallmem(char * cmdline, char * progheader)
@@ -1368,7 +2754,17 @@ void cluster_smallmem(char * cmdline, char * progheader)
   cluster(opt_cluster_smallmem, cmdline, progheader);
 }
 
+void cluster_linkage(char * cmdline, char * progheader)
+{
+  cluster(opt_cluster_linkage, cmdline, progheader);
+}
+
 void cluster_size(char * cmdline, char * progheader)
 {
-  cluster(opt_cluster_size, cmdline, progheader);
+  if (opt_shards > 0)
+    cluster_shards(opt_cluster_size);
+  else if (opt_id_levelcount > 1)
+    cluster_levels(opt_cluster_size);
+  else
+    cluster(opt_cluster_size, cmdline, progheader);
 }
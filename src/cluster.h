@@ -61,3 +61,4 @@
 void cluster_smallmem(char * cmdline, char * progheader);
 void cluster_fast(char * cmdline, char * progheader);
 void cluster_size(char * cmdline, char * progheader);
+void cluster_linkage(char * cmdline, char * progheader);
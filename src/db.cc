@@ -69,6 +69,11 @@ static unsigned long nucleotides = 0;
 static unsigned long longest;
 static unsigned long shortest;
 static unsigned long longestheader;
+static int db_fields = DB_HEADER | DB_QUALITY;
+
+static size_t dataalloc = 0;
+static size_t datalen = 0;
+static size_t seqindex_alloc = 0;
 
 seqinfo_t * seqindex;
 char * datap;
@@ -80,153 +85,42 @@ bool db_is_fastq()
 
 char * db_getquality(unsigned long seqno)
 {
-  if (is_fastq)
+  if (is_fastq && (db_fields & DB_QUALITY))
     return datap + seqindex[seqno].qual_p;
   else
     return 0;
 }
 
-void db_read(const char * filename, int upcase)
+void db_setfields(int fields)
 {
-  /* compile regexp for abundance pattern */
-  h = fastx_open(filename);
-
-  if (!h)
-    fatal("Unrecognized file type (not proper FASTA or FASTQ format)");
-
-  is_fastq = fastx_is_fastq(h);
-
-  long filesize = fastx_get_size(h);
-
-int promptLength = 13 + strlen(filename) + 1;  
-
-  char * prompt = (char*) malloc(promptLength * sizeof(char)); 
-  if (sprintf(prompt, "Reading file %s", filename) == -1) {
-    fatal("Out of memory"); 
+  /* select the fields to be kept by db_read, see db_fields_needed */
+  db_fields = fields;
 }
 
-  progress_init(prompt, filesize);
-
-  longest = 0;
-  shortest = LONG_MAX;
-  longestheader = 0;
-  sequences = 0;
-  nucleotides = 0;
-
-  long discarded_short = 0;
-  long discarded_long = 0;
-
-  /* allocate space for data */
-  unsigned long dataalloc = 0;
-  datap = 0;
-  unsigned long datalen = 0;
-
-  /* allocate space for index */
-  size_t seqindex_alloc = 0;
-  seqindex = 0;
-
-  while(fastx_next(h,
-                   ! opt_notrunclabels,
-                   upcase ? chrmap_upcase : chrmap_no_change))
-    {
-      size_t headerlength = fastx_get_header_length(h);
-      size_t sequencelength = fastx_get_sequence_length(h);
-
-      unsigned int abundance = abundance_get(global_abundance,
-                                             fastx_get_header(h));
-      
-      if (sequencelength < (size_t)opt_minseqlength)
-        {
-          discarded_short++;
-        }
-      else if (sequencelength > (size_t)opt_maxseqlength)
-        {
-          discarded_long++;
-        }
-      else
-        {
-          /* grow space for data, if necessary */
-          size_t dataalloc_old = dataalloc;
-          size_t needed = datalen + headerlength + 1 + sequencelength + 1;
-          if (is_fastq)
-            needed += sequencelength + 1;
-          while (dataalloc < needed)
-            dataalloc += MEMCHUNK;
-          if (dataalloc > dataalloc_old)
-            datap = (char *) xrealloc(datap, dataalloc);
-
-          /* store the header */
-          size_t header_p = datalen;
-          memcpy(datap + header_p,
-                 fastx_get_header(h),
-                 headerlength + 1);
-          datalen += headerlength + 1;
-          
-          /* store sequence */
-          size_t sequence_p = datalen;
-          memcpy(datap + sequence_p,
-                 fastx_get_sequence(h),
-                 sequencelength + 1);
-          datalen += sequencelength + 1;
-          
-          size_t quality_p = datalen;
-          if (is_fastq)
-            {
-              /* store quality */
-              memcpy(datap+quality_p,
-                     fastx_get_quality(h),
-                     sequencelength + 1);
-              datalen += sequencelength + 1;
-            }
-
-          /* grow space for index, if necessary */
-          size_t seqindex_alloc_old = seqindex_alloc;
-          while ((sequences + 1) * sizeof(seqinfo_t) > seqindex_alloc)
-            seqindex_alloc += MEMCHUNK;
-          if (seqindex_alloc > seqindex_alloc_old)
-            seqindex = (seqinfo_t *) xrealloc(seqindex, seqindex_alloc);
-          
-          /* update index */
-          seqinfo_t * seqindex_p = seqindex + sequences;
-          seqindex_p->headerlen = headerlength;
-          seqindex_p->seqlen = sequencelength;
-          seqindex_p->header_p = header_p;
-          seqindex_p->seq_p = sequence_p;
-          seqindex_p->qual_p = quality_p;
-          seqindex_p->size = abundance;
-
-          /* update statistics */
-          sequences++;
-          nucleotides += sequencelength;
-          if (sequencelength > longest)
-            longest = sequencelength;
-          if (sequencelength < shortest)
-            shortest = sequencelength;
-          if (headerlength > longestheader)
-            longestheader = headerlength;
-
-        }
-      progress_update(fastx_get_position(h));
-    }
+void db_report(unsigned long nucleotides,
+               unsigned long sequences,
+               unsigned long shortest,
+               unsigned long longest,
+               long discarded_short,
+               long discarded_long)
+{
+  /* show the statistics of a file that has been read */
 
-  progress_done();
-  free(prompt);
-  //fastx_close(h);
   if (!opt_quiet)
     {
       if (sequences > 0)
         fprintf(stderr,
                 "%'lu nt in %'lu seqs, min %'lu, max %'lu, avg %'.0f\n", 
-                db_getnucleotidecount(),
-                db_getsequencecount(),
-                db_getshortestsequence(),
-                db_getlongestsequence(),
-                db_getnucleotidecount() * 1.0 / db_getsequencecount());
+                nucleotides,
+                sequences,
+                shortest,
+                longest,
+                nucleotides * 1.0 / sequences);
       else
         fprintf(stderr,
                 "%'lu nt in %'lu seqs\n", 
-                db_getnucleotidecount(),
-                db_getsequencecount());
+                nucleotides,
+                sequences);
     }
 
   if (opt_log)
@@ -234,16 +128,16 @@ int promptLength = 13 + strlen(filename) + 1;
       if (sequences > 0)
         fprintf(fp_log,
                 "%'lu nt in %'lu seqs, min %'lu, max %'lu, avg %'.0f\n\n", 
-                db_getnucleotidecount(),
-                db_getsequencecount(),
-                db_getshortestsequence(),
-                db_getlongestsequence(),
-                db_getnucleotidecount() * 1.0 / db_getsequencecount());
+                nucleotides,
+                sequences,
+                shortest,
+                longest,
+                nucleotides * 1.0 / sequences);
       else
         fprintf(fp_log,
                 "%'lu nt in %'lu seqs\n\n", 
-                db_getnucleotidecount(),
-                db_getsequencecount());
+                nucleotides,
+                sequences);
     }
 
   /* Warn about discarded sequences */
@@ -271,6 +165,167 @@ int promptLength = 13 + strlen(filename) + 1;
                 "WARNING: %ld sequences longer than %ld nucleotides discarded.\n\n",
                 discarded_long, opt_maxseqlength);
     }
+}
+
+void db_init()
+{
+  /* start with an empty database, see db_add */
+
+  is_fastq = 0;
+  longest = 0;
+  shortest = LONG_MAX;
+  longestheader = 0;
+  sequences = 0;
+  nucleotides = 0;
+
+  dataalloc = 0;
+  datalen = 0;
+  datap = 0;
+
+  seqindex_alloc = 0;
+  seqindex = 0;
+}
+
+unsigned long db_add(char * header,
+                     size_t headerlength,
+                     char * sequence,
+                     size_t sequencelength,
+                     char * quality)
+{
+  /* append a sequence, with its quality if given; returns its number */
+
+  int size_start, size_end;
+  unsigned int abundance = abundance_get_span(header,
+                                              headerlength,
+                                              & size_start,
+                                              & size_end);
+
+  /* the abundance is known, an unused header is stored as empty */
+  if (! (db_fields & DB_HEADER))
+    {
+      headerlength = 0;
+      size_start = 0;
+      size_end = 0;
+    }
+
+  /* grow space for data, if necessary */
+  size_t dataalloc_old = dataalloc;
+  size_t needed = datalen + headerlength + 1 + sequencelength + 1;
+  if (quality)
+    needed += sequencelength + 1;
+  while (dataalloc < needed)
+    dataalloc += MEMCHUNK;
+  if (dataalloc > dataalloc_old)
+    datap = (char *) xrealloc(datap, dataalloc);
+
+  /* store the header */
+  size_t header_p = datalen;
+  memcpy(datap + header_p, header, headerlength);
+  datap[header_p + headerlength] = 0;
+  datalen += headerlength + 1;
+
+  /* store sequence */
+  size_t sequence_p = datalen;
+  memcpy(datap + sequence_p, sequence, sequencelength);
+  datap[sequence_p + sequencelength] = 0;
+  datalen += sequencelength + 1;
+
+  size_t quality_p = datalen;
+  if (quality)
+    {
+      /* store quality */
+      memcpy(datap + quality_p, quality, sequencelength + 1);
+      datalen += sequencelength + 1;
+    }
+
+  /* grow space for index, if necessary */
+  size_t seqindex_alloc_old = seqindex_alloc;
+  while ((sequences + 1) * sizeof(seqinfo_t) > seqindex_alloc)
+    seqindex_alloc += MEMCHUNK;
+  if (seqindex_alloc > seqindex_alloc_old)
+    seqindex = (seqinfo_t *) xrealloc(seqindex, seqindex_alloc);
+
+  /* update index */
+  seqinfo_t * seqindex_p = seqindex + sequences;
+  seqindex_p->headerlen = headerlength;
+  seqindex_p->seqlen = sequencelength;
+  seqindex_p->header_p = header_p;
+  seqindex_p->seq_p = sequence_p;
+  seqindex_p->qual_p = quality_p;
+  seqindex_p->size = abundance;
+  seqindex_p->size_start = size_start;
+  seqindex_p->size_end = size_end;
+
+  /* update statistics */
+  nucleotides += sequencelength;
+  if (sequencelength > longest)
+    longest = sequencelength;
+  if (sequencelength < shortest)
+    shortest = sequencelength;
+  if (headerlength > longestheader)
+    longestheader = headerlength;
+
+  return sequences++;
+}
+
+void db_read(const char * filename, int upcase)
+{
+  /* compile regexp for abundance pattern */
+  h = fastx_open(filename);
+
+  if (!h)
+    fatal("Unrecognized file type (not proper FASTA or FASTQ format)");
+
+  long filesize = fastx_get_size(h);
+
+int promptLength = 13 + strlen(filename) + 1;  
+
+  char * prompt = (char*) malloc(promptLength * sizeof(char)); 
+  if (sprintf(prompt, "Reading file %s", filename) == -1) {
+    fatal("Out of memory"); 
+}
+
+  progress_init(prompt, filesize);
+
+  db_init();
+  is_fastq = fastx_is_fastq(h);
+
+  long discarded_short = 0;
+  long discarded_long = 0;
+
+  while(fastx_next(h,
+                   ! opt_notrunclabels,
+                   upcase ? chrmap_upcase : chrmap_no_change))
+    {
+      size_t sequencelength = fastx_get_sequence_length(h);
+
+      if (sequencelength < (size_t)opt_minseqlength)
+        {
+          discarded_short++;
+        }
+      else if (sequencelength > (size_t)opt_maxseqlength)
+        {
+          discarded_long++;
+        }
+      else
+        {
+          bool keep_quality = is_fastq && (db_fields & DB_QUALITY);
+          db_add(fastx_get_header(h),
+                 fastx_get_header_length(h),
+                 fastx_get_sequence(h),
+                 sequencelength,
+                 keep_quality ? fastx_get_quality(h) : 0);
+        }
+      progress_update(fastx_get_position(h));
+    }
+
+  progress_done();
+  free(prompt);
+  //fastx_close(h);
+
+  db_report(nucleotides, sequences, shortest, longest,
+            discarded_short, discarded_long);
+
   show_rusage();
 }
 
@@ -405,24 +460,48 @@ inline int compare_byabundance(const void * a, const void * b)
     }
 }
 
+/* numeric part of the orderings above, as keys for radix_sort */
+
+static unsigned long key_bylength(const void * a)
+{
+  seqinfo_t * x = (seqinfo_t *) a;
+  return ((unsigned long) (UINT_MAX - x->seqlen) << 32) |
+    (UINT_MAX - x->size);
+}
+
+static unsigned long key_bylength_shortest_first(const void * a)
+{
+  seqinfo_t * x = (seqinfo_t *) a;
+  return ((unsigned long) x->seqlen << 32) | (UINT_MAX - x->size);
+}
+
+static unsigned long key_byabundance(const void * a)
+{
+  seqinfo_t * x = (seqinfo_t *) a;
+  return UINT_MAX - x->size;
+}
+
 void db_sortbylength()
 {
   progress_init("Sorting by length", 100);
-  qsort(seqindex, sequences, sizeof(seqinfo_t), compare_bylength);
+  radix_sort(seqindex, sequences, sizeof(seqinfo_t),
+             key_bylength, compare_bylength);
   progress_done();
 }
 
 void db_sortbylength_shortest_first()
 {
   progress_init("Sorting by length", 100);
-  qsort(seqindex, sequences, sizeof(seqinfo_t), compare_bylength_shortest_first);
+  radix_sort(seqindex, sequences, sizeof(seqinfo_t),
+             key_bylength_shortest_first, compare_bylength_shortest_first);
   progress_done();
 }
 
 void db_sortbyabundance()
 {
   progress_init("Sorting by abundance", 100);
-  qsort(seqindex, sequences, sizeof(seqinfo_t), compare_byabundance);
+  radix_sort(seqindex, sequences, sizeof(seqinfo_t),
+             key_byabundance, compare_byabundance);
   progress_done();
 }
 
@@ -66,6 +66,8 @@ struct seqinfo_s
   unsigned int headerlen;
   unsigned int seqlen;
   unsigned int size;
+  int size_start;               /* span of abundance annotation in header */
+  int size_end;                 /* end is zero if there is none */
 };
 
 typedef struct seqinfo_s seqinfo_t;
@@ -98,7 +100,49 @@ inline unsigned long db_getheaderlen(unsigned long seqno)
   return seqindex[seqno].headerlen;
 }
 
+inline void db_fprint_header_with_size(FILE * fp,
+                                       unsigned long seqno,
+                                       unsigned long size)
+{
+  abundance_fprint_span_with_size(fp,
+                                  db_getheader(seqno),
+                                  seqindex[seqno].headerlen,
+                                  seqindex[seqno].size_start,
+                                  seqindex[seqno].size_end,
+                                  size);
+}
+
+inline void db_fprint_header_strip_size(FILE * fp, unsigned long seqno)
+{
+  abundance_fprint_span_strip_size(fp,
+                                   db_getheader(seqno),
+                                   seqindex[seqno].headerlen,
+                                   seqindex[seqno].size_start,
+                                   seqindex[seqno].size_end);
+}
+
+/* fields to be stored by db_read, besides sequence and abundance */
+
+#define DB_HEADER 1
+#define DB_QUALITY 2
+
+void db_setfields(int fields);
+
 void db_read(const char * filename, int upcase);
+
+void db_init();
+unsigned long db_add(char * header,
+                     size_t headerlength,
+                     char * sequence,
+                     size_t sequencelength,
+                     char * quality);
+
+void db_report(unsigned long nucleotides,
+               unsigned long sequences,
+               unsigned long shortest,
+               unsigned long longest,
+               long discarded_short,
+               long discarded_long);
 void db_free();
 
 unsigned long db_getsequencecount();
@@ -119,8 +119,16 @@ long dbhash_search_first(char * seq,
                         unsigned long seqlen,
                         struct dbhash_search_info_s * info)
 {
-  
-  unsigned long hash = hash_cityhash64(seq, seqlen);
+  return dbhash_search_first_hash(seq, seqlen, hash_seq(seq, seqlen), info);
+}
+
+long dbhash_search_first_hash(char * seq,
+                              unsigned long seqlen,
+                              unsigned long hash,
+                              struct dbhash_search_info_s * info)
+{
+  /* as dbhash_search_first, with the hash computed by the caller */
+
   info->hash = hash;
   info->seq = seq;
   info->seqlen = seqlen;
@@ -171,11 +179,35 @@ long dbhash_search_next(struct dbhash_search_info_s * info)
     return -1;
 }
 
+bool dbhash_probe(unsigned long hash)
+{
+  /* is there an entry with this hash, identical sequence or not */
+
+  unsigned long index = hash & dbhash_mask;
+
+  while (bitmap_get(dbhash_bitmap, index))
+    {
+      if (dbhash_table[index].hash == hash)
+        return true;
+      index = (index + 1) & dbhash_mask;
+    }
+
+  return false;
+}
+
 void dbhash_add(char * seq, unsigned long seqlen, unsigned long seqno)
+{
+  dbhash_add_hash(seq, seqlen, hash_seq(seq, seqlen), seqno);
+}
+
+void dbhash_add_hash(char * seq,
+                     unsigned long seqlen,
+                     unsigned long hash,
+                     unsigned long seqno)
 {
   struct dbhash_search_info_s info;
   
-  long ret = dbhash_search_first(seq, seqlen, & info);
+  long ret = dbhash_search_first_hash(seq, seqlen, hash, & info);
   while (ret >= 0)
     ret = dbhash_search_next(&info);
   
@@ -189,23 +221,18 @@ void dbhash_add_one(unsigned long seqno)
 {
   char * seq = db_getsequence(seqno);
   unsigned long seqlen = db_getsequencelen(seqno);
-  char * normalized = (char*) xmalloc(seqlen+1);
-  string_normalize(normalized, seq, seqlen);
-  dbhash_add(normalized, seqlen, seqno);
+  dbhash_add(seq, seqlen, seqno);
 }
 
 void dbhash_add_all()
 {
   progress_init("Hashing database sequences", db_getsequencecount());
-  char * normalized = (char*) xmalloc(db_getlongestsequence()+1);
   for(unsigned long seqno=0; seqno < db_getsequencecount(); seqno++)
     {
       char * seq = db_getsequence(seqno);
       unsigned long seqlen = db_getsequencelen(seqno);
-      string_normalize(normalized, seq, seqlen);
-      dbhash_add(normalized, seqlen, seqno);
+      dbhash_add(seq, seqlen, seqno);
       progress_update(seqno+1);
     }
-  free(normalized);
   progress_done();
 }
@@ -76,11 +76,20 @@ void dbhash_open(unsigned long maxelements);
 void dbhash_close();
 
 void dbhash_add(char * seq, unsigned long seqlen, unsigned long seqno);
+void dbhash_add_hash(char * seq,
+                     unsigned long seqlen,
+                     unsigned long hash,
+                     unsigned long seqno);
 void dbhash_add_one(unsigned long seqno);
 void dbhash_add_all();
 
 long dbhash_search_first(char * seq,
                          unsigned long seqlen,
                          struct dbhash_search_info_s * info);
+long dbhash_search_first_hash(char * seq,
+                              unsigned long seqlen,
+                              unsigned long hash,
+                              struct dbhash_search_info_s * info);
 long dbhash_search_next(struct dbhash_search_info_s * info);
+bool dbhash_probe(unsigned long hash);
 void dbhash_search_finish(struct dbhash_search_info_s * info);
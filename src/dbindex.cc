@@ -70,12 +70,56 @@ static unsigned int kmerhashsize;
 static unsigned long kmerindexsize;
 unsigned int dbindex_count;
 
+/*
+  An index prepared with dbindex_prepare_empty grows with the sequences
+  added. The list of each kmer has room for kmeralloc[kmer] entries in
+  kmerindex. A full list is moved to the end of kmerindex with twice
+  the room, so the lists stay contiguous for dbindex_getmatchlist. The
+  space left behind is reclaimed by packing all lists again once it
+  exceeds the space in use.
+
+  With bitmaps, the list of a kmer found in at least one in
+  BITMAP_THRESHOLD of the sequences, and in at least BITMAP_MINCOUNT,
+  is replaced by a bitmap. All bitmaps have room for bitmap_capacity
+  sequences, which is doubled when the index is full.
+*/
+
+static unsigned int * kmeralloc;
+static unsigned long kmerindex_alloc;
+static unsigned long kmerindex_live;
+static unsigned int dbindex_map_alloc;
+static int growable_bitmap;
+static unsigned int bitmap_capacity;
+
 static uhandle_s * dbindex_uh;
 
 #define BITMAP_THRESHOLD 8
+#define BITMAP_MINCOUNT 32
+#define BITMAP_MINCAPACITY 1024
 
 static unsigned int bitmap_mincount;
 
+/*
+  The index also keeps a table of the hashes of the indexed sequences,
+  so that a sequence identical to a query can be found without a k-mer
+  search. It uses open addressing with linear probing and is doubled
+  when two thirds full. Each entry holds the seqno plus one, with zero
+  marking an empty entry.
+*/
+
+struct dbindex_exact_s
+{
+  unsigned long hash;
+  unsigned long seqno;
+};
+
+static struct dbindex_exact_s * exact_table;
+static unsigned long exact_size;
+static unsigned long exact_mask;
+static int dbindex_seqmask;
+
+#define EXACT_MINSIZE 1024
+
 void fprint_kmer(FILE * f, unsigned int kk, unsigned long kmer)
 {
   unsigned long x = kmer;
@@ -83,25 +127,199 @@ void fprint_kmer(FILE * f, unsigned int kk, unsigned long kmer)
     fprintf(f, "%c", sym_nt_2bit[(x >> (2*(kk-i-1))) & 3]);
 }
 
+static void dbindex_pack(unsigned long alloc)
+{
+  /* copy all lists of a growable index into a new kmerindex */
+
+  unsigned int * packed =
+    (unsigned int *) xmalloc(alloc * sizeof(unsigned int));
+  unsigned long sum = 0;
+  for(unsigned int kmer = 0; kmer < kmerhashsize; kmer++)
+    if (kmeralloc[kmer])
+      {
+        memcpy(packed + sum,
+               kmerindex + kmerhash[kmer],
+               kmercount[kmer] * sizeof(unsigned int));
+        kmerhash[kmer] = sum;
+        sum += kmeralloc[kmer];
+      }
+  free(kmerindex);
+  kmerindex = packed;
+  kmerindex_alloc = alloc;
+  kmerindexsize = sum;
+}
+
+static void dbindex_grow(unsigned int kmer)
+{
+  /* move the full list of the kmer to the end with more room */
+
+  unsigned int room = MAX(2 * kmeralloc[kmer], 4);
+
+  if (kmerindexsize + room > kmerindex_alloc)
+    {
+      if (kmerindexsize - kmerindex_live > kmerindex_live)
+        dbindex_pack(MAX(2 * kmerindex_live, kmerindex_live + room));
+      if (kmerindexsize + room > kmerindex_alloc)
+        {
+          kmerindex_alloc = MAX(2 * kmerindex_alloc, kmerindexsize + room);
+          kmerindex = (unsigned int *)
+            xrealloc(kmerindex, kmerindex_alloc * sizeof(unsigned int));
+        }
+    }
+
+  memcpy(kmerindex + kmerindexsize,
+         kmerindex + kmerhash[kmer],
+         kmercount[kmer] * sizeof(unsigned int));
+  kmerhash[kmer] = kmerindexsize;
+  kmerindexsize += room;
+  kmerindex_live += room - kmeralloc[kmer];
+  kmeralloc[kmer] = room;
+}
+
+static void dbindex_bitmap_promote(unsigned int kmer)
+{
+  /* replace the list of the kmer with a bitmap */
+
+  if (! bitmap_capacity)
+    {
+      bitmap_capacity = BITMAP_MINCAPACITY;
+      while (bitmap_capacity <= dbindex_count)
+        bitmap_capacity *= 2;
+    }
+
+  bitmap_t * b = bitmap_init(bitmap_capacity + 127); // pad for xmm
+  bitmap_reset_all(b);
+
+  unsigned int * list = kmerindex + kmerhash[kmer];
+  for(unsigned int j = 0; j < kmercount[kmer]; j++)
+    bitmap_set(b, list[j]);
+
+  kmerbitmap[kmer] = b;
+  kmerindex_live -= kmeralloc[kmer];
+  kmeralloc[kmer] = 0;
+  kmercount[kmer] = 0;
+}
+
+static void dbindex_bitmap_grow()
+{
+  /* double the room in all bitmaps */
+
+  bitmap_capacity *= 2;
+
+  for(unsigned int kmer = 0; kmer < kmerhashsize; kmer++)
+    if (kmerbitmap[kmer])
+      {
+        bitmap_t * b = kmerbitmap[kmer];
+        unsigned int oldbytes = (b->size + 7) / 8;
+        b->size = bitmap_capacity + 127;
+        unsigned int newbytes = (b->size + 7) / 8;
+        b->bitmap = (unsigned char *) xrealloc(b->bitmap, newbytes);
+        memset(b->bitmap + oldbytes, 0, newbytes - oldbytes);
+      }
+}
+
+static void dbindex_exact_alloc(unsigned long size)
+{
+  exact_size = size;
+  exact_mask = size - 1;
+  exact_table = (struct dbindex_exact_s *)
+    xmalloc(size * sizeof(struct dbindex_exact_s));
+  memset(exact_table, 0, size * sizeof(struct dbindex_exact_s));
+}
+
+static void dbindex_exact_insert(unsigned long hash, unsigned long seqno)
+{
+  unsigned long i = hash & exact_mask;
+  while (exact_table[i].seqno)
+    i = (i + 1) & exact_mask;
+  exact_table[i].hash = hash;
+  exact_table[i].seqno = seqno + 1;
+}
+
+static void dbindex_exact_add(unsigned int seqno)
+{
+  if (3 * (dbindex_count + 1) > 2 * exact_size)
+    {
+      /* double the table and insert the old entries again */
+      struct dbindex_exact_s * old_table = exact_table;
+      unsigned long old_size = exact_size;
+      dbindex_exact_alloc(2 * exact_size);
+      for(unsigned long i = 0; i < old_size; i++)
+        if (old_table[i].seqno)
+          dbindex_exact_insert(old_table[i].hash, old_table[i].seqno - 1);
+      free(old_table);
+    }
+
+  dbindex_exact_insert(hash_seq(db_getsequence(seqno),
+                                db_getsequencelen(seqno)),
+                       seqno);
+}
+
+long dbindex_getexact(char * seq, unsigned long seqlen, int seqmask)
+{
+  /* return the lowest seqno of the indexed sequences identical to seq,
+     or -1 if there is none or the index was made with another mask */
+
+  if (seqmask != dbindex_seqmask)
+    return -1;
+
+  unsigned long hash = hash_seq(seq, seqlen);
+  long best = -1;
+
+  for(unsigned long i = hash & exact_mask;
+      exact_table[i].seqno;
+      i = (i + 1) & exact_mask)
+    {
+      long seqno = exact_table[i].seqno - 1;
+      if ((exact_table[i].hash == hash) &&
+          ((best < 0) || (seqno < best)) &&
+          (db_getsequencelen(seqno) == seqlen) &&
+          (! memcmp(db_getsequence(seqno), seq, seqlen)))
+        best = seqno;
+    }
+
+  return best;
+}
+
 void dbindex_addsequence(unsigned int seqno, int seqmask)
 {
 #if 0
   printf("Adding seqno %d as index element no %d\n", seqno, dbindex_count);
 #endif
 
+  if (kmeralloc && (dbindex_count == dbindex_map_alloc))
+    {
+      dbindex_map_alloc = MAX(2 * dbindex_map_alloc, 1024);
+      dbindex_map = (unsigned int *)
+        xrealloc(dbindex_map, dbindex_map_alloc * sizeof(unsigned int));
+    }
+
+  if (bitmap_capacity && (dbindex_count == bitmap_capacity))
+    dbindex_bitmap_grow();
+
   unsigned int uniquecount;
   unsigned int * uniquelist;
   unique_count(dbindex_uh, opt_wordlength,
                db_getsequencelen(seqno), db_getsequence(seqno),
                & uniquecount, & uniquelist, seqmask);
   dbindex_map[dbindex_count] = seqno;
+  dbindex_seqmask = seqmask;
+  dbindex_exact_add(seqno);
   for(unsigned int i=0; i<uniquecount; i++)
     {
       unsigned int kmer = uniquelist[i];
       if (kmerbitmap[kmer])
         bitmap_set(kmerbitmap[kmer], dbindex_count);
       else
-        kmerindex[kmerhash[kmer]+(kmercount[kmer]++)] = dbindex_count;
+        {
+          if (kmeralloc && (kmercount[kmer] == kmeralloc[kmer]))
+            dbindex_grow(kmer);
+          kmerindex[kmerhash[kmer]+(kmercount[kmer]++)] = dbindex_count;
+          if (growable_bitmap &&
+              (kmercount[kmer] >= BITMAP_MINCOUNT) &&
+              (kmercount[kmer] >= (dbindex_count + 1) / BITMAP_THRESHOLD))
+            dbindex_bitmap_promote(kmer);
+        }
     }
   dbindex_count++;
 }
@@ -196,18 +414,70 @@ void dbindex_prepare(int use_bitmap, int seqmask)
 
   /* allocate space for mapping from indexno to seqno */
   dbindex_map = (unsigned int *) xmalloc(seqcount * sizeof(unsigned int));
+
+  /* allocate the table of sequence hashes for 2/3 fill rate */
+  unsigned long size = EXACT_MINSIZE;
+  while (3 * seqcount > 2 * size)
+    size *= 2;
+  dbindex_exact_alloc(size);
   
   dbindex_count = 0;
   
   show_rusage();
 }
 
+void dbindex_prepare_empty(int use_bitmap)
+{
+  /* an index that grows as sequences are added */
+
+  dbindex_uh = unique_init();
+
+  kmerhashsize = 1 << (2 * opt_wordlength);
+
+  kmercount = (unsigned int *) xmalloc(kmerhashsize * sizeof(unsigned int));
+  memset(kmercount, 0, kmerhashsize * sizeof(unsigned int));
+
+  kmeralloc = (unsigned int *) xmalloc(kmerhashsize * sizeof(unsigned int));
+  memset(kmeralloc, 0, kmerhashsize * sizeof(unsigned int));
+
+  kmerbitmap = (bitmap_t **) xmalloc(kmerhashsize * sizeof(bitmap_t *));
+  memset(kmerbitmap, 0, kmerhashsize * sizeof(bitmap_t *));
+
+  kmerhash = (unsigned long *) xmalloc((kmerhashsize+1) * sizeof(unsigned long));
+  memset(kmerhash, 0, (kmerhashsize+1) * sizeof(unsigned long));
+
+  kmerindex = 0;
+  kmerindexsize = 0;
+  kmerindex_alloc = 0;
+  kmerindex_live = 0;
+
+  dbindex_map = 0;
+  dbindex_map_alloc = 0;
+
+  growable_bitmap = use_bitmap;
+  bitmap_capacity = 0;
+
+  dbindex_exact_alloc(EXACT_MINSIZE);
+
+  dbindex_count = 0;
+}
+
 void dbindex_free()
 {
   free(kmerhash);
   free(kmerindex);
   free(kmercount);
   free(dbindex_map);
+  free(exact_table);
+  exact_table = 0;
+
+  if (kmeralloc)
+    {
+      free(kmeralloc);
+      kmeralloc = 0;
+      growable_bitmap = 0;
+      bitmap_capacity = 0;
+    }
 
   for(unsigned int kmer=0; kmer<kmerhashsize; kmer++)
     if (kmerbitmap[kmer])
@@ -59,10 +59,11 @@
 */
 
 #include "vsearch.h"
+#include <map>
+#include <string>
 
 //#define BITMAP
 
-#define HASH hash_cityhash64
 
 struct bucket
 {
@@ -142,79 +143,281 @@ int seqcmp(char * a, char * b, int n)
   return chrmap_4bit[(int)(*p)] - chrmap_4bit[(int)(*q)];
 }
 
-void derep_fulllength()
+/*
+  Streaming dereplication.
+
+  The input is read with fastx_next in batches of DEREP_BATCH records
+  and only the first occurrence of each unique sequence is stored,
+  together with its accumulated abundance. The headers of the other
+  occurrences are only kept when they are needed for the uc file. The
+  duplicates are thus never held in memory.
+
+  The records of a batch are first hashed in parallel, each thread
+  taking a contiguous range. With --strand both the smaller of the
+  hashes of the sequence and of its reverse complement is used, so
+  that both strands of a sequence end up in the same place. Both are
+  computed in a single pass by hash_seq_strands, without normalizing
+  or reverse complementing the sequence first.
+
+  The hash table is partitioned by the highest bits of the hash. Each
+  partition gets the list of its records of the batch in input order
+  and has its own linear probing table, unique sequences and memory,
+  so the partitions are updated in parallel without any locking. As
+  the records of a partition are inserted in input order, the first
+  occurrence of each unique sequence becomes its representative,
+  independent of the number of threads. At the end the unique
+  sequences of all partitions are collected for sorting.
+
+  With --memory_budget the input is instead first split into a number
+  of temporary spill files by the hash bits just below those selecting
+  the partition, so that all copies of a sequence end up in the same
+  file. The number of files is the smallest power of two expected to
+  bring the memory needed for each of them within the budget,
+  estimated from the input file size. Each spill file is then
+  dereplicated on its own as above, and its unique sequences are
+  sorted and written to a temporary run file. The runs are finally
+  merged for output.
+
+  With --derep_samples a number of files are dereplicated together,
+  each belonging to a named sample, and with --countout the abundance
+  of each unique sequence in each sample is accumulated along the way
+  for a sparse count table. The files are read in the order of the
+  first appearance of their sample, so that the counts of each unique
+  sequence are kept in a list ordered by sample.
+*/
+
+#define DEREP_PARTITION_BITS 8
+#define DEREP_PARTITIONS (1 << DEREP_PARTITION_BITS)
+#define DEREP_BATCH 65536
+#define DEREP_CHUNK (4 * 1024 * 1024)
+#define DEREP_SPILL_BITS_MAX 8
+
+struct derep_member_s
 {
-  FILE * fp_output = 0;
-  FILE * fp_uc = 0;
+  char * header;
+  struct derep_member_s * next;
+};
 
-  if (opt_output)
-    {
-      fp_output = fopen(opt_output, "w");
-      if (!fp_output)
-        fatal("Unable to open output file for writing");
-    }
+struct derep_count_s
+{
+  unsigned int sample;
+  unsigned int count;
+  struct derep_count_s * next;
+};
 
-  if (opt_uc)
+struct derep_unique_s
+{
+  unsigned long hash;
+  unsigned long ordinal;        /* input order of first occurrence */
+  char * header;
+  char * seq;
+  unsigned int headerlen;
+  unsigned int seqlen;
+  unsigned int size;
+  struct derep_member_s * members; /* other occurrences, for uc */
+  struct derep_member_s * members_last;
+  struct derep_count_s * counts; /* per sample, for countout */
+  struct derep_count_s * counts_last;
+};
+
+struct derep_record_s
+{
+  char * header;
+  char * seq;
+  size_t header_p;              /* offsets in batch data while reading */
+  size_t seq_p;
+  unsigned int headerlen;
+  unsigned int seqlen;
+  unsigned int abundance;
+  unsigned int sample;
+  unsigned long hash;
+  unsigned long ordinal;
+};
+
+struct derep_partition_s
+{
+  unsigned int * records;       /* records of this batch, input order */
+  long count;
+  unsigned int * table;         /* unique number plus one, 0 if empty */
+  unsigned long mask;           /* table size minus one */
+  struct derep_unique_s * uniques;
+  long unique_count;
+  long unique_alloc;
+  char * chunk;                 /* memory for headers and sequences */
+  size_t chunk_used;
+  size_t chunk_size;
+};
+
+struct derep_spill_s            /* record header in spill files */
+{
+  unsigned long hash;
+  unsigned long ordinal;
+  unsigned int abundance;
+  unsigned int headerlen;
+  unsigned int seqlen;
+  unsigned int sample;
+};
+
+struct derep_entry_s            /* unique sequence header in run files */
+{
+  unsigned long ordinal;
+  unsigned int size;
+  unsigned int headerlen;
+  unsigned int seqlen;
+  unsigned int member_count;
+  unsigned int count_count;
+  size_t member_bytes;
+};
+
+struct derep_run_s
+{
+  FILE * fp;
+  long count;                   /* unique sequences in the run */
+  long next;                    /* number of the next one to read */
+  struct derep_unique_s u;      /* current unique sequence */
+  char * data;                  /* its header, sequence and members */
+  size_t data_alloc;
+  struct derep_member_s * members;
+  unsigned int members_alloc;
+  struct derep_count_s * counts;
+  unsigned int counts_alloc;
+};
+
+static struct derep_partition_s * derep_partitions;
+static long derep_threads;
+
+static struct derep_record_s * derep_batch;
+static long derep_batch_count;
+static unsigned int derep_batch_longest;
+static unsigned int * derep_batch_order;
+
+static struct derep_unique_s ** derep_sorted; /* all uniques, in memory */
+static long derep_sorted_count;
+static struct derep_run_s * derep_runs;       /* or sorted runs on disk */
+static long derep_run_count;
+static struct derep_run_s ** derep_heap;
+static long derep_heap_count;
+static long derep_position;
+
+#define DEREP_DIGEST_BATCH 4096
+
+static char * derep_digest_hex;       /* digests of a batch of uniques */
+static char ** derep_digest_ptrs;
+static char ** derep_digest_seqs;
+static unsigned int * derep_digest_lens;
+static long derep_digest_first;
+static long derep_digest_count;       /* uniques in the batch */
+static long derep_digest_todo;        /* of which selected for output */
+static int derep_digest_type;
+static int derep_digest_width;
+
+static char ** derep_sample_names;
+static char * derep_prompt;
+
+static char * derep_alloc(struct derep_partition_s * part, size_t size)
+{
+  /* allocate memory from the chunks of the partition, 8-byte aligned */
+
+  size = (size + 7) & ~ (size_t) 7;
+
+  if (part->chunk_used + size > part->chunk_size)
     {
-      fp_uc = fopen(opt_uc, "w");
-      if (!fp_uc)
-        fatal("Unable to open output (uc) file for writing");
+      /* new chunk, linked to the previous one for freeing */
+      size_t chunk_size = MAX(DEREP_CHUNK, size + sizeof(char *));
+      char * chunk = (char *) xmalloc(chunk_size);
+      *(char **) chunk = part->chunk;
+      part->chunk = chunk;
+      part->chunk_size = chunk_size;
+      part->chunk_used = sizeof(char *);
     }
 
-  db_read(opt_derep_fulllength, 0);
+  char * p = part->chunk + part->chunk_used;
+  part->chunk_used += size;
+  return p;
+}
 
-  show_rusage();
+static char * derep_copy(struct derep_partition_s * part,
+                         char * s,
+                         unsigned int len)
+{
+  char * p = derep_alloc(part, len + 1);
+  memcpy(p, s, len);
+  p[len] = 0;
+  return p;
+}
 
-  long dbsequencecount = db_getsequencecount();
-  
-  /* adjust size of hash table for 2/3 fill rate */
+static void derep_hash_range(long t)
+{
+  /* hash the records of the batch in the range of thread t */
+
+  long first = derep_batch_count * t / derep_threads;
+  long last = derep_batch_count * (t + 1) / derep_threads;
 
-  long hashtablesize = 1;
-  int hash_shift = 0;
-  while (3 * dbsequencecount > 2 * hashtablesize)
+  for(long i = first; i < last; i++)
     {
-      hashtablesize <<= 1;
-      hash_shift++;
-    }
-  int hash_mask = hashtablesize - 1;
+      struct derep_record_s * r = derep_batch + i;
 
-  struct bucket * hashtable =
-    (struct bucket *) xmalloc(sizeof(bucket) * hashtablesize);
+      if (opt_strand > 1)
+        {
+          /* both strands in one pass, the smaller hash is used */
+          unsigned long plus, minus;
+          hash_seq_strands(r->seq, r->seqlen, & plus, & minus);
+          r->hash = MIN(plus, minus);
+        }
+      else
+        r->hash = hash_seq(r->seq, r->seqlen);
+    }
+}
 
-  memset(hashtable, 0, sizeof(bucket) * hashtablesize);
+static void derep_rehash(struct derep_partition_s * part, long needed)
+{
+  /*
+    grow the hash table of the partition for 2/3 fill rate, and the
+    unique sequences along with it
+  */
 
-#ifdef BITMAP
-  hash_occupied =
-    (unsigned char *) xmalloc(hashtablesize / 8);
-  memset(hash_occupied, 0, hashtablesize / 8);
-#endif
+  unsigned long tablesize = part->mask + 1;
+  if (3 * needed <= 2 * (long) tablesize)
+    return;
 
-  long clusters = 0;
-  long sumsize = 0;
-  unsigned long maxsize = 0;
-  double median = 0.0;
-  double average = 0.0;
+  while (3 * needed > 2 * (long) tablesize)
+    tablesize <<= 1;
 
-  /* alloc and init table of links to other sequences in cluster */
+  if (part->table)
+    free(part->table);
+  part->mask = tablesize - 1;
+  part->table = (unsigned int *) xmalloc(sizeof(unsigned int) * tablesize);
+  memset(part->table, 0, sizeof(unsigned int) * tablesize);
 
-  unsigned int * nextseqtab = (unsigned int*) xmalloc(sizeof(unsigned int) * dbsequencecount);
-  memset(nextseqtab, 0, sizeof(unsigned int) * dbsequencecount);
+  for(long u = 0; u < part->unique_count; u++)
+    {
+      unsigned long j = part->uniques[u].hash & part->mask;
+      while (part->table[j])
+        j = (j + 1) & part->mask;
+      part->table[j] = u + 1;
+    }
 
-  char * seq_up = (char*) xmalloc(db_getlongestsequence() + 1);
-  char * rc_seq_up = (char*) xmalloc(db_getlongestsequence() + 1);
-  
-  progress_init("Dereplicating", dbsequencecount);
-  for(long i=0; i<dbsequencecount; i++)
+  if (part->unique_alloc < (long) tablesize)
     {
-      unsigned int seqlen = db_getsequencelen(i);
-      char * seq = db_getsequence(i);
+      part->unique_alloc = tablesize;
+      part->uniques = (struct derep_unique_s *)
+        xrealloc(part->uniques,
+                 sizeof(struct derep_unique_s) * part->unique_alloc);
+    }
+}
 
-      /* normalize sequence: uppercase and replace U by T  */
-      string_normalize(seq_up, seq, seqlen);
+static void derep_fill_partition(struct derep_partition_s * part,
+                                 char * rc_seq)
+{
+  /* insert the records of the batch into the partition */
 
-      /* reverse complement if necessary */
-      if (opt_strand > 1)
-        reverse_complement(rc_seq_up, seq_up, seqlen);
+  derep_rehash(part, part->unique_count + part->count);
+
+  for(long k = 0; k < part->count; k++)
+    {
+      unsigned int i = part->records[k];
+      struct derep_record_s * r = derep_batch + i;
+      bool rc_done = false;
 
       /*
         Find free bucket or bucket for identical sequence.
@@ -224,118 +427,1011 @@ void derep_fulllength()
         collision when the number of sequences is about 5e9.
       */
 
-      unsigned long hash = HASH(seq_up, seqlen);
-      unsigned long j = hash & hash_mask;
-      struct bucket * bp = hashtable + j;
-      
-      while (
-#ifdef BITMAP
-             (hash_is_occupied(j))
-#else
-             (bp->size)
-#endif
-             &&
-             ((bp->hash != hash) ||
-              (seqlen != db_getsequencelen(bp->seqno_first)) ||
-              (seqcmp(seq_up, db_getsequence(bp->seqno_first), seqlen))))
-        {
-          bp++;
-          j++;
-          if (bp >= hashtable + hashtablesize)
+      unsigned long j = r->hash & part->mask;
+      struct derep_unique_s * u = 0;
+
+      while (part->table[j])
+        {
+          u = part->uniques + part->table[j] - 1;
+
+          if ((u->hash == r->hash) && (u->seqlen == r->seqlen))
             {
-              bp = hashtable;
-              j = 0;
+              if (! seqcmp(r->seq, u->seq, r->seqlen))
+                break;
+
+              if (opt_strand > 1)
+                {
+                  if (! rc_done)
+                    {
+                      reverse_complement(rc_seq, r->seq, r->seqlen);
+                      rc_done = true;
+                    }
+                  if (! seqcmp(rc_seq, u->seq, r->seqlen))
+                    break;
+                }
             }
+
+          u = 0;
+          j = (j + 1) & part->mask;
         }
-          
-      if ((opt_strand > 1) && !bp->size)
+
+      if (u)
         {
-          /* no match on plus strand */
-          /* check minus strand as well */
+          /* at least one identical sequence already */
+          u->size += r->abundance;
 
-          unsigned long rc_hash = HASH(rc_seq_up, seqlen);
-          struct bucket * rc_bp = hashtable + rc_hash % hashtablesize;
-          unsigned long k = rc_hash & hash_mask;
-          
-          while (
-#ifdef BITMAP
-                 (hash_is_occupied(j))
-#else
-                 (rc_bp->size)
-#endif
-                 &&
-                 ((rc_bp->hash != rc_hash) ||
-                  (seqlen != db_getsequencelen(rc_bp->seqno_first)) ||
-                  (seqcmp(rc_seq_up,
-                          db_getsequence(rc_bp->seqno_first),
-                          seqlen))))
+          if (opt_uc)
             {
-              rc_bp++;
-              k++;
-              if (rc_bp >= hashtable + hashtablesize)
+              struct derep_member_s * m = (struct derep_member_s *)
+                derep_alloc(part, sizeof(struct derep_member_s));
+              m->header = derep_copy(part, r->header, r->headerlen);
+              m->next = 0;
+              if (u->members_last)
+                u->members_last->next = m;
+              else
+                u->members = m;
+              u->members_last = m;
+            }
+
+          if (opt_countout)
+            {
+              if (u->counts_last->sample == r->sample)
+                u->counts_last->count += r->abundance;
+              else
                 {
-                  rc_bp = hashtable;
-                  k++;
+                  struct derep_count_s * c = (struct derep_count_s *)
+                    derep_alloc(part, sizeof(struct derep_count_s));
+                  c->sample = r->sample;
+                  c->count = r->abundance;
+                  c->next = 0;
+                  u->counts_last->next = c;
+                  u->counts_last = c;
                 }
             }
-
-          if (rc_bp->size)
+        }
+      else
+        {
+          /* no identical sequences yet */
+          part->table[j] = part->unique_count + 1;
+          u = part->uniques + part->unique_count++;
+          u->hash = r->hash;
+          u->ordinal = r->ordinal;
+          u->header = derep_copy(part, r->header, r->headerlen);
+          u->seq = derep_copy(part, r->seq, r->seqlen);
+          u->headerlen = r->headerlen;
+          u->seqlen = r->seqlen;
+          u->size = r->abundance;
+          u->members = 0;
+          u->members_last = 0;
+          u->counts = 0;
+          u->counts_last = 0;
+
+          if (opt_countout)
             {
-              bp = rc_bp;
-              j = k;
+              struct derep_count_s * c = (struct derep_count_s *)
+                derep_alloc(part, sizeof(struct derep_count_s));
+              c->sample = r->sample;
+              c->count = r->abundance;
+              c->next = 0;
+              u->counts = c;
+              u->counts_last = c;
             }
         }
+    }
+}
+
+static void derep_fill_partitions(long t)
+{
+  /* fill every derep_threads'th partition, starting with partition t */
 
-      long ab = opt_sizein ? db_getabundance(i) : 1;
-      sumsize += ab;
+  char * rc_seq = (char*) xmalloc(derep_batch_longest + 1);
 
-      if (bp->size)
+  for(long p = t; p < DEREP_PARTITIONS; p += derep_threads)
+    derep_fill_partition(derep_partitions + p, rc_seq);
+
+  free(rc_seq);
+}
+
+#if PTHREAD
+static void * derep_hash_worker(void * vp)
+{
+  derep_hash_range((long) vp);
+  return 0;
+}
+
+static void * derep_fill_worker(void * vp)
+{
+  derep_fill_partitions((long) vp);
+  return 0;
+}
+
+static void derep_run_threads(void * (*worker)(void *))
+{
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+  pthread_t * pthread
+    = (pthread_t *) xmalloc(derep_threads * sizeof(pthread_t));
+
+  for(long t=0; t<derep_threads; t++)
+    if (pthread_create(pthread+t, &attr, worker, (void*)t))
+      fatal("Cannot create thread");
+
+  for(long t=0; t<derep_threads; t++)
+    if (pthread_join(pthread[t], NULL))
+      fatal("Cannot join thread");
+
+  free(pthread);
+  pthread_attr_destroy(&attr);
+}
+#endif
+
+static void derep_hash_batch()
+{
+#if PTHREAD
+  derep_run_threads(derep_hash_worker);
+#else
+  derep_hash_range(0);
+#endif
+}
+
+static void derep_process_batch(bool hashed)
+{
+  /* hash the records of the batch, unless read back from a spill file */
+
+  if (! hashed)
+    derep_hash_batch();
+
+  /* distribute the records on the partitions, keeping input order */
+
+  for(long p = 0; p < DEREP_PARTITIONS; p++)
+    derep_partitions[p].count = 0;
+
+  for(long i = 0; i < derep_batch_count; i++)
+    derep_partitions[derep_batch[i].hash >> (64 - DEREP_PARTITION_BITS)]
+      .count++;
+
+  long offset = 0;
+  for(long p = 0; p < DEREP_PARTITIONS; p++)
+    {
+      derep_partitions[p].records = derep_batch_order + offset;
+      offset += derep_partitions[p].count;
+      derep_partitions[p].count = 0;
+    }
+
+  for(long i = 0; i < derep_batch_count; i++)
+    {
+      struct derep_partition_s * part = derep_partitions +
+        (derep_batch[i].hash >> (64 - DEREP_PARTITION_BITS));
+      part->records[part->count++] = i;
+    }
+
+  /* insert them */
+
+#if PTHREAD
+  derep_run_threads(derep_fill_worker);
+#else
+  derep_fill_partitions(0);
+#endif
+}
+
+unsigned long derep_key(const void * a)
+{
+  struct bucket * x = (struct bucket *) a;
+  return UINT_MAX - x->size;
+}
+
+unsigned long derep_key_unique(const void * a)
+{
+  struct derep_unique_s * x = *(struct derep_unique_s **) a;
+  return UINT_MAX - x->size;
+}
+
+int derep_compare_unique(const void * a, const void * b)
+{
+  struct derep_unique_s * x = *(struct derep_unique_s **) a;
+  struct derep_unique_s * y = *(struct derep_unique_s **) b;
+
+  /* highest abundance first, then by label, otherwise keep order */
+
+  if (x->size < y->size)
+    return +1;
+  else if (x->size > y->size)
+    return -1;
+  else
+    {
+      int r = strcmp(x->header, y->header);
+      if (r != 0)
+        return r;
+      else
         {
-          /* at least one identical sequence already */
-          bp->size += ab;
-          unsigned int last = bp->seqno_last;
-          nextseqtab[last] = i;
-          bp->seqno_last = i;
+          if (x->ordinal < y->ordinal)
+            return -1;
+          else if (x->ordinal > y->ordinal)
+            return +1;
+          else
+            return 0;
         }
-      else
+    }
+}
+
+static int derep_spill_bits(unsigned long filesize)
+{
+  /*
+    The headers, sequences, tables and uc members of the unique
+    sequences are assumed to take at most about twice the input size.
+    Input from a pipe has no known size and is never split.
+  */
+
+  if (opt_memory_budget <= 0)
+    return 0;
+
+  unsigned long budget = opt_memory_budget * 1024UL * 1024UL;
+  int bits = 0;
+  while ((bits < DEREP_SPILL_BITS_MAX) && (2 * filesize > (budget << bits)))
+    bits++;
+  return bits;
+}
+
+static void derep_batch_pointers(char * data)
+{
+  for(long i = 0; i < derep_batch_count; i++)
+    {
+      derep_batch[i].header = data + derep_batch[i].header_p;
+      derep_batch[i].seq = data + derep_batch[i].seq_p;
+    }
+}
+
+static void derep_spill_batch(FILE ** spill, long * spill_count, int bits)
+{
+  /* hash the records of the batch and append them to the spill files */
+
+  derep_hash_batch();
+
+  for(long i = 0; i < derep_batch_count; i++)
+    {
+      struct derep_record_s * r = derep_batch + i;
+      long f = (r->hash >> (64 - DEREP_PARTITION_BITS - bits))
+        & ((1 << bits) - 1);
+
+      struct derep_spill_s s;
+      memset(& s, 0, sizeof(s));
+      s.hash = r->hash;
+      s.ordinal = r->ordinal;
+      s.abundance = r->abundance;
+      s.headerlen = r->headerlen;
+      s.seqlen = r->seqlen;
+      s.sample = r->sample;
+
+      fwrite_temp(spill[f], & s, sizeof(s));
+      fwrite_temp(spill[f], r->header, r->headerlen + 1);
+      fwrite_temp(spill[f], r->seq, r->seqlen + 1);
+      spill_count[f]++;
+    }
+}
+
+static void derep_read_spill(FILE * fp,
+                             long count,
+                             char ** data,
+                             size_t * alloc)
+{
+  /* read the next count records of a spill file into the batch */
+
+  size_t used = 0;
+  derep_batch_count = 0;
+  derep_batch_longest = 0;
+
+  for(long i = 0; i < count; i++)
+    {
+      struct derep_spill_s s;
+      fread_temp(fp, & s, sizeof(s));
+
+      size_t needed = used + s.headerlen + 1 + s.seqlen + 1;
+      if (needed > *alloc)
         {
-          /* no identical sequences yet */
-          bp->size = ab;
-          bp->hash = hash;
-          bp->seqno_first = i;
-          bp->seqno_last = i;
-          clusters++;
+          while (needed > *alloc)
+            *alloc *= 2;
+          *data = (char *) xrealloc(*data, *alloc);
         }
+      fread_temp(fp, *data + used, needed - used);
+
+      struct derep_record_s * r = derep_batch + derep_batch_count++;
+      r->header_p = used;
+      r->seq_p = used + s.headerlen + 1;
+      r->headerlen = s.headerlen;
+      r->seqlen = s.seqlen;
+      r->abundance = s.abundance;
+      r->sample = s.sample;
+      r->hash = s.hash;
+      r->ordinal = s.ordinal;
+      used = needed;
+
+      if (s.seqlen > derep_batch_longest)
+        derep_batch_longest = s.seqlen;
+    }
 
-      if (bp->size > maxsize)
-        maxsize = bp->size;
+  derep_batch_pointers(*data);
+}
 
-#ifdef BITMAP
-      hash_set_occupied(j);
+static struct derep_unique_s ** derep_collect(long * count)
+{
+  /* collect the unique sequences of all partitions and sort them */
+
+  long clusters = 0;
+  for(long p = 0; p < DEREP_PARTITIONS; p++)
+    clusters += derep_partitions[p].unique_count;
+
+  struct derep_unique_s ** uniques = (struct derep_unique_s **)
+    xmalloc(sizeof(struct derep_unique_s *) * (clusters + 1));
+
+  long c = 0;
+  for(long p = 0; p < DEREP_PARTITIONS; p++)
+    {
+      struct derep_partition_s * part = derep_partitions + p;
+      for(long u = 0; u < part->unique_count; u++)
+        uniques[c++] = part->uniques + u;
+      if (part->table)
+        free(part->table);
+      part->table = 0;
+      part->mask = 0;
+    }
+
+  radix_sort(uniques, clusters, sizeof(struct derep_unique_s *),
+             derep_key_unique, derep_compare_unique);
+
+  *count = clusters;
+  return uniques;
+}
+
+static void derep_free_partitions()
+{
+  for(long p = 0; p < DEREP_PARTITIONS; p++)
+    {
+      struct derep_partition_s * part = derep_partitions + p;
+      while (part->chunk)
+        {
+          char * next = *(char **) part->chunk;
+          free(part->chunk);
+          part->chunk = next;
+        }
+      if (part->uniques)
+        free(part->uniques);
+      if (part->table)
+        free(part->table);
+    }
+  memset(derep_partitions, 0,
+         sizeof(struct derep_partition_s) * DEREP_PARTITIONS);
+}
+
+static void derep_write_run(FILE * fp,
+                            struct derep_unique_s ** uniques,
+                            long count)
+{
+  for(long i = 0; i < count; i++)
+    {
+      struct derep_unique_s * u = uniques[i];
+
+      struct derep_entry_s e;
+      memset(& e, 0, sizeof(e));
+      e.ordinal = u->ordinal;
+      e.size = u->size;
+      e.headerlen = u->headerlen;
+      e.seqlen = u->seqlen;
+      for (struct derep_member_s * m = u->members; m; m = m->next)
+        {
+          e.member_count++;
+          e.member_bytes += strlen(m->header) + 1;
+        }
+      for (struct derep_count_s * c = u->counts; c; c = c->next)
+        e.count_count++;
+
+      fwrite_temp(fp, & e, sizeof(e));
+      fwrite_temp(fp, u->header, u->headerlen + 1);
+      fwrite_temp(fp, u->seq, u->seqlen + 1);
+      for (struct derep_member_s * m = u->members; m; m = m->next)
+        fwrite_temp(fp, m->header, strlen(m->header) + 1);
+      for (struct derep_count_s * c = u->counts; c; c = c->next)
+        {
+          unsigned int pair[2] = { c->sample, c->count };
+          fwrite_temp(fp, pair, sizeof(pair));
+        }
+    }
+}
+
+static void derep_run_load(struct derep_run_s * run)
+{
+  /* read the next unique sequence of a run */
+
+  struct derep_entry_s e;
+  fread_temp(run->fp, & e, sizeof(e));
+
+  size_t needed = e.headerlen + 1 + e.seqlen + 1 + e.member_bytes;
+  if (needed > run->data_alloc)
+    {
+      run->data_alloc = needed;
+      run->data = (char *) xrealloc(run->data, run->data_alloc);
+    }
+  fread_temp(run->fp, run->data, needed);
+
+  if (e.member_count > run->members_alloc)
+    {
+      run->members_alloc = e.member_count;
+      run->members = (struct derep_member_s *)
+        xrealloc(run->members,
+                 sizeof(struct derep_member_s) * run->members_alloc);
+    }
+
+  if (e.count_count > run->counts_alloc)
+    {
+      run->counts_alloc = e.count_count;
+      run->counts = (struct derep_count_s *)
+        xrealloc(run->counts,
+                 sizeof(struct derep_count_s) * run->counts_alloc);
+    }
+
+  struct derep_unique_s * u = & run->u;
+  u->ordinal = e.ordinal;
+  u->size = e.size;
+  u->headerlen = e.headerlen;
+  u->seqlen = e.seqlen;
+  u->header = run->data;
+  u->seq = run->data + e.headerlen + 1;
+  u->members = e.member_count ? run->members : 0;
+  u->members_last = 0;
+
+  char * p = u->seq + e.seqlen + 1;
+  for(unsigned int m = 0; m < e.member_count; m++)
+    {
+      run->members[m].header = p;
+      run->members[m].next =
+        m + 1 < e.member_count ? run->members + m + 1 : 0;
+      p += strlen(p) + 1;
+    }
+
+  u->counts = e.count_count ? run->counts : 0;
+  u->counts_last = 0;
+
+  for(unsigned int c = 0; c < e.count_count; c++)
+    {
+      unsigned int pair[2];
+      fread_temp(run->fp, pair, sizeof(pair));
+      run->counts[c].sample = pair[0];
+      run->counts[c].count = pair[1];
+      run->counts[c].next =
+        c + 1 < e.count_count ? run->counts + c + 1 : 0;
+    }
+
+  run->next++;
+}
+
+static int derep_compare_runs(struct derep_run_s * a, struct derep_run_s * b)
+{
+  struct derep_unique_s * x = & a->u;
+  struct derep_unique_s * y = & b->u;
+  return derep_compare_unique(& x, & y);
+}
+
+static void derep_heap_down(long i)
+{
+  struct derep_run_s * run = derep_heap[i];
+
+  while (2 * i + 1 < derep_heap_count)
+    {
+      long c = 2 * i + 1;
+      if ((c + 1 < derep_heap_count) &&
+          (derep_compare_runs(derep_heap[c + 1], derep_heap[c]) < 0))
+        c++;
+      if (derep_compare_runs(derep_heap[c], run) >= 0)
+        break;
+      derep_heap[i] = derep_heap[c];
+      i = c;
+    }
+
+  derep_heap[i] = run;
+}
+
+static void derep_rewind()
+{
+  /* start over with the first unique sequence in sorted order */
+
+  derep_position = 0;
+
+  if (derep_runs)
+    {
+      derep_heap_count = 0;
+      for(long r = 0; r < derep_run_count; r++)
+        {
+          struct derep_run_s * run = derep_runs + r;
+          rewind_temp(run->fp);
+          run->next = 0;
+          if (run->count > 0)
+            {
+              derep_run_load(run);
+              derep_heap[derep_heap_count++] = run;
+            }
+        }
+      for(long i = derep_heap_count / 2 - 1; i >= 0; i--)
+        derep_heap_down(i);
+    }
+}
+
+static struct derep_unique_s * derep_next()
+{
+  /* the next unique sequence in sorted order, valid until the next call */
+
+  if (! derep_runs)
+    {
+      if (derep_position < derep_sorted_count)
+        return derep_sorted[derep_position++];
+      else
+        return 0;
+    }
+
+  if ((derep_position++ > 0) && (derep_heap_count > 0))
+    {
+      /* move on in the run of the previous one */
+      struct derep_run_s * run = derep_heap[0];
+      if (run->next < run->count)
+        derep_run_load(run);
+      else
+        derep_heap[0] = derep_heap[--derep_heap_count];
+      if (derep_heap_count > 0)
+        derep_heap_down(0);
+    }
+
+  return derep_heap_count > 0 ? & derep_heap[0]->u : 0;
+}
+
+static void derep_digest_init()
+{
+  if (opt_relabel_sha1)
+    {
+      derep_digest_type = DIGEST_SHA1;
+      derep_digest_width = LEN_HEX_DIG_SHA1;
+    }
+  else
+    {
+      derep_digest_type = DIGEST_MD5;
+      derep_digest_width = LEN_HEX_DIG_MD5;
+    }
+
+  derep_digest_hex = (char *) xmalloc(DEREP_DIGEST_BATCH * derep_digest_width);
+  derep_digest_ptrs = (char **) xmalloc(DEREP_DIGEST_BATCH * sizeof(char *));
+  derep_digest_seqs = (char **) xmalloc(DEREP_DIGEST_BATCH * sizeof(char *));
+  derep_digest_lens = (unsigned int *)
+    xmalloc(DEREP_DIGEST_BATCH * sizeof(unsigned int));
+  derep_digest_first = 0;
+  derep_digest_count = 0;
+  derep_digest_todo = 0;
+}
+
+static void derep_digest_exit()
+{
+  free(derep_digest_hex);
+  free(derep_digest_ptrs);
+  free(derep_digest_seqs);
+  free(derep_digest_lens);
+  derep_digest_hex = 0;
+  derep_digest_ptrs = 0;
+  derep_digest_seqs = 0;
+  derep_digest_lens = 0;
+}
+
+static void derep_digest_range(long t)
+{
+  /* digest the t'th share of the selected uniques in the batch */
+
+  long first = derep_digest_todo * t / derep_threads;
+  long last = derep_digest_todo * (t + 1) / derep_threads;
+
+  digest_hex_seqs(derep_digest_type,
+                  last - first,
+                  derep_digest_seqs + first,
+                  derep_digest_lens + first,
+                  derep_digest_ptrs + first);
+}
+
+#if PTHREAD
+static void * derep_digest_worker(void * vp)
+{
+  derep_digest_range((long) vp);
+  return 0;
+}
+#endif
+
+static void derep_digest_batch(long first)
+{
+  /* digest the selected uniques from the given sorted position onwards */
+
+  derep_digest_first = first;
+  derep_digest_count = MIN(derep_sorted_count - first, DEREP_DIGEST_BATCH);
+  derep_digest_todo = 0;
+
+  for(long j = 0; j < derep_digest_count; j++)
+    {
+      struct derep_unique_s * u = derep_sorted[first + j];
+      if ((u->size >= opt_minuniquesize) && (u->size <= opt_maxuniquesize))
+        {
+          long k = derep_digest_todo++;
+          derep_digest_seqs[k] = u->seq;
+          derep_digest_lens[k] = u->seqlen;
+          derep_digest_ptrs[k] = derep_digest_hex + j * derep_digest_width;
+        }
+    }
+
+#if PTHREAD
+  if (derep_threads > 1)
+    derep_run_threads(derep_digest_worker);
+  else
+    derep_digest_range(0);
+#else
+  derep_digest_range(0);
 #endif
+}
+
+static char * derep_digest(struct derep_unique_s * u)
+{
+  /* the hex digest of the unique last returned by derep_next, if needed */
+
+  if (! (opt_relabel_sha1 || opt_relabel_md5))
+    return 0;
+
+  if (derep_runs)
+    {
+      /* read back one by one from the runs on disk */
+      derep_digest_ptrs[0] = derep_digest_hex;
+      digest_hex_seqs(derep_digest_type, 1,
+                      & u->seq, & u->seqlen, derep_digest_ptrs);
+      return derep_digest_hex;
+    }
+
+  long i = derep_position - 1;
+  if ((i < derep_digest_first) ||
+      (i >= derep_digest_first + derep_digest_count))
+    derep_digest_batch(i);
+
+  return derep_digest_hex + (i - derep_digest_first) * derep_digest_width;
+}
+
+static double derep_median(std::map<unsigned int, long> & histogram,
+                           long clusters)
+{
+  /* median of the cluster sizes, given the number of clusters per size */
+
+  if (clusters == 0)
+    return 0.0;
 
-      progress_update(i);
+  long lower = (clusters - 1) / 2;
+  long upper = clusters / 2;
+  double lower_size = 0.0;
+  double upper_size = 0.0;
+  long seen = 0;
+
+  for(std::map<unsigned int, long>::reverse_iterator it = histogram.rbegin();
+      it != histogram.rend(); ++it)
+    {
+      if ((lower >= seen) && (lower < seen + it->second))
+        lower_size = it->first;
+      if ((upper >= seen) && (upper < seen + it->second))
+        {
+          upper_size = it->first;
+          break;
+        }
+      seen += it->second;
     }
+
+  return (lower_size + upper_size) / 2.0;
+}
+
+static void derep_fprint_label(FILE * fp,
+                               struct derep_unique_s * u,
+                               long ordinal,
+                               char * digest)
+{
+  /* the label of the sequence in the output, without abundance */
+
+  if (digest)
+    fprintf(fp, "%s", digest);
+  else if (opt_relabel_sha1)
+    fprint_seq_digest_sha1(fp, u->seq, u->seqlen);
+  else if (opt_relabel_md5)
+    fprint_seq_digest_md5(fp, u->seq, u->seqlen);
+  else if (opt_relabel)
+    fprintf(fp, "%s%ld", opt_relabel, ordinal);
+  else
+    {
+      int size_start, size_end;
+      abundance_scan(u->header, u->headerlen, & size_start, & size_end);
+      abundance_fprint_span_strip_size(fp, u->header, u->headerlen,
+                                       size_start, size_end);
+    }
+}
+
+static void derep_fprint_counts(FILE * fp,
+                                struct derep_unique_s * u,
+                                long ordinal,
+                                char * digest)
+{
+  /* one line per sample the sequence was seen in */
+
+  for (struct derep_count_s * c = u->counts; c; c = c->next)
+    {
+      derep_fprint_label(fp, u, ordinal, digest);
+      fprintf(fp, "\t%s\t%u\n", derep_sample_names[c->sample], c->count);
+    }
+}
+
+static fastx_handle derep_open(char * filename)
+{
+  fastx_handle h = fastx_open(filename);
+
+  if (!h)
+    fatal("Unrecognized file type (not proper FASTA or FASTQ format)");
+
+  derep_prompt = (char *) xmalloc(strlen(filename) + 20);
+  sprintf(derep_prompt, "Dereplicating file %s", filename);
+  progress_init(derep_prompt, fastx_get_size(h));
+
+  return h;
+}
+
+static void derep_close(fastx_handle h)
+{
   progress_done();
+  free(derep_prompt);
+  derep_prompt = 0;
+  fastx_close(h);
+}
+
+static void derep_files(long file_count,
+                        char ** files,
+                        unsigned int * samples)
+{
+  /* dereplicate the given files together, with their sample numbers */
+
+  FILE * fp_output = 0;
+  FILE * fp_uc = 0;
+  FILE * fp_countout = 0;
+
+  if (opt_output)
+    {
+      fp_output = fopen_output(opt_output);
+      if (!fp_output)
+        fatal("Unable to open output file for writing");
+    }
+
+  if (opt_uc)
+    {
+      fp_uc = fopen_output(opt_uc);
+      if (!fp_uc)
+        fatal("Unable to open output (uc) file for writing");
+    }
+
+  if (opt_countout)
+    {
+      fp_countout = fopen_output(opt_countout);
+      if (!fp_countout)
+        fatal("Unable to open count table output file for writing");
+    }
+
+#if PTHREAD
+  derep_threads = opt_threads > 0 ? opt_threads : 1;
+#else
+  derep_threads = 1;
+#endif
+
+  derep_partitions = (struct derep_partition_s *)
+    xmalloc(sizeof(struct derep_partition_s) * DEREP_PARTITIONS);
+  memset(derep_partitions, 0,
+         sizeof(struct derep_partition_s) * DEREP_PARTITIONS);
+
+  derep_batch = (struct derep_record_s *)
+    xmalloc(sizeof(struct derep_record_s) * DEREP_BATCH);
+  derep_batch_order = (unsigned int *)
+    xmalloc(sizeof(unsigned int) * DEREP_BATCH);
+  size_t batch_alloc = DEREP_CHUNK;
+  char * batch_data = (char *) xmalloc(batch_alloc);
+
+  /* read and dereplicate the input, one batch at a time */
+
+  long file = 0;
+  fastx_handle h = derep_open(files[file]);
+
+  /* or split it into spill files if it may not fit in memory */
+
+  unsigned long input_size = fastx_get_size(h);
+
+  if (opt_memory_budget > 0)
+    for(long f = 1; f < file_count; f++)
+      {
+        fastx_handle g = fastx_open(files[f]);
+        if (!g)
+          fatal("Unrecognized file type (not proper FASTA or FASTQ format)");
+        input_size += fastx_get_size(g);
+        fastx_close(g);
+      }
+
+  int spill_bits = derep_spill_bits(input_size);
+  long spill_files = spill_bits ? 1 << spill_bits : 0;
+  FILE ** spill = 0;
+  long * spill_count = 0;
+
+  if (spill_files)
+    {
+      spill = (FILE **) xmalloc(sizeof(FILE *) * spill_files);
+      spill_count = (long *) xmalloc(sizeof(long) * spill_files);
+      for(long f = 0; f < spill_files; f++)
+        {
+          spill[f] = fopen_temp();
+          spill_count[f] = 0;
+        }
+    }
+
+  unsigned long sequences = 0;
+  unsigned long nucleotides = 0;
+  unsigned long shortest = ULONG_MAX;
+  unsigned long longest = 0;
+  long discarded_short = 0;
+  long discarded_long = 0;
+  long sumsize = 0;
+
+  while (h)
+    {
+      size_t batch_used = 0;
+      derep_batch_count = 0;
+      derep_batch_longest = 0;
+
+      while ((derep_batch_count < DEREP_BATCH) && h)
+        {
+          if (! fastx_next(h, ! opt_notrunclabels, chrmap_no_change))
+            {
+              /* continue with the next file */
+              derep_close(h);
+              file++;
+              h = file < file_count ? derep_open(files[file]) : 0;
+              continue;
+            }
+
+          char * header = fastx_get_header(h);
+          unsigned int headerlen = fastx_get_header_length(h);
+          unsigned int seqlen = fastx_get_sequence_length(h);
+
+          int size_start, size_end;
+          long abundance = abundance_get_span(header, headerlen,
+                                              & size_start, & size_end);
+
+          if (seqlen < (unsigned long) opt_minseqlength)
+            discarded_short++;
+          else if (seqlen > (unsigned long) opt_maxseqlength)
+            discarded_long++;
+          else
+            {
+              /* copy header and sequence into the batch */
+
+              size_t needed = batch_used + headerlen + 1 + seqlen + 1;
+              if (needed > batch_alloc)
+                {
+                  while (needed > batch_alloc)
+                    batch_alloc *= 2;
+                  batch_data = (char *) xrealloc(batch_data, batch_alloc);
+                }
+
+              struct derep_record_s * r = derep_batch + derep_batch_count++;
+              r->header_p = batch_used;
+              memcpy(batch_data + batch_used, header, headerlen + 1);
+              batch_used += headerlen + 1;
+              r->seq_p = batch_used;
+              memcpy(batch_data + batch_used, fastx_get_sequence(h),
+                     seqlen + 1);
+              batch_used += seqlen + 1;
+              r->headerlen = headerlen;
+              r->seqlen = seqlen;
+              r->abundance = opt_sizein ? abundance : 1;
+              r->sample = samples[file];
+              r->ordinal = sequences;
+
+              sumsize += r->abundance;
+              sequences++;
+              nucleotides += seqlen;
+              if (seqlen < shortest)
+                shortest = seqlen;
+              if (seqlen > longest)
+                longest = seqlen;
+              if (seqlen > derep_batch_longest)
+                derep_batch_longest = seqlen;
+            }
+
+          progress_update(fastx_get_position(h));
+        }
+
+      derep_batch_pointers(batch_data);
+
+      if (derep_batch_count > 0)
+        {
+          if (spill_files)
+            derep_spill_batch(spill, spill_count, spill_bits);
+          else
+            derep_process_batch(false);
+        }
+    }
+
+  db_report(nucleotides, sequences, shortest, longest,
+            discarded_short, discarded_long);
 
-  free(seq_up);
-  free(rc_seq_up);
-  
   show_rusage();
 
+  /* sort the unique sequences, one spill file at a time if split */
 
-  progress_init("Sorting", 1);
-  qsort(hashtable, hashtablesize, sizeof(bucket), derep_compare);
-  progress_done();
+  long clusters = 0;
+  unsigned long maxsize = 0;
+  double median = 0.0;
+  double average = 0.0;
+  std::map<unsigned int, long> histogram;
 
+  if (spill_files)
+    {
+      derep_run_count = spill_files;
+      derep_runs = (struct derep_run_s *)
+        xmalloc(sizeof(struct derep_run_s) * derep_run_count);
+      memset(derep_runs, 0, sizeof(struct derep_run_s) * derep_run_count);
+      derep_heap = (struct derep_run_s **)
+        xmalloc(sizeof(struct derep_run_s *) * derep_run_count);
 
-  if (clusters > 0)
+      progress_init("Dereplicating and sorting temporary files",
+                    spill_files);
+
+      for(long f = 0; f < spill_files; f++)
+        {
+          rewind_temp(spill[f]);
+
+          for(long done = 0; done < spill_count[f]; done += derep_batch_count)
+            {
+              derep_read_spill(spill[f],
+                               MIN(DEREP_BATCH, spill_count[f] - done),
+                               & batch_data, & batch_alloc);
+              derep_process_batch(true);
+            }
+
+          fclose(spill[f]);
+
+          struct derep_run_s * run = derep_runs + f;
+          struct derep_unique_s ** uniques = derep_collect(& run->count);
+          run->fp = fopen_temp();
+          derep_write_run(run->fp, uniques, run->count);
+
+          for(long i = 0; i < run->count; i++)
+            histogram[uniques[i]->size]++;
+          clusters += run->count;
+
+          free(uniques);
+          derep_free_partitions();
+          progress_update(f + 1);
+        }
+
+      progress_done();
+      free(spill);
+      free(spill_count);
+    }
+  else
     {
-      if (clusters % 2)
-        median = hashtable[(clusters-1)/2].size;
-      else
-        median = (hashtable[(clusters/2)-1].size +
-                  hashtable[clusters/2].size) / 2.0;
+      progress_init("Sorting", 1);
+      derep_sorted = derep_collect(& derep_sorted_count);
+      progress_done();
+
+      clusters = derep_sorted_count;
+      for(long i = 0; i < clusters; i++)
+        histogram[derep_sorted[i]->size]++;
+    }
+
+  free(batch_data);
+  free(derep_batch_order);
+  free(derep_batch);
+
+  if (clusters > 0)
+    {
+      maxsize = histogram.rbegin()->first;
+      median = derep_median(histogram, clusters);
     }
   
   average = 1.0 * sumsize / clusters;
@@ -353,51 +1449,67 @@ void derep_fulllength()
   show_rusage();
   
 
-  /* count selected */
+  /* write output, counting the selected ones */
 
   long selected = 0;
-  for (long i=0; i<clusters; i++)
-    {
-      struct bucket * bp = hashtable + i;
-      long size = bp->size;
-      if ((size >= opt_minuniquesize) && (size <= opt_maxuniquesize))
-        {
-          selected++;
-          if (selected == opt_topn)
-            break;
-        }
-    }
-
 
-  /* write output */
-
-  if (opt_output)
+  if (opt_output || opt_countout)
     {
       progress_init("Writing output file", clusters);
 
-      long relabel_count = 0;
-      for (long i=0; i<clusters; i++)
+      /* digests for relabelling are computed in batches ahead of writing */
+      if (opt_relabel_sha1 || opt_relabel_md5)
+        derep_digest_init();
+
+      derep_rewind();
+      long i = 0;
+      struct derep_unique_s * u;
+      while ((u = derep_next()))
         {
-          struct bucket * bp = hashtable + i;
-          long size = bp->size;
+          long size = u->size;
           if ((size >= opt_minuniquesize) && (size <= opt_maxuniquesize))
             {
-              relabel_count++;
-              fasta_print_relabel(fp_output,
-                                  db_getsequence(bp->seqno_first),
-                                  db_getsequencelen(bp->seqno_first),
-                                  db_getheader(bp->seqno_first),
-                                  db_getheaderlen(bp->seqno_first),
-                                  size,
-                                  relabel_count);
-              if (relabel_count == opt_topn)
+              selected++;
+              char * digest = derep_digest(u);
+              if (fp_output)
+                fasta_print_relabel_digest(fp_output,
+                                           u->seq,
+                                           u->seqlen,
+                                           u->header,
+                                           u->headerlen,
+                                           size,
+                                           selected,
+                                           digest);
+              if (fp_countout)
+                derep_fprint_counts(fp_countout, u, selected, digest);
+              if (selected == opt_topn)
                 break;
             }
-          progress_update(i);
+          progress_update(i++);
         }
 
       progress_done();
-      fclose(fp_output);
+      if (opt_relabel_sha1 || opt_relabel_md5)
+        derep_digest_exit();
+      if (fp_output)
+        fclose(fp_output);
+      if (fp_countout)
+        fclose(fp_countout);
+    }
+  else
+    {
+      derep_rewind();
+      struct derep_unique_s * u;
+      while ((u = derep_next()))
+        {
+          long size = u->size;
+          if ((size >= opt_minuniquesize) && (size <= opt_maxuniquesize))
+            {
+              selected++;
+              if (selected == opt_topn)
+                break;
+            }
+        }
     }
 
   show_rusage();
@@ -405,21 +1517,20 @@ void derep_fulllength()
   if (opt_uc)
     {
       progress_init("Writing uc file, first part", clusters);
+      derep_rewind();
       for (long i=0; i<clusters; i++)
         {
-          struct bucket * bp = hashtable + i;
-          char * h =  db_getheader(bp->seqno_first);
-          long len = db_getsequencelen(bp->seqno_first);
+          struct derep_unique_s * u = derep_next();
+          char * h = u->header;
+          long len = u->seqlen;
 
           fprintf(fp_uc, "S\t%ld\t%ld\t*\t*\t*\t*\t*\t%s\t*\n",
                   i, len, h);
           
-          for (unsigned long next = nextseqtab[bp->seqno_first];
-               next;
-               next = nextseqtab[next])
+          for (struct derep_member_s * m = u->members; m; m = m->next)
             fprintf(fp_uc,
                     "H\t%ld\t%ld\t%.1f\t*\t0\t0\t*\t%s\t%s\n",
-                    i, len, 100.0, db_getheader(next), h);
+                    i, len, 100.0, m->header, h);
 
           progress_update(i);
         }
@@ -427,11 +1538,12 @@ void derep_fulllength()
       show_rusage();
       
       progress_init("Writing uc file, second part", clusters);
+      derep_rewind();
       for (long i=0; i<clusters; i++)
         {
-          struct bucket * bp = hashtable + i;
+          struct derep_unique_s * u = derep_next();
           fprintf(fp_uc, "C\t%ld\t%u\t*\t*\t*\t*\t*\t%s\t*\n",
-                  i, bp->size, db_getheader(bp->seqno_first));
+                  i, u->size, u->header);
           progress_update(i);
         }
       fclose(fp_uc);
@@ -454,11 +1566,414 @@ void derep_fulllength()
                 100.0 * (clusters - selected) / clusters);
     }
   
-  free(nextseqtab);
-  free(hashtable);
-  db_free();
+  if (derep_runs)
+    {
+      for(long r = 0; r < derep_run_count; r++)
+        {
+          fclose(derep_runs[r].fp);
+          if (derep_runs[r].data)
+            free(derep_runs[r].data);
+          if (derep_runs[r].members)
+            free(derep_runs[r].members);
+          if (derep_runs[r].counts)
+            free(derep_runs[r].counts);
+        }
+      free(derep_runs);
+      free(derep_heap);
+      derep_runs = 0;
+      derep_heap = 0;
+    }
+  else
+    {
+      free(derep_sorted);
+      derep_sorted = 0;
+    }
+
+  derep_free_partitions();
+  free(derep_partitions);
+}
+
+void derep_fulllength()
+{
+  unsigned int sample = 0;
+  derep_sample_names = & opt_derep_fulllength;
+  derep_files(1, & opt_derep_fulllength, & sample);
+  derep_sample_names = 0;
+}
+
+void derep_samples()
+{
+  /*
+    Read the list of samples, one per line with the sample name and
+    the file name separated by white space. Lines starting with # are
+    ignored.
+  */
+
+  FILE * fp = fopen(opt_derep_samples, "r");
+  if (!fp)
+    fatal("Unable to open samples file for reading");
+
+  std::map<std::string, unsigned int> sample_numbers;
+  std::vector<std::string> names;
+  std::vector<std::string> filenames;
+  std::vector<unsigned int> file_samples;
+
+  size_t line_alloc = 1024;
+  char * line = (char *) xmalloc(line_alloc);
+
+  while (fgets(line, line_alloc, fp))
+    {
+      size_t len = strlen(line);
+      while ((len == line_alloc - 1) && (line[len - 1] != '\n'))
+        {
+          line_alloc *= 2;
+          line = (char *) xrealloc(line, line_alloc);
+          if (! fgets(line + len, line_alloc - len, fp))
+            break;
+          len += strlen(line + len);
+        }
+
+      while ((len > 0) && isspace(line[len - 1]))
+        line[--len] = 0;
+
+      char * name = line;
+      while (isspace(*name))
+        name++;
+      if ((*name == 0) || (*name == '#'))
+        continue;
+
+      char * filename = name;
+      while (*filename && ! isspace(*filename))
+        filename++;
+      if (*filename == 0)
+        fatal("Missing file name for sample %s in samples file", name);
+      *filename++ = 0;
+      while (isspace(*filename))
+        filename++;
+
+      std::map<std::string, unsigned int>::iterator it
+        = sample_numbers.find(name);
+      unsigned int sample;
+      if (it == sample_numbers.end())
+        {
+          sample = names.size();
+          sample_numbers[name] = sample;
+          names.push_back(name);
+        }
+      else
+        sample = it->second;
+
+      filenames.push_back(filename);
+      file_samples.push_back(sample);
+    }
+
+  free(line);
+  fclose(fp);
+
+  if (filenames.empty())
+    fatal("No samples in samples file");
+
+  /* read the files of each sample together, in order of first appearance */
+
+  long file_count = filenames.size();
+  char ** files = (char **) xmalloc(sizeof(char *) * file_count);
+  unsigned int * samples
+    = (unsigned int *) xmalloc(sizeof(unsigned int) * file_count);
+
+  long f = 0;
+  for(unsigned int sample = 0; sample < names.size(); sample++)
+    for(long i = 0; i < file_count; i++)
+      if (file_samples[i] == sample)
+        {
+          files[f] = (char *) filenames[i].c_str();
+          samples[f] = sample;
+          f++;
+        }
+
+  derep_sample_names = (char **) xmalloc(sizeof(char *) * names.size());
+  for(unsigned int sample = 0; sample < names.size(); sample++)
+    derep_sample_names[sample] = (char *) names[sample].c_str();
+
+  derep_files(file_count, files, samples);
+
+  free(derep_sample_names);
+  derep_sample_names = 0;
+  free(samples);
+  free(files);
+}
+
+/*
+  Prefix dereplication.
+
+  The sequences are processed shortest first. A sequence identical to
+  a cluster representative joins that cluster, while a sequence that
+  has the representative of a cluster as a prefix takes the cluster
+  over and becomes its new representative. Otherwise it starts a new
+  cluster. The representatives are thus always free of prefixes of
+  each other, and each distinct sequence ends up in the cluster of the
+  first sequence processed that it is a proper prefix of, if any.
+
+  Instead of probing a hash table for every prefix length of every
+  sequence, the normalized sequences are sorted lexicographically with
+  a multikey quicksort. The sequences having a given sequence as a
+  prefix then follow it directly, and a single scan with a stack of
+  the prefixes of the current sequence finds the first extension of
+  every distinct sequence, using only the common prefix length of
+  neighbours. The sequences are partitioned on their first few
+  nucleotides, which no prefix relation can cross, and the partitions
+  are sorted and scanned in parallel.
+*/
+
+#define DEREP_PREFIX_PARTITIONS 256
+#define DEREP_PREFIX_KEY 4
+#define DEREP_PREFIX_NONE UINT_MAX          /* not a prefix of any other */
+#define DEREP_PREFIX_DUPLICATE (UINT_MAX - 1) /* identical to an earlier */
+
+struct derep_prefix_s
+{
+  char * seq;                   /* normalized */
+  unsigned int len;
+  unsigned int seqno;
+};
+
+struct derep_prefix_stack_s
+{
+  unsigned int seqno;
+  unsigned int len;
+  unsigned int extension;       /* first longer sequence seen with it */
+};
+
+static unsigned int * derep_prefix_members; /* seqnos by partition */
+static long * derep_prefix_offsets;
+static unsigned int * derep_prefix_extension;
+static unsigned int * derep_prefix_duplicate; /* next identical, or 0 */
+
+static inline int derep_prefix_char(struct derep_prefix_s * x,
+                                    unsigned int d)
+{
+  /* the end of a sequence sorts before any nucleotide */
+  return d < x->len ? (unsigned char) x->seq[d] : 0;
+}
+
+static int derep_prefix_compare(struct derep_prefix_s * x,
+                                struct derep_prefix_s * y,
+                                unsigned int d)
+{
+  /* compare from position d, identical sequences by order */
+
+  unsigned int m = MIN(x->len, y->len);
+  while ((d < m) && (x->seq[d] == y->seq[d]))
+    d++;
+
+  int r = derep_prefix_char(x, d) - derep_prefix_char(y, d);
+  if (r)
+    return r;
+  else if (x->seqno < y->seqno)
+    return -1;
+  else if (x->seqno > y->seqno)
+    return +1;
+  else
+    return 0;
+}
+
+static int derep_prefix_compare_seqno(const void * a, const void * b)
+{
+  struct derep_prefix_s * x = (struct derep_prefix_s *) a;
+  struct derep_prefix_s * y = (struct derep_prefix_s *) b;
+
+  if (x->seqno < y->seqno)
+    return -1;
+  else if (x->seqno > y->seqno)
+    return +1;
+  else
+    return 0;
+}
+
+static void derep_prefix_sort(struct derep_prefix_s * a,
+                              long n,
+                              unsigned int d)
+{
+  /* multikey quicksort of a[0..n-1], all equal up to position d */
+
+  while (n > 1)
+    {
+      if (n < 16)
+        {
+          for(long i = 1; i < n; i++)
+            {
+              struct derep_prefix_s x = a[i];
+              long j = i;
+              while ((j > 0) && (derep_prefix_compare(a + j - 1, & x, d) > 0))
+                {
+                  a[j] = a[j - 1];
+                  j--;
+                }
+              a[j] = x;
+            }
+          return;
+        }
+
+      /* median of three as pivot */
+
+      int p = derep_prefix_char(a, d);
+      int q = derep_prefix_char(a + n / 2, d);
+      int r = derep_prefix_char(a + n - 1, d);
+      int v = (p < q) ? ((q < r) ? q : ((p < r) ? r : p))
+                      : ((p < r) ? p : ((q < r) ? r : q));
+
+      /* three-way partitioning on the character at position d */
+
+      long lt = 0;
+      long gt = n - 1;
+      long i = 0;
+      while (i <= gt)
+        {
+          int c = derep_prefix_char(a + i, d);
+          if (c < v)
+            {
+              struct derep_prefix_s t = a[lt];
+              a[lt++] = a[i];
+              a[i++] = t;
+            }
+          else if (c > v)
+            {
+              struct derep_prefix_s t = a[gt];
+              a[gt--] = a[i];
+              a[i] = t;
+            }
+          else
+            i++;
+        }
+
+      derep_prefix_sort(a, lt, d);
+      derep_prefix_sort(a + gt + 1, n - gt - 1, d);
+
+      if (v == 0)
+        {
+          /* identical sequences, keep them in order */
+          qsort(a + lt, gt + 1 - lt, sizeof(struct derep_prefix_s),
+                derep_prefix_compare_seqno);
+          return;
+        }
+
+      a += lt;
+      n = gt + 1 - lt;
+      d++;
+    }
+}
+
+static void derep_prefix_partition(long p)
+{
+  long first = derep_prefix_offsets[p];
+  long n = derep_prefix_offsets[p + 1] - first;
+
+  if (n == 0)
+    return;
+
+  /* normalize the sequences of the partition: uppercase, U by T */
+
+  size_t total = 0;
+  for(long k = 0; k < n; k++)
+    total += db_getsequencelen(derep_prefix_members[first + k]) + 1;
+
+  char * buffer = (char *) xmalloc(total);
+  struct derep_prefix_s * a = (struct derep_prefix_s *)
+    xmalloc(sizeof(struct derep_prefix_s) * n);
+
+  char * s = buffer;
+  for(long k = 0; k < n; k++)
+    {
+      unsigned int seqno = derep_prefix_members[first + k];
+      a[k].seq = s;
+      a[k].len = db_getsequencelen(seqno);
+      a[k].seqno = seqno;
+      string_normalize(s, db_getsequence(seqno), a[k].len);
+      s += a[k].len + 1;
+    }
+
+  derep_prefix_sort(a, n, 0);
+
+  /*
+    Scan in sorted order, with a stack holding the distinct sequences
+    that are prefixes of the current one. When a sequence is popped,
+    all sequences having it as a prefix have been seen, and the first
+    of them (lowest seqno) is passed on to its own longest prefix.
+  */
+
+  struct derep_prefix_stack_s * stack = (struct derep_prefix_stack_s *)
+    xmalloc(sizeof(struct derep_prefix_stack_s) * n);
+  long top = 0;
+
+  for(long k = 0; k <= n; k++)
+    {
+      unsigned int lcp = 0;
+
+      if ((k > 0) && (k < n))
+        {
+          struct derep_prefix_s * x = a + k - 1;
+          struct derep_prefix_s * y = a + k;
+          unsigned int m = MIN(x->len, y->len);
+          while ((lcp < m) && (x->seq[lcp] == y->seq[lcp]))
+            lcp++;
+
+          if ((lcp == x->len) && (lcp == y->len))
+            {
+              derep_prefix_extension[y->seqno] = DEREP_PREFIX_DUPLICATE;
+              derep_prefix_duplicate[x->seqno] = y->seqno;
+              continue;
+            }
+        }
+
+      while ((top > 0) && ((k == n) || (stack[top - 1].len > lcp)))
+        {
+          struct derep_prefix_stack_s * e = stack + --top;
+          derep_prefix_extension[e->seqno] = e->extension;
+          if (top > 0)
+            {
+              unsigned int m = MIN(e->seqno, e->extension);
+              if (m < stack[top - 1].extension)
+                stack[top - 1].extension = m;
+            }
+        }
+
+      if (k < n)
+        {
+          stack[top].seqno = a[k].seqno;
+          stack[top].len = a[k].len;
+          stack[top].extension = DEREP_PREFIX_NONE;
+          top++;
+        }
+    }
+
+  free(stack);
+  free(a);
+  free(buffer);
 }
 
+static void derep_prefix_partitions(long t)
+{
+  for(long p = t; p < DEREP_PREFIX_PARTITIONS; p += derep_threads)
+    derep_prefix_partition(p);
+}
+
+#if PTHREAD
+static void * derep_prefix_worker(void * vp)
+{
+  derep_prefix_partitions((long) vp);
+  return 0;
+}
+#endif
+
+static unsigned int derep_prefix_key(unsigned int seqno, unsigned int len)
+{
+  /* partition of a sequence, from its first len normalized symbols */
+
+  char * seq = db_getsequence(seqno);
+  unsigned int h = 0;
+  for(unsigned int j = 0; j < len; j++)
+    h = h * 31 + (unsigned char) chrmap_normalize[(int)(seq[j])];
+  return h % DEREP_PREFIX_PARTITIONS;
+}
 
 void derep_prefix()
 {
@@ -467,14 +1982,14 @@ void derep_prefix()
 
   if (opt_output)
     {
-      fp_output = fopen(opt_output, "w");
+      fp_output = fopen_output(opt_output);
       if (!fp_output)
         fatal("Unable to open output file for writing");
     }
 
   if (opt_uc)
     {
-      fp_uc = fopen(opt_uc, "w");
+      fp_uc = fopen_output(opt_uc);
       if (!fp_uc)
         fatal("Unable to open output (uc) file for writing");
     }
@@ -486,190 +2001,138 @@ void derep_prefix()
   show_rusage();
 
   long dbsequencecount = db_getsequencecount();
-  
-  /* adjust size of hash table for 2/3 fill rate */
 
-  long hashtablesize = 1;
-  int hash_shift = 0;
-  while (3 * dbsequencecount > 2 * hashtablesize)
-    {
-      hashtablesize <<= 1;
-      hash_shift++;
-    }
-  int hash_mask = hashtablesize - 1;
+#if PTHREAD
+  derep_threads = opt_threads > 0 ? opt_threads : 1;
+#else
+  derep_threads = 1;
+#endif
 
-  struct bucket * hashtable =
-    (struct bucket *) xmalloc(sizeof(bucket) * hashtablesize);
+  /* partition the sequences on their first symbols */
 
-  memset(hashtable, 0, sizeof(bucket) * hashtablesize);
+  unsigned int key_len = MIN(DEREP_PREFIX_KEY, db_getshortestsequence());
 
-  long clusters = 0;
-  long sumsize = 0;
-  unsigned long maxsize = 0;
-  double median = 0.0;
-  double average = 0.0;
+  derep_prefix_members = (unsigned int *)
+    xmalloc(sizeof(unsigned int) * (dbsequencecount + 1));
+  derep_prefix_offsets = (long *)
+    xmalloc(sizeof(long) * (DEREP_PREFIX_PARTITIONS + 1));
+  memset(derep_prefix_offsets, 0,
+         sizeof(long) * (DEREP_PREFIX_PARTITIONS + 1));
 
-  /* alloc and init table of links to other sequences in cluster */
+  for(long i=0; i<dbsequencecount; i++)
+    derep_prefix_offsets[derep_prefix_key(i, key_len) + 1]++;
+  for(long p = 0; p < DEREP_PREFIX_PARTITIONS; p++)
+    derep_prefix_offsets[p + 1] += derep_prefix_offsets[p];
 
-  unsigned int * nextseqtab = (unsigned int*) xmalloc(sizeof(unsigned int) * dbsequencecount);
-  memset(nextseqtab, 0, sizeof(unsigned int) * dbsequencecount);
+  long * fill = (long *) xmalloc(sizeof(long) * DEREP_PREFIX_PARTITIONS);
+  memcpy(fill, derep_prefix_offsets, sizeof(long) * DEREP_PREFIX_PARTITIONS);
+  for(long i=0; i<dbsequencecount; i++)
+    derep_prefix_members[fill[derep_prefix_key(i, key_len)]++] = i;
+  free(fill);
 
-  char * seq_up = (char*) xmalloc(db_getlongestsequence() + 1);
+  /* find the first extension of each distinct sequence */
 
-  /* make table of hash values of prefixes */
+  derep_prefix_extension = (unsigned int *)
+    xmalloc(sizeof(unsigned int) * (dbsequencecount + 1));
+  derep_prefix_duplicate = (unsigned int *)
+    xmalloc(sizeof(unsigned int) * (dbsequencecount + 1));
+  memset(derep_prefix_duplicate, 0, sizeof(unsigned int) * dbsequencecount);
 
-  unsigned int len_longest = db_getlongestsequence();
-  unsigned int len_shortest = db_getshortestsequence();
-  unsigned long * prefix_hashes = (unsigned long *) 
-    xmalloc(sizeof(unsigned long) * (len_longest+1));
-  
-  progress_init("Dereplicating", dbsequencecount);
+  progress_init("Dereplicating", 1);
+#if PTHREAD
+  derep_run_threads(derep_prefix_worker);
+#else
+  derep_prefix_partitions(0);
+#endif
+  progress_done();
+
+  show_rusage();
+
+  /*
+    Each sequence takes over the cluster of the one distinct sequence,
+    if any, that it is the first extension of. The members of a
+    cluster are linked as they would be when built shortest first:
+    the representative, the chain of sequences it took over, and then
+    the duplicates of each of them, innermost first.
+  */
+
+  unsigned int * child = derep_prefix_members;
   for(long i=0; i<dbsequencecount; i++)
-    {
-      unsigned int seqlen = db_getsequencelen(i);
-      char * seq = db_getsequence(i);
-
-      /* normalize sequence: uppercase and replace U by T  */
-      string_normalize(seq_up, seq, seqlen);
-
-      unsigned long ab = opt_sizein ? db_getabundance(i) : 1;
-      sumsize += ab;
-
-      /* 
-         Look for matching identical or prefix sequences.
-         
-         Use a hash function that can quickly be applied iteratively on longer
-         and longer sequences.
-         
-         Hash values are generated for all prefixes and saved.
-
-         Should start at exact sequence and then try shorter and shorter
-         sequences.
-         
-         No need to check shorter sequences than the shortest in the database.
-         
-         Three cases:
-         1) Exact match: Update count, point to next
-         2) Prefix match: Mark old, insert new, update count, point to next
-         3) No match: Insert new entry
+    child[i] = DEREP_PREFIX_NONE;
 
-      */
+  long clusters = 0;
+  for(long i=0; i<dbsequencecount; i++)
+    {
+      unsigned int e = derep_prefix_extension[i];
+      if (e == DEREP_PREFIX_NONE)
+        clusters++;
+      else if (e != DEREP_PREFIX_DUPLICATE)
+        child[e] = i;
+    }
 
-      /* compute hashes of all prefixes */
+  struct bucket * hashtable =
+    (struct bucket *) xmalloc(sizeof(bucket) * (clusters + 1));
+  memset(hashtable, 0, sizeof(bucket) * (clusters + 1));
 
-      unsigned long fnv1a_hash = 14695981039346656037UL;
-      for(unsigned int j = 0; j < seqlen; j++)
-        {
-          fnv1a_hash ^= seq_up[j];
-          fnv1a_hash *= 1099511628211UL;
-          prefix_hashes[j] = fnv1a_hash;
-        }
+  unsigned int * nextseqtab = (unsigned int*) xmalloc(sizeof(unsigned int) * dbsequencecount);
+  memset(nextseqtab, 0, sizeof(unsigned int) * dbsequencecount);
 
-      /* first, look for an identical match */
+  long sumsize = 0;
+  unsigned long maxsize = 0;
+  double median = 0.0;
+  double average = 0.0;
 
-      unsigned int prefix_len = seqlen;
+  std::vector<unsigned int> path;
+  long c = 0;
 
-      unsigned long hash = prefix_hashes[prefix_len-1];
-      struct bucket * bp = hashtable + (hash & hash_mask);
-      
-      while ((bp->size) &&
-             ((bp->deleted) ||
-              (bp->hash != hash) ||
-              (prefix_len != db_getsequencelen(bp->seqno_first)) ||
-              (seqcmp(seq_up, db_getsequence(bp->seqno_first), prefix_len))))
-        {
-          bp++;
-          if (bp >= hashtable + hashtablesize)
-            bp = hashtable;
-        }
+  for(long i=0; i<dbsequencecount; i++)
+    {
+      if (derep_prefix_extension[i] != DEREP_PREFIX_NONE)
+        continue;
 
-      /* at this point, bp points either to (1) a free empty hash bucket, or
-         (2) a bucket with an exact match. */
+      path.clear();
+      for(unsigned int u = i; u != DEREP_PREFIX_NONE; u = child[u])
+        path.push_back(u);
 
-      unsigned long orig_hash = hash;
-      struct bucket * orig_bp = bp;
+      unsigned int last = i;
+      unsigned long size = opt_sizein ? db_getabundance(i) : 1;
 
-      if (bp->size)
-        {
-          /* exact match */
-          bp->size += ab;
-          unsigned int last = bp->seqno_last;
-          nextseqtab[last] = i;
-          bp->seqno_last = i;
-          
-          if (bp->size > maxsize)
-            maxsize = bp->size;
-        }
-      else
+      for(size_t j = 1; j < path.size(); j++)
         {
-          /* look for prefix match */
-          
-          while((! bp->size) && (prefix_len-- >= len_shortest))
-            {
-              hash = prefix_hashes[prefix_len-1];
-              bp = hashtable + (hash & hash_mask);
-              
-              while ((bp->size) &&
-                     ((bp->deleted) ||
-                      (bp->hash != hash) ||
-                      (prefix_len != db_getsequencelen(bp->seqno_first)) ||
-                      (seqcmp(seq_up,
-                              db_getsequence(bp->seqno_first),
-                              prefix_len))))
-                {
-                  bp++;
-                  if (bp >= hashtable + hashtablesize)
-                    bp = hashtable;
-                }
-            }
-          
-          if ((bp->size) && (prefix_len >= len_shortest))
-            {
-              /* prefix match */
-
-              /* get necessary info, then delete prefix from hash */
-              unsigned int first = bp->seqno_first;
-              unsigned int last = bp->seqno_last;
-              unsigned int size = bp->size;
-              bp->deleted = true;
-              
-              /* create new hash entry */
-              bp = orig_bp;
-              bp->size = size + ab;
-              bp->hash = orig_hash;
-              bp->seqno_first = i;
-              nextseqtab[i] = first;
-              bp->seqno_last = last;
-              
-              if (bp->size > maxsize)
-                maxsize = bp->size;
-            }
-          else
-            {
-              /* no match */
-              orig_bp->size = ab;
-              orig_bp->hash = orig_hash;
-              orig_bp->seqno_first = i;
-              orig_bp->seqno_last = i;
-              
-              if (ab > maxsize)
-                maxsize = ab;
-              clusters++;
-            }
+          nextseqtab[last] = path[j];
+          last = path[j];
+          size += opt_sizein ? db_getabundance(last) : 1;
         }
-      
-      progress_update(i);
+
+      for(size_t j = path.size(); j > 0; j--)
+        for(unsigned int d = derep_prefix_duplicate[path[j - 1]];
+            d;
+            d = derep_prefix_duplicate[d])
+          {
+            nextseqtab[last] = d;
+            last = d;
+            size += opt_sizein ? db_getabundance(d) : 1;
+          }
+
+      struct bucket * bp = hashtable + c++;
+      bp->size = size;
+      bp->seqno_first = i;
+      bp->seqno_last = last;
+
+      sumsize += size;
+      if (size > maxsize)
+        maxsize = size;
     }
-  progress_done();
-  
-  free(prefix_hashes);
 
-  free(seq_up);
+  free(derep_prefix_duplicate);
+  free(derep_prefix_extension);
+  free(derep_prefix_offsets);
+  free(derep_prefix_members);
   
   show_rusage();
 
   progress_init("Sorting", 1);
-  qsort(hashtable, hashtablesize, sizeof(bucket), derep_compare);
+  radix_sort(hashtable, clusters, sizeof(bucket), derep_key, derep_compare);
   progress_done();
 
   if (clusters > 0)
@@ -60,3 +60,4 @@
 
 void derep_fulllength();
 void derep_prefix();
+void derep_samples();
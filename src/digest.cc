@@ -0,0 +1,406 @@
+/*
+
+  VSEARCH: a versatile open source tool for metagenomics
+
+  Copyright (C) 2014-2015, Torbjorn Rognes, Frederic Mahe and Tomas Flouri
+  All rights reserved.
+
+  Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+  Department of Informatics, University of Oslo,
+  PO Box 1080 Blindern, NO-0316 Oslo, Norway
+
+  This software is dual-licensed and available under a choice
+  of one of two licenses, either under the terms of the GNU
+  General Public License version 3 or the BSD 2-Clause License.
+
+
+  GNU General Public License version 3
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+  The BSD 2-Clause License
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vsearch.h"
+#include <algorithm>
+
+/*
+  Multi-buffer SHA1 and MD5 digests of normalized sequences.
+
+  Both algorithms only use 32-bit additions, logical operations and
+  rotations, so DIGEST_LANES independent messages are hashed at once
+  in the 32-bit lanes of SSE2 registers, one 64-byte block of each at
+  a time. The blocks are assembled lane by lane, normalizing the
+  sequence (uppercase, U replaced by T) and adding the padding and
+  length on the fly, so no normalized copy is made. The sequences are
+  grouped by their number of blocks, so that the lanes of a group
+  mostly finish together; a lane that has run out of blocks keeps its
+  state while the others continue.
+
+  The digests are identical to those of get_hex_seq_digest_sha1 and
+  get_hex_seq_digest_md5. The function has no state of its own and
+  may be called from several threads at once.
+*/
+
+static const unsigned int digest_md5_k[64] =
+  {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+  };
+
+static const int digest_md5_r[64] =
+  {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+  };
+
+static const char digest_hexdigits[] = "0123456789abcdef";
+
+#define DIGEST_ROTL(x, n) \
+  _mm_or_si128(_mm_slli_epi32((x), (n)), _mm_srli_epi32((x), 32 - (n)))
+
+static inline unsigned long digest_blocks(unsigned int len)
+{
+  /* number of 64-byte blocks with the 0x80 byte and 8-byte length */
+  return (len + 8) / 64 + 1;
+}
+
+static void digest_block(unsigned char * block,
+                         char * seq,
+                         unsigned int len,
+                         unsigned long b,
+                         bool bigendian)
+{
+  /*
+    Assemble block b of the padded normalized message. For SHA1 the
+    bytes of each word are stored in reverse order, so that the words
+    can be loaded in the native little-endian order in both cases.
+  */
+
+  unsigned long start = 64 * b;
+  unsigned int swap = bigendian ? 3 : 0;
+  unsigned char * p = (unsigned char *) seq + start;
+
+  if (start + 64 <= len)
+    {
+      for(unsigned int i = 0; i < 64; i++)
+        block[i ^ swap] = chrmap_normalize[p[i]];
+      return;
+    }
+
+  for(unsigned int i = 0; i < 64; i++)
+    {
+      unsigned long pos = start + i;
+      if (pos < len)
+        block[i ^ swap] = chrmap_normalize[p[i]];
+      else if (pos == len)
+        block[i ^ swap] = 0x80;
+      else
+        block[i ^ swap] = 0;
+    }
+
+  if (b + 1 == digest_blocks(len))
+    {
+      unsigned long bits = 8UL * len;
+      for(unsigned int i = 0; i < 8; i++)
+        {
+          unsigned char byte = (bits >> (8 * i)) & 0xff;
+          if (bigendian)
+            block[(63 - i) ^ swap] = byte;
+          else
+            block[56 + i] = byte;
+        }
+    }
+}
+
+static inline __m128i digest_select(__m128i mask, __m128i x, __m128i y)
+{
+  /* x in the lanes of the mask, y elsewhere */
+  return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+static void digest_sha1_block(__m128i * state, __m128i * m, __m128i mask)
+{
+  __m128i w[16];
+  for(int t = 0; t < 16; t++)
+    w[t] = m[t];
+
+  __m128i a = state[0];
+  __m128i b = state[1];
+  __m128i c = state[2];
+  __m128i d = state[3];
+  __m128i e = state[4];
+
+  /* the message schedule is kept in a ring of 16 words */
+
+#define DIGEST_SHA1_ROUND(f, k)                                         \
+  {                                                                     \
+    if (t >= 16)                                                        \
+      {                                                                 \
+        __m128i x = _mm_xor_si128(_mm_xor_si128(w[(t - 3) & 15],        \
+                                                w[(t - 8) & 15]),       \
+                                  _mm_xor_si128(w[(t - 14) & 15],       \
+                                                w[t & 15]));            \
+        w[t & 15] = DIGEST_ROTL(x, 1);                                  \
+      }                                                                 \
+    __m128i temp = _mm_add_epi32(_mm_add_epi32(DIGEST_ROTL(a, 5), (f)), \
+                                 _mm_add_epi32(_mm_add_epi32(e, (k)),   \
+                                               w[t & 15]));             \
+    e = d;                                                              \
+    d = c;                                                              \
+    c = DIGEST_ROTL(b, 30);                                             \
+    b = a;                                                              \
+    a = temp;                                                           \
+  }
+
+  __m128i k1 = _mm_set1_epi32(0x5a827999);
+  __m128i k2 = _mm_set1_epi32(0x6ed9eba1);
+  __m128i k3 = _mm_set1_epi32((int) 0x8f1bbcdc);
+  __m128i k4 = _mm_set1_epi32((int) 0xca62c1d6);
+
+  for(int t = 0; t < 20; t++)
+    DIGEST_SHA1_ROUND(_mm_xor_si128(d, _mm_and_si128(b, _mm_xor_si128(c, d))),
+                      k1);
+  for(int t = 20; t < 40; t++)
+    DIGEST_SHA1_ROUND(_mm_xor_si128(_mm_xor_si128(b, c), d), k2);
+  for(int t = 40; t < 60; t++)
+    DIGEST_SHA1_ROUND(_mm_or_si128(_mm_and_si128(b, c),
+                                   _mm_and_si128(d, _mm_or_si128(b, c))),
+                      k3);
+  for(int t = 60; t < 80; t++)
+    DIGEST_SHA1_ROUND(_mm_xor_si128(_mm_xor_si128(b, c), d), k4);
+
+#undef DIGEST_SHA1_ROUND
+
+  state[0] = digest_select(mask, _mm_add_epi32(state[0], a), state[0]);
+  state[1] = digest_select(mask, _mm_add_epi32(state[1], b), state[1]);
+  state[2] = digest_select(mask, _mm_add_epi32(state[2], c), state[2]);
+  state[3] = digest_select(mask, _mm_add_epi32(state[3], d), state[3]);
+  state[4] = digest_select(mask, _mm_add_epi32(state[4], e), state[4]);
+}
+
+static void digest_md5_block(__m128i * state, __m128i * m, __m128i mask)
+{
+  __m128i a = state[0];
+  __m128i b = state[1];
+  __m128i c = state[2];
+  __m128i d = state[3];
+  __m128i ones = _mm_set1_epi32(-1);
+
+#define DIGEST_MD5_ROUND(f, g)                                          \
+  {                                                                     \
+    __m128i k = _mm_set1_epi32((int) digest_md5_k[i]);                  \
+    __m128i x = _mm_add_epi32(_mm_add_epi32((f), a),                    \
+                              _mm_add_epi32(k, m[(g)]));                \
+    __m128i r = _mm_cvtsi32_si128(digest_md5_r[i]);                     \
+    __m128i l = _mm_cvtsi32_si128(32 - digest_md5_r[i]);                \
+    a = d;                                                              \
+    d = c;                                                              \
+    c = b;                                                              \
+    b = _mm_add_epi32(b, _mm_or_si128(_mm_sll_epi32(x, r),              \
+                                      _mm_srl_epi32(x, l)));            \
+  }
+
+  for(int i = 0; i < 16; i++)
+    DIGEST_MD5_ROUND(_mm_xor_si128(d, _mm_and_si128(b, _mm_xor_si128(c, d))),
+                     i);
+  for(int i = 16; i < 32; i++)
+    DIGEST_MD5_ROUND(_mm_xor_si128(c, _mm_and_si128(d, _mm_xor_si128(b, c))),
+                     (5 * i + 1) & 15);
+  for(int i = 32; i < 48; i++)
+    DIGEST_MD5_ROUND(_mm_xor_si128(_mm_xor_si128(b, c), d),
+                     (3 * i + 5) & 15);
+  for(int i = 48; i < 64; i++)
+    DIGEST_MD5_ROUND(_mm_xor_si128(c, _mm_or_si128(b, _mm_xor_si128(d, ones))),
+                     (7 * i) & 15);
+
+#undef DIGEST_MD5_ROUND
+
+  state[0] = digest_select(mask, _mm_add_epi32(state[0], a), state[0]);
+  state[1] = digest_select(mask, _mm_add_epi32(state[1], b), state[1]);
+  state[2] = digest_select(mask, _mm_add_epi32(state[2], c), state[2]);
+  state[3] = digest_select(mask, _mm_add_epi32(state[3], d), state[3]);
+}
+
+static void digest_lanes(int type,
+                         int lanes,
+                         char ** seqs,
+                         unsigned int * lens,
+                         char ** hex)
+{
+  /* digest up to DIGEST_LANES sequences in parallel */
+
+  bool sha1 = (type == DIGEST_SHA1);
+  int words = sha1 ? 5 : 4;
+
+  __m128i state[5];
+  if (sha1)
+    {
+      state[0] = _mm_set1_epi32(0x67452301);
+      state[1] = _mm_set1_epi32((int) 0xefcdab89);
+      state[2] = _mm_set1_epi32((int) 0x98badcfe);
+      state[3] = _mm_set1_epi32(0x10325476);
+      state[4] = _mm_set1_epi32((int) 0xc3d2e1f0);
+    }
+  else
+    {
+      state[0] = _mm_set1_epi32(0x67452301);
+      state[1] = _mm_set1_epi32((int) 0xefcdab89);
+      state[2] = _mm_set1_epi32((int) 0x98badcfe);
+      state[3] = _mm_set1_epi32(0x10325476);
+    }
+
+  unsigned long blocks[DIGEST_LANES];
+  unsigned long maxblocks = 0;
+  for(int l = 0; l < DIGEST_LANES; l++)
+    {
+      blocks[l] = l < lanes ? digest_blocks(lens[l]) : 0;
+      maxblocks = MAX(maxblocks, blocks[l]);
+    }
+
+  /* the blocks of lanes without more blocks are left as they are */
+  unsigned char block[DIGEST_LANES][64];
+  memset(block, 0, sizeof(block));
+  __m128i m[16];
+
+  for(unsigned long b = 0; b < maxblocks; b++)
+    {
+      for(int l = 0; l < DIGEST_LANES; l++)
+        if (b < blocks[l])
+          digest_block(block[l], seqs[l], lens[l], b, sha1);
+
+      /* transpose the blocks into vectors of the same word of each lane */
+      for(int t = 0; t < 16; t += 4)
+        {
+          __m128i r0 = _mm_loadu_si128((__m128i *) (block[0] + 4 * t));
+          __m128i r1 = _mm_loadu_si128((__m128i *) (block[1] + 4 * t));
+          __m128i r2 = _mm_loadu_si128((__m128i *) (block[2] + 4 * t));
+          __m128i r3 = _mm_loadu_si128((__m128i *) (block[3] + 4 * t));
+          __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+          __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+          __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+          __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+          m[t + 0] = _mm_unpacklo_epi64(t0, t1);
+          m[t + 1] = _mm_unpackhi_epi64(t0, t1);
+          m[t + 2] = _mm_unpacklo_epi64(t2, t3);
+          m[t + 3] = _mm_unpackhi_epi64(t2, t3);
+        }
+
+      __m128i mask = _mm_set_epi32(b < blocks[3] ? -1 : 0,
+                                   b < blocks[2] ? -1 : 0,
+                                   b < blocks[1] ? -1 : 0,
+                                   b < blocks[0] ? -1 : 0);
+
+      if (sha1)
+        digest_sha1_block(state, m, mask);
+      else
+        digest_md5_block(state, m, mask);
+    }
+
+  /* write the words of each lane in hexadecimal */
+
+  unsigned int out[5][DIGEST_LANES];
+  for(int i = 0; i < words; i++)
+    _mm_storeu_si128((__m128i *) out[i], state[i]);
+
+  for(int l = 0; l < lanes; l++)
+    {
+      char * h = hex[l];
+      for(int i = 0; i < words; i++)
+        for(int j = 0; j < 4; j++)
+          {
+            unsigned int byte = sha1 ?
+              (out[i][l] >> (24 - 8 * j)) & 0xff :
+              (out[i][l] >> (8 * j)) & 0xff;
+            *h++ = digest_hexdigits[byte >> 4];
+            *h++ = digest_hexdigits[byte & 15];
+          }
+      *h = 0;
+    }
+}
+
+void digest_hex_seqs(int type,
+                     long count,
+                     char ** seqs,
+                     unsigned int * lens,
+                     char ** hex)
+{
+  /* order the sequences by their number of blocks, then by index */
+
+  unsigned long * order =
+    (unsigned long *) xmalloc(count * sizeof(unsigned long));
+  for(long i = 0; i < count; i++)
+    order[i] = (MIN(digest_blocks(lens[i]), 0xffffffffUL) << 32) | i;
+  std::sort(order, order + count);
+
+  for(long i = 0; i < count; i += DIGEST_LANES)
+    {
+      int lanes = MIN(DIGEST_LANES, count - i);
+      char * lane_seqs[DIGEST_LANES];
+      unsigned int lane_lens[DIGEST_LANES];
+      char * lane_hex[DIGEST_LANES];
+      for(int l = 0; l < lanes; l++)
+        {
+          unsigned long k = order[i + l] & 0xffffffffUL;
+          lane_seqs[l] = seqs[k];
+          lane_lens[l] = lens[k];
+          lane_hex[l] = hex[k];
+        }
+      digest_lanes(type, lanes, lane_seqs, lane_lens, lane_hex);
+    }
+
+  free(order);
+}
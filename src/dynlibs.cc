@@ -70,6 +70,10 @@ void * gz_lib;
 gzFile (*gzdopen_p)(int, const char *);
 int (*gzclose_p)(gzFile);
 int (*gzread_p)(gzFile, void *, unsigned);
+int (*deflateInit2__p)(z_streamp, int, int, int, int, int, const char *, int);
+int (*deflate_p)(z_streamp, int);
+int (*deflateEnd_p)(z_streamp);
+uLong (*deflateBound_p)(z_streamp, uLong);
 #endif
 
 #ifdef HAVE_BZLIB_H
@@ -96,6 +100,15 @@ void dynlibs_open()
         dlsym(gz_lib, "gzclose");
       gzread_p = (int (*)(gzFile, void*, unsigned))
         dlsym(gz_lib, "gzread");
+      deflateInit2__p = (int (*)(z_streamp, int, int, int, int, int,
+                                 const char *, int))
+        dlsym(gz_lib, "deflateInit2_");
+      deflate_p = (int (*)(z_streamp, int))
+        dlsym(gz_lib, "deflate");
+      deflateEnd_p = (int (*)(z_streamp))
+        dlsym(gz_lib, "deflateEnd");
+      deflateBound_p = (uLong (*)(z_streamp, uLong))
+        dlsym(gz_lib, "deflateBound");
     }
 #endif
 
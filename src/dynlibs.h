@@ -63,6 +63,11 @@ extern void * gz_lib;
 extern gzFile (*gzdopen_p)(int, const char *);
 extern int (*gzclose_p)(gzFile);
 extern int (*gzread_p)(gzFile, void*, unsigned);
+extern int (*deflateInit2__p)(z_streamp, int, int, int, int, int,
+                              const char *, int);
+extern int (*deflate_p)(z_streamp, int);
+extern int (*deflateEnd_p)(z_streamp);
+extern uLong (*deflateBound_p)(z_streamp, uLong);
 #endif
 
 #ifdef HAVE_BZLIB_H
@@ -0,0 +1,437 @@
+/*
+
+  VSEARCH: a versatile open source tool for metagenomics
+
+  Copyright (C) 2014-2015, Torbjorn Rognes, Frederic Mahe and Tomas Flouri
+  All rights reserved.
+
+  Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+  Department of Informatics, University of Oslo,
+  PO Box 1080 Blindern, NO-0316 Oslo, Norway
+
+  This software is dual-licensed and available under a choice
+  of one of two licenses, either under the terms of the GNU
+  General Public License version 3 or the BSD 2-Clause License.
+
+
+  GNU General Public License version 3
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+  The BSD 2-Clause License
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vsearch.h"
+
+/*
+  External merge sort of the sequences in a file.
+
+  With --memory_budget, sortbysize and sortbylength do not read the
+  whole file into memory. The sequences are collected while reading
+  until the budget would be exceeded; this run is then sorted and
+  written to an anonymous temporary file (see fopen_temp). About a
+  quarter of the budget is set aside for the index of the run and the
+  rest holds the headers and sequences. When the file fits in a
+  single run, nothing is written and the sorted run is returned from
+  memory.
+
+  Otherwise, the runs are merged with a heap ordered by the same
+  comparison function. At most EXTSORT_MERGE_MAX runs are merged at a
+  time; when there are more, groups of them are first merged into
+  longer runs in additional passes. The comparison function must
+  define a total order, e.g. by falling back to the sequence number,
+  for the result to be identical to an in-memory sort.
+
+  extsort_next returns the sequences in order. The entry returned is
+  only valid until the next call.
+*/
+
+struct extsort_record_s
+{
+  unsigned int header_len;
+  unsigned int seqlen;
+  unsigned int size;
+  unsigned int seqno;
+};
+
+struct extsort_run_s
+{
+  FILE * fp;
+  long left;
+  struct topn_entry_s e;
+};
+
+static bool (*extsort_select)(struct topn_entry_s *);
+static int (*extsort_compare)(const void *, const void *);
+static long extsort_selected;
+
+/* the run being collected, with the header offsets into the data */
+static char * extsort_data;
+static size_t extsort_data_alloc;
+static size_t extsort_data_used;
+static size_t extsort_data_max;
+static struct topn_entry_s * extsort_entries;
+static size_t * extsort_offsets;
+static long extsort_entries_alloc;
+static long extsort_entries_count;
+static long extsort_entries_max;
+static long extsort_entries_next;
+
+/* the runs written to temporary files, and the ones being merged */
+static std::vector<FILE *> extsort_files;
+static std::vector<long> extsort_file_counts;
+static struct extsort_run_s * extsort_runs;
+static struct extsort_run_s ** extsort_heap;
+static long extsort_run_count;
+static long extsort_heap_count;
+static struct topn_entry_s extsort_current;
+
+static void extsort_sort_run()
+{
+  for(long i = 0; i < extsort_entries_count; i++)
+    {
+      struct topn_entry_s * e = extsort_entries + i;
+      e->header = extsort_data + extsort_offsets[i];
+      e->sequence = e->header + e->header_len + 1;
+    }
+
+  qsort(extsort_entries, extsort_entries_count,
+        sizeof(struct topn_entry_s), extsort_compare);
+}
+
+static void extsort_write(FILE * fp, struct topn_entry_s * e)
+{
+  struct extsort_record_s r;
+  r.header_len = e->header_len;
+  r.seqlen = e->seqlen;
+  r.size = e->size;
+  r.seqno = e->seqno;
+  fwrite_temp(fp, & r, sizeof(r));
+  fwrite_temp(fp, e->header, e->header_len + 1);
+  fwrite_temp(fp, e->sequence, e->seqlen + 1);
+}
+
+static void extsort_read(FILE * fp, struct topn_entry_s * e)
+{
+  struct extsort_record_s r;
+  fread_temp(fp, & r, sizeof(r));
+  e->header_len = r.header_len;
+  e->seqlen = r.seqlen;
+  e->size = r.size;
+  e->seqno = r.seqno;
+  e->header = (char *) xrealloc(e->header, r.header_len + 1);
+  fread_temp(fp, e->header, r.header_len + 1);
+  e->sequence = (char *) xrealloc(e->sequence, r.seqlen + 1);
+  fread_temp(fp, e->sequence, r.seqlen + 1);
+}
+
+static void extsort_spill()
+{
+  /* sort the collected run and write it to a temporary file */
+
+  extsort_sort_run();
+
+  FILE * fp = fopen_temp();
+  for(long i = 0; i < extsort_entries_count; i++)
+    extsort_write(fp, extsort_entries + i);
+  rewind_temp(fp);
+
+  extsort_files.push_back(fp);
+  extsort_file_counts.push_back(extsort_entries_count);
+
+  extsort_data_used = 0;
+  extsort_entries_count = 0;
+}
+
+static void extsort_take(struct topn_entry_s * e)
+{
+  if (extsort_select && ! extsort_select(e))
+    return;
+
+  extsort_selected++;
+
+  size_t needed = e->header_len + 1 + e->seqlen + 1;
+
+  if ((extsort_entries_count > 0) &&
+      ((extsort_data_used + needed > extsort_data_max) ||
+       (extsort_entries_count == extsort_entries_max)))
+    extsort_spill();
+
+  if (extsort_data_used + needed > extsort_data_alloc)
+    {
+      extsort_data_alloc = MIN(MAX(2 * extsort_data_alloc, 1048576UL),
+                               extsort_data_max);
+      extsort_data_alloc = MAX(extsort_data_alloc, extsort_data_used + needed);
+      extsort_data = (char *) xrealloc(extsort_data, extsort_data_alloc);
+    }
+
+  if (extsort_entries_count == extsort_entries_alloc)
+    {
+      extsort_entries_alloc = MIN(MAX(2 * extsort_entries_alloc, 1024L),
+                                  extsort_entries_max);
+      extsort_entries = (struct topn_entry_s *)
+        xrealloc(extsort_entries,
+                 extsort_entries_alloc * sizeof(struct topn_entry_s));
+      extsort_offsets = (size_t *)
+        xrealloc(extsort_offsets, extsort_entries_alloc * sizeof(size_t));
+    }
+
+  struct topn_entry_s * x = extsort_entries + extsort_entries_count;
+  x->header_len = e->header_len;
+  x->seqlen = e->seqlen;
+  x->size = e->size;
+  x->seqno = e->seqno;
+  extsort_offsets[extsort_entries_count] = extsort_data_used;
+  extsort_entries_count++;
+
+  memcpy(extsort_data + extsort_data_used, e->header, e->header_len + 1);
+  extsort_data_used += e->header_len + 1;
+  memcpy(extsort_data + extsort_data_used, e->sequence, e->seqlen + 1);
+  extsort_data_used += e->seqlen + 1;
+}
+
+static void extsort_heap_down(long i)
+{
+  struct extsort_run_s * x = extsort_heap[i];
+  while (2 * i + 1 < extsort_heap_count)
+    {
+      long c = 2 * i + 1;
+      if ((c + 1 < extsort_heap_count) &&
+          (extsort_compare(& extsort_heap[c + 1]->e,
+                           & extsort_heap[c]->e) < 0))
+        c++;
+      if (extsort_compare(& x->e, & extsort_heap[c]->e) <= 0)
+        break;
+      extsort_heap[i] = extsort_heap[c];
+      i = c;
+    }
+  extsort_heap[i] = x;
+}
+
+static void extsort_merge_open(long first, long count)
+{
+  /* start merging count of the runs in the temporary files */
+
+  extsort_run_count = count;
+  extsort_runs = (struct extsort_run_s *)
+    xmalloc(count * sizeof(struct extsort_run_s));
+  extsort_heap = (struct extsort_run_s **)
+    xmalloc(count * sizeof(struct extsort_run_s *));
+  extsort_heap_count = 0;
+
+  for(long i = 0; i < count; i++)
+    {
+      struct extsort_run_s * run = extsort_runs + i;
+      run->fp = extsort_files[first + i];
+      run->left = extsort_file_counts[first + i];
+      run->e.header = 0;
+      run->e.sequence = 0;
+      if (run->left > 0)
+        {
+          extsort_read(run->fp, & run->e);
+          run->left--;
+          extsort_heap[extsort_heap_count++] = run;
+        }
+    }
+
+  for(long i = extsort_heap_count / 2 - 1; i >= 0; i--)
+    extsort_heap_down(i);
+}
+
+static struct topn_entry_s * extsort_merge_next()
+{
+  if (extsort_heap_count == 0)
+    return 0;
+
+  /* take over the buffers of the first entry and refill its run */
+
+  struct extsort_run_s * run = extsort_heap[0];
+  struct topn_entry_s t = extsort_current;
+  extsort_current = run->e;
+  run->e = t;
+
+  if (run->left > 0)
+    {
+      extsort_read(run->fp, & run->e);
+      run->left--;
+    }
+  else
+    extsort_heap[0] = extsort_heap[--extsort_heap_count];
+
+  if (extsort_heap_count > 0)
+    extsort_heap_down(0);
+
+  return & extsort_current;
+}
+
+static void extsort_merge_close()
+{
+  for(long i = 0; i < extsort_run_count; i++)
+    {
+      fclose(extsort_runs[i].fp);
+      free(extsort_runs[i].e.header);
+      free(extsort_runs[i].e.sequence);
+    }
+  free(extsort_runs);
+  extsort_runs = 0;
+  free(extsort_heap);
+  extsort_heap = 0;
+  extsort_run_count = 0;
+  extsort_heap_count = 0;
+}
+
+void extsort_open(const char * filename,
+                  unsigned long budget,
+                  bool (*select)(struct topn_entry_s *),
+                  int (*compare)(const void *, const void *))
+{
+  extsort_select = select;
+  extsort_compare = compare;
+  extsort_selected = 0;
+
+  extsort_data_max = MAX(budget - budget / 4, 1);
+  extsort_data_alloc = 0;
+  extsort_data_used = 0;
+  extsort_data = 0;
+
+  extsort_entries_max =
+    MAX(budget / 4 / (sizeof(struct topn_entry_s) + sizeof(size_t)), 1);
+  extsort_entries_alloc = 0;
+  extsort_entries_count = 0;
+  extsort_entries_next = 0;
+  extsort_entries = 0;
+  extsort_offsets = 0;
+
+  extsort_current.header = 0;
+  extsort_current.sequence = 0;
+
+  topn_scan(filename, extsort_take);
+
+  if (extsort_files.empty())
+    {
+      /* everything fits in memory */
+      progress_init("Sorting", 100);
+      extsort_sort_run();
+      progress_done();
+      return;
+    }
+
+  if (extsort_entries_count > 0)
+    extsort_spill();
+
+  free(extsort_data);
+  extsort_data = 0;
+  free(extsort_entries);
+  extsort_entries = 0;
+  free(extsort_offsets);
+  extsort_offsets = 0;
+
+  /* merge groups of runs until they can all be merged at once */
+
+  while (extsort_files.size() > EXTSORT_MERGE_MAX)
+    {
+      std::vector<FILE *> files;
+      std::vector<long> counts;
+      long runs = extsort_files.size();
+
+      progress_init("Merging temporary files", runs);
+      for(long first = 0; first < runs; first += EXTSORT_MERGE_MAX)
+        {
+          long count = MIN(EXTSORT_MERGE_MAX, runs - first);
+          long merged = 0;
+          FILE * fp = fopen_temp();
+          extsort_merge_open(first, count);
+          struct topn_entry_s * e;
+          while ((e = extsort_merge_next()))
+            {
+              extsort_write(fp, e);
+              merged++;
+            }
+          extsort_merge_close();
+          rewind_temp(fp);
+          files.push_back(fp);
+          counts.push_back(merged);
+          progress_update(first + count);
+        }
+      progress_done();
+
+      extsort_files.swap(files);
+      extsort_file_counts.swap(counts);
+    }
+
+  extsort_merge_open(0, extsort_files.size());
+}
+
+long extsort_count()
+{
+  return extsort_selected;
+}
+
+struct topn_entry_s * extsort_next()
+{
+  if (extsort_runs)
+    return extsort_merge_next();
+  else if (extsort_entries_next < extsort_entries_count)
+    return extsort_entries + extsort_entries_next++;
+  else
+    return 0;
+}
+
+void extsort_close()
+{
+  if (extsort_runs)
+    extsort_merge_close();
+
+  free(extsort_current.header);
+  free(extsort_current.sequence);
+  extsort_current.header = 0;
+  extsort_current.sequence = 0;
+
+  free(extsort_data);
+  extsort_data = 0;
+  free(extsort_entries);
+  extsort_entries = 0;
+  free(extsort_offsets);
+  extsort_offsets = 0;
+  extsort_entries_count = 0;
+
+  extsort_files.clear();
+  extsort_file_counts.clear();
+}
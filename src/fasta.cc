@@ -143,7 +143,7 @@ fasta_handle fasta_open(const char * filename)
   if (h->format == FORMAT_BZIP)
     {
       /* BZIP2: Keep original file open, then open as bzipped file as well */
-#ifdef HAVE_ZLIB_H
+#ifdef HAVE_BZLIB_H
       if (!bz2_lib)
         fatal("Files compressed with bzip2 are not supported");
       int bzError;
@@ -356,11 +356,31 @@ void fasta_filter_sequence(fasta_handle h,
 
   char * p = h->sequence_buffer.data;
   char * q = p;
+  char * e = p + h->sequence_buffer.length;
+  char * scalar_until = p;
   char c;
   char msg[200];
 
-  while ((c = *p++))
+  while (p < e)
     {
+      /* copy runs of plain nucleotides quickly, but stay with the
+         table below for a while if the last run was short */
+      if (p >= scalar_until)
+        {
+          unsigned long n = fastx_scan_nucleotides(q, p, e - p, char_mapping);
+          p += n;
+          q += n;
+          if (n < 16)
+            scalar_until = p + 16;
+
+          if (p == e)
+            break;
+        }
+
+      c = *p++;
+      if (! c)
+        break;
+
       char m = char_action[(int)c];
 
       switch(m)
@@ -409,18 +429,6 @@ void fasta_filter_sequence(fasta_handle h,
   h->sequence_buffer.length = q - h->sequence_buffer.data;
 }
 
-char* isLineFeed(char* searchData, int rest) {
-	char* lf = NULL;
-	
-      /* find LF */
-      lf = (char *) memchr(searchData,'\n', rest);
-	
-	//try /r
-	if (lf == NULL) {  lf = (char *) memchr(searchData,'\r', rest); }
-	if (lf == NULL) { lf = (char *) memchr(searchData,'\f', rest); }
-	return lf;
-}
-
 bool fasta_next(fasta_handle h,
                 bool truncateatspace,
                 char * char_mapping)
@@ -453,8 +461,8 @@ bool fasta_next(fasta_handle h,
         fatal("Invalid FASTA - header must be terminated with newline");
       
       /* find LF */
-      lf = isLineFeed(h->file_buffer.data + h->file_buffer.position, rest);
-
+      lf = fastx_scan_linefeed(h->file_buffer.data + h->file_buffer.position,
+                               rest);
 
       /* copy to header buffer */
       unsigned long len = rest;
@@ -473,7 +481,8 @@ bool fasta_next(fasta_handle h,
 
   /* read one or more sequence lines */
 
-  while (1)
+  bool next_record = false;
+  while (! next_record)
     {
       /* get more data, if necessary */
       rest = fasta_file_fill_buffer(h);
@@ -482,24 +491,33 @@ bool fasta_next(fasta_handle h,
       if (rest == 0)
         break;
 
-      /* end if new sequence starts */
-      if (lf && (h->file_buffer.data[h->file_buffer.position] == '>'))
-        break;
+      /* step over the lines available in the buffer and copy them
+         in one go, end if new sequence starts */
 
-      /* find LF */
-      lf = isLineFeed(h->file_buffer.data + h->file_buffer.position, rest);
+      char * start = h->file_buffer.data + h->file_buffer.position;
+      char * end = start + rest;
+      char * p = start;
 
-      unsigned long len = rest;
-      if (lf)
+      while (p < end)
         {
-          /* LF found, copy up to and including LF */
-          len = lf - (h->file_buffer.data + h->file_buffer.position) + 1;
+          if (lf && (*p == '>'))
+            {
+              next_record = true;
+              break;
+            }
+
+          /* find LF */
+          lf = fastx_scan_linefeed(p, end - p);
+
+          if (lf)
+            p = lf + 1;
+          else
+            p = end;
         }
-      buffer_extend(& h->sequence_buffer,
-                    h->file_buffer.data + h->file_buffer.position,
-                    len);
+
+      unsigned long len = p - start;
+      buffer_extend(& h->sequence_buffer, start, len);
       h->file_buffer.position += len;
-      rest -= len;
     }
 
   h->seqno++;
@@ -570,6 +588,40 @@ char * fasta_get_sequence(fasta_handle h)
 
 /* fasta output */
 
+void fasta_format_header(xstring * s, const char * hdr)
+{
+  s->add_c('>');
+  s->add_s(hdr);
+  s->add_c('\n');
+}
+
+void fasta_format_sequence(xstring * s, char * seq,
+                           unsigned long len, int width)
+{
+  /* as fasta_print_sequence, but append to a string */
+
+  if (width < 1)
+    {
+      s->add_sn(seq, len);
+      s->add_c('\n');
+    }
+  else
+    {
+      for(unsigned long i=0; i<len; i += width)
+        {
+          s->add_sn(seq + i, MIN(len - i, (unsigned long) width));
+          s->add_c('\n');
+        }
+    }
+}
+
+void fasta_format(xstring * s, const char * hdr,
+                  char * seq, unsigned long len)
+{
+  fasta_format_header(s, hdr);
+  fasta_format_sequence(s, seq, len, opt_fasta_width);
+}
+
 void fasta_print_header(FILE * fp, const char * hdr)
 {
   fprintf(fp, ">%s\n", hdr);
@@ -605,18 +657,23 @@ void fasta_print(FILE * fp, const char * hdr,
 }
 
 
-void fasta_print_relabel(FILE * fp,
-                         char * seq,
-                         int len,
-                         char * header,
-                         int header_len,
-                         int abundance,
-                         int ordinal)
+static void fasta_print_relabel_span(FILE * fp,
+                                     char * seq,
+                                     int len,
+                                     char * header,
+                                     int header_len,
+                                     int size_start,
+                                     int size_end,
+                                     int abundance,
+                                     int ordinal,
+                                     const char * digest)
 {
   fprintf(fp, ">");
   if (opt_relabel || opt_relabel_sha1 || opt_relabel_md5)
     {
-      if (opt_relabel_sha1)
+      if (digest)
+        fprintf(fp, "%s", digest);
+      else if (opt_relabel_sha1)
         fprint_seq_digest_sha1(fp, seq, len);
       else if (opt_relabel_md5)
         fprint_seq_digest_md5(fp, seq, len);
@@ -631,18 +688,20 @@ void fasta_print_relabel(FILE * fp,
     }
   else if (opt_sizeout)
     {
-      abundance_fprint_header_with_size(global_abundance,
-                                        fp,
-                                        header,
-                                        header_len,
-                                        abundance);
+      abundance_fprint_span_with_size(fp,
+                                      header,
+                                      header_len,
+                                      size_start,
+                                      size_end,
+                                      abundance);
     }
   else if (opt_xsize)
     {
-      abundance_fprint_header_strip_size(global_abundance,
-                                         fp,
-                                         header,
-                                         header_len);
+      abundance_fprint_span_strip_size(fp,
+                                       header,
+                                       header_len,
+                                       size_start,
+                                       size_end);
     }
   else
     {
@@ -653,17 +712,60 @@ void fasta_print_relabel(FILE * fp,
   fasta_print_sequence(fp, seq, len, opt_fasta_width);
 }
 
+void fasta_print_relabel(FILE * fp,
+                         char * seq,
+                         int len,
+                         char * header,
+                         int header_len,
+                         int abundance,
+                         int ordinal)
+{
+  int size_start = 0;
+  int size_end = 0;
+
+  if (opt_sizeout || opt_xsize)
+    abundance_scan(header, header_len, & size_start, & size_end);
+
+  fasta_print_relabel_span(fp, seq, len, header, header_len,
+                           size_start, size_end, abundance, ordinal, 0);
+}
+
+void fasta_print_relabel_digest(FILE * fp,
+                                char * seq,
+                                int len,
+                                char * header,
+                                int header_len,
+                                int abundance,
+                                int ordinal,
+                                const char * digest)
+{
+  /* as above, with the hex digest of the sequence already computed */
+
+  int size_start = 0;
+  int size_end = 0;
+
+  if (opt_sizeout || opt_xsize)
+    abundance_scan(header, header_len, & size_start, & size_end);
+
+  fasta_print_relabel_span(fp, seq, len, header, header_len,
+                           size_start, size_end, abundance, ordinal, digest);
+}
+
 void fasta_print_db_relabel(FILE * fp,
                             unsigned long seqno,
                             int ordinal)
 {
-  fasta_print_relabel(fp,
-                      db_getsequence(seqno),
-                      db_getsequencelen(seqno),
-                      db_getheader(seqno),
-                      db_getheaderlen(seqno),
-                      db_getabundance(seqno),
-                      ordinal);
+  /* the abundance annotation was located by db_read */
+  fasta_print_relabel_span(fp,
+                           db_getsequence(seqno),
+                           db_getsequencelen(seqno),
+                           db_getheader(seqno),
+                           db_getheaderlen(seqno),
+                           seqindex[seqno].size_start,
+                           seqindex[seqno].size_end,
+                           db_getabundance(seqno),
+                           ordinal,
+                           0);
 }
 
 void fasta_print_db_sequence(FILE * fp, unsigned long seqno)
@@ -685,15 +787,8 @@ void fasta_print_db(FILE * fp, unsigned long seqno)
 
 void fasta_print_db_size(FILE * fp, unsigned long seqno, unsigned long size)
 {
-  char * hdr = db_getheader(seqno);
-  int hdrlen = db_getheaderlen(seqno);
-  
   fprintf(fp, ">");
-  abundance_fprint_header_with_size(global_abundance,
-                                    fp,
-                                    hdr,
-                                    hdrlen,
-                                    size);
+  db_fprint_header_with_size(fp, seqno, size);
   fprintf(fp, "\n");
 
   char * seq = db_getsequence(seqno);
@@ -706,14 +801,8 @@ void fasta_print_db_strip_size(FILE * fp, unsigned long seqno)
 {
   /* write FASTA but remove abundance information, as with --xsize option */
 
-  char * hdr = db_getheader(seqno);
-  int hdrlen = db_getheaderlen(seqno);
-
   fprintf(fp, ">");
-  abundance_fprint_header_strip_size(global_abundance,
-                                     fp,
-                                     hdr,
-                                     hdrlen);
+  db_fprint_header_strip_size(fp, seqno);
   fprintf(fp, "\n");
 
   char * seq = db_getsequence(seqno);
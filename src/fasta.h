@@ -116,6 +116,14 @@ long fasta_get_abundance(fasta_handle h);
 
 /* fasta output */
 
+void fasta_format_header(xstring * s, const char * hdr);
+
+void fasta_format_sequence(xstring * s, char * seq,
+                           unsigned long len, int width);
+
+void fasta_format(xstring * s, const char * hdr,
+                  char * seq, unsigned long len);
+
 void fasta_print_header(FILE * fp, const char * hdr);
 
 void fasta_print_sequence(FILE * fp, char * seq,
@@ -132,6 +140,15 @@ void fasta_print_relabel(FILE * fp,
                          int abundance,
                          int ordinal);
 
+void fasta_print_relabel_digest(FILE * fp,
+                                char * seq,
+                                int len,
+                                char * header,
+                                int header_len,
+                                int abundance,
+                                int ordinal,
+                                const char * digest);
+
 void fasta_print_db(FILE * fp, unsigned long seqno);
 
 void fasta_print_db_sequence(FILE * fp, unsigned long seqno);
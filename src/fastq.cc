@@ -195,7 +195,7 @@ fastq_handle fastq_open(const char * filename)
   if (h->format == FORMAT_BZIP)
     {
       /* BZIP2: Keep original file open, then open as bzipped file as well */
-#ifdef HAVE_ZLIB_H
+#ifdef HAVE_BZLIB_H
       if (!bz2_lib)
         fatal("Files compressed with bzip2 are not supported");
       int bzError;
@@ -399,8 +399,30 @@ void buffer_filter_extend(fastq_handle h,
   char * q = d;
   char msg[200];
 
+  unsigned long scalar_until = 0;
+
   for(unsigned long i = 0; i < len; i++)
     {
+      /* copy runs of plain nucleotides or quality symbols quickly, but
+         stay with the table below for a while if the last run was short */
+      if (i >= scalar_until)
+        {
+          unsigned long n = 0;
+          if (char_action == char_fq_action_seq)
+            n = fastx_scan_nucleotides(q, p, len - i, char_mapping);
+          else if ((char_action == char_fq_action_qual) &&
+                   (char_mapping == map_identity))
+            n = fastx_scan_quality(q, p, len - i);
+          p += n;
+          q += n;
+          i += n;
+          if (n < 16)
+            scalar_until = i + 16;
+
+          if (i == len)
+            break;
+        }
+
       char c = *p++;
       char m = char_action[(int)c];
 
@@ -93,28 +93,28 @@ void fastq_filter()
 
   if (opt_fastaout)
     {
-      fp_fastaout = fopen(opt_fastaout, "w");
+      fp_fastaout = fopen_output(opt_fastaout);
       if (!fp_fastaout)
         fatal("Unable to open fasta output file for writing");
     }
 
   if (opt_fastqout)
     {
-      fp_fastqout = fopen(opt_fastqout, "w");
+      fp_fastqout = fopen_output(opt_fastqout);
       if (!fp_fastqout)
         fatal("Unable to open fastq output file for writing");
     }
 
   if (opt_fastaout_discarded)
     {
-      fp_fastaout_discarded = fopen(opt_fastaout_discarded, "w");
+      fp_fastaout_discarded = fopen_output(opt_fastaout_discarded);
       if (!fp_fastaout_discarded)
         fatal("Unable to open fasta output file for writing");
     }
 
   if (opt_fastqout_discarded)
     {
-      fp_fastqout_discarded = fopen(opt_fastqout_discarded, "w");
+      fp_fastqout_discarded = fopen_output(opt_fastqout_discarded);
       if (!fp_fastqout_discarded)
         fatal("Unable to open fastq output file for writing");
     }
@@ -848,14 +848,14 @@ void fastx_revcomp()
 
   if (opt_fastaout)
     {
-      fp_fastaout = fopen(opt_fastaout, "w");
+      fp_fastaout = fopen_output(opt_fastaout);
       if (!fp_fastaout)
         fatal("Unable to open fasta output file for writing");
     }
 
   if (opt_fastqout)
     {
-      fp_fastqout = fopen(opt_fastqout, "w");
+      fp_fastqout = fopen_output(opt_fastqout);
       if (!fp_fastqout)
         fatal("Unable to open fastq output file for writing");
     }
@@ -946,7 +946,7 @@ void fastq_convert()
 
   FILE * fp_fastqout = 0;
 
-  fp_fastqout = fopen(opt_fastqout, "w");
+  fp_fastqout = fopen_output(opt_fastqout);
   if (!fp_fastqout)
     fatal("Unable to open fastq output file for writing");
 
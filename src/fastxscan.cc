@@ -0,0 +1,256 @@
+/*
+
+  VSEARCH: a versatile open source tool for metagenomics
+
+  Copyright (C) 2014-2015, Torbjorn Rognes, Frederic Mahe and Tomas Flouri
+  All rights reserved.
+
+  Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+  Department of Informatics, University of Oslo,
+  PO Box 1080 Blindern, NO-0316 Oslo, Norway
+
+  This software is dual-licensed and available under a choice
+  of one of two licenses, either under the terms of the GNU
+  General Public License version 3 or the BSD 2-Clause License.
+
+
+  GNU General Public License version 3
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+  The BSD 2-Clause License
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vsearch.h"
+
+/*
+  Helpers for the fasta and fastq parsers that examine the input
+  16 bytes at a time using SSE2 instructions. Each function handles
+  only the common case (plain line breaks, plain nucleotide symbols
+  or printable quality symbols) and returns as soon as anything else
+  is seen, leaving that character to the table-driven code of the
+  caller. Error messages and line numbers are therefore unchanged.
+*/
+
+inline int first_bit(int mask)
+{
+  /* index of the least significant bit set in a non-zero mask */
+  int i = 0;
+  while (! (mask & 1))
+    {
+      mask >>= 1;
+      i++;
+    }
+  return i;
+}
+
+char * fastx_scan_linefeed(char * p, unsigned long len)
+{
+  /*
+    Locate the end of the current line in a single pass.
+
+    Return a pointer to the first LF in the len bytes starting at p.
+    If there is no LF, return the first CR instead, and if there is
+    no CR either, return the first FF. Return NULL if none of them
+    are present.
+  */
+
+  char * cr = 0;
+  char * ff = 0;
+  unsigned long i = 0;
+
+#ifdef __SSE2__
+  const __m128i v_lf = _mm_set1_epi8('\n');
+  const __m128i v_cr = _mm_set1_epi8('\r');
+  const __m128i v_ff = _mm_set1_epi8('\f');
+
+  for( ; i + 16 <= len; i += 16)
+    {
+      __m128i v = _mm_loadu_si128((__m128i *)(p + i));
+      int m_lf = _mm_movemask_epi8(_mm_cmpeq_epi8(v, v_lf));
+      if (m_lf)
+        return p + i + first_bit(m_lf);
+      if (! cr)
+        {
+          int m_cr = _mm_movemask_epi8(_mm_cmpeq_epi8(v, v_cr));
+          if (m_cr)
+            cr = p + i + first_bit(m_cr);
+        }
+      if (! ff)
+        {
+          int m_ff = _mm_movemask_epi8(_mm_cmpeq_epi8(v, v_ff));
+          if (m_ff)
+            ff = p + i + first_bit(m_ff);
+        }
+    }
+#endif
+
+  for( ; i < len; i++)
+    {
+      char c = p[i];
+      if (c == '\n')
+        return p + i;
+      else if ((c == '\r') && ! cr)
+        cr = p + i;
+      else if ((c == '\f') && ! ff)
+        ff = p + i;
+    }
+
+  return cr ? cr : ff;
+}
+
+unsigned long fastx_scan_nucleotides(char * dst,
+                                     char * src,
+                                     unsigned long len,
+                                     char * char_mapping)
+{
+  /*
+    Copy the initial run of IUPAC nucleotide symbols (ABCDGHKMNRSTUVWY
+    in upper or lower case) from src to dst, mapping them with
+    char_mapping. These are the legal symbols in both fasta and fastq
+    sequences. Return the number of characters copied. Only the upcase
+    and the identity mappings are vectorized, nothing is copied for
+    other mappings. The destination may be the same as the source, or
+    lie before it.
+  */
+
+  unsigned long i = 0;
+
+#ifdef __SSE2__
+  bool upcase;
+  if (char_mapping == chrmap_upcase)
+    upcase = true;
+  else if (char_mapping == chrmap_no_change)
+    upcase = false;
+  else
+    return 0;
+
+  /* upper case letters from A to Y, except EFIJLOPQX */
+
+  const __m128i v_case = _mm_set1_epi8((char)0xdf);
+  const __m128i v_lo = _mm_set1_epi8('A' - 1);
+  const __m128i v_hi = _mm_set1_epi8('Y' + 1);
+  const __m128i v_e = _mm_set1_epi8('E');
+  const __m128i v_f = _mm_set1_epi8('F');
+  const __m128i v_i = _mm_set1_epi8('I');
+  const __m128i v_j = _mm_set1_epi8('J');
+  const __m128i v_l = _mm_set1_epi8('L');
+  const __m128i v_o = _mm_set1_epi8('O');
+  const __m128i v_p = _mm_set1_epi8('P');
+  const __m128i v_q = _mm_set1_epi8('Q');
+  const __m128i v_x = _mm_set1_epi8('X');
+
+  for( ; i + 16 <= len; i += 16)
+    {
+      __m128i v = _mm_loadu_si128((__m128i *)(src + i));
+      __m128i u = _mm_and_si128(v, v_case);
+      __m128i inside = _mm_and_si128(_mm_cmpgt_epi8(u, v_lo),
+                                     _mm_cmplt_epi8(u, v_hi));
+      __m128i excluded = _mm_or_si128
+        (_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(u, v_e),
+                                   _mm_cmpeq_epi8(u, v_f)),
+                      _mm_or_si128(_mm_cmpeq_epi8(u, v_i),
+                                   _mm_cmpeq_epi8(u, v_j))),
+         _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(u, v_l),
+                                   _mm_cmpeq_epi8(u, v_o)),
+                      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(u, v_p),
+                                                _mm_cmpeq_epi8(u, v_q)),
+                                   _mm_cmpeq_epi8(u, v_x))));
+      int mask = _mm_movemask_epi8(_mm_andnot_si128(excluded, inside));
+
+      if (mask == 0xffff)
+        _mm_storeu_si128((__m128i *)(dst + i), upcase ? u : v);
+      else
+        {
+          /* copy the legal prefix of this block one by one */
+          int n = first_bit(~mask);
+          for(int j = 0; j < n; j++)
+            dst[i+j] = char_mapping[(unsigned char)(src[i+j])];
+          return i + n;
+        }
+    }
+#else
+  (void) dst;
+  (void) src;
+  (void) char_mapping;
+#endif
+
+  return i;
+}
+
+unsigned long fastx_scan_quality(char * dst,
+                                 char * src,
+                                 unsigned long len)
+{
+  /*
+    Copy the initial run of printable quality symbols (ascii 33-126)
+    from src to dst without mapping. Return the number copied.
+  */
+
+  unsigned long i = 0;
+
+#ifdef __SSE2__
+  const __m128i v_lo = _mm_set1_epi8(32);
+  const __m128i v_hi = _mm_set1_epi8(127);
+
+  for( ; i + 16 <= len; i += 16)
+    {
+      /* bytes above 127 are negative and fail the first test */
+      __m128i v = _mm_loadu_si128((__m128i *)(src + i));
+      __m128i m = _mm_and_si128(_mm_cmpgt_epi8(v, v_lo),
+                                _mm_cmplt_epi8(v, v_hi));
+      int mask = _mm_movemask_epi8(m);
+
+      if (mask == 0xffff)
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+      else
+        {
+          int n = first_bit(~mask);
+          memcpy(dst + i, src + i, n);
+          return i + n;
+        }
+    }
+#else
+  (void) dst;
+  (void) src;
+#endif
+
+  return i;
+}
@@ -0,0 +1,386 @@
+/*
+
+  VSEARCH: a versatile open source tool for metagenomics
+
+  Copyright (C) 2014-2015, Torbjorn Rognes, Frederic Mahe and Tomas Flouri
+  All rights reserved.
+
+  Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+  Department of Informatics, University of Oslo,
+  PO Box 1080 Blindern, NO-0316 Oslo, Norway
+
+  This software is dual-licensed and available under a choice
+  of one of two licenses, either under the terms of the GNU
+  General Public License version 3 or the BSD 2-Clause License.
+
+
+  GNU General Public License version 3
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+  The BSD 2-Clause License
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vsearch.h"
+
+/*
+  Compressed output files.
+
+  A file opened with gzout_open is an ordinary stdio stream, so all
+  the existing fprintf and fwrite calls work unchanged. Behind it the
+  data is cut into blocks of 1 MB that are compressed independently
+  and written as a series of concatenated gzip members, which gzip,
+  zcat and zlib read as one stream. With threads the blocks are
+  compressed in parallel by a pool of opt_threads workers; whichever
+  worker completes the oldest outstanding block writes it and any
+  following blocks that are ready, keeping the original order.
+
+  The zlib functions are loaded at run time (see dynlibs.cc) and the
+  stream is created with fopencookie (glibc) or funopen (BSD, macOS).
+*/
+
+#define GZOUT_BLOCKSIZE (1024 * 1024)
+#define GZOUT_LEVEL 6
+
+#if defined(HAVE_ZLIB_H) && (defined(__GLIBC__) || defined(__APPLE__))
+#define GZOUT 1
+#else
+#define GZOUT 0
+#endif
+
+#if GZOUT
+
+struct gzout_block_s
+{
+  char * in;
+  size_t in_length;
+  char * out;
+  size_t out_alloc;
+  size_t out_length;
+  bool compressed;
+};
+
+struct gzout_s
+{
+  FILE * fp;                  /* the underlying file */
+  int slots;
+  gzout_block_s * ring;       /* block n is in ring[n % slots] */
+
+  long filled;                /* blocks handed over for compression */
+  long taken;                 /* blocks picked up by a worker */
+  long written;               /* blocks written to the file */
+
+  gzout_block_s * current;    /* block being filled, if any */
+
+#if PTHREAD
+  int threads;
+  pthread_t * workers;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond_work;
+  pthread_cond_t cond_space;
+  bool writing;
+  bool done;
+#endif
+};
+
+static void gzout_compress(gzout_block_s * b)
+{
+  z_stream zs;
+  memset(& zs, 0, sizeof(zs));
+
+  /* window bits 15 + 16 gives a gzip header and trailer */
+  if ((*deflateInit2__p)(& zs, GZOUT_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY,
+                         ZLIB_VERSION, (int) sizeof(z_stream)) != Z_OK)
+    fatal("Unable to initialize gzip compression");
+
+  size_t bound = (*deflateBound_p)(& zs, b->in_length) + 64;
+  if (bound > b->out_alloc)
+    {
+      b->out_alloc = bound;
+      b->out = (char *) xrealloc(b->out, b->out_alloc);
+    }
+
+  zs.next_in = (Bytef *) b->in;
+  zs.avail_in = b->in_length;
+  zs.next_out = (Bytef *) b->out;
+  zs.avail_out = b->out_alloc;
+
+  if ((*deflate_p)(& zs, Z_FINISH) != Z_STREAM_END)
+    fatal("Unable to compress output with gzip");
+
+  b->out_length = b->out_alloc - zs.avail_out;
+  (*deflateEnd_p)(& zs);
+}
+
+static void gzout_write(gzout_s * g, gzout_block_s * b)
+{
+  if (fwrite(b->out, 1, b->out_length, g->fp) != b->out_length)
+    fatal("Unable to write to output file");
+}
+
+#if PTHREAD
+
+static void * gzout_worker(void * vp)
+{
+  gzout_s * g = (gzout_s *) vp;
+
+  pthread_mutex_lock(& g->mutex);
+  while (1)
+    {
+      while ((g->taken == g->filled) && ! g->done)
+        pthread_cond_wait(& g->cond_work, & g->mutex);
+
+      if (g->taken == g->filled)
+        break;
+
+      gzout_block_s * b = g->ring + (g->taken % g->slots);
+      g->taken++;
+
+      pthread_mutex_unlock(& g->mutex);
+      gzout_compress(b);
+      pthread_mutex_lock(& g->mutex);
+
+      b->compressed = true;
+
+      /* write the oldest blocks, if they are ready, one writer at a time */
+      while ((! g->writing) && (g->written < g->taken))
+        {
+          gzout_block_s * w = g->ring + (g->written % g->slots);
+          if (! w->compressed)
+            break;
+
+          g->writing = true;
+          pthread_mutex_unlock(& g->mutex);
+          gzout_write(g, w);
+          pthread_mutex_lock(& g->mutex);
+          g->writing = false;
+
+          w->compressed = false;
+          g->written++;
+          pthread_cond_broadcast(& g->cond_space);
+        }
+    }
+  pthread_mutex_unlock(& g->mutex);
+
+  return 0;
+}
+
+#endif
+
+static void gzout_get_block(gzout_s * g)
+{
+  /* wait for a free slot for the next block */
+
+#if PTHREAD
+  pthread_mutex_lock(& g->mutex);
+  while (g->filled - g->written == g->slots)
+    pthread_cond_wait(& g->cond_space, & g->mutex);
+  pthread_mutex_unlock(& g->mutex);
+#endif
+
+  g->current = g->ring + (g->filled % g->slots);
+  g->current->in_length = 0;
+}
+
+static void gzout_put_block(gzout_s * g)
+{
+  /* hand the current block over for compression */
+
+#if PTHREAD
+  pthread_mutex_lock(& g->mutex);
+  g->filled++;
+  pthread_cond_signal(& g->cond_work);
+  pthread_mutex_unlock(& g->mutex);
+#else
+  gzout_compress(g->current);
+  gzout_write(g, g->current);
+  g->filled++;
+  g->taken++;
+  g->written++;
+#endif
+
+  g->current = 0;
+}
+
+static ssize_t gzout_cookie_write(void * cookie, const char * buf, size_t size)
+{
+  gzout_s * g = (gzout_s *) cookie;
+  size_t left = size;
+
+  while (left > 0)
+    {
+      if (! g->current)
+        gzout_get_block(g);
+
+      gzout_block_s * b = g->current;
+      size_t n = MIN(left, GZOUT_BLOCKSIZE - b->in_length);
+      memcpy(b->in + b->in_length, buf, n);
+      b->in_length += n;
+      buf += n;
+      left -= n;
+
+      if (b->in_length == GZOUT_BLOCKSIZE)
+        gzout_put_block(g);
+    }
+
+  return size;
+}
+
+static int gzout_cookie_close(void * cookie)
+{
+  gzout_s * g = (gzout_s *) cookie;
+
+  /* an empty file still gets one (empty) member to be valid gzip */
+  if ((! g->current) && (g->filled == 0))
+    gzout_get_block(g);
+
+  if (g->current)
+    gzout_put_block(g);
+
+#if PTHREAD
+  pthread_mutex_lock(& g->mutex);
+  g->done = true;
+  pthread_cond_broadcast(& g->cond_work);
+  pthread_mutex_unlock(& g->mutex);
+
+  for(int t = 0; t < g->threads; t++)
+    if (pthread_join(g->workers[t], NULL))
+      fatal("Cannot join thread");
+
+  free(g->workers);
+  pthread_cond_destroy(& g->cond_space);
+  pthread_cond_destroy(& g->cond_work);
+  pthread_mutex_destroy(& g->mutex);
+#endif
+
+  if (g->written != g->filled)
+    fatal("Internal error: compressed output incomplete");
+
+  int ret = fclose(g->fp);
+
+  for(int i = 0; i < g->slots; i++)
+    {
+      free(g->ring[i].in);
+      if (g->ring[i].out)
+        free(g->ring[i].out);
+    }
+  free(g->ring);
+  free(g);
+
+  return ret;
+}
+
+#ifdef __APPLE__
+static int gzout_funopen_write(void * cookie, const char * buf, int size)
+{
+  return gzout_cookie_write(cookie, buf, size);
+}
+#endif
+
+#endif
+
+FILE * gzout_open(const char * filename)
+{
+#if GZOUT
+  if (! gz_lib)
+    fatal("Compressed output with gzip is not supported");
+
+  FILE * fp = fopen(filename, "wb");
+  if (! fp)
+    return 0;
+
+  gzout_s * g = (gzout_s *) xmalloc(sizeof(gzout_s));
+  g->fp = fp;
+  g->filled = 0;
+  g->taken = 0;
+  g->written = 0;
+  g->current = 0;
+
+#if PTHREAD
+  g->threads = opt_threads > 0 ? opt_threads : 1;
+  g->slots = 2 * g->threads;
+#else
+  g->slots = 1;
+#endif
+
+  g->ring = (gzout_block_s *) xmalloc(g->slots * sizeof(gzout_block_s));
+  for(int i = 0; i < g->slots; i++)
+    {
+      g->ring[i].in = (char *) xmalloc(GZOUT_BLOCKSIZE);
+      g->ring[i].in_length = 0;
+      g->ring[i].out = 0;
+      g->ring[i].out_alloc = 0;
+      g->ring[i].out_length = 0;
+      g->ring[i].compressed = false;
+    }
+
+#if PTHREAD
+  g->writing = false;
+  g->done = false;
+  pthread_mutex_init(& g->mutex, NULL);
+  pthread_cond_init(& g->cond_work, NULL);
+  pthread_cond_init(& g->cond_space, NULL);
+  g->workers = (pthread_t *) xmalloc(g->threads * sizeof(pthread_t));
+  for(int t = 0; t < g->threads; t++)
+    if (pthread_create(g->workers + t, NULL, gzout_worker, (void *) g))
+      fatal("Cannot create thread");
+#endif
+
+#ifdef __APPLE__
+  FILE * f = funopen(g, 0, gzout_funopen_write, 0, gzout_cookie_close);
+#else
+  cookie_io_functions_t io;
+  memset(& io, 0, sizeof(io));
+  io.write = gzout_cookie_write;
+  io.close = gzout_cookie_close;
+  FILE * f = fopencookie(g, "w", io);
+#endif
+
+  if (! f)
+    fatal("Unable to open compressed output file");
+
+  return f;
+#else
+  (void) filename;
+  fatal("Compressed output with gzip is not supported");
+  return 0;
+#endif
+}
@@ -0,0 +1,630 @@
+/*
+
+  VSEARCH: a versatile open source tool for metagenomics
+
+  Copyright (C) 2014-2015, Torbjorn Rognes, Frederic Mahe and Tomas Flouri
+  All rights reserved.
+
+  Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+  Department of Informatics, University of Oslo,
+  PO Box 1080 Blindern, NO-0316 Oslo, Norway
+
+  This software is dual-licensed and available under a choice
+  of one of two licenses, either under the terms of the GNU
+  General Public License version 3 or the BSD 2-Clause License.
+
+
+  GNU General Public License version 3
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+  The BSD 2-Clause License
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vsearch.h"
+#include <algorithm>
+
+/*
+  Single-linkage clustering by differences, for --cluster_linkage.
+
+  Two sequences are linked when one is turned into the other by at
+  most --differences substitutions, insertions or deletions, and the
+  clusters are the connected components of these links. No alignments
+  are computed. All sequences are put in the hash table of dbhash.cc,
+  and the links of a sequence are found by enumerating every variant
+  within the given number of differences and looking it up there.
+
+  To avoid hashing each variant from scratch, the table is keyed by a
+  polynomial hash of the nucleotides, mixed as in hash_seq. With the
+  hashes of all prefixes of a sequence at hand, the hash of a variant
+  with one more difference takes a few multiplications. A variant is
+  only written out and compared when its hash is in the table.
+  Insertions and deletions that give the same variant as one further
+  left in a homopolymer are skipped, and the differences are made in
+  order of position.
+
+  The neighbourhoods are enumerated by several threads, each taking
+  the next block of sequences in turn. The links of each sequence are
+  kept with the differences leading to the target, and the sequences
+  are then expanded breadth-first from the centroids by the caller.
+*/
+
+#define LINKAGE_BASE 0x100000001b3UL
+#define LINKAGE_BLOCK 256
+
+static const char linkage_nt[4] = { 'A', 'C', 'G', 'T' };
+
+static int linkage_differences;
+static unsigned long * linkage_power; /* powers of LINKAGE_BASE */
+
+static unsigned int * linkage_count;  /* number of links of each sequence */
+static unsigned long * linkage_first; /* first link of each sequence */
+static struct linkage_edge_s * linkage_edges;
+
+static std::vector<struct linkage_edge_s> * linkage_block_edges;
+static unsigned long linkage_blocks;
+static unsigned long linkage_next;    /* next block to enumerate */
+
+#if PTHREAD
+static pthread_mutex_t linkage_mutex;
+#endif
+
+static LinearMemoryAligner * linkage_lma;
+static long * linkage_scorematrix;
+
+typedef struct linkage_thread_s
+{
+  unsigned int source;
+  char * variant[LINKAGE_MAXDIFFS + 1];
+  unsigned long length[LINKAGE_MAXDIFFS + 1];
+  unsigned long * prefix[LINKAGE_MAXDIFFS + 1];
+  struct linkage_edit_s edit[LINKAGE_MAXDIFFS];
+  std::vector<struct linkage_edge_s> * edges;
+} linkage_thread_t;
+
+inline unsigned long linkage_mix(unsigned long h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdUL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53UL;
+  h ^= h >> 33;
+  return h;
+}
+
+static void linkage_prefix(char * seq, unsigned long len, unsigned long * prefix)
+{
+  prefix[0] = 0;
+  for(unsigned long i = 0; i < len; i++)
+    prefix[i+1] = prefix[i] * LINKAGE_BASE + chrmap_4bit[(int)(seq[i])];
+}
+
+static unsigned long linkage_apply(char * dst,
+                                   char * src,
+                                   unsigned long len,
+                                   struct linkage_edit_s * e)
+{
+  /* write the sequence with the edit applied, return its length */
+
+  unsigned long pos = e->pos;
+  memcpy(dst, src, pos);
+
+  switch (e->op)
+    {
+    case 'S':
+      dst[pos] = e->nt;
+      memcpy(dst + pos + 1, src + pos + 1, len - pos - 1);
+      return len;
+
+    case 'I':
+      dst[pos] = e->nt;
+      memcpy(dst + pos + 1, src + pos, len - pos);
+      return len + 1;
+
+    default:
+      memcpy(dst + pos, src + pos + 1, len - pos - 1);
+      return len - 1;
+    }
+}
+
+static void linkage_found(linkage_thread_t * lt, int depth, unsigned long key)
+{
+  /* link the source to all sequences identical to the variant */
+
+  struct dbhash_search_info_s info;
+  long target = dbhash_search_first_hash(lt->variant[depth],
+                                         lt->length[depth],
+                                         key,
+                                         & info);
+  while (target >= 0)
+    {
+      if (target != lt->source)
+        {
+          struct linkage_edge_s edge;
+          memset(& edge, 0, sizeof(edge));
+          edge.target = target;
+          edge.diffs = depth;
+          memcpy(edge.edit, lt->edit, depth * sizeof(struct linkage_edit_s));
+          lt->edges->push_back(edge);
+        }
+      target = dbhash_search_next(& info);
+    }
+}
+
+static void linkage_enumerate(linkage_thread_t * lt, int depth);
+
+static void linkage_variant(linkage_thread_t * lt,
+                            int depth,
+                            unsigned long hash)
+{
+  /* the variant with edit[depth] applied to variant[depth] */
+
+  unsigned long key = linkage_mix(hash);
+  bool found = dbhash_probe(key);
+  bool last = depth + 1 == linkage_differences;
+
+  if (last && ! found)
+    return;
+
+  lt->length[depth+1] = linkage_apply(lt->variant[depth+1],
+                                      lt->variant[depth],
+                                      lt->length[depth],
+                                      lt->edit + depth);
+
+  if (found)
+    linkage_found(lt, depth + 1, key);
+
+  if (! last)
+    linkage_enumerate(lt, depth + 1);
+}
+
+static void linkage_enumerate(linkage_thread_t * lt, int depth)
+{
+  /* look up all variants with one more difference than variant[depth] */
+
+  char * seq = lt->variant[depth];
+  unsigned long len = lt->length[depth];
+  unsigned long * prefix = lt->prefix[depth];
+  struct linkage_edit_s * e = lt->edit + depth;
+
+  linkage_prefix(seq, len, prefix);
+  unsigned long whole = prefix[len];
+
+  if (depth == 0)
+    {
+      /* identical sequences */
+      unsigned long key = linkage_mix(whole);
+      if (dbhash_probe(key))
+        linkage_found(lt, 0, key);
+    }
+
+  /*
+    A further difference is only made at or after the position of the
+    previous one, as any set of differences may be applied from left
+    to right. At that first position, the homopolymer rule would refer
+    to a variant further left that is not made, and is not applied.
+  */
+
+  unsigned long start = depth > 0 ? lt->edit[depth-1].pos : 0;
+
+  for(unsigned long i = start; i <= len; i++)
+    {
+      unsigned long before = i > start ? chrmap_4bit[(int)(seq[i-1])] : 0;
+      unsigned long suffix = whole - prefix[i] * linkage_power[len - i];
+
+      e->pos = i;
+
+      /* insertions before position i */
+      e->op = 'I';
+      for(int n = 0; n < 4; n++)
+        {
+          unsigned long c = chrmap_4bit[(int)(linkage_nt[n])];
+          if (c == before)
+            continue;
+          e->nt = linkage_nt[n];
+          linkage_variant(lt, depth,
+                          (prefix[i] * LINKAGE_BASE + c)
+                          * linkage_power[len - i] + suffix);
+        }
+
+      if (i == len)
+        break;
+
+      unsigned long here = chrmap_4bit[(int)(seq[i])];
+      unsigned long after = whole - prefix[i+1] * linkage_power[len - i - 1];
+
+      /* deletion of position i, once for each homopolymer */
+      if (here != before)
+        {
+          e->op = 'D';
+          e->nt = 0;
+          linkage_variant(lt, depth,
+                          prefix[i] * linkage_power[len - i - 1] + after);
+        }
+
+      /* substitutions at position i */
+      e->op = 'S';
+      for(int n = 0; n < 4; n++)
+        {
+          unsigned long c = chrmap_4bit[(int)(linkage_nt[n])];
+          if (c == here)
+            continue;
+          e->nt = linkage_nt[n];
+          linkage_variant(lt, depth,
+                          whole + (c - here) * linkage_power[len - i - 1]);
+        }
+    }
+}
+
+inline bool linkage_compare_edges(const struct linkage_edge_s & a,
+                                  const struct linkage_edge_s & b)
+{
+  if (a.target != b.target)
+    return a.target < b.target;
+  else
+    return a.diffs < b.diffs;
+}
+
+inline bool linkage_same_target(const struct linkage_edge_s & a,
+                                const struct linkage_edge_s & b)
+{
+  return a.target == b.target;
+}
+
+static void linkage_range()
+{
+  linkage_thread_t lt;
+
+  unsigned long longest = db_getlongestsequence() + linkage_differences;
+  for(int d = 0; d <= linkage_differences; d++)
+    {
+      lt.variant[d] = d ? (char *) xmalloc(longest + 1) : 0;
+      lt.prefix[d] = (unsigned long *)
+        xmalloc((longest + 1) * sizeof(unsigned long));
+    }
+
+  unsigned int seqcount = db_getsequencecount();
+
+  while (1)
+    {
+#if PTHREAD
+      pthread_mutex_lock(&linkage_mutex);
+#endif
+      unsigned long block = linkage_next;
+      if (block < linkage_blocks)
+        {
+          linkage_next++;
+          progress_update(block * LINKAGE_BLOCK);
+        }
+#if PTHREAD
+      pthread_mutex_unlock(&linkage_mutex);
+#endif
+
+      if (block >= linkage_blocks)
+        break;
+
+      lt.edges = linkage_block_edges + block;
+
+      unsigned int last = MIN(seqcount, (block + 1) * LINKAGE_BLOCK);
+      for(unsigned int seqno = block * LINKAGE_BLOCK; seqno < last; seqno++)
+        {
+          unsigned long start = lt.edges->size();
+
+          lt.source = seqno;
+          lt.variant[0] = db_getsequence(seqno);
+          lt.length[0] = db_getsequencelen(seqno);
+          linkage_enumerate(& lt, 0);
+
+          /* keep the link with the fewest differences to each target */
+          std::sort(lt.edges->begin() + start, lt.edges->end(),
+                    linkage_compare_edges);
+          lt.edges->erase(std::unique(lt.edges->begin() + start,
+                                      lt.edges->end(),
+                                      linkage_same_target),
+                          lt.edges->end());
+
+          linkage_count[seqno] = lt.edges->size() - start;
+        }
+    }
+
+  for(int d = 0; d <= linkage_differences; d++)
+    {
+      if (d)
+        free(lt.variant[d]);
+      free(lt.prefix[d]);
+    }
+}
+
+#if PTHREAD
+static void * linkage_worker(void * vp)
+{
+  (void) vp;
+  linkage_range();
+  return 0;
+}
+#endif
+
+void linkage_build(int differences)
+{
+  linkage_differences = differences;
+
+  unsigned int seqcount = db_getsequencecount();
+  unsigned long longest = db_getlongestsequence() + differences;
+
+  linkage_power = (unsigned long *)
+    xmalloc((longest + 1) * sizeof(unsigned long));
+  linkage_power[0] = 1;
+  for(unsigned long i = 1; i <= longest; i++)
+    linkage_power[i] = linkage_power[i-1] * LINKAGE_BASE;
+
+  /* hash all sequences */
+
+  unsigned long * prefix = (unsigned long *)
+    xmalloc((longest + 1) * sizeof(unsigned long));
+
+  dbhash_open(seqcount);
+  progress_init("Hashing sequences", seqcount);
+  for(unsigned int seqno = 0; seqno < seqcount; seqno++)
+    {
+      char * seq = db_getsequence(seqno);
+      unsigned long len = db_getsequencelen(seqno);
+      linkage_prefix(seq, len, prefix);
+      dbhash_add_hash(seq, len, linkage_mix(prefix[len]), seqno);
+      progress_update(seqno);
+    }
+  progress_done();
+
+  free(prefix);
+
+  /* find the links of all sequences in blocks */
+
+  linkage_count = (unsigned int *) xmalloc(seqcount * sizeof(unsigned int));
+  linkage_blocks = (seqcount + LINKAGE_BLOCK - 1) / LINKAGE_BLOCK;
+  linkage_block_edges =
+    new std::vector<struct linkage_edge_s>[linkage_blocks];
+  linkage_next = 0;
+
+  progress_init("Finding neighbours", seqcount);
+
+#if PTHREAD
+  if (opt_threads > 1)
+    {
+      pthread_mutex_init(&linkage_mutex, NULL);
+
+      pthread_attr_t linkage_attr;
+      pthread_attr_init(&linkage_attr);
+      pthread_attr_setdetachstate(&linkage_attr, PTHREAD_CREATE_JOINABLE);
+
+      pthread_t * pthread
+        = (pthread_t *) xmalloc(opt_threads * sizeof(pthread_t));
+
+      for(long t=0; t<opt_threads; t++)
+        if (pthread_create(pthread+t, &linkage_attr, linkage_worker, (void*)t))
+          fatal("Cannot create thread");
+
+      for(long t=0; t<opt_threads; t++)
+        if (pthread_join(pthread[t], NULL))
+          fatal("Cannot join thread");
+
+      free(pthread);
+      pthread_attr_destroy(&linkage_attr);
+      pthread_mutex_destroy(&linkage_mutex);
+    }
+  else
+    linkage_range();
+#else
+  linkage_range();
+#endif
+
+  progress_done();
+
+  dbhash_close();
+
+  /* gather the links of the blocks in sequence order */
+
+  linkage_first = (unsigned long *)
+    xmalloc((seqcount + 1) * sizeof(unsigned long));
+  unsigned long sum = 0;
+  for(unsigned int seqno = 0; seqno < seqcount; seqno++)
+    {
+      linkage_first[seqno] = sum;
+      sum += linkage_count[seqno];
+    }
+  linkage_first[seqcount] = sum;
+
+  linkage_edges = (struct linkage_edge_s *)
+    xmalloc(MAX(sum, 1) * sizeof(struct linkage_edge_s));
+  unsigned long edge = 0;
+  for(unsigned long block = 0; block < linkage_blocks; block++)
+    {
+      std::vector<struct linkage_edge_s> & v = linkage_block_edges[block];
+      if (v.size())
+        memcpy(linkage_edges + edge, & v[0],
+               v.size() * sizeof(struct linkage_edge_s));
+      edge += v.size();
+    }
+
+  delete [] linkage_block_edges;
+  linkage_block_edges = 0;
+  free(linkage_count);
+  linkage_count = 0;
+
+  /* for the statistics of the links reported */
+
+  linkage_lma = new LinearMemoryAligner;
+  linkage_scorematrix = linkage_lma->scorematrix_create(opt_match,
+                                                        opt_mismatch);
+  linkage_lma->set_parameters(linkage_scorematrix,
+                              opt_gap_open_query_left,
+                              opt_gap_open_target_left,
+                              opt_gap_open_query_interior,
+                              opt_gap_open_target_interior,
+                              opt_gap_open_query_right,
+                              opt_gap_open_target_right,
+                              opt_gap_extension_query_left,
+                              opt_gap_extension_target_left,
+                              opt_gap_extension_query_interior,
+                              opt_gap_extension_target_interior,
+                              opt_gap_extension_query_right,
+                              opt_gap_extension_target_right);
+}
+
+void linkage_free()
+{
+  free(linkage_power);
+  linkage_power = 0;
+  free(linkage_first);
+  linkage_first = 0;
+  free(linkage_edges);
+  linkage_edges = 0;
+  delete linkage_lma;
+  linkage_lma = 0;
+  free(linkage_scorematrix);
+  linkage_scorematrix = 0;
+}
+
+unsigned long linkage_getedgecount(unsigned int seqno)
+{
+  return linkage_first[seqno + 1] - linkage_first[seqno];
+}
+
+struct linkage_edge_s * linkage_getedges(unsigned int seqno)
+{
+  return linkage_edges + linkage_first[seqno];
+}
+
+void linkage_hit(unsigned int source,
+                 struct linkage_edge_s * edge,
+                 struct hit * hit)
+{
+  /*
+    Describe the link as a hit of its target, the query, to the source.
+    The alignment columns follow from the edits: M for both sequences,
+    D for a nucleotide only in the query, I for one only in the source.
+  */
+
+  unsigned int target = edge->target;
+  char * qseq = db_getsequence(target);
+  long qlen = db_getsequencelen(target);
+  char * tseq = db_getsequence(source);
+  long tlen = db_getsequencelen(source);
+
+  std::vector<char> column(tlen, 'M');
+
+  for(int k = 0; k < edge->diffs; k++)
+    {
+      struct linkage_edit_s * e = edge->edit + k;
+
+      /* find the column of the position in the edited sequence */
+      unsigned long c = 0;
+      unsigned long pos = 0;
+      while (c < column.size())
+        {
+          if (column[c] != 'I')
+            {
+              if (pos == e->pos)
+                break;
+              pos++;
+            }
+          c++;
+        }
+
+      if (e->op == 'I')
+        column.insert(column.begin() + c, 'D');
+      else if (e->op == 'D')
+        {
+          if (column[c] == 'D')
+            column.erase(column.begin() + c);
+          else
+            column[c] = 'I';
+        }
+    }
+
+  /* run-length encode the columns as a cigar string */
+
+  xstring cigar;
+  unsigned long i = 0;
+  while (i < column.size())
+    {
+      unsigned long run = 1;
+      while ((i + run < column.size()) && (column[i + run] == column[i]))
+        run++;
+      if (run > 1)
+        cigar.add_d(run);
+      cigar.add_c(column[i]);
+      i += run;
+    }
+
+  long nwscore;
+  long nwalignmentlength;
+  long nwmatches;
+  long nwmismatches;
+  long nwgaps;
+
+  linkage_lma->alignstats(cigar.get_string(),
+                          qseq,
+                          tseq,
+                          & nwscore,
+                          & nwalignmentlength,
+                          & nwmatches,
+                          & nwmismatches,
+                          & nwgaps);
+
+  hit->target = source;
+  hit->strand = 0;
+  hit->count = 0;
+  hit->accepted = 1;
+  hit->rejected = 0;
+  hit->aligned = 1;
+  hit->weak = 0;
+  hit->shortest = MIN(qlen, tlen);
+  hit->longest = MAX(qlen, tlen);
+  hit->nwalignment = xstrdup(cigar.get_string());
+  hit->nwscore = nwscore;
+  hit->nwdiff = nwalignmentlength - nwmatches;
+  hit->nwgaps = nwgaps;
+  hit->nwindels = nwalignmentlength - nwmatches - nwmismatches;
+  hit->nwalignmentlength = nwalignmentlength;
+  hit->nwid = 100.0 * nwmatches / nwalignmentlength;
+  hit->matches = nwmatches;
+  hit->mismatches = nwmismatches;
+
+  align_trim(hit);
+}
@@ -90,7 +90,7 @@ static long total = 0;
 FILE * fileopenw(char * filename)
 {
   FILE * fp = 0;
-  fp = fopen(filename, "w");
+  fp = fopen_output(filename);
   if (!fp)
     fatal("Unable to open file for writing (%s)", filename);
   return fp;
@@ -83,6 +83,7 @@ inline void minheap_empty(minheap_t * m)
   m->count = 0;
 }
 
+int elem_smaller(elem_t * a, elem_t * b);
 elem_t minheap_poplast(minheap_t * m);
 void minheap_sort(minheap_t * m);
 minheap_t * minheap_init(int size);
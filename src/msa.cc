@@ -62,13 +62,67 @@
 
 /* Compute consensus sequence and msa of clustered sequences */
 
-static char * aln;
-static int alnpos;
-static int * profile;
+/*
+  The buffers are kept from one cluster to the next and only grow, so
+  that each thread computing alignments needs its own msa_t.
+*/
+
+struct msa_s
+{
+  int * maxi;        /* max insertions in front of each centroid position */
+  int maxi_alloc;
+  int * profile;     /* counts of each nucleotide in each column */
+  char * aln;        /* aligned sequence */
+  char * cons;       /* consensus sequence */
+  int aln_alloc;
+  char * rc_buffer;  /* reverse complemented target */
+  long rc_alloc;
+  int alnpos;
+};
+
+msa_t * msa_init()
+{
+  msa_t * m = (msa_t *) xmalloc(sizeof(msa_t));
+  memset(m, 0, sizeof(msa_t));
+  return m;
+}
+
+void msa_exit(msa_t * m)
+{
+  if (m->maxi)
+    free(m->maxi);
+  if (m->profile)
+    free(m->profile);
+  if (m->aln)
+    free(m->aln);
+  if (m->cons)
+    free(m->cons);
+  if (m->rc_buffer)
+    free(m->rc_buffer);
+  free(m);
+}
+
+inline char msa_cigar_next(char * * p, long * run)
+{
+  /* parse the next run length and operation of a cigar string */
+
+  char * q = * p;
+  long n = 0;
+  if ((*q >= '0') && (*q <= '9'))
+    {
+      while ((*q >= '0') && (*q <= '9'))
+        n = 10 * n + (*q++ - '0');
+    }
+  else
+    n = 1;
+  * run = n;
+  * p = q + 1;
+  return * q;
+}
 
-void msa_add(char c)
+inline void msa_add(msa_t * m, char c)
 {
-  int * p = profile + 4 * alnpos;
+  int * p = m->profile + 4 * m->alnpos;
 
   switch(toupper(c))
     {
@@ -137,19 +191,83 @@ void msa_add(char c)
       break;
     }   
 
-  aln[alnpos++] = c;
+  m->aln[m->alnpos++] = c;
+}
+
+static void msa_format_centroid(xstring * s,
+                                int cluster,
+                                int centroid_seqno,
+                                int target_count,
+                                long totalabundance)
+{
+  /* header of the consensus or profile of a cluster */
+
+  s->add_s(">centroid=");
+
+  if (opt_sizeout)
+    {
+      /* must remove old size info first */
+      char * header_wo_size 
+        = abundance_strip_size(global_abundance,
+                               db_getheader(centroid_seqno), 
+                               db_getheaderlen(centroid_seqno));
+      s->add_s(header_wo_size);
+      s->add_s(";seqs=");
+      s->add_d(target_count);
+      s->add_s(";size=");
+      s->add_l(totalabundance);
+      s->add_c(';');
+      free(header_wo_size);
+    }
+  else
+    {
+      s->add_s(db_getheader(centroid_seqno));
+      s->add_s(";seqs=");
+      s->add_d(target_count);
+      s->add_c(';');
+    }
+
+  if (opt_clusterout_id)
+    {
+      s->add_s("clusterid=");
+      s->add_d(cluster);
+      s->add_c(';');
+    }
+
+  s->add_c('\n');
 }
 
-void msa(FILE * fp_msaout, FILE * fp_consout, FILE * fp_profile,
-         int cluster,
-         int target_count, struct msa_target_s * target_list,
-         long totalabundance)
+static void msa_format_count(xstring * s, int count)
+{
+  /* a count in twelfths, as a whole number if possible */
+
+  s->add_c('\t');
+  if (count % 12 == 0)
+    s->add_d(count / 12);
+  else
+    {
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "%.2f", 1.0 * count / 12.0);
+      s->add_s(buffer);
+    }
+}
+
+void msa_format(msa_t * m,
+                xstring * s_msaout, xstring * s_consout, xstring * s_profile,
+                int cluster,
+                int target_count, struct msa_target_s * target_list,
+                long totalabundance)
 {
   int centroid_seqno = target_list[0].seqno;
   int centroid_len = db_getsequencelen(centroid_seqno);
 
   /* find max insertions in front of each position in the centroid sequence */
-  int * maxi = (int *) xmalloc((centroid_len + 1) * sizeof(int));
+  if (centroid_len + 1 > m->maxi_alloc)
+    {
+      m->maxi_alloc = centroid_len + 1;
+      m->maxi = (int *) xrealloc(m->maxi, m->maxi_alloc * sizeof(int));
+    }
+  int * maxi = m->maxi;
   memset(maxi, 0, (centroid_len + 1) * sizeof(int));
 
   for(int j=1; j<target_count; j++)
@@ -159,11 +277,8 @@ void msa(FILE * fp_msaout, FILE * fp_consout, FILE * fp_profile,
       int pos = 0;
       while (p < e)
         {
-          long run = 1;
-          int scanlength = 0;
-          sscanf(p, "%ld%n", &run, &scanlength);
-          p += scanlength;
-          char op = *p++;
+          long run;
+          char op = msa_cigar_next(& p, & run);
           switch (op)
             {
             case 'M':
@@ -185,10 +300,18 @@ void msa(FILE * fp_msaout, FILE * fp_consout, FILE * fp_profile,
   alnlen += centroid_len;
 
   /* allocate memory for profile (for consensus) and aligned seq */
-  profile = (int *) xmalloc(4 * sizeof(int) * alnlen);
+  if (alnlen + 1 > m->aln_alloc)
+    {
+      m->aln_alloc = alnlen + 1;
+      m->profile = (int *) xrealloc(m->profile,
+                                    4 * sizeof(int) * m->aln_alloc);
+      m->aln = (char *) xrealloc(m->aln, m->aln_alloc);
+      m->cons = (char *) xrealloc(m->cons, m->aln_alloc);
+    }
+  int * profile = m->profile;
+  char * aln = m->aln;
+  char * cons = m->cons;
   memset(profile, 0, 4 * sizeof(int) * alnlen);
-  aln = (char *) xmalloc(alnlen+1);
-  char * cons = (char *) xmalloc(alnlen+1);
   
   /* Find longest target sequence on reverse strand and allocate buffer */
   long longest_reversed = 0;
@@ -199,13 +322,16 @@ void msa(FILE * fp_msaout, FILE * fp_consout, FILE * fp_profile,
         if (len > longest_reversed)
           longest_reversed = len;
       }
-  char * rc_buffer = 0;
-  if (longest_reversed > 0)
-    rc_buffer = (char*) xmalloc(longest_reversed + 1);
+  if (longest_reversed + 1 > m->rc_alloc)
+    {
+      m->rc_alloc = longest_reversed + 1;
+      m->rc_buffer = (char *) xrealloc(m->rc_buffer, m->rc_alloc);
+    }
+  char * rc_buffer = m->rc_buffer;
 
   /* blank line before each msa */
-  if (fp_msaout)
-    fprintf(fp_msaout, "\n");
+  if (s_msaout)
+    s_msaout->add_c('\n');
   
   for(int j=0; j<target_count; j++)
     {
@@ -222,15 +348,15 @@ void msa(FILE * fp_msaout, FILE * fp_consout, FILE * fp_profile,
       int inserted = 0;
       int qpos = 0;
       int tpos = 0;
-      alnpos = 0;
+      m->alnpos = 0;
 
       if (!j)
         {
           for(int x=0; x < centroid_len; x++)
             {
               for(int y=0; y < maxi[qpos]; y++)
-                msa_add('-');
-              msa_add(target_seq[tpos++]);
+                msa_add(m, '-');
+              msa_add(m, target_seq[tpos++]);
               qpos++;
             }
         }
@@ -240,20 +366,17 @@ void msa(FILE * fp_msaout, FILE * fp_consout, FILE * fp_profile,
           char * e = p + strlen(p);
           while (p < e)
             {
-              long run = 1;
-              int scanlength = 0;
-              sscanf(p, "%ld%n", &run, &scanlength);
-              p += scanlength;
-              char op = *p++;
+              long run;
+              char op = msa_cigar_next(& p, & run);
               
               if (op == 'D')
                 {
                   for(int x=0; x < maxi[qpos]; x++)
                     {
                       if (x < run)
-                        msa_add(target_seq[tpos++]);
+                        msa_add(m, target_seq[tpos++]);
                       else
-                        msa_add('-');
+                        msa_add(m, '-');
                     }
                   inserted = 1;
                 }
@@ -263,12 +386,12 @@ void msa(FILE * fp_msaout, FILE * fp_consout, FILE * fp_profile,
                     {
                       if (!inserted)
                         for(int y=0; y < maxi[qpos]; y++)
-                          msa_add('-');
+                          msa_add(m, '-');
                       
                       if (op == 'M')
-                        msa_add(target_seq[tpos++]);
+                        msa_add(m, target_seq[tpos++]);
                       else
-                        msa_add('-');
+                        msa_add(m, '-');
                       
                       qpos++;
                       inserted = 0;
@@ -279,23 +402,23 @@ void msa(FILE * fp_msaout, FILE * fp_consout, FILE * fp_profile,
       
       if (!inserted)
         for(int x=0; x < maxi[qpos]; x++)
-          msa_add('-');
+          msa_add(m, '-');
       
       /* end of sequence string */
-      aln[alnpos] = 0;
+      aln[m->alnpos] = 0;
 
       /* print header & sequence */
-      if (fp_msaout)
+      if (s_msaout)
         {
-          fprintf(fp_msaout, ">%s%s\n", j ? "" : "*", 
-                  db_getheader(target_seqno));
-          fasta_print_sequence(fp_msaout, aln, alnlen, opt_fasta_width);
+          s_msaout->add_c('>');
+          if (! j)
+            s_msaout->add_c('*');
+          s_msaout->add_s(db_getheader(target_seqno));
+          s_msaout->add_c('\n');
+          fasta_format_sequence(s_msaout, aln, alnlen, opt_fasta_width);
         }
     }  
 
-  if (rc_buffer)
-    free(rc_buffer);
-
   /* consensus */
 
   int conslen = 0;
@@ -344,90 +467,36 @@ void msa(FILE * fp_msaout, FILE * fp_consout, FILE * fp_profile,
   aln[alnlen] = 0;
   cons[conslen] = 0;
 
-  if (fp_msaout)
-    fasta_print(fp_msaout, "consensus", aln, alnlen);
+  if (s_msaout)
+    fasta_format(s_msaout, "consensus", aln, alnlen);
 
-  if (fp_consout)
+  if (s_consout)
     {
-      if (opt_sizeout)
-        {
-          /* must remove old size info first */
-          char * header_wo_size 
-            = abundance_strip_size(global_abundance,
-                                   db_getheader(centroid_seqno), 
-                                   db_getheaderlen(centroid_seqno));
-          fprintf(fp_consout,
-                  ">centroid=%s;seqs=%d;size=%ld;",
-                  header_wo_size,
-                  target_count,
-                  totalabundance);
-          free(header_wo_size);
-        }
-      else
-          fprintf(fp_consout,
-                  ">centroid=%s;seqs=%d;",
-                  db_getheader(centroid_seqno),
-                  target_count);
-
-      if (opt_clusterout_id)
-        fprintf(fp_consout, "clusterid=%d;", cluster);
-
-      fprintf(fp_consout, "\n");
-
-      fasta_print_sequence(fp_consout, cons, conslen, opt_fasta_width);
+      msa_format_centroid(s_consout, cluster, centroid_seqno,
+                          target_count, totalabundance);
+      fasta_format_sequence(s_consout, cons, conslen, opt_fasta_width);
     }
   
-  if (fp_profile)
+  if (s_profile)
     {
-      /* must remove old size info first */
-      if (opt_sizeout)
-        {
-          char * header_wo_size 
-            = abundance_strip_size(global_abundance,
-                                   db_getheader(centroid_seqno), 
-                                   db_getheaderlen(centroid_seqno));
-          fprintf(fp_profile,
-                  ">centroid=%s;seqs=%d;size=%ld;",
-                  header_wo_size, 
-                  target_count,
-                  totalabundance);
-          free(header_wo_size);
-        }
-      else
-        fprintf(fp_profile,
-                ">centroid=%s;seqs=%d;",
-                db_getheader(centroid_seqno),
-                target_count);
-
-      if (opt_clusterout_id)
-        fprintf(fp_profile, "clusterid=%d;", cluster);
-
-      fprintf(fp_profile, "\n");
+      msa_format_centroid(s_profile, cluster, centroid_seqno,
+                          target_count, totalabundance);
 
       for (int i=0; i<alnlen; i++)
         {
-          fprintf(fp_profile, "%d\t%c", i, aln[i]);
+          s_profile->add_d(i);
+          s_profile->add_c('\t');
+          s_profile->add_c(aln[i]);
           int nongap_count = 0;
           for (int c=0; c<4; c++)
             {
               int count = profile[4*i+c];
               nongap_count += count;
-              if (count % 12 == 0)
-                fprintf(fp_profile, "\t%d", count / 12);
-              else
-                fprintf(fp_profile, "\t%.2f", 1.0 * count / 12.0);
+              msa_format_count(s_profile, count);
             }
-          if (nongap_count % 12 == 0)
-            fprintf(fp_profile, "\t%d", target_count - nongap_count / 12);
-          else
-            fprintf(fp_profile, "\t%.2f", 1.0 * target_count - 1.0 * nongap_count / 12.0);
-          fprintf(fp_profile, "\n");
+          msa_format_count(s_profile, 12 * target_count - nongap_count);
+          s_profile->add_c('\n');
         }
-      fprintf(fp_profile, "\n");
+      s_profile->add_c('\n');
     }
-
-  free(maxi);
-  free(aln);
-  free(cons);
-  free(profile);
 }
@@ -65,7 +65,16 @@ struct msa_target_s
   int strand;
 };
 
-void msa(FILE * fp_msaout, FILE * fp_consout, FILE * fp_profile,
-         int cluster,
-         int target_count, struct msa_target_s * target_list,
-         long totalabundance);
+struct msa_s;
+
+typedef struct msa_s msa_t;
+
+msa_t * msa_init();
+
+void msa_exit(msa_t * m);
+
+void msa_format(msa_t * m,
+                xstring * s_msaout, xstring * s_consout, xstring * s_profile,
+                int cluster,
+                int target_count, struct msa_target_s * target_list,
+                long totalabundance);
@@ -0,0 +1,260 @@
+/*
+
+  VSEARCH: a versatile open source tool for metagenomics
+
+  Copyright (C) 2014-2015, Torbjorn Rognes, Frederic Mahe and Tomas Flouri
+  All rights reserved.
+
+  Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+  Department of Informatics, University of Oslo,
+  PO Box 1080 Blindern, NO-0316 Oslo, Norway
+
+  This software is dual-licensed and available under a choice
+  of one of two licenses, either under the terms of the GNU
+  General Public License version 3 or the BSD 2-Clause License.
+
+
+  GNU General Public License version 3
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+  The BSD 2-Clause License
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vsearch.h"
+
+/*
+  Radix sorting of records with a numeric leading key.
+
+  The comparison functions used for sorting sequences by abundance or
+  length first compare numbers and only fall back to the labels and
+  the input order when these are equal. radix_sort takes a function
+  that packs the numeric part of such an ordering into a 64-bit key,
+  sorts (key, position) pairs with a stable least significant digit
+  radix sort, eight bits at a time, and rearranges the records. Only
+  the runs of records with identical keys are then sorted with the
+  original comparison function, so the result is the same as with
+  qsort and that function alone. Digits that are equal in all keys
+  are skipped.
+
+  With threads each pass is split in contiguous ranges: every thread
+  counts the digits of its range, the counts are turned into separate
+  output offsets for each thread, and every thread then moves its own
+  range, which keeps the sort stable.
+*/
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_MIN_PARALLEL 65536
+
+struct radix_item_s
+{
+  unsigned long key;
+  unsigned long index;
+};
+
+static struct radix_item_s * radix_src;
+static struct radix_item_s * radix_dst;
+static long radix_n;
+static int radix_shift;
+static long radix_threads;
+static long (* radix_counts)[RADIX_BUCKETS];
+
+static void radix_count(long t)
+{
+  long first = radix_n * t / radix_threads;
+  long last = radix_n * (t + 1) / radix_threads;
+  long * counts = radix_counts[t];
+
+  memset(counts, 0, sizeof(long) * RADIX_BUCKETS);
+  for(long i = first; i < last; i++)
+    counts[(radix_src[i].key >> radix_shift) & (RADIX_BUCKETS - 1)]++;
+}
+
+static void radix_scatter(long t)
+{
+  long first = radix_n * t / radix_threads;
+  long last = radix_n * (t + 1) / radix_threads;
+  long * offsets = radix_counts[t];
+
+  for(long i = first; i < last; i++)
+    {
+      unsigned int d = (radix_src[i].key >> radix_shift) & (RADIX_BUCKETS - 1);
+      radix_dst[offsets[d]++] = radix_src[i];
+    }
+}
+
+#if PTHREAD
+static void * radix_count_worker(void * vp)
+{
+  radix_count((long) vp);
+  return 0;
+}
+
+static void * radix_scatter_worker(void * vp)
+{
+  radix_scatter((long) vp);
+  return 0;
+}
+
+static void radix_run_threads(void * (*worker)(void *))
+{
+  pthread_t * pthread
+    = (pthread_t *) xmalloc(radix_threads * sizeof(pthread_t));
+
+  for(long t=0; t<radix_threads; t++)
+    if (pthread_create(pthread+t, 0, worker, (void*)t))
+      fatal("Cannot create thread");
+
+  for(long t=0; t<radix_threads; t++)
+    if (pthread_join(pthread[t], NULL))
+      fatal("Cannot join thread");
+
+  free(pthread);
+}
+#endif
+
+static void radix_pass()
+{
+#if PTHREAD
+  if (radix_threads > 1)
+    radix_run_threads(radix_count_worker);
+  else
+    radix_count(0);
+#else
+  radix_count(0);
+#endif
+
+  /* turn the counts into output offsets, thread by thread per digit */
+
+  long offset = 0;
+  for(long d = 0; d < RADIX_BUCKETS; d++)
+    for(long t = 0; t < radix_threads; t++)
+      {
+        long count = radix_counts[t][d];
+        radix_counts[t][d] = offset;
+        offset += count;
+      }
+
+#if PTHREAD
+  if (radix_threads > 1)
+    radix_run_threads(radix_scatter_worker);
+  else
+    radix_scatter(0);
+#else
+  radix_scatter(0);
+#endif
+}
+
+void radix_sort(void * base,
+                long n,
+                size_t width,
+                unsigned long (*key)(const void *),
+                int (*compare)(const void *, const void *))
+{
+  if (n < 2)
+    return;
+
+  char * records = (char *) base;
+
+  struct radix_item_s * items = (struct radix_item_s *)
+    xmalloc(sizeof(struct radix_item_s) * n);
+  struct radix_item_s * temp = (struct radix_item_s *)
+    xmalloc(sizeof(struct radix_item_s) * n);
+
+  unsigned long all_or = 0;
+  unsigned long all_and = ULONG_MAX;
+  for(long i = 0; i < n; i++)
+    {
+      items[i].key = key(records + i * width);
+      items[i].index = i;
+      all_or |= items[i].key;
+      all_and &= items[i].key;
+    }
+
+#if PTHREAD
+  radix_threads = (n >= RADIX_MIN_PARALLEL) && (opt_threads > 1) ?
+    opt_threads : 1;
+#else
+  radix_threads = 1;
+#endif
+
+  radix_counts = (long (*)[RADIX_BUCKETS])
+    xmalloc(sizeof(long) * RADIX_BUCKETS * radix_threads);
+  radix_n = n;
+  radix_src = items;
+  radix_dst = temp;
+
+  for(radix_shift = 0; radix_shift < 64; radix_shift += RADIX_BITS)
+    if (((all_or ^ all_and) >> radix_shift) & (RADIX_BUCKETS - 1))
+      {
+        radix_pass();
+        struct radix_item_s * swap = radix_src;
+        radix_src = radix_dst;
+        radix_dst = swap;
+      }
+
+  free(radix_counts);
+
+  /* rearrange the records */
+
+  items = radix_src;
+  char * sorted = (char *) xmalloc(width * n);
+  for(long i = 0; i < n; i++)
+    memcpy(sorted + i * width, records + items[i].index * width, width);
+  memcpy(records, sorted, width * n);
+  free(sorted);
+
+  /* order records with identical keys by the comparison function */
+
+  long i = 0;
+  while (i < n)
+    {
+      long j = i + 1;
+      while ((j < n) && (items[j].key == items[i].key))
+        j++;
+      if (j - i > 1)
+        qsort(records + i * width, j - i, width, compare);
+      i = j;
+    }
+
+  free(radix_src);
+  free(radix_dst);
+}
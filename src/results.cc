@@ -60,12 +60,12 @@
 
 #include "vsearch.h"
 
-void results_show_fastapairs_one(FILE * fp,
-                                 struct hit * hp,
-                                 char * query_head,
-                                 char * qsequence,
-                                 long qseqlen,
-                                 char * rc)
+void results_format_fastapairs_one(xstring * s,
+                                   struct hit * hp,
+                                   char * query_head,
+                                   char * qsequence,
+                                   long qseqlen,
+                                   char * rc)
 {
   /* http://www.drive5.com/usearch/manual/fastapairs.html */
   
@@ -75,33 +75,45 @@ void results_show_fastapairs_one(FILE * fp,
                                  hp->nwalignment,
                                  hp->nwalignmentlength,
                                  0);
-      fasta_print_header(fp, query_head);
-      fasta_print_sequence(fp,
-                           qrow + hp->trim_q_left + hp->trim_t_left,
-                           hp->internal_alignmentlength, 0);
+      fasta_format_header(s, query_head);
+      fasta_format_sequence(s,
+                            qrow + hp->trim_q_left + hp->trim_t_left,
+                            hp->internal_alignmentlength, 0);
       free(qrow);
       
       char * trow = align_getrow(db_getsequence(hp->target),
                                  hp->nwalignment,
                                  hp->nwalignmentlength,
                                  1);
-      fasta_print_header(fp, db_getheader(hp->target));
-      fasta_print_sequence(fp,
-                           trow + hp->trim_q_left + hp->trim_t_left,
-                           hp->internal_alignmentlength, 0);
+      fasta_format_header(s, db_getheader(hp->target));
+      fasta_format_sequence(s,
+                            trow + hp->trim_q_left + hp->trim_t_left,
+                            hp->internal_alignmentlength, 0);
       free(trow);
       
-      fprintf(fp, "\n");
+      s->add_c('\n');
     }
 }
 
+void results_show_fastapairs_one(FILE * fp,
+                                 struct hit * hp,
+                                 char * query_head,
+                                 char * qsequence,
+                                 long qseqlen,
+                                 char * rc)
+{
+  xstring s;
+  results_format_fastapairs_one(&s, hp, query_head, qsequence, qseqlen, rc);
+  fwrite(s.get_string(), 1, s.get_length(), fp);
+}
 
-void results_show_blast6out_one(FILE * fp,
-                                struct hit * hp,
-                                char * query_head,
-                                char * qsequence, 
-                                long qseqlen,
-                                char * rc)
+
+void results_format_blast6out_one(xstring * s,
+                                  struct hit * hp,
+                                  char * query_head,
+                                  char * qsequence, 
+                                  long qseqlen,
+                                  char * rc)
 {
 
   /* 
@@ -141,33 +153,50 @@ void results_show_blast6out_one(FILE * fp,
           qend = qseqlen;
         }
       
-      fprintf(fp,
-              "%s\t%s\t%.1f\t%d\t%d\t%d\t%d\t%d\t%d\t%lu\t%d\t%d\n",
-              query_head,
-              db_getheader(hp->target),
-              hp->id,
-              hp->internal_alignmentlength,
-              hp->mismatches,
-              hp->internal_gaps,
-              qstart,
-              qend,
-              1,
-              db_getsequencelen(hp->target),
-              -1,
-              0);
+      s->add_s(query_head);
+      s->add_c('\t');
+      s->add_s(db_getheader(hp->target));
+      s->add_c('\t');
+      s->add_f1(hp->id);
+      s->add_c('\t');
+      s->add_d(hp->internal_alignmentlength);
+      s->add_c('\t');
+      s->add_d(hp->mismatches);
+      s->add_c('\t');
+      s->add_d(hp->internal_gaps);
+      s->add_c('\t');
+      s->add_d(qstart);
+      s->add_c('\t');
+      s->add_d(qend);
+      s->add_s("\t1\t");
+      s->add_lu(db_getsequencelen(hp->target));
+      s->add_s("\t-1\t0\n");
     }
   else
     {
-        fprintf(fp, "%s\t*\t0.0\t0\t0\t0\t0\t0\t0\t0\t-1\t0\n", query_head);
+      s->add_s(query_head);
+      s->add_s("\t*\t0.0\t0\t0\t0\t0\t0\t0\t0\t-1\t0\n");
     }
 }
 
-void results_show_uc_one(FILE * fp,
-                         struct hit * hp,
-                         char * query_head,
-                         char * qsequence,
-                         long qseqlen,
-                         char * rc)
+void results_show_blast6out_one(FILE * fp,
+                                struct hit * hp,
+                                char * query_head,
+                                char * qsequence, 
+                                long qseqlen,
+                                char * rc)
+{
+  xstring s;
+  results_format_blast6out_one(&s, hp, query_head, qsequence, qseqlen, rc);
+  fwrite(s.get_string(), 1, s.get_length(), fp);
+}
+
+void results_format_uc_one(xstring * s,
+                           struct hit * hp,
+                           char * query_head,
+                           char * qsequence,
+                           long qseqlen,
+                           char * rc)
 {
   /*
     http://www.drive5.com/usearch/manual/ucout.html
@@ -190,24 +219,46 @@ void results_show_uc_one(FILE * fp,
       bool perfect = (hp->matches == qseqlen) &&
         (qseqlen = db_getsequencelen(hp->target));
 
-      fprintf(fp,
-              "H\t%d\t%ld\t%.1f\t%c\t0\t0\t%s\t%s\t%s\n",
-              hp->target,
-              qseqlen,
-              hp->id,
-              hp->strand ? '-' : '+',
-              perfect ? "=" : hp->nwalignment,
-              query_head,
-              db_getheader(hp->target));
+      s->add_s("H\t");
+      s->add_d(hp->target);
+      s->add_c('\t');
+      s->add_l(qseqlen);
+      s->add_c('\t');
+      s->add_f1(hp->id);
+      s->add_c('\t');
+      s->add_c(hp->strand ? '-' : '+');
+      s->add_s("\t0\t0\t");
+      s->add_s(perfect ? "=" : hp->nwalignment);
+      s->add_c('\t');
+      s->add_s(query_head);
+      s->add_c('\t');
+      s->add_s(db_getheader(hp->target));
+      s->add_c('\n');
     }
   else
-    fprintf(fp, "N\t*\t*\t*\t.\t*\t*\t*\t%s\t*\n", query_head);
+    {
+      s->add_s("N\t*\t*\t*\t.\t*\t*\t*\t");
+      s->add_s(query_head);
+      s->add_s("\t*\n");
+    }
 }
 
-void results_show_userout_one(FILE * fp, struct hit * hp,
-                              char * query_head,
-                              char * qsequence, long qseqlen,
-                              char * rc)
+void results_show_uc_one(FILE * fp,
+                         struct hit * hp,
+                         char * query_head,
+                         char * qsequence,
+                         long qseqlen,
+                         char * rc)
+{
+  xstring s;
+  results_format_uc_one(&s, hp, query_head, qsequence, qseqlen, rc);
+  fwrite(s.get_string(), 1, s.get_length(), fp);
+}
+
+void results_format_userout_one(xstring * s, struct hit * hp,
+                                char * query_head,
+                                char * qsequence, long qseqlen,
+                                char * rc)
 {
 
   /*
@@ -218,7 +269,7 @@ void results_show_userout_one(FILE * fp, struct hit * hp,
   for (int c = 0; c < userfields_requested_count; c++)
     {
       if (c)
-        fprintf(fp, "\t");
+        s->add_c('\t');
 
       int field = userfields_requested[c];
           
@@ -239,86 +290,86 @@ void results_show_userout_one(FILE * fp, struct hit * hp,
       switch (field)
         {
         case 0: /* query */
-          fprintf(fp, "%s", query_head);
+          s->add_s(query_head);
           break;
         case 1: /* target */
-          fprintf(fp, "%s", hp ? t_head : "*");
+          s->add_s(hp ? t_head : "*");
           break;
         case 2: /* evalue */
-          fprintf(fp, "-1");
+          s->add_s("-1");
           break;
         case 3: /* id */
-          fprintf(fp, "%.1f", hp ? hp->id : 0.0);
+          s->add_f1(hp ? hp->id : 0.0);
           break;
         case 4: /* pctpv */
-          fprintf(fp, "%.1f", (hp && (hp->internal_alignmentlength > 0)) ? 100.0 * hp->matches / hp->internal_alignmentlength : 0.0);
+          s->add_f1((hp && (hp->internal_alignmentlength > 0)) ? 100.0 * hp->matches / hp->internal_alignmentlength : 0.0);
           break;
         case 5: /* pctgaps */
-          fprintf(fp, "%.1f", (hp && (hp->internal_alignmentlength > 0)) ? 100.0 * hp->internal_indels / hp->internal_alignmentlength : 0.0);
+          s->add_f1((hp && (hp->internal_alignmentlength > 0)) ? 100.0 * hp->internal_indels / hp->internal_alignmentlength : 0.0);
           break;
         case 6: /* pairs */
-          fprintf(fp, "%d", hp ? hp->matches + hp->mismatches : 0);
+          s->add_d(hp ? hp->matches + hp->mismatches : 0);
           break;
         case 7: /* gaps */
-          fprintf(fp, "%d", hp ? hp->internal_indels : 0);
+          s->add_d(hp ? hp->internal_indels : 0);
           break;
         case 8: /* qlo */
-          fprintf(fp, "%ld", hp ? (hp->strand ? qseqlen : 1) : 0);
+          s->add_l(hp ? (hp->strand ? qseqlen : 1) : 0);
           break;
         case 9: /* qhi */
-          fprintf(fp, "%ld", hp ? (hp->strand ? 1 : qseqlen) : 0);
+          s->add_l(hp ? (hp->strand ? 1 : qseqlen) : 0);
           break;
         case 10: /* tlo */
-          fprintf(fp, "%d", hp ? 1 : 0);
+          s->add_d(hp ? 1 : 0);
           break;
         case 11: /* thi */
-          fprintf(fp, "%ld", tseqlen);
+          s->add_l(tseqlen);
           break;
         case 12: /* pv */
-          fprintf(fp, "%d", hp ? hp->matches : 0);
+          s->add_d(hp ? hp->matches : 0);
           break;
         case 13: /* ql */
-          fprintf(fp, "%ld", qseqlen);
+          s->add_l(qseqlen);
           break;
         case 14: /* tl */
-          fprintf(fp, "%ld", hp ? tseqlen : 0);
+          s->add_l(hp ? tseqlen : 0);
           break;
         case 15: /* qs */
-          fprintf(fp, "%ld", qseqlen);
+          s->add_l(qseqlen);
           break;
         case 16: /* ts */
-          fprintf(fp, "%ld", hp ? tseqlen : 0);
+          s->add_l(hp ? tseqlen : 0);
           break;
         case 17: /* alnlen */
-          fprintf(fp, "%d", hp ? hp->internal_alignmentlength : 0);
+          s->add_d(hp ? hp->internal_alignmentlength : 0);
           break;
         case 18: /* opens */
-          fprintf(fp, "%d", hp ? hp->internal_gaps : 0);
+          s->add_d(hp ? hp->internal_gaps : 0);
           break;
         case 19: /* exts */
-          fprintf(fp, "%d", hp ? hp->internal_indels - hp->internal_gaps : 0);
+          s->add_d(hp ? hp->internal_indels - hp->internal_gaps : 0);
           break;
         case 20: /* raw */
-          fprintf(fp, "%d", hp ? hp->nwscore : 0);
+          s->add_d(hp ? hp->nwscore : 0);
           break;
         case 21: /* bits */
-          fprintf(fp, "%d", 0);
+          s->add_d(0);
           break;
         case 22: /* aln */ 
           if (hp)
-            align_fprint_uncompressed_alignment(fp, hp->nwalignment);
+            align_format_uncompressed_alignment(s, hp->nwalignment);
           break;
         case 23: /* caln */
           if (hp)
-            fprintf(fp, "%s", hp->nwalignment);
+            s->add_s(hp->nwalignment);
           break;
         case 24: /* qstrand */
           if (hp)
-            fprintf(fp, "%c", hp->strand ? '-' : '+');
+            s->add_c(hp->strand ? '-' : '+');
           break;
         case 25: /* tstrand */
           if (hp)
-            fprintf(fp, "%c", '+');
+            s->add_c('+');
           break;
         case 26: /* qrow */
           if (hp)
@@ -327,9 +378,8 @@ void results_show_userout_one(FILE * fp, struct hit * hp,
                                   hp->nwalignment,
                                   hp->nwalignmentlength,
                                   0);
-              fprintf(fp, "%.*s",
-                      (int)(hp->internal_alignmentlength),
-                      qrow + hp->trim_q_left + hp->trim_t_left);
+              s->add_sn(qrow + hp->trim_q_left + hp->trim_t_left,
+                        hp->internal_alignmentlength);
               free(qrow);
             }
           break;
@@ -340,65 +390,74 @@ void results_show_userout_one(FILE * fp, struct hit * hp,
                                   hp->nwalignment,
                                   hp->nwalignmentlength,
                                   1);
-              fprintf(fp, "%.*s",
-                      (int)(hp->internal_alignmentlength),
-                      trow + hp->trim_q_left + hp->trim_t_left);
+              s->add_sn(trow + hp->trim_q_left + hp->trim_t_left,
+                        hp->internal_alignmentlength);
               free(trow);
             }
           break;
         case 28: /* qframe */
-          fprintf(fp, "+0");
+          s->add_s("+0");
           break;
         case 29: /* tframe */
-          fprintf(fp, "+0");
+          s->add_s("+0");
           break;
         case 30: /* mism */
-          fprintf(fp, "%d", hp ? hp->mismatches : 0);
+          s->add_d(hp ? hp->mismatches : 0);
           break;
         case 31: /* ids */
-          fprintf(fp, "%d", hp ? hp->matches : 0);
+          s->add_d(hp ? hp->matches : 0);
           break;
         case 32: /* qcov */
-          fprintf(fp, "%.1f",
-                  hp ? 100.0 * (hp->matches + hp->mismatches) / qseqlen : 0.0);
+          s->add_f1(hp ?
+                    100.0 * (hp->matches + hp->mismatches) / qseqlen : 0.0);
           break;
         case 33: /* tcov */
-          fprintf(fp, "%.1f",
-                  hp ? 100.0 * (hp->matches + hp->mismatches) / tseqlen : 0.0);
+          s->add_f1(hp ?
+                    100.0 * (hp->matches + hp->mismatches) / tseqlen : 0.0);
           break;
         case 34: /* id0 */
-          fprintf(fp, "%.1f", hp ? hp->id0 : 0.0);
+          s->add_f1(hp ? hp->id0 : 0.0);
           break;
         case 35: /* id1 */
-          fprintf(fp, "%.1f", hp ? hp->id1 : 0.0);
+          s->add_f1(hp ? hp->id1 : 0.0);
           break;
         case 36: /* id2 */
-          fprintf(fp, "%.1f", hp ? hp->id2 : 0.0);
+          s->add_f1(hp ? hp->id2 : 0.0);
           break;
         case 37: /* id3 */
-          fprintf(fp, "%.1f", hp ? hp->id3 : 0.0);
+          s->add_f1(hp ? hp->id3 : 0.0);
           break;
         case 38: /* id4 */
-          fprintf(fp, "%.1f", hp ? hp->id4 : 0.0);
+          s->add_f1(hp ? hp->id4 : 0.0);
           break;
 
           /* new internal alignment coordinates */
 
         case 39: /* qilo */
-          fprintf(fp, "%d", hp ? hp->trim_q_left + 1 : 0);
+          s->add_d(hp ? hp->trim_q_left + 1 : 0);
           break;
         case 40: /* qihi */
-          fprintf(fp, "%ld", hp ? qseqlen - hp->trim_q_right : 0);
+          s->add_l(hp ? qseqlen - hp->trim_q_right : 0);
           break;
         case 41: /* tilo */
-          fprintf(fp, "%d", hp ? hp->trim_t_left + 1 : 0);
+          s->add_d(hp ? hp->trim_t_left + 1 : 0);
           break;
         case 42: /* tihi */
-          fprintf(fp, "%ld", hp ? tseqlen - hp->trim_t_right : 0);
+          s->add_l(hp ? tseqlen - hp->trim_t_right : 0);
           break;
         }
     }
-  fprintf(fp, "\n");
+  s->add_c('\n');
+}
+
+void results_show_userout_one(FILE * fp, struct hit * hp,
+                              char * query_head,
+                              char * qsequence, long qseqlen,
+                              char * rc)
+{
+  xstring s;
+  results_format_userout_one(&s, hp, query_head, qsequence, qseqlen, rc);
+  fwrite(s.get_string(), 1, s.get_length(), fp);
 }
 
 void results_show_alnout(FILE * fp,
@@ -629,13 +688,13 @@ void results_show_samheader(FILE * fp,
     }
 }
 
-void results_show_samout(FILE * fp,
-                         struct hit * hits,
-                         int hitcount,
-                         char * query_head,
-                         char * qsequence,
-                         long qseqlen,
-                         char * rc)
+void results_format_samout(xstring * s,
+                           struct hit * hits,
+                           int hitcount,
+                           char * query_head,
+                           char * qsequence,
+                           long qseqlen,
+                           char * rc)
 {
   /* 
      SAM format output
@@ -698,45 +757,48 @@ void results_show_samout(FILE * fp,
                             & cigar,
                             & md);
 
-          fprintf(fp,
-                  "%s\t%u\t%s\t%lu\t%u\t%s\t%s\t%lu\t%lu\t%s\t%s\t"
-                  "AS:i:%.0f\tXN:i:%d\tXM:i:%d\tXO:i:%d\t"
-                  "XG:i:%d\tNM:i:%d\tMD:Z:%s\tYT:Z:%s\n",
-                  query_head,
-                  0x10 * hp->strand | (t>0 ? 0x100 : 0),
-                  db_getheader(hp->target),
-                  1UL,
-                  255,
-                  cigar.get_string(),
-                  "*",
-                  0UL,
-                  0UL,
-                  hp->strand ? rc : qsequence,
-                  "*",
-                  hp->id,
-                  0,
-                  hp->mismatches,
-                  hp->internal_gaps,
-                  hp->internal_indels,
-                  hp->mismatches + hp->internal_indels,
-                  md.get_string(),
-                  "UU");
+          s->add_s(query_head);
+          s->add_c('\t');
+          s->add_d(0x10 * hp->strand | (t>0 ? 0x100 : 0));
+          s->add_c('\t');
+          s->add_s(db_getheader(hp->target));
+          s->add_s("\t1\t255\t");
+          s->add_s(cigar.get_string());
+          s->add_s("\t*\t0\t0\t");
+          s->add_s(hp->strand ? rc : qsequence);
+          s->add_s("\t*\tAS:i:");
+          s->add_l((long) nearbyint(hp->id));
+          s->add_s("\tXN:i:0\tXM:i:");
+          s->add_d(hp->mismatches);
+          s->add_s("\tXO:i:");
+          s->add_d(hp->internal_gaps);
+          s->add_s("\tXG:i:");
+          s->add_d(hp->internal_indels);
+          s->add_s("\tNM:i:");
+          s->add_d(hp->mismatches + hp->internal_indels);
+          s->add_s("\tMD:Z:");
+          s->add_s(md.get_string());
+          s->add_s("\tYT:Z:UU\n");
         }
     }
   else if (opt_output_no_hits)
     {
-      fprintf(fp,
-              "%s\t%u\t%s\t%lu\t%u\t%s\t%s\t%lu\t%lu\t%s\t%s\n",
-              query_head,
-              0x04,
-              "*",
-              0UL,
-              255,
-              "*",
-              "*",
-              0UL,
-              0UL,
-              qsequence,
-              "*");
+      s->add_s(query_head);
+      s->add_s("\t4\t*\t0\t255\t*\t*\t0\t0\t");
+      s->add_s(qsequence);
+      s->add_s("\t*\n");
     }
 }
+
+void results_show_samout(FILE * fp,
+                         struct hit * hits,
+                         int hitcount,
+                         char * query_head,
+                         char * qsequence,
+                         long qseqlen,
+                         char * rc)
+{
+  xstring s;
+  results_format_samout(&s, hits, hitcount, query_head, qsequence, qseqlen, rc);
+  fwrite(s.get_string(), 1, s.get_length(), fp);
+}
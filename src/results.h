@@ -66,6 +66,42 @@ void results_show_alnout(FILE * fp,
                          long qseqlen,
                          char * rc);
 
+void results_format_blast6out_one(xstring * s,
+                                  struct hit * hp,
+                                  char * query_head,
+                                  char * qsequence,
+                                  long qseqlen,
+                                  char * rc);
+
+void results_format_uc_one(xstring * s,
+                           struct hit * hp,
+                           char * query_head,
+                           char * qsequence,
+                           long qseqlen,
+                           char * rc);
+
+void results_format_userout_one(xstring * s,
+                                struct hit * hp,
+                                char * query_head,
+                                char * qsequence,
+                                long qseqlen,
+                                char * rc);
+
+void results_format_fastapairs_one(xstring * s,
+                                   struct hit * hp,
+                                   char * query_head,
+                                   char * qsequence,
+                                   long qseqlen,
+                                   char * rc);
+
+void results_format_samout(xstring * s,
+                           struct hit * hits,
+                           int hitcount,
+                           char * query_head,
+                           char * qsequence,
+                           long qseqlen,
+                           char * rc);
+
 void results_show_blast6out_one(FILE * fp,
                                 struct hit * hp,
                                 char * query_head,
@@ -60,6 +60,17 @@
 
 #include "vsearch.h"
 
+/*
+  The alignments of a query may be kept in a cache, indexed by the
+  database sequence number of the query, and used instead of aligning
+  the same query and target again. It is filled by the caller, when
+  the same queries are to be searched again with other thresholds,
+  and only read while searching.
+*/
+
+static std::vector<struct hit> * search_cache = 0;
+static unsigned long search_cache_size = 0;
+
 /* per thread data */
 
 inline int hit_compare_byid_typed(struct hit * x, struct hit * y)
@@ -188,6 +199,26 @@ void _mm_print_epi8(__m128i x)
     printf("%s%02x", (i>0?" ":""), y[15-i]);
 }
 
+static void search_count_bitmap(count_t * kmers,
+                                unsigned char * bitmap,
+                                int indexed_count)
+{
+  /* count the kmer hits of all the sequences in the bitmap */
+
+  if (ssse3_present)
+    {
+#ifndef __SSE2__
+      increment_counters_from_bitmap_ssse3(kmers, bitmap, indexed_count);
+#endif
+    }
+  else
+    {
+#ifdef __SSE2__
+      increment_counters_from_bitmap_sse2(kmers, bitmap, indexed_count);
+#endif
+    }
+}
+
 void search_topscores(struct searchinfo_s * si)
 {
   /*
@@ -211,18 +242,7 @@ void search_topscores(struct searchinfo_s * si)
       unsigned char * bitmap = dbindex_getbitmap(kmer);
       
       if (bitmap)
-        {
-            if (ssse3_present) {
-              #ifdef __SSE2__
-#else
-            increment_counters_from_bitmap_ssse3(si->kmers, bitmap, indexed_count);
-#endif
-            }else{
-              #ifdef __SSE2__
-            increment_counters_from_bitmap_sse2(si->kmers, bitmap, indexed_count);
-                #endif
-            }
-        }
+        search_count_bitmap(si->kmers, bitmap, indexed_count);
       else
         {
           unsigned int * list = dbindex_getmatchlist(kmer);
@@ -236,6 +256,77 @@ void search_topscores(struct searchinfo_s * si)
     topscore_insert(i, si);
   
   minheap_sort(si->m);
+
+  si->topscore_count = si->m->count;
+}
+
+bool search_hits_could_change(struct searchinfo_s * si,
+                              unsigned int index)
+{
+  /*
+    Return whether the sequence added to the index as number index
+    after the last search of si could have changed its hits. The
+    targets are analysed in the order of their kmer scores until the
+    search is done, so a sequence scoring below the last target
+    analysed makes no difference, unless all targets in the heap were
+    analysed. The kmer count is an upper bound, as the kmers with
+    bitmaps are always counted. The sorted heap array keeps the
+    targets popped from its end.
+  */
+
+  if (si->topscore_count < 0)
+    return true;
+
+  unsigned int count = 0;
+
+  for(unsigned int i=0; i<si->kmersamplecount; i++)
+    {
+      unsigned int kmer = si->kmersample[i];
+      unsigned char * bitmap = dbindex_getbitmap(kmer);
+
+      if (bitmap)
+        count += (bitmap[index >> 3] >> (index & 7)) & 1;
+      else
+        {
+          /* the lists are in index order */
+          unsigned int * list = dbindex_getmatchlist(kmer);
+          unsigned int lo = 0;
+          unsigned int hi = dbindex_getmatchcount(kmer);
+          while (lo < hi)
+            {
+              unsigned int mid = lo + (hi - lo) / 2;
+              if (list[mid] < index)
+                lo = mid + 1;
+              else
+                hi = mid;
+            }
+          if ((lo < dbindex_getmatchcount(kmer)) && (list[lo] == index))
+            count++;
+        }
+    }
+
+  if (!search_enough_kmers(si, count))
+    return false;
+
+  unsigned int seqno = dbindex_getmapping(index);
+
+  elem_t novel;
+  novel.count = count;
+  novel.seqno = seqno;
+  novel.length = db_getsequencelen(seqno);
+
+  if (si->m->count > 0)
+    {
+      /* some targets were left, compare with the last one analysed */
+      if (si->m->count == si->topscore_count)
+        return false;
+      return elem_smaller(si->m->array + si->m->count, & novel);
+    }
+
+  if (si->topscore_count < si->m->alloc)
+    return true;
+
+  return elem_smaller(si->m->array, & novel);
 }
 
 int seqncmp(char * a, char * b, unsigned long n)
@@ -472,6 +563,74 @@ int search_acceptable_aligned(struct searchinfo_s * si,
     }
 }
 
+static struct hit * search_cache_find(struct searchinfo_s * si, int target)
+{
+  if (! search_cache)
+    return 0;
+
+  std::vector<struct hit> & cached = search_cache[si->query_no];
+
+  for(unsigned long j = 0; j < cached.size(); j++)
+    if ((cached[j].target == target) && (cached[j].strand == si->strand))
+      return & cached[j];
+
+  return 0;
+}
+
+void search_cache_init(unsigned long seqcount)
+{
+  search_cache = new std::vector<struct hit>[seqcount];
+  search_cache_size = seqcount;
+}
+
+void search_cache_exit()
+{
+  for(unsigned long i = 0; i < search_cache_size; i++)
+    for(unsigned long j = 0; j < search_cache[i].size(); j++)
+      free(search_cache[i][j].nwalignment);
+  delete [] search_cache;
+  search_cache = 0;
+  search_cache_size = 0;
+}
+
+void search_cache_add(struct searchinfo_s * si)
+{
+  /* keep the alignments made for the query */
+
+  std::vector<struct hit> & cached = search_cache[si->query_no];
+
+  for(int i = 0; i < si->hit_count; i++)
+    {
+      struct hit * hit = si->hits + i;
+      if (hit->aligned && hit->nwalignment &&
+          ! search_cache_find(si, hit->target))
+        {
+          cached.push_back(* hit);
+          cached.back().nwalignment = xstrdup(hit->nwalignment);
+        }
+    }
+}
+
+bool search_cache_get(struct searchinfo_s * si, struct hit * hit)
+{
+  /* fill in the hit from an earlier alignment of the query and target */
+
+  struct hit * c = search_cache_find(si, hit->target);
+
+  if (! c)
+    return false;
+
+  unsigned int count = hit->count;
+  * hit = * c;
+  hit->count = count;
+  hit->accepted = 0;
+  hit->rejected = 0;
+  hit->weak = 0;
+  hit->aligned = 1;
+  hit->nwalignment = xstrdup(c->nwalignment);
+  return true;
+}
+
 void align_delayed(struct searchinfo_s * si)
 {
   /* compute global alignment */
@@ -489,7 +648,7 @@ void align_delayed(struct searchinfo_s * si)
   for(int x = si->finalized; x < si->hit_count; x++)
     {
       struct hit * hit = si->hits + x;
-      if (! hit->rejected)
+      if ((! hit->rejected) && (! search_cache_find(si, hit->target)))
         target_list[target_count++] = hit->target;
     }
 
@@ -517,6 +676,13 @@ void align_delayed(struct searchinfo_s * si)
             {
               si->rejects++;
             }
+          else if (search_cache_get(si, hit))
+            {
+              if (search_acceptable_aligned(si, hit))
+                si->accepts++;
+              else
+                si->rejects++;
+            }
           else
             {
               long target = hit->target;
@@ -599,9 +765,100 @@ void align_delayed(struct searchinfo_s * si)
   si->finalized = si->hit_count;
 }
 
-void search_onequery(struct searchinfo_s * si, int seqmask)
+void search_hit_identical(struct searchinfo_s * si,
+                          struct hit * hit,
+                          int target)
+{
+  /* fill in the hit for a target identical to the query,
+     as if it had been aligned */
+
+  hit->target = target;
+  hit->strand = si->strand;
+  hit->count = 0;
+
+  hit->nwscore = si->qseqlen * opt_match;
+  hit->nwdiff = 0;
+  hit->nwgaps = 0;
+  hit->nwindels = 0;
+  hit->nwalignmentlength = si->qseqlen;
+  hit->nwid = 100.0;
+  hit->matches = si->qseqlen;
+  hit->mismatches = 0;
+
+  char cigar[32];
+  snprintf(cigar, sizeof(cigar), "%dM", si->qseqlen);
+  hit->nwalignment = xstrdup(cigar);
+
+  hit->internal_alignmentlength = si->qseqlen;
+  hit->internal_gaps = 0;
+  hit->internal_indels = 0;
+  hit->trim_q_left = 0;
+  hit->trim_q_right = 0;
+  hit->trim_t_left = 0;
+  hit->trim_t_right = 0;
+  hit->trim_aln_left = 0;
+  hit->trim_aln_right = 0;
+
+  hit->id = 100.0;
+  hit->id0 = 100.0;
+  hit->id1 = 100.0;
+  hit->id2 = 100.0;
+  hit->id3 = 100.0;
+  hit->id4 = 100.0;
+
+  hit->shortest = si->qseqlen;
+  hit->longest = si->qseqlen;
+
+  hit->aligned = 1;
+  hit->accepted = 0;
+  hit->rejected = 0;
+  hit->weak = 0;
+}
+
+/*
+  When only one hit is to be accepted and no weak hits are reported,
+  a target identical to the query is accepted without a k-mer search
+  or any alignment, provided the SIMD aligner would have scored it
+  without overflow. The kmers of the query are still sampled, as the
+  clustering compares them with new centroids.
+*/
+
+#define EXACT_MAXLENGTH 5000
+#define EXACT_MAXSCORE (SHRT_MAX / 2)
+
+static bool search_exact_shortcut(struct searchinfo_s * si, int seqmask)
+{
+  if ((opt_maxaccepts != 1) ||
+      (opt_weak_id < opt_id) ||
+      (si->qseqlen > EXACT_MAXLENGTH) ||
+      (si->qseqlen * opt_match > EXACT_MAXSCORE))
+    return false;
+
+  long target = dbindex_getexact(si->qsequence, si->qseqlen, seqmask);
+
+  if ((target < 0) || (! search_acceptable_unaligned(si, target)))
+    return false;
+
+  struct hit * hit = si->hits;
+  search_hit_identical(si, hit, target);
+  hit->count = si->kmersamplecount;
+
+  if (! search_acceptable_aligned(si, hit))
+    {
+      free(hit->nwalignment);
+      hit->nwalignment = 0;
+      return false;
+    }
+
+  si->hit_count = 1;
+  si->accepts = 1;
+  si->rejects = 0;
+  si->finalized = 1;
+  return true;
+}
+
+static void search_analyse_topscores(struct searchinfo_s * si)
 {
-  si->hit_count = 0;
   search16_qprep(si->s, si->qsequence, si->qseqlen);
 
   si->lma = new LinearMemoryAligner;
@@ -622,14 +879,6 @@ void search_onequery(struct searchinfo_s * si, int seqmask)
                           opt_gap_extension_query_right,
                           opt_gap_extension_target_right);
   
-  /* extract unique kmer samples from query*/
-  unique_count(si->uh, opt_wordlength, 
-               si->qseqlen, si->qsequence,
-               & si->kmersamplecount, & si->kmersample, seqmask);
-  
-  /* find database sequences with the most kmer hits */
-  search_topscores(si);
-  
   /* analyse targets with the highest number of kmer hits */
   si->accepts = 0;
   si->rejects = 0;
@@ -682,6 +931,131 @@ void search_onequery(struct searchinfo_s * si, int seqmask)
   free(scorematrix);
 }
 
+void search_onequery(struct searchinfo_s * si, int seqmask)
+{
+  si->hit_count = 0;
+  si->topscore_count = -1;
+
+  /* extract unique kmer samples from query*/
+  unique_count(si->uh, opt_wordlength, 
+               si->qseqlen, si->qsequence,
+               & si->kmersamplecount, & si->kmersample, seqmask);
+
+  if (search_exact_shortcut(si, seqmask))
+    return;
+
+  /* find database sequences with the most kmer hits */
+  search_topscores(si);
+  
+  search_analyse_topscores(si);
+}
+
+void search_segments(struct searchinfo_s * si,
+                     int segments,
+                     char * seq,
+                     int seqlen,
+                     int seqmask)
+{
+  /*
+    Search for each of the consecutive segments of a sequence, given
+    in si[0], si[1], ..., with the same hits as search_onequery on
+    each segment alone. The kmers are extracted once, together with
+    the segments they occur in, and the match list of each kmer is
+    walked once, counting the kmer hits of all segments at the same
+    time. The kmer samples of all segments are kept by si[0].
+  */
+
+  int segment_end[UNIQUE_MAXSEGMENTS];
+  unsigned int segment_listlen[UNIQUE_MAXSEGMENTS];
+  unsigned int * segment_list[UNIQUE_MAXSEGMENTS];
+
+  int end = 0;
+  for(int i=0; i < segments; i++)
+    {
+      end += si[i].qseqlen;
+      segment_end[i] = end;
+    }
+
+  unsigned int listlen;
+  unsigned int * list;
+  unsigned int * masks;
+
+  unique_count_segments(si[0].uh, opt_wordlength, seqlen, seq,
+                        segments, segment_end,
+                        & listlen, & list, & masks,
+                        segment_listlen, segment_list, seqmask);
+
+  int indexed_count = dbindex_getcount();
+
+  /* segments to be searched with kmers */
+  unsigned int active = 0;
+
+  for(int i=0; i < segments; i++)
+    {
+      si[i].hit_count = 0;
+      si[i].topscore_count = -1;
+      si[i].kmersamplecount = segment_listlen[i];
+      si[i].kmersample = segment_list[i];
+
+      if (! search_exact_shortcut(si + i, seqmask))
+        {
+          active |= 1U << i;
+          memset(si[i].kmers, 0, indexed_count * sizeof(count_t));
+          minheap_empty(si[i].m);
+        }
+    }
+
+  /* count kmer hits in the database sequences for all segments */
+
+  for(unsigned int j=0; j < listlen; j++)
+    {
+      unsigned int mask = masks[j] & active;
+      if (! mask)
+        continue;
+
+      unsigned int kmer = list[j];
+      unsigned char * bitmap = dbindex_getbitmap(kmer);
+      
+      if (bitmap)
+        {
+          for(int i=0; i < segments; i++)
+            if (mask & (1U << i))
+              search_count_bitmap(si[i].kmers, bitmap, indexed_count);
+        }
+      else
+        {
+          unsigned int * matchlist = dbindex_getmatchlist(kmer);
+          unsigned int count = dbindex_getmatchcount(kmer);
+
+          if (! (mask & (mask - 1)))
+            {
+              /* most kmers occur in one segment only */
+              count_t * kmers = si[__builtin_ctz(mask)].kmers;
+              for(unsigned int k=0; k < count; k++)
+                kmers[matchlist[k]]++;
+            }
+          else
+            for(unsigned int k=0; k < count; k++)
+              for(int i=0; i < segments; i++)
+                if (mask & (1U << i))
+                  si[i].kmers[matchlist[k]]++;
+        }
+    }
+
+  for(int t=0; t < indexed_count; t++)
+    for(int i=0; i < segments; i++)
+      if (active & (1U << i))
+        topscore_insert(t, si + i);
+
+  for(int i=0; i < segments; i++)
+    if (active & (1U << i))
+      {
+        minheap_sort(si[i].m);
+        si[i].topscore_count = si[i].m->count;
+        search_analyse_topscores(si + i);
+      }
+}
+
 struct hit * search_findbest2_byid(struct searchinfo_s * si_p,
                                    struct searchinfo_s * si_m)
 {
@@ -139,11 +139,18 @@ struct searchinfo_s
   int accepts;                  /* number of accepts */
   int rejects;                  /* number of rejects */
   minheap_t * m;                /* min heap with the top kmer db seqs */
+  int topscore_count;           /* db seqs in the heap, -1 if no kmer search */
   int finalized;
 };
 
 void search_onequery(struct searchinfo_s * si, int seqmask);
 
+void search_segments(struct searchinfo_s * si,
+                     int segments,
+                     char * seq,
+                     int seqlen,
+                     int seqmask);
+
 struct hit * search_findbest2_byid(struct searchinfo_s * si_p,
                                    struct searchinfo_s * si_m);
 
@@ -162,5 +169,17 @@ void search_joinhits(struct searchinfo_s * si_p,
                      struct hit * * hits,
                      int * hit_count);
 
+void search_hit_identical(struct searchinfo_s * si,
+                          struct hit * hit,
+                          int target);
+
 bool search_enough_kmers(struct searchinfo_s * si,
                          unsigned int count);
+
+bool search_hits_could_change(struct searchinfo_s * si,
+                              unsigned int index);
+
+void search_cache_init(unsigned long seqcount);
+void search_cache_exit();
+void search_cache_add(struct searchinfo_s * si);
+bool search_cache_get(struct searchinfo_s * si, struct hit * hit);
@@ -91,60 +91,22 @@ static FILE * fp_notmatched = 0;
 static FILE * fp_dbmatched = 0;
 static FILE * fp_dbnotmatched = 0;
 
+/* ordered writers for the per-query output files */
+static writer_t * w_samout = 0;
+static writer_t * w_userout = 0;
+static writer_t * w_blast6out = 0;
+static writer_t * w_uc = 0;
+static writer_t * w_fastapairs = 0;
+static writer_t * w_matched = 0;
+static writer_t * w_notmatched = 0;
+
 void add_hit(struct searchinfo_s * si, unsigned long seqno)
 {
   if (search_acceptable_unaligned(si, seqno))
     {
       struct hit * hp = si->hits + si->hit_count;
       si->hit_count++;
-      
-      hp->target = seqno;
-      hp->strand = si->strand;
-      
-      hp->count = 0;
-      
-      hp->nwscore = si->qseqlen * opt_match;
-      hp->nwdiff = 0;
-      hp->nwgaps = 0;
-      hp->nwindels = 0;
-      hp->nwalignmentlength = si->qseqlen;
-      hp->nwid = 100.0;
-      hp->matches = si->qseqlen;
-      hp->mismatches = 0;
-      
-	int promptLength = hp->nwalignmentlength + 1;  
-
-  hp->nwalignment  = (char*) malloc(promptLength * sizeof(char)); 
-
-      int ret = sprintf(hp->nwalignment, "%dM", si->qseqlen);
-      if ((ret == -1) || (!hp->nwalignment))
-        fatal("Out of memory");
-      
-      hp->internal_alignmentlength = si->qseqlen;
-      hp->internal_gaps = 0;
-      hp->internal_indels = 0;
-      hp->trim_q_left = 0;
-      hp->trim_q_right = 0;
-      hp->trim_t_left = 0;
-      hp->trim_t_right = 0;
-      hp->trim_aln_left = 0;
-      hp->trim_aln_right = 0;
-      
-      hp->id = 100.0;
-      hp->id0 = 100.0;
-      hp->id1 = 100.0;
-      hp->id2 = 100.0;
-      hp->id3 = 100.0;
-      hp->id4 = 100.0;
-      
-      hp->shortest = si->qseqlen;
-      hp->longest = si->qseqlen;
-      
-      hp->aligned = 1;
-
-      hp->accepted = 0;
-      hp->rejected = 0;
-      hp->weak = 0;
+      search_hit_identical(si, hp, seqno);
       (void) search_acceptable_aligned(si, hp);
     }
 }
@@ -155,144 +117,173 @@ void search_exact_onequery(struct searchinfo_s * si)
 
   char * seq = si->qsequence;
   unsigned long seqlen = si->qseqlen;
-  char * normalized = (char*) xmalloc(seqlen+1);
-  string_normalize(normalized, seq, seqlen);
 
   si->hit_count = 0;
 
-  long ret = dbhash_search_first(normalized, seqlen, & info);
+  /* the hash and comparison use 4-bit codes, no normalization needed */
+  long ret = dbhash_search_first(seq, seqlen, & info);
   while (ret >= 0)
     {
       add_hit(si, ret);
       ret = dbhash_search_next(&info);
     }
-  free(normalized);
 }
 
-void search_exact_output_results(int hit_count,
-                           struct hit * hits,
-                           char * query_head,
-                           int qseqlen,
-                           char * qsequence,
-                           char * qsequence_rc)
+void search_exact_output_results(long t,
+                                 int hit_count,
+                                 struct hit * hits,
+                                 char * query_head,
+                                 int qseqlen,
+                                 char * qsequence,
+                                 char * qsequence_rc)
 {
-#if PTHREAD
-  pthread_mutex_lock(&mutex_output);
-#endif
   /* show results */
   long toreport = MIN(opt_maxhits, hit_count);
-
-  if (fp_alnout)
-    results_show_alnout(fp_alnout,
-                        hits,
-                        toreport,
-                        query_head,
-                        qsequence,
-                        qseqlen, 
-                        qsequence_rc);
-
-  if (fp_samout)
-    results_show_samout(fp_samout,
-                        hits,
-                        toreport,
-                        query_head,
-                        qsequence,
-                        qseqlen, 
-                        qsequence_rc);
+  long query_no = si_plus[t].query_no;
+
+  /* format output into the per-thread buffers without locking */
+
+  xstring * s_samout = w_samout ? writer_buffer(w_samout, t) : 0;
+  xstring * s_fastapairs = w_fastapairs ? writer_buffer(w_fastapairs, t) : 0;
+  xstring * s_uc = w_uc ? writer_buffer(w_uc, t) : 0;
+  xstring * s_userout = w_userout ? writer_buffer(w_userout, t) : 0;
+  xstring * s_blast6out = w_blast6out ? writer_buffer(w_blast6out, t) : 0;
+  xstring * s_matched = w_matched ? writer_buffer(w_matched, t) : 0;
+  xstring * s_notmatched = w_notmatched ? writer_buffer(w_notmatched, t) : 0;
+
+  if (s_samout)
+    results_format_samout(s_samout,
+                          hits,
+                          toreport,
+                          query_head,
+                          qsequence,
+                          qseqlen, 
+                          qsequence_rc);
 
   if (toreport)
     {
       double top_hit_id = hits[0].id;
       
-      for(int t = 0; t < toreport; t++)
+      for(int h = 0; h < toreport; h++)
         {
-          struct hit * hp = hits + t;
+          struct hit * hp = hits + h;
 
           if (opt_top_hits_only && (hp->id < top_hit_id))
             break;
               
-          if (fp_fastapairs)
-            results_show_fastapairs_one(fp_fastapairs,
-                                        hp, 
-                                        query_head,
-                                        qsequence,
-                                        qseqlen,
-                                        qsequence_rc);
-
-          if (fp_uc)
-            if ((t==0) || opt_uc_allhits)
-              results_show_uc_one(fp_uc,
-                                  hp,
-                                  query_head,
-                                  qsequence,
-                                  qseqlen,
-                                  qsequence_rc);
+          if (s_fastapairs)
+            results_format_fastapairs_one(s_fastapairs,
+                                          hp, 
+                                          query_head,
+                                          qsequence,
+                                          qseqlen,
+                                          qsequence_rc);
+
+          if (s_uc)
+            if ((h==0) || opt_uc_allhits)
+              results_format_uc_one(s_uc,
+                                    hp,
+                                    query_head,
+                                    qsequence,
+                                    qseqlen,
+                                    qsequence_rc);
               
-          if (fp_userout)
-            results_show_userout_one(fp_userout,
-                                     hp,
-                                     query_head, 
-                                     qsequence,
-                                     qseqlen,
-                                     qsequence_rc);
-              
-          if (fp_blast6out)
-            results_show_blast6out_one(fp_blast6out,
+          if (s_userout)
+            results_format_userout_one(s_userout,
                                        hp,
-                                       query_head,
+                                       query_head, 
                                        qsequence,
                                        qseqlen,
                                        qsequence_rc);
+              
+          if (s_blast6out)
+            results_format_blast6out_one(s_blast6out,
+                                         hp,
+                                         query_head,
+                                         qsequence,
+                                         qseqlen,
+                                         qsequence_rc);
         }
     }
   else if (opt_output_no_hits)
     {
-      if (fp_uc)
-        results_show_uc_one(fp_uc,
-                            0,
-                            query_head,
-                            qsequence,
-                            qseqlen,
-                            qsequence_rc);
+      if (s_uc)
+        results_format_uc_one(s_uc,
+                              0,
+                              query_head,
+                              qsequence,
+                              qseqlen,
+                              qsequence_rc);
       
-      if (fp_userout)
-        results_show_userout_one(fp_userout,
-                                 0,
-                                 query_head, 
-                                 qsequence,
-                                 qseqlen,
-                                 qsequence_rc);
-      
-      if (fp_blast6out)
-        results_show_blast6out_one(fp_blast6out,
+      if (s_userout)
+        results_format_userout_one(s_userout,
                                    0,
-                                   query_head,
+                                   query_head, 
                                    qsequence,
                                    qseqlen,
                                    qsequence_rc);
+      
+      if (s_blast6out)
+        results_format_blast6out_one(s_blast6out,
+                                     0,
+                                     query_head,
+                                     qsequence,
+                                     qseqlen,
+                                     qsequence_rc);
     }
 
   if (hit_count)
     {
-      if (opt_matched)
-        fasta_print(fp_matched,
-                    query_head,
-                    qsequence,
-                    qseqlen);
+      if (s_matched)
+        fasta_format(s_matched,
+                     query_head,
+                     qsequence,
+                     qseqlen);
     }
   else
     {
-      if (opt_notmatched)
-        fasta_print(fp_notmatched,
-                    query_head,
-                    qsequence,
-                    qseqlen);
+      if (s_notmatched)
+        fasta_format(s_notmatched,
+                     query_head,
+                     qsequence,
+                     qseqlen);
     }
 
+  /* pass the buffers on, they are written in query order */
+
+  if (w_samout)
+    writer_commit(w_samout, t, query_no);
+  if (w_fastapairs)
+    writer_commit(w_fastapairs, t, query_no);
+  if (w_uc)
+    writer_commit(w_uc, t, query_no);
+  if (w_userout)
+    writer_commit(w_userout, t, query_no);
+  if (w_blast6out)
+    writer_commit(w_blast6out, t, query_no);
+  if (w_matched)
+    writer_commit(w_matched, t, query_no);
+  if (w_notmatched)
+    writer_commit(w_notmatched, t, query_no);
+
+#if PTHREAD
+  pthread_mutex_lock(&mutex_output);
+#endif
+
+  if (fp_alnout)
+    results_show_alnout(fp_alnout,
+                        hits,
+                        toreport,
+                        query_head,
+                        qsequence,
+                        qseqlen, 
+                        qsequence_rc);
+
   /* update matching db sequences */
   for (int i=0; i < hit_count; i++)
     if (hits[i].accepted)
       dbmatched[hits[i].target]++;
+  
 #if PTHREAD
   pthread_mutex_unlock(&mutex_output);
 #endif
@@ -326,7 +317,8 @@ int search_exact_query(long t)
                   & hits,
                   & hit_count);
 
-  search_exact_output_results(hit_count,
+  search_exact_output_results(t,
+                              hit_count,
                               hits,
                               si_plus[t].query_head,
                               si_plus[t].qseqlen,
@@ -510,7 +502,7 @@ void search_exact_prep(char * cmdline, char * progheader)
 
   if (opt_alnout)
     {
-      fp_alnout = fopen(opt_alnout, "w");
+      fp_alnout = fopen_output(opt_alnout);
       if (! fp_alnout)
         fatal("Unable to open alignment output file for writing");
 
@@ -520,63 +512,63 @@ void search_exact_prep(char * cmdline, char * progheader)
 
   if (opt_samout)
     {
-      fp_samout = fopen(opt_samout, "w");
+      fp_samout = fopen_output(opt_samout);
       if (! fp_samout)
         fatal("Unable to open SAM output file for writing");
     }
 
   if (opt_userout)
     {
-      fp_userout = fopen(opt_userout, "w");
+      fp_userout = fopen_output(opt_userout);
       if (! fp_userout)
         fatal("Unable to open user-defined output file for writing");
     }
 
   if (opt_blast6out)
     {
-      fp_blast6out = fopen(opt_blast6out, "w");
+      fp_blast6out = fopen_output(opt_blast6out);
       if (! fp_blast6out)
         fatal("Unable to open blast6-like output file for writing");
     }
 
   if (opt_uc)
     {
-      fp_uc = fopen(opt_uc, "w");
+      fp_uc = fopen_output(opt_uc);
       if (! fp_uc)
         fatal("Unable to open uc output file for writing");
     }
 
   if (opt_fastapairs)
     {
-      fp_fastapairs = fopen(opt_fastapairs, "w");
+      fp_fastapairs = fopen_output(opt_fastapairs);
       if (! fp_fastapairs)
         fatal("Unable to open fastapairs output file for writing");
     }
 
   if (opt_matched)
     {
-      fp_matched = fopen(opt_matched, "w");
+      fp_matched = fopen_output(opt_matched);
       if (! fp_matched)
         fatal("Unable to open matched output file for writing");
     }
 
   if (opt_notmatched)
     {
-      fp_notmatched = fopen(opt_notmatched, "w");
+      fp_notmatched = fopen_output(opt_notmatched);
       if (! fp_notmatched)
         fatal("Unable to open notmatched output file for writing");
     }
 
   if (opt_dbmatched)
     {
-      fp_dbmatched = fopen(opt_dbmatched, "w");
+      fp_dbmatched = fopen_output(opt_dbmatched);
       if (! fp_dbmatched)
         fatal("Unable to open dbmatched output file for writing");
     }
 
   if (opt_dbnotmatched)
     {
-      fp_dbnotmatched = fopen(opt_dbnotmatched, "w");
+      fp_dbnotmatched = fopen_output(opt_dbnotmatched);
       if (! fp_dbnotmatched)
         fatal("Unable to open dbnotmatched output file for writing");
     }
@@ -585,6 +577,22 @@ void search_exact_prep(char * cmdline, char * progheader)
 
   results_show_samheader(fp_samout, cmdline, opt_db);
 
+  /* per-query output goes through ordered writers */
+  if (fp_samout)
+    w_samout = writer_open(fp_samout, opt_threads);
+  if (fp_userout)
+    w_userout = writer_open(fp_userout, opt_threads);
+  if (fp_blast6out)
+    w_blast6out = writer_open(fp_blast6out, opt_threads);
+  if (fp_uc)
+    w_uc = writer_open(fp_uc, opt_threads);
+  if (fp_fastapairs)
+    w_fastapairs = writer_open(fp_fastapairs, opt_threads);
+  if (fp_matched)
+    w_matched = writer_open(fp_matched, opt_threads);
+  if (fp_notmatched)
+    w_notmatched = writer_open(fp_notmatched, opt_threads);
+
   if (opt_dbmask == MASK_DUST)
     dust_all();
   else if ((opt_dbmask == MASK_SOFT) && (opt_hardmask))
@@ -604,9 +612,23 @@ void search_exact_prep(char * cmdline, char * progheader)
   dbhash_add_all();
 }
 
+static void search_writers_close()
+{
+  writer_t ** w[] = { & w_samout, & w_userout, & w_blast6out, & w_uc,
+                      & w_fastapairs, & w_matched, & w_notmatched };
+
+  for (unsigned int i = 0; i < sizeof(w) / sizeof(writer_t **); i++)
+    if (*w[i])
+      {
+        writer_close(*w[i]);
+        *w[i] = 0;
+      }
+}
+
 void search_exact_done()
 {
   /* clean up, global */
+  search_writers_close();
   dbhash_close();
 
   db_free();
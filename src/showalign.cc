@@ -281,26 +281,33 @@ char * align_getrow(char * seq, char * cigar, int alen, int origin)
   return row;
 }
 
-void align_fprint_uncompressed_alignment(FILE * f, char * cigar)
+void align_format_uncompressed_alignment(xstring * s, char * cigar)
 {
   char * p = cigar;
   while(*p)
     {
       if (*p > '9')
-        fprintf(f, "%c", *p++);
+        s->add_c(*p++);
       else
         {
-          int n = 0;
-          char c = 0;
-          int x = 0;
-          if (sscanf(p, "%d%c%n", &n, &c, &x) == 2)
+          char * q;
+          long n = strtol(p, &q, 10);
+          char c = *q;
+          if ((q > p) && c)
             {
-              for(int i = 0; i<n; i++)
-                fprintf(f, "%c", c);
-              p += x;
+              for(long i = 0; i<n; i++)
+                s->add_c(c);
+              p = q + 1;
             }
           else
             fatal("bad alignment string");
         }
     }
 }
+
+void align_fprint_uncompressed_alignment(FILE * f, char * cigar)
+{
+  xstring s;
+  align_format_uncompressed_alignment(&s, cigar);
+  fwrite(s.get_string(), 1, s.get_length(), f);
+}
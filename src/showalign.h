@@ -60,6 +60,8 @@
 
 char * align_getrow(char * seq, char * cigar, int alignlen, int origin);
 
+void align_format_uncompressed_alignment(xstring * s, char * cigar);
+
 void align_fprint_uncompressed_alignment(FILE * f, char * cigar);
 
 void align_show(FILE * f,
@@ -100,12 +100,164 @@ int sortbylength_compare(const void * a, const void * b)
       }
 }
 
+unsigned long sortbylength_key(const void * a)
+{
+  struct sortinfo_s * x = (struct sortinfo_s *) a;
+  return ((unsigned long) (UINT_MAX - x->length) << 32) |
+    (UINT_MAX - x->size);
+}
+
+static std::vector<unsigned int> sortbylength_values;
+
+static bool sortbylength_select(struct topn_entry_s * e)
+{
+  sortbylength_values.push_back(e->seqlen);
+  return true;
+}
+
+int sortbylength_compare_entry(const void * a, const void * b)
+{
+  struct topn_entry_s * x = (struct topn_entry_s *) a;
+  struct topn_entry_s * y = (struct topn_entry_s *) b;
+
+  /* same order as sortbylength_compare */
+
+  if (x->seqlen < y->seqlen)
+    return +1;
+  else if (x->seqlen > y->seqlen)
+    return -1;
+  else
+    if (x->size < y->size)
+      return +1;
+    else if (x->size > y->size)
+      return -1;
+    else
+      {
+        int r = strcmp(x->header, y->header);
+        if (r != 0)
+          return r;
+        else
+          {
+            if (x->seqno < y->seqno)
+              return -1;
+            else if (x->seqno > y->seqno)
+              return +1;
+            else
+              return 0;
+          }
+      }
+}
+
+static void sortbylength_report(double median)
+{
+  if (!opt_quiet)
+    fprintf(stderr, "Median length: %.0f\n", median);
+
+  if (opt_log)
+    fprintf(fp_log, "Median length: %.0f\n", median);
+}
+
+static void sortbylength_topn(FILE * fp_output)
+{
+  /* select the first opt_topn sequences while reading the file */
+
+  sortbylength_values.clear();
+
+  long count = 0;
+  struct topn_entry_s * entries = topn_read(opt_sortbylength,
+                                            opt_topn,
+                                            sortbylength_select,
+                                            sortbylength_compare_entry,
+                                            & count);
+  show_rusage();
+
+  sortbylength_report(topn_median(sortbylength_values));
+  std::vector<unsigned int>().swap(sortbylength_values);
+
+  show_rusage();
+
+  progress_init("Writing output", count);
+  for(long i=0; i<count; i++)
+    {
+      fasta_print_relabel(fp_output,
+                          entries[i].sequence,
+                          entries[i].seqlen,
+                          entries[i].header,
+                          entries[i].header_len,
+                          entries[i].size,
+                          i+1);
+      progress_update(i);
+    }
+  progress_done();
+  show_rusage();
+
+  topn_free(entries, count);
+}
+
+static void sortbylength_external(FILE * fp_output)
+{
+  /* sort through temporary files within the memory budget */
+
+  extsort_open(opt_sortbylength,
+               opt_memory_budget * 1024UL * 1024UL,
+               0,
+               sortbylength_compare_entry);
+  show_rusage();
+
+  /* the median is taken from the sorted sequences as they pass by */
+
+  long passed = extsort_count();
+  long written = MIN(passed, opt_topn);
+  long needed = MIN(passed, MAX(written, passed / 2 + 1));
+  double lower = 0.0;
+  double upper = 0.0;
+
+  progress_init("Writing output", needed);
+  for(long i=0; i<needed; i++)
+    {
+      struct topn_entry_s * e = extsort_next();
+      if (i == (passed - 1) / 2)
+        lower = e->seqlen;
+      if (i == passed / 2)
+        upper = e->seqlen;
+      if (i < written)
+        fasta_print_relabel(fp_output,
+                            e->sequence,
+                            e->seqlen,
+                            e->header,
+                            e->header_len,
+                            e->size,
+                            i+1);
+      progress_update(i);
+    }
+  progress_done();
+
+  extsort_close();
+
+  sortbylength_report((lower + upper) / 2.0);
+  show_rusage();
+}
+
 void sortbylength()
 {
-  FILE * fp_output = fopen(opt_output, "w");
+  FILE * fp_output = fopen_output(opt_output);
   if (!fp_output)
     fatal("Unable to open sortbylength output file for writing");
 
+  if (opt_topn <= TOPN_STREAM_MAX)
+    {
+      sortbylength_topn(fp_output);
+      fclose(fp_output);
+      return;
+    }
+
+  if (opt_memory_budget > 0)
+    {
+      sortbylength_external(fp_output);
+      fclose(fp_output);
+      return;
+    }
+
   db_read(opt_sortbylength, 0);
   show_rusage();
 
@@ -127,7 +279,8 @@ void sortbylength()
   show_rusage();
 
   progress_init("Sorting", 100);
-  qsort(sortinfo, passed, sizeof(sortinfo_s), sortbylength_compare);
+  radix_sort(sortinfo, passed, sizeof(sortinfo_s),
+             sortbylength_key, sortbylength_compare);
   progress_done();
 
   double median = 0.0;
@@ -140,11 +293,7 @@ void sortbylength()
                   sortinfo[passed/2].length) / 2.0;
     }
 
-  if (!opt_quiet)
-    fprintf(stderr, "Median length: %.0f\n", median);
-
-  if (opt_log)
-    fprintf(fp_log, "Median length: %.0f\n", median);
+  sortbylength_report(median);
 
   show_rusage();
   
@@ -59,3 +59,5 @@
 */
 
 void sortbylength();
+
+int sortbylength_compare_entry(const void * a, const void * b);
@@ -94,12 +94,168 @@ int sortbysize_compare(const void * a, const void * b)
     }
 }
 
+unsigned long sortbysize_key(const void * a)
+{
+  struct sortinfo_s * x = (struct sortinfo_s *) a;
+  return UINT_MAX - x->size;
+}
+
+static std::vector<unsigned int> sortbysize_values;
+
+static bool sortbysize_filter(struct topn_entry_s * e)
+{
+  return (e->size >= opt_minsize) && (e->size <= opt_maxsize);
+}
+
+static bool sortbysize_select(struct topn_entry_s * e)
+{
+  if (sortbysize_filter(e))
+    {
+      sortbysize_values.push_back(e->size);
+      return true;
+    }
+  else
+    return false;
+}
+
+int sortbysize_compare_entry(const void * a, const void * b)
+{
+  struct topn_entry_s * x = (struct topn_entry_s *) a;
+  struct topn_entry_s * y = (struct topn_entry_s *) b;
+
+  /* same order as sortbysize_compare */
+
+  if (x->size < y->size)
+    return +1;
+  else if (x->size > y->size)
+    return -1;
+  else
+    {
+      int r = strcmp(x->header, y->header);
+      if (r != 0)
+        return r;
+      else
+        {
+          if (x->seqno < y->seqno)
+            return -1;
+          else if (x->seqno > y->seqno)
+            return +1;
+          else
+            return 0;
+        }
+    }
+}
+
+static void sortbysize_report(double median)
+{
+  if (! opt_quiet)
+    fprintf(stderr, "Median abundance: %.0f\n", median);
+
+  if (opt_log)
+    fprintf(fp_log, "Median abundance: %.0f\n", median);
+}
+
+static void sortbysize_topn(FILE * fp_output)
+{
+  /* select the first opt_topn sequences while reading the file */
+
+  sortbysize_values.clear();
+
+  long count = 0;
+  struct topn_entry_s * entries = topn_read(opt_sortbysize,
+                                            opt_topn,
+                                            sortbysize_select,
+                                            sortbysize_compare_entry,
+                                            & count);
+  show_rusage();
+
+  sortbysize_report(topn_median(sortbysize_values));
+  std::vector<unsigned int>().swap(sortbysize_values);
+
+  show_rusage();
+
+  progress_init("Writing output", count);
+  for(long i=0; i<count; i++)
+    {
+      fasta_print_relabel(fp_output,
+                          entries[i].sequence,
+                          entries[i].seqlen,
+                          entries[i].header,
+                          entries[i].header_len,
+                          entries[i].size,
+                          i+1);
+      progress_update(i);
+    }
+  progress_done();
+  show_rusage();
+
+  topn_free(entries, count);
+}
+
+static void sortbysize_external(FILE * fp_output)
+{
+  /* sort through temporary files within the memory budget */
+
+  extsort_open(opt_sortbysize,
+               opt_memory_budget * 1024UL * 1024UL,
+               sortbysize_filter,
+               sortbysize_compare_entry);
+  show_rusage();
+
+  /* the median is taken from the sorted sequences as they pass by */
+
+  long passed = extsort_count();
+  long written = MIN(passed, opt_topn);
+  long needed = MIN(passed, MAX(written, passed / 2 + 1));
+  double lower = 0.0;
+  double upper = 0.0;
+
+  progress_init("Writing output", needed);
+  for(long i=0; i<needed; i++)
+    {
+      struct topn_entry_s * e = extsort_next();
+      if (i == (passed - 1) / 2)
+        lower = e->size;
+      if (i == passed / 2)
+        upper = e->size;
+      if (i < written)
+        fasta_print_relabel(fp_output,
+                            e->sequence,
+                            e->seqlen,
+                            e->header,
+                            e->header_len,
+                            e->size,
+                            i+1);
+      progress_update(i);
+    }
+  progress_done();
+
+  extsort_close();
+
+  sortbysize_report((lower + upper) / 2.0);
+  show_rusage();
+}
+
 void sortbysize()
 {
-  FILE * fp_output = fopen(opt_output, "w");
+  FILE * fp_output = fopen_output(opt_output);
   if (!fp_output)
     fatal("Unable to open sortbysize output file for writing");
 
+  if (opt_topn <= TOPN_STREAM_MAX)
+    {
+      sortbysize_topn(fp_output);
+      fclose(fp_output);
+      return;
+    }
+
+  if (opt_memory_budget > 0)
+    {
+      sortbysize_external(fp_output);
+      fclose(fp_output);
+      return;
+    }
+
   db_read(opt_sortbysize, 0);
 
   show_rusage();
@@ -130,7 +286,8 @@ void sortbysize()
   show_rusage();
 
   progress_init("Sorting", 100);
-  qsort(sortinfo, passed, sizeof(sortinfo_s), sortbysize_compare);
+  radix_sort(sortinfo, passed, sizeof(sortinfo_s),
+             sortbysize_key, sortbysize_compare);
   progress_done();
   
   double median = 0.0;
@@ -143,11 +300,7 @@ void sortbysize()
                   sortinfo[passed/2].size) / 2.0;
     }
 
-  if (! opt_quiet)
-    fprintf(stderr, "Median abundance: %.0f\n", median);
-
-  if (opt_log)
-    fprintf(fp_log, "Median abundance: %.0f\n", median);
+  sortbysize_report(median);
 
   show_rusage();
   
@@ -59,3 +59,5 @@
 */
 
 void sortbysize();
+
+int sortbysize_compare_entry(const void * a, const void * b);
@@ -0,0 +1,295 @@
+/*
+
+  VSEARCH: a versatile open source tool for metagenomics
+
+  Copyright (C) 2014-2015, Torbjorn Rognes, Frederic Mahe and Tomas Flouri
+  All rights reserved.
+
+  Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+  Department of Informatics, University of Oslo,
+  PO Box 1080 Blindern, NO-0316 Oslo, Norway
+
+  This software is dual-licensed and available under a choice
+  of one of two licenses, either under the terms of the GNU
+  General Public License version 3 or the BSD 2-Clause License.
+
+
+  GNU General Public License version 3
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+  The BSD 2-Clause License
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vsearch.h"
+#include <algorithm>
+
+/*
+  Selection of the first n sequences of a file in a given order.
+
+  When only the first few sequences of a sorted file are wanted
+  (--topn), there is no need to read the entire file into memory and
+  sort it. The sequences are read one at a time and a heap with the
+  n best sequences seen so far is kept, with the one that would come
+  last in the output at the root. A new sequence that comes before
+  the root replaces it, all others are skipped without being copied.
+  The comparison function receives topn_entry_s records and must
+  define a total order, e.g. by falling back to the sequence number,
+  for the result to be identical to a full sort. Only the retained
+  sequences are finally sorted.
+
+  The select function is called with every sequence that passes the
+  length limits, before it is considered for the heap, and decides
+  whether it takes part in the selection. It may also be used to
+  collect statistics on all the sequences.
+
+  The sequences are read by topn_scan, which applies the same length
+  limits and reports the same statistics as db_read.
+*/
+
+static struct topn_entry_s * topn_entries;
+static struct topn_entry_s ** topn_heap;
+static long topn_alloc;
+static long topn_count;
+static long topn_n;
+static bool (*topn_select)(struct topn_entry_s *);
+static int (*topn_compare)(const void *, const void *);
+
+static void topn_sift_up(long i)
+{
+  struct topn_entry_s * x = topn_heap[i];
+  while (i > 0)
+    {
+      long p = (i - 1) / 2;
+      if (topn_compare(topn_heap[p], x) >= 0)
+        break;
+      topn_heap[i] = topn_heap[p];
+      i = p;
+    }
+  topn_heap[i] = x;
+}
+
+static void topn_sift_down(long i)
+{
+  struct topn_entry_s * x = topn_heap[i];
+  while (2 * i + 1 < topn_count)
+    {
+      long c = 2 * i + 1;
+      if ((c + 1 < topn_count) &&
+          (topn_compare(topn_heap[c + 1], topn_heap[c]) > 0))
+        c++;
+      if (topn_compare(x, topn_heap[c]) >= 0)
+        break;
+      topn_heap[i] = topn_heap[c];
+      i = c;
+    }
+  topn_heap[i] = x;
+}
+
+static void topn_store(struct topn_entry_s * dst, struct topn_entry_s * src)
+{
+  /* copy a sequence from the input buffers into a heap entry */
+  dst->header = (char *) xrealloc(dst->header, src->header_len + 1);
+  memcpy(dst->header, src->header, src->header_len + 1);
+  dst->sequence = (char *) xrealloc(dst->sequence, src->seqlen + 1);
+  memcpy(dst->sequence, src->sequence, src->seqlen + 1);
+  dst->header_len = src->header_len;
+  dst->seqlen = src->seqlen;
+  dst->size = src->size;
+  dst->seqno = src->seqno;
+}
+
+void topn_scan(const char * filename, void (*take)(struct topn_entry_s *))
+{
+  /* pass each sequence within the length limits to take, in order */
+
+  fastx_handle h = fastx_open(filename);
+
+  if (!h)
+    fatal("Unrecognized file type (not proper FASTA or FASTQ format)");
+
+  char * prompt = (char *) xmalloc(strlen(filename) + 14);
+  sprintf(prompt, "Reading file %s", filename);
+
+  progress_init(prompt, fastx_get_size(h));
+
+  unsigned long sequences = 0;
+  unsigned long nucleotides = 0;
+  unsigned long shortest = LONG_MAX;
+  unsigned long longest = 0;
+  long discarded_short = 0;
+  long discarded_long = 0;
+
+  while(fastx_next(h, ! opt_notrunclabels, chrmap_no_change))
+    {
+      struct topn_entry_s e;
+      e.header = fastx_get_header(h);
+      e.sequence = fastx_get_sequence(h);
+      e.header_len = fastx_get_header_length(h);
+      e.seqlen = fastx_get_sequence_length(h);
+
+      int size_start, size_end;
+      e.size = abundance_get_span(e.header, e.header_len,
+                                  & size_start, & size_end);
+
+      if (e.seqlen < (unsigned long) opt_minseqlength)
+        discarded_short++;
+      else if (e.seqlen > (unsigned long) opt_maxseqlength)
+        discarded_long++;
+      else
+        {
+          e.seqno = sequences;
+
+          sequences++;
+          nucleotides += e.seqlen;
+          if (e.seqlen > longest)
+            longest = e.seqlen;
+          if (e.seqlen < shortest)
+            shortest = e.seqlen;
+
+          take(& e);
+        }
+      progress_update(fastx_get_position(h));
+    }
+
+  progress_done();
+  free(prompt);
+  fastx_close(h);
+
+  db_report(nucleotides, sequences, shortest, longest,
+            discarded_short, discarded_long);
+}
+
+static void topn_take(struct topn_entry_s * e)
+{
+  if (! topn_select(e))
+    return;
+
+  if (topn_count < topn_n)
+    {
+      if (topn_count == topn_alloc)
+        {
+          /* the heap points into the entries, rebuild it */
+          topn_alloc = MIN(topn_n, 2 * topn_alloc);
+          topn_entries = (struct topn_entry_s *)
+            xrealloc(topn_entries,
+                     topn_alloc * sizeof(struct topn_entry_s));
+          topn_heap = (struct topn_entry_s **)
+            xrealloc(topn_heap,
+                     topn_alloc * sizeof(struct topn_entry_s *));
+          for(long i = 0; i < topn_count; i++)
+            topn_heap[i] = topn_entries + i;
+          for(long i = topn_count / 2 - 1; i >= 0; i--)
+            topn_sift_down(i);
+        }
+      struct topn_entry_s * x = topn_entries + topn_count;
+      x->header = 0;
+      x->sequence = 0;
+      topn_store(x, e);
+      topn_heap[topn_count] = x;
+      topn_sift_up(topn_count);
+      topn_count++;
+    }
+  else if ((topn_n > 0) && (topn_compare(e, topn_heap[0]) < 0))
+    {
+      topn_store(topn_heap[0], e);
+      topn_sift_down(0);
+    }
+}
+
+struct topn_entry_s * topn_read(const char * filename,
+                                long n,
+                                bool (*select)(struct topn_entry_s *),
+                                int (*compare)(const void *, const void *),
+                                long * count)
+{
+  topn_n = n;
+  topn_select = select;
+  topn_compare = compare;
+  topn_count = 0;
+  topn_alloc = MAX(MIN(n, 1024), 1);
+  topn_entries = (struct topn_entry_s *)
+    xmalloc(topn_alloc * sizeof(struct topn_entry_s));
+  topn_heap = (struct topn_entry_s **)
+    xmalloc(topn_alloc * sizeof(struct topn_entry_s *));
+
+  topn_scan(filename, topn_take);
+
+  free(topn_heap);
+  topn_heap = 0;
+
+  struct topn_entry_s * entries = topn_entries;
+  topn_entries = 0;
+
+  qsort(entries, topn_count, sizeof(struct topn_entry_s), compare);
+
+  * count = topn_count;
+  return entries;
+}
+
+void topn_free(struct topn_entry_s * entries, long count)
+{
+  for(long i = 0; i < count; i++)
+    {
+      free(entries[i].header);
+      free(entries[i].sequence);
+    }
+  free(entries);
+}
+
+double topn_median(std::vector<unsigned int> & values)
+{
+  /* median of the values, which are reordered */
+
+  long count = values.size();
+
+  if (count == 0)
+    return 0.0;
+
+  std::vector<unsigned int>::iterator upper = values.begin() + count / 2;
+  std::nth_element(values.begin(), upper, values.end());
+  double upper_value = *upper;
+
+  if (count % 2)
+    return upper_value;
+
+  double lower_value = *std::max_element(values.begin(), upper);
+  return (lower_value + upper_value) / 2.0;
+}
@@ -85,6 +85,10 @@ struct uhandle_s
 
   unsigned long bitmap_size;
   unsigned long * bitmap;
+
+  int segment_alloc;
+  unsigned int * masks;
+  unsigned int * segment_list;
 };
 
 struct uhandle_s * unique_init()
@@ -100,6 +104,10 @@ struct uhandle_s * unique_init()
   uh->bitmap_size = 0;
   uh->bitmap = 0;
 
+  uh->segment_alloc = 0;
+  uh->masks = 0;
+  uh->segment_list = 0;
+
   return uh;
 }
 
@@ -111,6 +119,10 @@ void unique_exit(struct uhandle_s * uh)
     free(uh->hash);
   if (uh->list)
     free(uh->list);
+  if (uh->masks)
+    free(uh->masks);
+  if (uh->segment_list)
+    free(uh->segment_list);
   free(uh);
 }
 
@@ -307,6 +319,121 @@ void unique_count(struct uhandle_s * uh,
     unique_count_hash(uh, k, seqlen, seq, listlen, list, seqmask);
 }
 
+void unique_count_segments(struct uhandle_s * uh,
+                           int k,
+                           int seqlen,
+                           char * seq,
+                           int segments,
+                           int * segment_end,
+                           unsigned int * listlen,
+                           unsigned int * * list,
+                           unsigned int * * masks,
+                           unsigned int * segment_listlen,
+                           unsigned int * * segment_list,
+                           int seqmask)
+{
+  /*
+    Find the unique kmers in consecutive segments of a sequence in one
+    pass. Segment i ends before position segment_end[i]. Only kmers
+    lying entirely within a segment are included, like when each
+    segment is counted alone. The list holds each kmer once, and the
+    mask of each kmer has bit i set if it occurs in segment i. The
+    list of each segment holds its kmers in the order they first
+    occur, like the list from unique_count on that segment.
+  */
+
+  if (uh->alloc < 2*seqlen)
+    {
+      while (uh->alloc < 2*seqlen)
+        uh->alloc *= 2;
+      uh->hash = (struct bucket_s *)
+        xrealloc(uh->hash, sizeof(struct bucket_s) * uh->alloc);
+      uh->list = (unsigned int *)
+        xrealloc(uh->list, sizeof(unsigned int) * uh->alloc);
+    }
+
+  if (uh->segment_alloc < uh->alloc)
+    {
+      uh->segment_alloc = uh->alloc;
+      uh->masks = (unsigned int *)
+        xrealloc(uh->masks, sizeof(unsigned int) * uh->segment_alloc);
+      uh->segment_list = (unsigned int *)
+        xrealloc(uh->segment_list, sizeof(unsigned int) * uh->segment_alloc);
+    }
+
+  uh->size = 1;
+  while (uh->size < 2*seqlen)
+    uh->size *= 2;
+  uh->hash_mask = uh->size - 1;
+
+  memset(uh->hash, 0, sizeof(struct bucket_s) * uh->size);
+
+  unsigned long bad = 0;
+  unsigned int kmer = 0;
+  unsigned int mask = (1<<(2*k)) - 1;
+
+  unsigned int * maskmap = (seqmask != MASK_NONE) ?
+    chrmap_mask_lower : chrmap_mask_ambig;
+
+  unsigned int unique = 0;
+  unsigned int segment_unique = 0;
+  int start = 0;
+
+  for(int i = 0; i < segments; i++)
+    {
+      segment_list[i] = uh->segment_list + segment_unique;
+
+      /* restart the kmer at the beginning of each segment */
+      int pos = start;
+      int end = segment_end[i];
+
+      while (pos < end)
+        {
+          bad <<= 2UL;
+          bad |= maskmap[(int)(seq[pos])];
+          bad &= mask;
+
+          kmer <<= 2;
+          kmer |= chrmap_2bit[(int)(seq[pos])];
+          kmer &= mask;
+
+          pos++;
+
+          if ((pos - start >= k) && !bad)
+            {
+              unsigned long j = HASH((char*)&kmer, (k+3)/4) & uh->hash_mask;
+              while((uh->hash[j].count) && (uh->hash[j].kmer != kmer))
+                j = (j + 1) & uh->hash_mask;
+
+              if (!(uh->hash[j].count))
+                {
+                  /* not seen before, count holds the list index plus one */
+                  uh->list[unique] = kmer;
+                  uh->masks[unique] = 0;
+                  unique++;
+                  uh->hash[j].kmer = kmer;
+                  uh->hash[j].count = unique;
+                }
+
+              unsigned int x = uh->hash[j].count - 1;
+              if (!(uh->masks[x] & (1U << i)))
+                {
+                  /* not seen before in this segment */
+                  uh->masks[x] |= 1U << i;
+                  uh->segment_list[segment_unique++] = kmer;
+                }
+            }
+        }
+
+      segment_listlen[i] = uh->segment_list + segment_unique - segment_list[i];
+      start = end;
+    }
+
+  *listlen = unique;
+  *list = uh->list;
+  *masks = uh->masks;
+}
+
 int unique_count_shared(struct uhandle_s * uh,
                         int k,
                         int listlen,
@@ -58,6 +58,9 @@
 
 */
 
+/* the most segments unique_count_segments can tell apart */
+#define UNIQUE_MAXSEGMENTS 32
+
 struct bucket_s;
 struct uhandle_s;
 
@@ -73,6 +76,19 @@ void unique_count(struct uhandle_s * uh,
                   unsigned int * * list,
                   int seqmask);
 
+void unique_count_segments(struct uhandle_s * uh,
+                           int k,
+                           int seqlen,
+                           char * seq,
+                           int segments,
+                           int * segment_end,
+                           unsigned int * listlen,
+                           unsigned int * * list,
+                           unsigned int * * masks,
+                           unsigned int * segment_listlen,
+                           unsigned int * * segment_list,
+                           int seqmask);
+
 int unique_count_shared(struct uhandle_s * uh,
                         int k,
                         int listlen,
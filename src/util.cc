@@ -60,6 +60,10 @@
 
 #include "vsearch.h"
 
+#ifdef _WIN32
+#include <io.h>
+#endif
+
 static const char * progress_prompt;
 static unsigned long progress_next;
 static unsigned long progress_size;
@@ -192,6 +196,121 @@ unsigned long hash_cityhash64(char * s, unsigned long n)
   return CityHash64((const char*)s, n);
 }
 
+/*
+  Hashing of nucleotide sequences on both strands in a single pass.
+
+  Each nucleotide is replaced by its 4-bit code (chrmap_4bit), so case
+  and U/T do not matter and no normalized copy is needed. The codes
+  are packed into 64-bit words of 16 nucleotides, starting at the
+  beginning of the sequence, and the words are combined as the digits
+  of a polynomial with an odd multiplier. The words of the reverse
+  complement start at the end of the sequence, so they are offset by
+  the length modulo 16. They are built from the complementary codes
+  in the same loop, in reverse order within each word, and their
+  polynomial is summed up with increasing powers. The hash
+  of the minus strand is therefore exactly the plus strand hash of
+  the reverse complementary sequence, and the smaller of the two is a
+  strand independent hash. Both are finished with a bit mixer.
+*/
+
+#define HASH_SEQ_MUL 0x9ddfea08eb382d69UL
+
+/* complements of the 4-bit codes: A-T, C-G, R-Y, K-M, B-V and D-H */
+static const unsigned long hash_seq_complement[16] =
+  { 0, 4, 3, 2, 1, 6, 5, 7, 8, 10, 9, 14, 13, 12, 11, 15 };
+
+static unsigned long hash_seq_finish(unsigned long h, unsigned long n)
+{
+  h ^= n * HASH_SEQ_MUL;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdUL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53UL;
+  h ^= h >> 33;
+  return h;
+}
+
+unsigned long hash_seq(char * s, unsigned long n)
+{
+  /* plus strand hash only, identical to the plus hash of hash_seq_strands */
+
+  unsigned char * p = (unsigned char *) s;
+  unsigned long h = 0;
+  unsigned long i = 0;
+
+  while (i + 16 <= n)
+    {
+      unsigned long w = 0;
+      for(int k = 0; k < 16; k++)
+        w = (w << 4) | chrmap_4bit[p[i + k]];
+      h = h * HASH_SEQ_MUL + w;
+      i += 16;
+    }
+
+  if (i < n)
+    {
+      unsigned long w = 0;
+      for( ; i < n; i++)
+        w = (w << 4) | chrmap_4bit[p[i]];
+      h = h * HASH_SEQ_MUL + w;
+    }
+
+  return hash_seq_finish(h, n);
+}
+
+void hash_seq_strands(char * s,
+                      unsigned long n,
+                      unsigned long * plus,
+                      unsigned long * minus)
+{
+  unsigned char * p = (unsigned char *) s;
+
+  /* the first reverse complementary word is short unless n % 16 == 0 */
+  unsigned long r = n & 15;
+
+  unsigned long hf = 0;
+  unsigned long hr = 0;
+  unsigned long power = 1;
+  unsigned long i = 0;
+
+  if (r)
+    {
+      unsigned long rw = 0;
+      for(i = 0; i < r; i++)
+        rw = (rw >> 4) | (hash_seq_complement[chrmap_4bit[p[i]]] << 60);
+      hr = rw >> (64 - 4 * r);
+      power = HASH_SEQ_MUL;
+    }
+
+  /* the plus strand words start at 0, the minus strand words at r */
+
+  for(i = 0; i + 16 <= n; i += 16)
+    {
+      unsigned long fw = 0;
+      unsigned long rw = 0;
+      for(int k = 0; k < 16; k++)
+        {
+          fw = (fw << 4) | chrmap_4bit[p[i + k]];
+          rw = (rw >> 4) |
+            (hash_seq_complement[chrmap_4bit[p[i + r + k]]] << 60);
+        }
+      hf = hf * HASH_SEQ_MUL + fw;
+      hr += rw * power;
+      power *= HASH_SEQ_MUL;
+    }
+
+  if (i < n)
+    {
+      unsigned long fw = 0;
+      for( ; i < n; i++)
+        fw = (fw << 4) | chrmap_4bit[p[i]];
+      hf = hf * HASH_SEQ_MUL + fw;
+    }
+
+  * plus = hash_seq_finish(hf, n);
+  * minus = hash_seq_finish(hr, n);
+}
+
 long getusec(void)
 {
     struct timeval tv;
@@ -351,6 +470,124 @@ void fprint_hex(FILE * fp, unsigned char * data, int len)
     fprintf(fp, "%02x", data[i]);
 }
 
+FILE * fopen_output(const char * filename)
+{
+  /* open an output file, compressed with gzip if the name ends in .gz */
+
+  size_t len = strlen(filename);
+  if ((len > 3) && (strcmp(filename + len - 3, ".gz") == 0))
+    return gzout_open(filename);
+  else
+    return fopen(filename, "w");
+}
+
+FILE * fopen_output_at(const char * filename, long length)
+{
+  /* open an existing output file for writing after its first length
+     bytes, discarding the rest; compressed files cannot be reopened */
+
+  size_t len = strlen(filename);
+  if ((len > 3) && (strcmp(filename + len - 3, ".gz") == 0))
+    fatal("Unable to continue writing to compressed file %s", filename);
+
+  FILE * fp = fopen(filename, "r+");
+  if (! fp)
+    return 0;
+
+#ifdef _WIN32
+  int error = _chsize(_fileno(fp), length);
+#else
+  int error = ftruncate(fileno(fp), length);
+#endif
+
+  if (error || fseek(fp, 0, SEEK_END))
+    {
+      fclose(fp);
+      return 0;
+    }
+
+  return fp;
+}
+
+FILE * fopen_temp()
+{
+  /* create an anonymous temporary file in $TMPDIR or /tmp */
+
+  FILE * fp = 0;
+
+#ifdef _WIN32
+  fp = tmpfile();
+  if (! fp)
+    fatal("Unable to create temporary file");
+#else
+  char * name;
+  fp = fopen_temp_named(& name);
+  unlink(name);
+  free(name);
+#endif
+
+  return fp;
+}
+
+FILE * fopen_temp_named(char ** name)
+{
+  /* create a temporary file that may be opened again by its name;
+     the caller must remove the file and free the name */
+
+  FILE * fp = 0;
+
+#ifdef _WIN32
+  char * tmp = _tempnam(0, "vsearch");
+  if (tmp)
+    {
+      * name = xstrdup(tmp);
+      free(tmp);
+      fp = fopen(* name, "w+b");
+    }
+#else
+  const char * dir = getenv("TMPDIR");
+  if ((! dir) || (! *dir))
+    dir = "/tmp";
+
+  * name = (char *) xmalloc(strlen(dir) + 20);
+  sprintf(* name, "%s/vsearch.XXXXXX", dir);
+
+  int fd = mkstemp(* name);
+  if (fd >= 0)
+    {
+      fp = fdopen(fd, "w+b");
+      if (! fp)
+        {
+          close(fd);
+          unlink(* name);
+        }
+    }
+#endif
+
+  if (! fp)
+    fatal("Unable to create temporary file");
+
+  return fp;
+}
+
+void fwrite_temp(FILE * fp, const void * p, size_t n)
+{
+  if (fwrite(p, 1, n, fp) != n)
+    fatal("Unable to write to temporary file");
+}
+
+void fread_temp(FILE * fp, void * p, size_t n)
+{
+  if (fread(p, 1, n, fp) != n)
+    fatal("Unable to read from temporary file");
+}
+
+void rewind_temp(FILE * fp)
+{
+  if (fflush(fp) || fseek(fp, 0, SEEK_SET))
+    fatal("Unable to read from temporary file");
+}
+
 void SHA1(const unsigned char * d, unsigned long n, unsigned char * md)
 {
   if (!md)
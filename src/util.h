@@ -96,6 +96,11 @@ void * xrealloc(void * ptr, size_t size);
 char * xstrdup(const char *s);
 char * xstrchrnul(char *s, int c);
 unsigned long hash_cityhash64(char * s, unsigned long n);
+unsigned long hash_seq(char * s, unsigned long n);
+void hash_seq_strands(char * s,
+                      unsigned long n,
+                      unsigned long * plus,
+                      unsigned long * minus);
 long getusec(void);
 void show_rusage();
 
@@ -113,6 +118,15 @@ void reverse_complement(char * rc, char * seq, long len);
 
 void fprint_hex(FILE * fp, unsigned char * data, int len);
 
+FILE * fopen_output(const char * filename);
+FILE * fopen_output_at(const char * filename, long length);
+
+FILE * fopen_temp();
+FILE * fopen_temp_named(char ** name);
+void fwrite_temp(FILE * fp, const void * p, size_t n);
+void fread_temp(FILE * fp, void * p, size_t n);
+void rewind_temp(FILE * fp);
+
 void get_hex_seq_digest_sha1(char * hex, char * seq, int seqlen);
 void get_hex_seq_digest_md5(char * hex, char * seq, int seqlen);
 
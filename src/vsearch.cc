@@ -78,6 +78,7 @@ bool opt_quiet;
 bool opt_relabel_keep;
 bool opt_relabel_md5;
 bool opt_relabel_sha1;
+bool opt_resume;
 bool opt_samheader;
 bool opt_sizeorder;
 bool opt_xsize;
@@ -92,17 +93,21 @@ char * opt_alnout;
 char * opt_blast6out;
 char * opt_borderline;
 char * opt_centroids;
+char * opt_checkpoint;
 char * opt_chimeras;
 char * opt_cluster_fast;
+char * opt_cluster_linkage;
 char * opt_cluster_size;
 char * opt_cluster_smallmem;
 char * opt_clusters;
 char * opt_consout;
+char * opt_countout;
 char * opt_db;
 char * opt_dbmatched;
 char * opt_dbnotmatched;
 char * opt_derep_fulllength;
 char * opt_derep_prefix;
+char * opt_derep_samples;
 char * opt_fastaout;
 char * opt_fastaout_discarded;
 char * opt_fastapairs;
@@ -144,6 +149,8 @@ double opt_dn;
 double opt_fastq_maxee;
 double opt_fastq_maxee_rate;
 double opt_id;
+double * opt_id_levels;
+int opt_id_levelcount;
 double opt_max_unmasked_pct;
 double opt_maxid;
 double opt_maxqt;
@@ -187,6 +194,7 @@ long opt_fastq_maxmergelen;
 long opt_fastq_minmergelen;
 long opt_fastq_minovlen;
 long opt_dbmask;
+long opt_differences;
 long opt_fasta_width;
 long opt_fastq_ascii;
 long opt_fastq_asciiout;
@@ -217,6 +225,7 @@ long opt_maxseqlength;
 long opt_maxsize;
 long opt_maxsubs;
 long opt_maxuniquesize;
+long opt_memory_budget;
 long opt_mincols;
 long opt_minseqlength;
 long opt_minsize;
@@ -233,6 +242,7 @@ long opt_rowlen;
 long opt_sample_size;
 long opt_self;
 long opt_selfid;
+long opt_shards;
 long opt_sizein;
 long opt_sizeout;
 long opt_strand;
@@ -520,6 +530,33 @@ double args_getdouble(char * arg)
   return temp;
 }
 
+void args_getidlevels(char * arg)
+{
+  /* one or more identity thresholds, separated by commas */
+
+  opt_id_levelcount = 0;
+
+  char * p = arg;
+  while (1)
+    {
+      int len = 0;
+      double temp = 0;
+      if (sscanf(p, "%lf%n", &temp, &len) != 1)
+        fatal("Illegal option argument");
+      opt_id_levels = (double *)
+        xrealloc(opt_id_levels, (opt_id_levelcount + 1) * sizeof(double));
+      opt_id_levels[opt_id_levelcount++] = temp;
+      p += len;
+      if (*p == 0)
+        break;
+      if (*p != ',')
+        fatal("Illegal option argument");
+      p++;
+    }
+
+  opt_id = opt_id_levels[0];
+}
+
 void args_init(int argc, char **argv)
 {
   /* Set defaults */
@@ -537,8 +574,10 @@ void args_init(int argc, char **argv)
   opt_blast6out = 0;
   opt_borderline = 0;
   opt_centroids = 0;
+  opt_checkpoint = 0;
   opt_chimeras = 0;
   opt_cluster_fast = 0;
+  opt_cluster_linkage = 0;
   opt_cluster_size = 0;
   opt_cluster_smallmem = 0;
   opt_clusterout_id = 0;
@@ -546,12 +585,15 @@ void args_init(int argc, char **argv)
   opt_clusters = 0;
   opt_cons_truncate = 0;
   opt_consout = 0;
+  opt_countout = 0;
   opt_db = 0;
   opt_dbmask = MASK_DUST;
   opt_dbmatched = 0;
   opt_dbnotmatched = 0;
   opt_derep_fulllength = 0;
   opt_derep_prefix = 0;
+  opt_derep_samples = 0;
+  opt_differences = 1;
   opt_dn = 1.4;
   opt_eeout = 0;
   opt_eetabbedout = 0;
@@ -610,6 +652,8 @@ void args_init(int argc, char **argv)
   opt_hardmask = 0;
   opt_help = 0;
   opt_id = -1.0;
+  opt_id_levels = 0;
+  opt_id_levelcount = 0;
   opt_iddef = 2;
   opt_idprefix = 0;
   opt_idsuffix = 0;
@@ -634,6 +678,7 @@ void args_init(int argc, char **argv)
   opt_maxsl = DBL_MAX;
   opt_maxsubs = INT_MAX;
   opt_maxuniquesize = LONG_MAX;
+  opt_memory_budget = 0;
   opt_mid = 0.0;
   opt_min_unmasked_pct = 0.0;
   opt_mincols = 0;
@@ -665,6 +710,7 @@ void args_init(int argc, char **argv)
   opt_relabel_keep = 0;
   opt_relabel_md5 = 0;
   opt_relabel_sha1 = 0;
+  opt_resume = 0;
   opt_reverse = 0;
   opt_rightjust = 0;
   opt_rowlen = 64;
@@ -675,6 +721,7 @@ void args_init(int argc, char **argv)
   opt_search_exact = 0;
   opt_self = 0;
   opt_selfid = 0;
+  opt_shards = 0;
   opt_shuffle = 0;
   opt_sizein = 0;
   opt_sizeorder = 0;
@@ -874,6 +921,14 @@ void args_init(int argc, char **argv)
     {"fastaout_notmerged_rev",required_argument, 0, 0 },
     {"reverse",               required_argument, 0, 0 },
     {"eetabbedout",           required_argument, 0, 0 },
+    {"memory_budget",         required_argument, 0, 0 },
+    {"derep_samples",         required_argument, 0, 0 },
+    {"countout",              required_argument, 0, 0 },
+    {"shards",                required_argument, 0, 0 },
+    {"checkpoint",            required_argument, 0, 0 },
+    {"resume",                no_argument,       0, 0 },
+    {"cluster_linkage",       required_argument, 0, 0 },
+    {"differences",           required_argument, 0, 0 },
     { 0, 0, 0, 0 }
   };
 
@@ -914,7 +969,7 @@ void args_init(int argc, char **argv)
           break;
 
         case 5:
-          opt_id = args_getdouble(optarg);
+          args_getidlevels(optarg);
           break;
 
         case 6:
@@ -1580,6 +1635,38 @@ void args_init(int argc, char **argv)
           opt_eetabbedout = optarg;
           break;
 
+        case 166:
+          opt_memory_budget = args_getlong(optarg);
+          break;
+
+        case 167:
+          opt_derep_samples = optarg;
+          break;
+
+        case 168:
+          opt_countout = optarg;
+          break;
+
+        case 169:
+          opt_shards = args_getlong(optarg);
+          break;
+
+        case 170:
+          opt_checkpoint = optarg;
+          break;
+
+        case 171:
+          opt_resume = 1;
+          break;
+
+        case 172:
+          opt_cluster_linkage = optarg;
+          break;
+
+        case 173:
+          opt_differences = args_getlong(optarg);
+          break;
+
         default:
           fatal("Internal error in option parsing");
         }
@@ -1611,6 +1698,8 @@ void args_init(int argc, char **argv)
     commands++;
   if (opt_derep_prefix)
     commands++;
+  if (opt_derep_samples)
+    commands++;
   if (opt_help)
     commands++;
   if (opt_version)
@@ -1627,6 +1716,8 @@ void args_init(int argc, char **argv)
     commands++;
   if (opt_cluster_size)
     commands++;
+  if (opt_cluster_linkage)
+    commands++;
   if (opt_uchime_denovo)
     commands++;
   if (opt_uchime_ref)
@@ -1670,6 +1761,49 @@ void args_init(int argc, char **argv)
   if ((opt_threads < 0) || (opt_threads > 1024))
     fatal("The argument to --threads must be in the range 0 (default) to 1024");
 
+  if (opt_memory_budget < 0)
+    fatal("The argument to --memory_budget must not be negative");
+
+  if (opt_shards < 0)
+    fatal("The argument to --shards must not be negative");
+
+  if ((opt_shards > 0) && ! (opt_cluster_fast || opt_cluster_size))
+    fatal("Option --shards is only valid with --cluster_fast or --cluster_size");
+
+  if (opt_checkpoint && ! (opt_cluster_fast || opt_cluster_size))
+    fatal("Option --checkpoint is only valid with --cluster_fast or --cluster_size");
+
+  if (opt_checkpoint && (opt_shards > 0))
+    fatal("Options --checkpoint and --shards cannot be combined");
+
+  if (opt_resume && ! opt_checkpoint)
+    fatal("Option --resume requires --checkpoint");
+
+  if (opt_id_levelcount > 1)
+    {
+      if (! (opt_cluster_fast || opt_cluster_size))
+        fatal("Several --id thresholds are only valid with --cluster_fast or --cluster_size");
+
+      if ((opt_shards > 0) || opt_checkpoint)
+        fatal("Several --id thresholds cannot be combined with --shards or --checkpoint");
+
+      for(int i = 1; i < opt_id_levelcount; i++)
+        if (opt_id_levels[i] >= opt_id_levels[i-1])
+          fatal("The --id thresholds must be in decreasing order");
+
+      if (opt_id_levels[opt_id_levelcount-1] < 0.0)
+        fatal("Identity between 0.0 and 1.0 must be specified with --id");
+    }
+
+  if ((opt_differences < 1) || (opt_differences > LINKAGE_MAXDIFFS))
+    fatal("The argument to --differences must be 1 or 2");
+
+  if (opt_cluster_linkage && (opt_msaout || opt_consout || opt_profile))
+    fatal("Options --msaout, --consout and --profile are not available with --cluster_linkage");
+
+  if (opt_cluster_linkage && (opt_strand > 1))
+    fatal("Option --cluster_linkage only uses the plus strand");
+
   if ((opt_wordlength < 7) || (opt_wordlength > 15))
     fatal("The argument to --wordlength must be in the range 7 to 15");
 
@@ -1774,7 +1908,8 @@ void args_init(int argc, char **argv)
   if (opt_minseqlength == 0)
     {
       if (opt_cluster_smallmem || opt_cluster_fast || opt_cluster_size ||
-          opt_usearch_global || opt_derep_fulllength || opt_derep_prefix )
+          opt_cluster_linkage || opt_usearch_global || opt_derep_fulllength || opt_derep_prefix ||
+          opt_derep_samples)
         opt_minseqlength = 32;
       else
         opt_minseqlength = 1;
@@ -1834,17 +1969,21 @@ void cmd_help()
               "\n"
               "Clustering\n"
               "  --cluster_fast FILENAME     cluster sequences after sorting by length\n"
+              "  --cluster_linkage FILENAME  link sequences within --differences, no alignment\n"
               "  --cluster_size FILENAME     cluster sequences after sorting by abundance\n"
               "  --cluster_smallmem FILENAME cluster already sorted sequences (see -usersort)\n"
               "Options (most searching options also apply)\n"
               "  --centroids FILENAME        output centroid sequences to FASTA file\n"
+              "  --checkpoint FILENAME       save the clustering state to file periodically\n"
               "  --clusterout_id             add cluster id info to consout and profile files\n"
               "  --clusterout_sort           order msaout, consout, profile by decr abundance\n"
               "  --clusters STRING           output each cluster to a separate FASTA file\n"
               "  --consout FILENAME          output cluster consensus sequences to FASTA file\n"
               "  --cons_truncate             do not ignore terminal gaps in MSA for consensus\n"
-              "  --id REAL                   reject if identity lower\n"
+              "  --differences INT           max differences of linked seqs, 1 or 2 (1)\n"
+              "  --id REAL[,REAL...]         reject if identity lower, several for levels\n"
               "  --iddef INT                 id definition, 0-4=CD-HIT,all,int,MBL,BLAST (2)\n"
+              "  --memory_budget INT         with --shards, sort within INT MB of memory\n"
               "  --msaout FILENAME           output multiple seq. alignments to FASTA file\n"
               "  --profile FILENAME          output sequence profile of each cluster to file\n"
               "  --qmask none|dust|soft      mask seqs with dust, soft or no method (dust)\n"
@@ -1852,6 +1991,8 @@ void cmd_help()
               "  --relabel_keep              keep the old label after the new when relabelling\n"
               "  --relabel_md5               relabel with md5 digest of normalized sequence\n"
               "  --relabel_sha1              relabel with sha1 digest of normalized sequence\n"
+              "  --resume                    continue from the state in the checkpoint file\n"
+              "  --shards INT                cluster in INT parts, then merge their centroids\n"
               "  --sizein                    propagate abundance annotation from input\n"
               "  --sizeorder                 sort accepted centroids by abundance (AGC)\n"
               "  --sizeout                   write cluster abundances to centroid file\n"
@@ -1863,8 +2004,11 @@ void cmd_help()
               "Dereplication\n"
               "  --derep_fulllength FILENAME dereplicate sequences in the given FASTA file\n"
               "  --derep_prefix FILENAME     dereplicate sequences in file based on prefixes\n"
+              "  --derep_samples FILENAME    dereplicate the sample files listed in file\n"
               "Options\n"
+              "  --countout FILENAME         output sparse sample count table\n"
               "  --maxuniquesize INT         maximum abundance for output from dereplication\n"
+              "  --memory_budget INT         use temporary files to stay within INT MB\n"
               "  --minuniquesize INT         minimum abundance for output from dereplication\n"
               "  --output FILENAME           output FASTA file\n"
               "  --relabel STRING            relabel with this prefix string after derep.\n"
@@ -2058,6 +2202,7 @@ void cmd_help()
               "  --sortbysize FILENAME       abundance sort sequences in given FASTA file\n"
               "Options\n"
               "  --maxsize INT               maximum abundance for sortbysize\n"
+              "  --memory_budget INT         use temporary files to stay within INT MB\n"
               "  --minsize INT               minimum abundance for sortbysize\n"
               "  --output FILENAME           output to specified FASTA file\n"
               "  --randseed INT              seed for PRNG, zero to use random data source (0)\n"
@@ -2162,11 +2307,13 @@ void cmd_sortbylength()
 
 void cmd_derep()
 {
-  if ((!opt_output) && (!opt_uc))
+  if ((!opt_output) && (!opt_uc) && (!opt_countout))
     fatal("Output file for derepl_fulllength must be specified with --output or --uc");
   
   if (opt_derep_fulllength)
     derep_fulllength();
+  else if (opt_derep_samples)
+    derep_samples();
   else
     {
       if (opt_strand > 1)
@@ -2227,6 +2374,7 @@ void cmd_none()
             "vsearch --cluster_smallmem FILENAME --usersort --id 0.97 --centroids FILENAME\n"
             "vsearch --derep_fulllength FILENAME --output FILENAME\n"
             "vsearch --derep_prefix FILENAME --output FILENAME\n"
+            "vsearch --derep_samples FILENAME --output FILENAME --countout FILENAME\n"
             "vsearch --fastq_chars FILENAME\n"
             "vsearch --fastq_convert FILENAME --fastqout FILENAME --fastq_ascii 64\n"
             "vsearch --fastq_filter FILENAME --fastqout FILENAME --fastq_truncqual 20\n"
@@ -2272,7 +2420,7 @@ void cmd_cluster()
       (!opt_samout) && (!opt_profile))
     fatal("No output files specified");
   
-  if ((opt_id < 0.0) || (opt_id > 1.0))
+  if ((! opt_cluster_linkage) && ((opt_id < 0.0) || (opt_id > 1.0)))
     fatal("Identity between 0.0 and 1.0 must be specified with --id");
 
   if (opt_cluster_fast)
@@ -2281,6 +2429,8 @@ void cmd_cluster()
     cluster_smallmem(cmdline, progheader);
   else if (opt_cluster_size)
     cluster_size(cmdline, progheader);
+  else if (opt_cluster_linkage)
+    cluster_linkage(cmdline, progheader);
 }
 
 void cmd_uchime()
@@ -2380,6 +2530,26 @@ void show_header()
     }
 }
 
+int db_fields_needed()
+{
+  /* the fields that db_read must keep for the selected command */
+
+  int fields = 0;
+
+  /* headers are not shown when relabelling shuffled or subsampled
+     sequences, all other commands use them */
+  if (! ((opt_shuffle || opt_fastx_subsample) &&
+         (opt_relabel || opt_relabel_sha1 || opt_relabel_md5) &&
+         ! opt_relabel_keep))
+    fields |= DB_HEADER;
+
+  /* quality scores are only written by these with --fastqout */
+  if ((opt_fastx_mask || opt_fastx_subsample) && opt_fastqout)
+    fields |= DB_QUALITY;
+
+  return fields;
+}
+
 int main(int argc, char** argv)
 {
   fillheader();
@@ -2423,6 +2593,8 @@ int main(int argc, char** argv)
 
   global_abundance = abundance_init();
 
+  db_setfields(db_fields_needed());
+
   if (opt_help)
     cmd_help();
   else if (opt_allpairs_global)
@@ -2433,7 +2605,7 @@ int main(int argc, char** argv)
     cmd_sortbysize();
   else if (opt_sortbylength)
     cmd_sortbylength();
-  else if (opt_derep_fulllength || opt_derep_prefix)
+  else if (opt_derep_fulllength || opt_derep_prefix || opt_derep_samples)
     cmd_derep();
   else if (opt_shuffle)
     cmd_shuffle();
@@ -2441,7 +2613,8 @@ int main(int argc, char** argv)
     cmd_subsample();
   else if (opt_maskfasta)
     cmd_maskfasta();
-  else if (opt_cluster_smallmem || opt_cluster_fast || opt_cluster_size)
+  else if (opt_cluster_smallmem || opt_cluster_fast || opt_cluster_size ||
+           opt_cluster_linkage)
     cmd_cluster();
   else if (opt_uchime_denovo || opt_uchime_ref)
     cmd_uchime();
@@ -135,6 +135,8 @@
 #include "showalign.h"
 #include "userfields.h"
 #include "results.h"
+#include "writer.h"
+#include "gzout.h"
 #include "sortbysize.h"
 #include "sortbylength.h"
 #include "derep.h"
@@ -149,8 +151,14 @@
 #include "fasta.h"
 #include "fastq.h"
 #include "fastx.h"
+#include "fastxscan.h"
+#include "radixsort.h"
+#include "topn.h"
+#include "extsort.h"
+#include "digest.h"
 #include "fastqops.h"
 #include "dbhash.h"
+#include "linkage.h"
 #include "searchexact.h"
 #include "mergepairs.h"
 
@@ -218,6 +226,7 @@ extern bool opt_quiet;
 extern bool opt_relabel_keep;
 extern bool opt_relabel_md5;
 extern bool opt_relabel_sha1;
+extern bool opt_resume;
 extern bool opt_samheader;
 extern bool opt_sizeorder;
 extern bool opt_xsize;
@@ -226,17 +235,21 @@ extern char * opt_alnout;
 extern char * opt_blast6out;
 extern char * opt_borderline;
 extern char * opt_centroids;
+extern char * opt_checkpoint;
 extern char * opt_chimeras;
 extern char * opt_cluster_fast;
+extern char * opt_cluster_linkage;
 extern char * opt_cluster_size;
 extern char * opt_cluster_smallmem;
 extern char * opt_clusters;
 extern char * opt_consout;
+extern char * opt_countout;
 extern char * opt_db;
 extern char * opt_dbmatched;
 extern char * opt_dbnotmatched;
 extern char * opt_derep_fulllength;
 extern char * opt_derep_prefix;
+extern char * opt_derep_samples;
 extern char * opt_eetabbedout;
 extern char * opt_fastaout_notmerged_fwd;
 extern char * opt_fastaout_notmerged_rev;
@@ -284,6 +297,8 @@ extern double opt_dn;
 extern double opt_fastq_maxee;
 extern double opt_fastq_maxee_rate;
 extern double opt_id;
+extern double * opt_id_levels;
+extern int opt_id_levelcount;
 extern double opt_max_unmasked_pct;
 extern double opt_maxid;
 extern double opt_maxqt;
@@ -323,6 +338,7 @@ extern int opt_uchimeout5;
 extern int opt_usersort;
 extern int opt_version;
 extern long opt_dbmask;
+extern long opt_differences;
 extern long opt_fasta_width;
 extern long opt_fastq_ascii;
 extern long opt_fastq_asciiout;
@@ -357,6 +373,7 @@ extern long opt_maxseqlength;
 extern long opt_maxsize;
 extern long opt_maxsubs;
 extern long opt_maxuniquesize;
+extern long opt_memory_budget;
 extern long opt_mincols;
 extern long opt_minseqlength;
 extern long opt_minsize;
@@ -373,6 +390,7 @@ extern long opt_rowlen;
 extern long opt_sample_size;
 extern long opt_self;
 extern long opt_selfid;
+extern long opt_shards;
 extern long opt_sizein;
 extern long opt_sizeout;
 extern long opt_strand;
@@ -0,0 +1,317 @@
+/*
+
+  VSEARCH: a versatile open source tool for metagenomics
+
+  Copyright (C) 2014-2015, Torbjorn Rognes, Frederic Mahe and Tomas Flouri
+  All rights reserved.
+
+  Contact: Torbjorn Rognes <torognes@ifi.uio.no>,
+  Department of Informatics, University of Oslo,
+  PO Box 1080 Blindern, NO-0316 Oslo, Norway
+
+  This software is dual-licensed and available under a choice
+  of one of two licenses, either under the terms of the GNU
+  General Public License version 3 or the BSD 2-Clause License.
+
+
+  GNU General Public License version 3
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+  The BSD 2-Clause License
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+  COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "vsearch.h"
+#include <map>
+
+/*
+  Ordered output writer.
+
+  Each worker thread formats the output for one query into its own
+  buffer (obtained with writer_buffer) without holding any lock, and
+  then hands it over with writer_commit together with the ordinal
+  number of the query. Every ordinal from 0 and upwards must be
+  committed exactly once, even if nothing is to be written for it.
+
+  Buffers arriving out of order are kept aside until all the earlier
+  ones have arrived. The output is collected into large blocks that
+  are written to the file descriptor with write(2) by a separate
+  writer thread, so that the workers never wait for the disk unless
+  too many blocks are queued.
+*/
+
+#define WRITER_BLOCKSIZE (1024 * 1024)
+#define WRITER_MAXQUEUED 64
+
+struct writer_chunk_s
+{
+  char * data;
+  size_t length;
+};
+
+struct writer_s
+{
+  FILE * fp;
+  int fd;
+  int threads;
+  xstring * buffers;                  /* per-thread formatting buffers */
+
+  long next;                          /* next ordinal to append */
+  std::map<long, writer_chunk_s> * pending; /* arrived out of order */
+
+  char * block;                       /* block being assembled */
+  size_t block_length;
+
+  writer_chunk_s * queue;             /* full blocks ready for writing */
+  int queue_head;
+  int queue_count;
+  bool done;
+
+#if PTHREAD
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond_work;
+  pthread_cond_t cond_space;
+#endif
+};
+
+static void writer_write(writer_t * w, char * data, size_t length)
+{
+  while (length > 0)
+    {
+      long n;
+      if (w->fd >= 0)
+        n = write(w->fd, data, length);
+      else
+        n = fwrite(data, 1, length, w->fp);
+      if (n <= 0)
+        fatal("Unable to write to output file");
+      data += n;
+      length -= n;
+    }
+}
+
+static void writer_enqueue_block(writer_t * w)
+{
+  /* pass the current block on to the writer, start a new one */
+
+  if (w->block_length == 0)
+    return;
+
+#if PTHREAD
+  while (w->queue_count == WRITER_MAXQUEUED)
+    pthread_cond_wait(&w->cond_space, &w->mutex);
+
+  int tail = (w->queue_head + w->queue_count) % WRITER_MAXQUEUED;
+  w->queue[tail].data = w->block;
+  w->queue[tail].length = w->block_length;
+  w->queue_count++;
+  pthread_cond_signal(&w->cond_work);
+
+  w->block = (char *) xmalloc(WRITER_BLOCKSIZE);
+#else
+  writer_write(w, w->block, w->block_length);
+#endif
+
+  w->block_length = 0;
+}
+
+static void writer_append(writer_t * w, char * data, size_t length)
+{
+  while (length > 0)
+    {
+      size_t n = MIN(length, WRITER_BLOCKSIZE - w->block_length);
+      memcpy(w->block + w->block_length, data, n);
+      w->block_length += n;
+      data += n;
+      length -= n;
+      if (w->block_length == WRITER_BLOCKSIZE)
+        writer_enqueue_block(w);
+    }
+}
+
+#if PTHREAD
+static void * writer_thread(void * vp)
+{
+  writer_t * w = (writer_t *) vp;
+
+  pthread_mutex_lock(&w->mutex);
+  while (1)
+    {
+      while ((w->queue_count == 0) && ! w->done)
+        pthread_cond_wait(&w->cond_work, &w->mutex);
+
+      if (w->queue_count == 0)
+        break;
+
+      writer_chunk_s c = w->queue[w->queue_head];
+      w->queue_head = (w->queue_head + 1) % WRITER_MAXQUEUED;
+      w->queue_count--;
+      pthread_cond_signal(&w->cond_space);
+
+      pthread_mutex_unlock(&w->mutex);
+      writer_write(w, c.data, c.length);
+      free(c.data);
+      pthread_mutex_lock(&w->mutex);
+    }
+  pthread_mutex_unlock(&w->mutex);
+
+  return 0;
+}
+#endif
+
+writer_t * writer_open(FILE * fp, int threads)
+{
+  writer_t * w = (writer_t *) xmalloc(sizeof(writer_t));
+
+  /* anything written earlier with stdio must come first */
+  fflush(fp);
+
+  w->fp = fp;
+#ifdef _WIN32
+  w->fd = -1;
+#else
+  /* streams without a descriptor (compressed output) use fwrite */
+  w->fd = fileno(fp);
+#endif
+  w->threads = threads;
+  w->buffers = new xstring[threads];
+  w->next = 0;
+  w->pending = new std::map<long, writer_chunk_s>;
+  w->block = (char *) xmalloc(WRITER_BLOCKSIZE);
+  w->block_length = 0;
+  w->queue = (writer_chunk_s *) xmalloc(WRITER_MAXQUEUED *
+                                        sizeof(writer_chunk_s));
+  w->queue_head = 0;
+  w->queue_count = 0;
+  w->done = false;
+
+#if PTHREAD
+  pthread_mutex_init(&w->mutex, NULL);
+  pthread_cond_init(&w->cond_work, NULL);
+  pthread_cond_init(&w->cond_space, NULL);
+  if (pthread_create(&w->thread, NULL, writer_thread, (void *) w))
+    fatal("Cannot create thread");
+#endif
+
+  return w;
+}
+
+xstring * writer_buffer(writer_t * w, int t)
+{
+  xstring * b = w->buffers + t;
+  b->empty();
+  return b;
+}
+
+void writer_commit(writer_t * w, int t, long ordinal)
+{
+  xstring * b = w->buffers + t;
+
+#if PTHREAD
+  pthread_mutex_lock(&w->mutex);
+#endif
+
+  if (ordinal == w->next)
+    {
+      writer_append(w, b->get_string(), b->get_length());
+      w->next++;
+
+      /* append any waiting buffers that are now in turn */
+      std::map<long, writer_chunk_s>::iterator it;
+      while (((it = w->pending->begin()) != w->pending->end()) &&
+             (it->first == w->next))
+        {
+          writer_append(w, it->second.data, it->second.length);
+          if (it->second.data)
+            free(it->second.data);
+          w->pending->erase(it);
+          w->next++;
+        }
+    }
+  else
+    {
+      /* keep a copy until its turn comes */
+      writer_chunk_s c;
+      c.length = b->get_length();
+      c.data = 0;
+      if (c.length > 0)
+        {
+          c.data = (char *) xmalloc(c.length);
+          memcpy(c.data, b->get_string(), c.length);
+        }
+      (*w->pending)[ordinal] = c;
+    }
+
+#if PTHREAD
+  pthread_mutex_unlock(&w->mutex);
+#endif
+
+  b->empty();
+}
+
+void writer_close(writer_t * w)
+{
+  if (! w->pending->empty())
+    fatal("Internal error: output missing for some queries");
+
+#if PTHREAD
+  pthread_mutex_lock(&w->mutex);
+  writer_enqueue_block(w);
+  w->done = true;
+  pthread_cond_signal(&w->cond_work);
+  pthread_mutex_unlock(&w->mutex);
+
+  if (pthread_join(w->thread, NULL))
+    fatal("Cannot join thread");
+
+  pthread_cond_destroy(&w->cond_space);
+  pthread_cond_destroy(&w->cond_work);
+  pthread_mutex_destroy(&w->mutex);
+#else
+  writer_enqueue_block(w);
+#endif
+
+  free(w->block);
+  free(w->queue);
+  delete w->pending;
+  delete [] w->buffers;
+  free(w);
+}
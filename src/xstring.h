@@ -66,6 +66,17 @@ class xstring
   char * string;
   size_t length;
   size_t alloc;
+
+  void makespace(size_t needed)
+  {
+    /* make room for needed more chars and a terminator,
+       growing geometrically to keep appends cheap */
+    if (length + needed + 1 > alloc)
+      {
+        alloc = MAX(length + needed + 1, 2 * alloc);
+        string = (char*) xrealloc(string, alloc);
+      }
+  }
   
  public:
   
@@ -105,40 +116,83 @@ class xstring
 
   void add_c(char c)
   {
-    size_t needed = 1;
-    if (length + needed + 1 > alloc)
-      {
-        alloc = length + needed + 1;
-        string = (char*) xrealloc(string, alloc);
-      }
+    makespace(1);
     string[length] = c;
     length += 1;
     string[length] = 0;
   }
-  
-  void add_d(int d)
+
+  void add_lu(unsigned long u)
   {
-    int needed = snprintf(0, 0, "%d", d);
-    if (needed < 0)
-      fatal("snprintf failed");
-    if (length + needed + 1 > alloc)
+    /* format digits backwards into a small buffer */
+    char buf[24];
+    char * e = buf + sizeof(buf);
+    char * p = e;
+    do
       {
-        alloc = length + needed + 1;
-        string = (char*) xrealloc(string, alloc);
+        *--p = '0' + (u % 10);
+        u /= 10;
+      }
+    while (u);
+    add_sn(p, e - p);
+  }
+
+  void add_l(long d)
+  {
+    if (d < 0)
+      {
+        add_c('-');
+        add_lu(0UL - (unsigned long) d);
       }
-    sprintf(string + length, "%d", d);
-    length += needed;
+    else
+      add_lu(d);
   }
   
-  void add_s(char * s)
+  void add_d(int d)
   {
-    size_t needed = strlen(s);
-    if (length + needed + 1 > alloc)
+    add_l(d);
+  }
+
+  void add_f1(double x)
+  {
+    /*
+      Same as "%.1f". Use integer arithmetic except for negative,
+      huge or non-finite values, and for values so close to a
+      rounding tie that the multiplication could get it wrong.
+    */
+
+    double v = x * 10.0;
+    double f = floor(v);
+    double frac = v - f;
+
+    if ((x >= 0.0) && (v < 1e15) && (fabs(frac - 0.5) > 1e-6))
       {
-        alloc = length + needed + 1;
-        string = (char*) xrealloc(string, alloc);
+        unsigned long n = (unsigned long) f + (frac > 0.5 ? 1 : 0);
+        add_lu(n / 10);
+        add_c('.');
+        add_c('0' + n % 10);
       }
-    strcpy((string + length), s);
-    length += needed;
+    else
+      {
+        int needed = snprintf(0, 0, "%.1f", x);
+        if (needed < 0)
+          fatal("snprintf failed");
+        makespace(needed);
+        sprintf(string + length, "%.1f", x);
+        length += needed;
+      }
+  }
+
+  void add_sn(const char * s, size_t n)
+  {
+    makespace(n);
+    memcpy(string + length, s, n);
+    length += n;
+    string[length] = 0;
+  }
+  
+  void add_s(const char * s)
+  {
+    add_sn(s, strlen(s));
   }
 };